@@ -0,0 +1,519 @@
+/*
+ * Benchmark of the library database (librawstudio/rs-library.c).
+ *
+ * Builds two synthetic catalogues, one with the schema used up to library
+ * version 3 and one with the indexes from version 4, and times the queries
+ * Rawstudio runs against them. The "old" column uses the statements from
+ * before version 4, prepared on every call, the "new" column the current
+ * statements, prepared once.
+ *
+ * Each photo is linked to six tags: a make, a year, a month and three of
+ * 1000 plain tags, "tag0" to "tag999". Photos are placed 500 to a
+ * directory. The data is the same for every run.
+ *
+ * Only needs SQLite:
+ *   gcc -O2 -o library-benchmark library-benchmark.c -lsqlite3
+ *   ./library-benchmark [photos] [directory for the databases]
+ *
+ * The defaults are 500000 photos, giving 3M tag links, and /tmp.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#define PHOTOS_PER_DIRECTORY 500
+#define PLAIN_TAGS 1000
+#define IMPORT_PHOTOS 500
+
+static const char *makes[] = { "Canon", "Nikon", "Sony", "Pentax", "Olympus", "Panasonic", "Fujifilm", "Leica" };
+static const char *months[] = { "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December" };
+#define N_MAKES (sizeof(makes)/sizeof(makes[0]))
+#define N_MONTHS (sizeof(months)/sizeof(months[0]))
+#define N_YEARS 20
+
+static int photos_total = 500000;
+static unsigned int seed = 42;
+
+static unsigned int
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) & 0xffffff;
+}
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+execute(sqlite3 *db, const char *sql)
+{
+	char *error = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &error) != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: %s\n", sql, error);
+		sqlite3_free(error);
+		exit(1);
+	}
+}
+
+static sqlite3_stmt *
+prepare(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: %s\n", sql, sqlite3_errmsg(db));
+		exit(1);
+	}
+	return stmt;
+}
+
+static void
+photo_filename(char *buffer, size_t size, const char *root, int photo)
+{
+	snprintf(buffer, size, "/%s/%04d/IMG_%07d.CR2", root, photo / PHOTOS_PER_DIRECTORY, photo);
+}
+
+/* The six tags of a photo, names must hold 6 buffers of 32 bytes */
+static void
+photo_tags(char names[6][32])
+{
+	int i, plain[3];
+
+	snprintf(names[0], 32, "%s", makes[next_random() % N_MAKES]);
+	snprintf(names[1], 32, "%d", 2000 + next_random() % N_YEARS);
+	snprintf(names[2], 32, "%s", months[next_random() % N_MONTHS]);
+	for(i = 0; i < 3; i++)
+	{
+		int j, again;
+		do {
+			plain[i] = next_random() % PLAIN_TAGS;
+			again = 0;
+			for(j = 0; j < i; j++)
+				again |= (plain[j] == plain[i]);
+		} while (again);
+		snprintf(names[3+i], 32, "tag%d", plain[i]);
+	}
+}
+
+static sqlite3 *
+open_library(const char *filename, int indexed)
+{
+	sqlite3 *db;
+	sqlite3_stmt *stmt, *find_tag, *add_tag, *add_link;
+	char name[256], tags[6][32];
+	int photo, i;
+	double start = now_ms();
+
+	unlink(filename);
+	if (sqlite3_open(filename, &db) != SQLITE_OK)
+	{
+		fprintf(stderr, "Can't open %s\n", filename);
+		exit(1);
+	}
+
+	execute(db, "PRAGMA synchronous = OFF;");
+	execute(db, indexed ? "PRAGMA journal_mode = WAL;" : "PRAGMA journal_mode = memory;");
+	execute(db, "PRAGMA temp_store = memory;");
+
+	execute(db, "create table library (id integer primary key, filename varchar(1024), identifier varchar(32), fingerprinted integer default 0)");
+	execute(db, "create table tags (id integer primary key, tagname varchar(128))");
+	execute(db, "create table phototags (photo integer, tag integer, autotag integer)");
+
+	/* Same data in both catalogues */
+	seed = 42;
+
+	execute(db, "BEGIN TRANSACTION;");
+	find_tag = prepare(db, "SELECT id FROM tags WHERE tagname = ?1;");
+	add_tag = prepare(db, "INSERT INTO tags (tagname) VALUES (?1);");
+	add_link = prepare(db, "INSERT INTO phototags (photo, tag, autotag) VALUES (?1, ?2, 1);");
+	stmt = prepare(db, "INSERT INTO library (id, filename) VALUES (?1, ?2);");
+
+	/* All tags up front, so tag lookups are fast while building */
+	for(i = 0; i < (int) N_MAKES; i++)
+	{
+		sqlite3_bind_text(add_tag, 1, makes[i], -1, SQLITE_STATIC);
+		sqlite3_step(add_tag);
+		sqlite3_reset(add_tag);
+	}
+	for(i = 0; i < N_YEARS; i++)
+	{
+		snprintf(name, sizeof(name), "%d", 2000 + i);
+		sqlite3_bind_text(add_tag, 1, name, -1, SQLITE_TRANSIENT);
+		sqlite3_step(add_tag);
+		sqlite3_reset(add_tag);
+	}
+	for(i = 0; i < (int) N_MONTHS; i++)
+	{
+		sqlite3_bind_text(add_tag, 1, months[i], -1, SQLITE_STATIC);
+		sqlite3_step(add_tag);
+		sqlite3_reset(add_tag);
+	}
+	for(i = 0; i < PLAIN_TAGS; i++)
+	{
+		snprintf(name, sizeof(name), "tag%d", i);
+		sqlite3_bind_text(add_tag, 1, name, -1, SQLITE_TRANSIENT);
+		sqlite3_step(add_tag);
+		sqlite3_reset(add_tag);
+	}
+	execute(db, "create temp table tagids (tagname varchar(128) primary key, id integer)");
+	execute(db, "insert into tagids select tagname, id from tags");
+	sqlite3_finalize(find_tag);
+	find_tag = prepare(db, "SELECT id FROM tagids WHERE tagname = ?1;");
+
+	for(photo = 0; photo < photos_total; photo++)
+	{
+		photo_filename(name, sizeof(name), "photos", photo);
+		sqlite3_bind_int(stmt, 1, photo + 1);
+		sqlite3_bind_text(stmt, 2, name, -1, SQLITE_TRANSIENT);
+		sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+
+		photo_tags(tags);
+		for(i = 0; i < 6; i++)
+		{
+			sqlite3_bind_text(find_tag, 1, tags[i], -1, SQLITE_TRANSIENT);
+			sqlite3_step(find_tag);
+			sqlite3_bind_int(add_link, 1, photo + 1);
+			sqlite3_bind_int(add_link, 2, sqlite3_column_int(find_tag, 0));
+			sqlite3_reset(find_tag);
+			sqlite3_step(add_link);
+			sqlite3_reset(add_link);
+		}
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(find_tag);
+	sqlite3_finalize(add_tag);
+	sqlite3_finalize(add_link);
+	execute(db, "drop table tagids");
+	execute(db, "COMMIT;");
+
+	if (indexed)
+	{
+		/* As library_create_indexes() */
+		execute(db, "create index if not exists library_filename on library (filename);");
+		execute(db, "create index if not exists library_identifier on library (identifier);");
+		execute(db, "create index if not exists tags_tagname on tags (tagname);");
+		execute(db, "create index if not exists tags_tagname_nocase on tags (tagname collate nocase);");
+		execute(db, "create index if not exists phototags_photo_tag on phototags (photo, tag);");
+		execute(db, "create index if not exists phototags_tag_photo on phototags (tag, photo);");
+		execute(db, "analyze;");
+	}
+
+	printf("Built %s in %.0f ms\n", filename, now_ms() - start);
+
+	return db;
+}
+
+/* Statements of the new code are prepared once, as library_statement() */
+enum {
+	STMT_FIND_PHOTO,
+	STMT_FIND_TAG,
+	STMT_ADD_PHOTO,
+	STMT_ADD_LINK,
+	STMT_PHOTO_TAGS,
+	STMT_BACKUP,
+	STMT_SEARCH,
+	STMT_LAST = STMT_SEARCH + 8
+};
+static sqlite3_stmt *statements[STMT_LAST];
+
+static sqlite3_stmt *
+statement(sqlite3 *db, int old, int slot, const char *sql)
+{
+	if (old)
+		return prepare(db, sql);
+	if (!statements[slot])
+		statements[slot] = prepare(db, sql);
+	return statements[slot];
+}
+
+static void
+statement_done(sqlite3_stmt *stmt, int old)
+{
+	if (old)
+		sqlite3_finalize(stmt);
+	else
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+}
+
+static int
+split(char *needle, char **parts, int max)
+{
+	char *save = NULL, *part;
+	int n = 0;
+
+	for(part = strtok_r(needle, " ", &save); part && n < max; part = strtok_r(NULL, " ", &save))
+		parts[n++] = part;
+	return n;
+}
+
+/* rs_library_search() */
+static int
+search(sqlite3 *db, int old, const char *needle)
+{
+	sqlite3_stmt *stmt;
+	char buffer[256], *parts[8];
+	int num_tags, n, count = 0;
+
+	snprintf(buffer, sizeof(buffer), "%s", needle);
+	num_tags = split(buffer, parts, 8);
+
+	if (old)
+	{
+		/* Two temporary tables, as before version 4 */
+		execute(db, "create temp table if not exists filter (photo integer)");
+		for(n = 0; n < num_tags; n++)
+		{
+			stmt = prepare(db, "insert into filter select phototags.photo from phototags, tags where phototags.tag = tags.id and lower(tags.tagname) = lower(?1) ;");
+			sqlite3_bind_text(stmt, 1, parts[n], -1, SQLITE_TRANSIENT);
+			sqlite3_step(stmt);
+			sqlite3_finalize(stmt);
+		}
+		execute(db, "create temp table if not exists result (photo integer, count integer)");
+		execute(db, "insert into result select photo, count(photo) from filter group by photo;");
+		stmt = prepare(db, "select library.filename from library,result where library.id = result.photo and result.count = ?1 order by library.filename;");
+		sqlite3_bind_int(stmt, 1, num_tags);
+	}
+	else
+	{
+		char sql[2048];
+		int len = snprintf(sql, sizeof(sql), "select filename from library where id in (");
+		for(n = 0; n < num_tags; n++)
+			len += snprintf(sql + len, sizeof(sql) - len, "%sselect photo from phototags where tag in (select id from tags where tagname = ?%d collate nocase)",
+				n > 0 ? " intersect " : "", n+1);
+		snprintf(sql + len, sizeof(sql) - len, ") order by filename;");
+		stmt = statement(db, old, STMT_SEARCH + num_tags - 1, sql);
+		for(n = 0; n < num_tags; n++)
+			sqlite3_bind_text(stmt, n+1, parts[n], -1, SQLITE_TRANSIENT);
+	}
+
+	/* MAX_SEARCH_RESULTS */
+	while (count < 1000 && sqlite3_step(stmt) == SQLITE_ROW)
+		count++;
+	statement_done(stmt, old);
+
+	if (old)
+	{
+		execute(db, "delete from filter;");
+		execute(db, "delete from result;");
+	}
+
+	return count;
+}
+
+static int search_make(sqlite3 *db, int old, int i) { return search(db, old, "canon"); }
+static int search_three(sqlite3 *db, int old, int i) { return search(db, old, "canon 2005 tag17"); }
+static int search_plain(sqlite3 *db, int old, int i) { return search(db, old, "tag17 tag18"); }
+
+/* library_find_photo_id() */
+static int
+find_photo(sqlite3 *db, int old, const char *filename)
+{
+	sqlite3_stmt *stmt = statement(db, old, STMT_FIND_PHOTO, "SELECT id FROM library WHERE filename = ?1;");
+	int id = -1;
+
+	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		id = sqlite3_column_int(stmt, 0);
+	statement_done(stmt, old);
+
+	return id;
+}
+
+static int
+find_by_filename(sqlite3 *db, int old, int i)
+{
+	char name[256];
+
+	photo_filename(name, sizeof(name), "photos", (i * 7919) % photos_total);
+	return find_photo(db, old, name) > 0;
+}
+
+/* rs_library_photo_tags() */
+static int
+tags_of_photo(sqlite3 *db, int old, int i)
+{
+	sqlite3_stmt *stmt = statement(db, old, STMT_PHOTO_TAGS, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1;");
+	char name[256];
+	int count = 0;
+
+	photo_filename(name, sizeof(name), "photos", (i * 7919) % photos_total);
+	sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		count++;
+	statement_done(stmt, old);
+
+	return count;
+}
+
+/* rs_library_backup_tags() without writing the XML */
+static int
+backup_directory(sqlite3 *db, int old, int i)
+{
+	sqlite3_stmt *stmt;
+	int directory = (i * 31) % (photos_total / PHOTOS_PER_DIRECTORY);
+	char first[256], last[256];
+	int count = 0;
+
+	if (old)
+	{
+		stmt = prepare(db, "select library.filename,library.identifier,tags.tagname,phototags.autotag from library,phototags,tags where library.filename like ?1 and phototags.photo = library.id and tags.id = phototags.tag order by library.filename;");
+		snprintf(first, sizeof(first), "/photos/%04d/%%", directory);
+		sqlite3_bind_text(stmt, 1, first, -1, SQLITE_TRANSIENT);
+	}
+	else
+	{
+		stmt = statement(db, old, STMT_BACKUP, "select library.filename,library.identifier,tags.tagname,phototags.autotag from library,phototags,tags where library.filename >= ?1 and library.filename < ?2 and phototags.photo = library.id and tags.id = phototags.tag order by library.filename;");
+		snprintf(first, sizeof(first), "/photos/%04d/", directory);
+		snprintf(last, sizeof(last), "/photos/%04d0", directory);
+		sqlite3_bind_text(stmt, 1, first, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt, 2, last, -1, SQLITE_TRANSIENT);
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		count++;
+	statement_done(stmt, old);
+
+	return count;
+}
+
+/* rs_library_add_photo_with_metadata() for photos new to the library. Before
+ * version 4 only the tags were added in a transaction */
+static int
+import_photos(sqlite3 *db, int old, int i)
+{
+	sqlite3_stmt *stmt;
+	char name[256], tags[6][32];
+	int photo, t;
+
+	seed = 4242 + i;
+	for(photo = 0; photo < IMPORT_PHOTOS; photo++)
+	{
+		int photo_id;
+
+		photo_filename(name, sizeof(name), old ? "import-old" : "import-new", i * IMPORT_PHOTOS + photo);
+		if (!old)
+			execute(db, "BEGIN TRANSACTION;");
+
+		if (find_photo(db, old, name) != -1)
+		{
+			if (!old)
+				execute(db, "COMMIT;");
+			continue;
+		}
+
+		stmt = statement(db, old, STMT_ADD_PHOTO, "INSERT INTO library (filename) VALUES (?1);");
+		sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
+		sqlite3_step(stmt);
+		photo_id = sqlite3_last_insert_rowid(db);
+		statement_done(stmt, old);
+
+		if (old)
+			execute(db, "BEGIN TRANSACTION;");
+		photo_tags(tags);
+		for(t = 0; t < 6; t++)
+		{
+			int tag_id = 0;
+
+			stmt = statement(db, old, STMT_FIND_TAG, "SELECT id FROM tags WHERE tagname = ?1;");
+			sqlite3_bind_text(stmt, 1, tags[t], -1, SQLITE_TRANSIENT);
+			if (sqlite3_step(stmt) == SQLITE_ROW)
+				tag_id = sqlite3_column_int(stmt, 0);
+			statement_done(stmt, old);
+
+			stmt = statement(db, old, STMT_ADD_LINK, "INSERT INTO phototags (photo, tag, autotag) VALUES (?1, ?2, ?3);");
+			sqlite3_bind_int(stmt, 1, photo_id);
+			sqlite3_bind_int(stmt, 2, tag_id);
+			sqlite3_bind_int(stmt, 3, 1);
+			sqlite3_step(stmt);
+			statement_done(stmt, old);
+		}
+		execute(db, "COMMIT;");
+	}
+
+	return IMPORT_PHOTOS;
+}
+
+/* Repeat a query until it has run for a while, and print the average time */
+static void
+run(sqlite3 *old_db, sqlite3 *new_db, const char *label, int (*query)(sqlite3 *db, int old, int i), int max_runs)
+{
+	double elapsed[2];
+	int results[2];
+	int old;
+
+	for(old = 1; old >= 0; old--)
+	{
+		sqlite3 *db = old ? old_db : new_db;
+		double start = now_ms();
+		int runs = 0;
+
+		do {
+			results[old] = query(db, old, runs++);
+		} while (runs < max_runs && now_ms() - start < 1000.0);
+		elapsed[old] = (now_ms() - start) / runs;
+	}
+
+	if (results[0] != results[1])
+		printf("%s: results differ, %d old and %d new\n", label, results[1], results[0]);
+	printf("  %-32s %10.2f ms -> %8.2f ms\n", label, elapsed[1], elapsed[0]);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *directory = "/tmp";
+	char old_file[1024], new_file[1024];
+	sqlite3 *old_db, *new_db;
+	int i;
+
+	if (argc > 1)
+		photos_total = atoi(argv[1]);
+	if (argc > 2)
+		directory = argv[2];
+	if (photos_total < PHOTOS_PER_DIRECTORY)
+		photos_total = PHOTOS_PER_DIRECTORY;
+
+	snprintf(old_file, sizeof(old_file), "%s/library-benchmark-v3.db", directory);
+	snprintf(new_file, sizeof(new_file), "%s/library-benchmark-v4.db", directory);
+	old_db = open_library(old_file, 0);
+	new_db = open_library(new_file, 1);
+
+	printf("%d photos and %d tag links, old schema and queries versus new:\n", photos_total, photos_total * 6);
+	run(old_db, new_db, "search \"canon\"", search_make, 100);
+	run(old_db, new_db, "search \"canon 2005 tag17\"", search_three, 100);
+	run(old_db, new_db, "search \"tag17 tag18\"", search_plain, 100);
+	run(old_db, new_db, "find photo by filename", find_by_filename, 10000);
+	run(old_db, new_db, "tags of a photo", tags_of_photo, 10000);
+	run(old_db, new_db, "backup tags of a directory", backup_directory, 1000);
+	run(old_db, new_db, "import 500 photos, 6 tags each", import_photos, 1);
+
+	for(i = 0; i < STMT_LAST; i++)
+		if (statements[i])
+			sqlite3_finalize(statements[i]);
+	sqlite3_close(old_db);
+	sqlite3_close(new_db);
+	unlink(old_file);
+	unlink(new_file);
+	snprintf(new_file, sizeof(new_file), "%s/library-benchmark-v4.db-wal", directory);
+	unlink(new_file);
+	snprintf(new_file, sizeof(new_file), "%s/library-benchmark-v4.db-shm", directory);
+	unlink(new_file);
+
+	return 0;
+}
@@ -38,6 +38,8 @@
 #define CONF_BATCH_SIZE_WIDTH "batch_size_width"
 #define CONF_BATCH_SIZE_HEIGHT "batch_size_height"
 #define CONF_BATCH_SIZE_SCALE "batch_size_scale"
+#define CONF_BATCH_CONCURRENCY "batch_concurrency"
+#define CONF_BATCH_MEMORY_LIMIT "batch_memory_limit"
 #define CONF_ROI_GRID "roi_grid"
 #define CONF_CROP_ASPECT "crop_aspect"
 #define CONF_SHOW_FILENAMES "show_filenames_in_iconview"
@@ -86,6 +88,10 @@
 #define CONF_ENFUSE_CACHE "conf_enfuse_cache"
 #define CONF_MAP_SOURCE "conf_map_source"
 #define CONF_MAP_ZOOM "map_zoom"
+#define CONF_WORKER_THREADS "worker_threads"
+#define CONF_IO_QUEUE_DEPTH "io_queue_depth"
+#define CONF_IMAGE_POOL_LIMIT "image_pool_limit"
+#define CONF_PRELOAD_LIMIT "preload_limit"
 
 #define DEFAULT_CONF_EXPORT_FILENAME "%f_%2c"
 #define DEFAULT_CONF_BATCH_DIRECTORY "batch_exports/"
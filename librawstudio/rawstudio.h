@@ -60,7 +60,9 @@ extern "C" {
 #include "rs-output.h"
 #include "rs-plugin-manager.h"
 #include "rs-job-queue.h"
+#include "rs-thread-pool.h"
 #include "rs-utils.h"
+#include "rs-fingerprint.h"
 #include "rs-math.h"
 #include "rs-color.h"
 #include "rs-settings.h"
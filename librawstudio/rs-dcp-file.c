@@ -212,6 +212,22 @@ rs_dcp_file_new_from_file(const gchar *path)
 	return g_object_new(RS_TYPE_DCP_FILE, "filename", path, NULL);
 }
 
+RSDcpFile *
+rs_dcp_file_new_from_index(const gchar *path, const gchar *model, const gchar *name)
+{
+	g_return_val_if_fail(path != NULL, NULL);
+	g_return_val_if_fail(model != NULL, NULL);
+
+	/* Without "filename" nothing is read, RSTiff will load the file on first
+	 * access to an IFD entry */
+	RSDcpFile *dcp_file = g_object_new(RS_TYPE_DCP_FILE, NULL);
+	RS_TIFF(dcp_file)->filename = g_strdup(path);
+	dcp_file->model = g_strdup(model);
+	dcp_file->name = g_strdup(name);
+
+	return dcp_file;
+}
+
 const gchar *
 rs_dcp_file_get_model(RSDcpFile *dcp_file)
 {
@@ -44,6 +44,10 @@ GType rs_dcp_file_get_type(void);
 
 RSDcpFile *rs_dcp_file_new_from_file(const gchar *path);
 
+/* Returns a profile with model and name already known, the file itself is
+ * not read until profile data is needed */
+RSDcpFile *rs_dcp_file_new_from_index(const gchar *path, const gchar *model, const gchar *name);
+
 const gchar *rs_dcp_file_get_model(RSDcpFile *dcp_file);
 
 gboolean rs_dcp_file_get_color_matrix1(RSDcpFile *dcp_file, RS_MATRIX3 *matrix);
@@ -25,6 +25,7 @@ struct _RSFilterRequest {
 	gboolean roi_set;
 	GdkRectangle roi;
 	gboolean quick;
+	GCancellable *cancellable;
 };
 
 G_DEFINE_TYPE(RSFilterRequest, rs_filter_request, RS_TYPE_FILTER_PARAM)
@@ -32,6 +33,11 @@ G_DEFINE_TYPE(RSFilterRequest, rs_filter_request, RS_TYPE_FILTER_PARAM)
 static void
 rs_filter_request_finalize(GObject *object)
 {
+	RSFilterRequest *filter_request = RS_FILTER_REQUEST(object);
+
+	if (filter_request->cancellable)
+		g_object_unref(filter_request->cancellable);
+
 	G_OBJECT_CLASS (rs_filter_request_parent_class)->finalize (object);
 }
 
@@ -48,6 +54,7 @@ rs_filter_request_init(RSFilterRequest *filter_request)
 {
 	filter_request->roi_set = FALSE;
 	filter_request->quick = FALSE;
+	filter_request->cancellable = NULL;
 }
 
 /**
@@ -96,6 +103,7 @@ rs_filter_request_clone(const RSFilterRequest *filter_request)
 		new_filter_request->roi_set = filter_request->roi_set;
 		new_filter_request->roi = filter_request->roi;
 		new_filter_request->quick = filter_request->quick;
+		rs_filter_request_set_cancellable(new_filter_request, filter_request->cancellable);
 
 		rs_filter_param_clone(RS_FILTER_PARAM(new_filter_request), RS_FILTER_PARAM(filter_request));
 	}
@@ -165,3 +173,38 @@ gboolean rs_filter_request_get_quick(const RSFilterRequest *filter_request)
 
 	return ret;
 }
+
+/**
+ * Attach a GCancellable to a RSFilterRequest. Filters will stop passing the
+ * request on once it's cancelled, see rs_filter_request_is_cancelled()
+ * @param filter_request A RSFilterRequest
+ * @param cancellable A GCancellable or NULL
+ */
+void
+rs_filter_request_set_cancellable(RSFilterRequest *filter_request, GCancellable *cancellable)
+{
+	g_return_if_fail(RS_IS_FILTER_REQUEST(filter_request));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	if (cancellable)
+		g_object_ref(cancellable);
+	if (filter_request->cancellable)
+		g_object_unref(filter_request->cancellable);
+	filter_request->cancellable = cancellable;
+}
+
+/**
+ * Check if the GCancellable attached to a RSFilterRequest has been cancelled
+ * @param filter_request A RSFilterRequest
+ * @return TRUE if the result of the request is no longer needed, FALSE otherwise
+ */
+gboolean
+rs_filter_request_is_cancelled(const RSFilterRequest *filter_request)
+{
+	gboolean ret = FALSE;
+
+	if (RS_IS_FILTER_REQUEST(filter_request) && filter_request->cancellable)
+		ret = g_cancellable_is_cancelled(filter_request->cancellable);
+
+	return ret;
+}
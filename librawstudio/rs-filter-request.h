@@ -21,6 +21,7 @@
 #define RS_FILTER_REQUEST_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include "rs-filter-param.h"
 
 G_BEGIN_DECLS
@@ -91,6 +92,21 @@ void rs_filter_request_set_quick(RSFilterRequest *filter_request, gboolean quick
  */
 gboolean rs_filter_request_get_quick(const RSFilterRequest *filter_request);
 
+/**
+ * Attach a GCancellable to a RSFilterRequest. Filters will stop passing the
+ * request on once it's cancelled, see rs_filter_request_is_cancelled()
+ * @param filter_request A RSFilterRequest
+ * @param cancellable A GCancellable or NULL
+ */
+void rs_filter_request_set_cancellable(RSFilterRequest *filter_request, GCancellable *cancellable);
+
+/**
+ * Check if the GCancellable attached to a RSFilterRequest has been cancelled
+ * @param filter_request A RSFilterRequest
+ * @return TRUE if the result of the request is no longer needed, FALSE otherwise
+ */
+gboolean rs_filter_request_is_cancelled(const RSFilterRequest *filter_request);
+
 G_END_DECLS
 
 #endif /* RS_FILTER_REQUEST_H */
@@ -154,6 +154,50 @@ rs_filter_response_get_roi(const RSFilterResponse *filter_response)
 	return ret;
 }
 
+/**
+ * Get where the images of the response are placed in the whole image. An
+ * image exactly the size of the ROI only covers the ROI and is placed at the
+ * origin of the ROI, any other image covers the whole image
+ * @param filter_response A RSFilterResponse
+ * @param x Will be set to the horizontal position of the image
+ * @param y Will be set to the vertical position of the image
+ * @return TRUE if the image only covers the ROI, FALSE otherwise
+ */
+gboolean
+rs_filter_response_get_origin(const RSFilterResponse *filter_response, gint *x, gint *y)
+{
+	gint width, height;
+
+	*x = 0;
+	*y = 0;
+
+	g_return_val_if_fail(RS_IS_FILTER_RESPONSE(filter_response), FALSE);
+
+	if (!filter_response->roi_set)
+		return FALSE;
+
+	if (filter_response->image)
+	{
+		width = filter_response->image->w;
+		height = filter_response->image->h;
+	}
+	else if (filter_response->image8)
+	{
+		width = gdk_pixbuf_get_width(filter_response->image8);
+		height = gdk_pixbuf_get_height(filter_response->image8);
+	}
+	else
+		return FALSE;
+
+	if (width != filter_response->roi.width || height != filter_response->roi.height)
+		return FALSE;
+
+	*x = filter_response->roi.x;
+	*y = filter_response->roi.y;
+
+	return TRUE;
+}
+
 /**
  * Set quick flag on a response, this should be set if the image has been
  * rendered by any quick method and a better method is available
@@ -71,6 +71,17 @@ void rs_filter_response_set_roi(RSFilterResponse *filter_response, GdkRectangle
  */
 GdkRectangle *rs_filter_response_get_roi(const RSFilterResponse *filter_response);
 
+/**
+ * Get where the images of the response are placed in the whole image. An
+ * image exactly the size of the ROI only covers the ROI and is placed at the
+ * origin of the ROI, any other image covers the whole image
+ * @param filter_response A RSFilterResponse
+ * @param x Will be set to the horizontal position of the image
+ * @param y Will be set to the vertical position of the image
+ * @return TRUE if the image only covers the ROI, FALSE otherwise
+ */
+gboolean rs_filter_response_get_origin(const RSFilterResponse *filter_response, gint *x, gint *y);
+
 /**
  * Set quick flag on a response, this should be set if the image has been
  * rendered by any quick method and a better method is available
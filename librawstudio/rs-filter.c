@@ -18,6 +18,7 @@
  */
 
 #include <stdlib.h> /* system() */
+#include <string.h> /* memcpy() */
 #include <rawstudio.h>
 #include "rs-filter.h"
 
@@ -76,6 +77,7 @@ rs_filter_class_init(RSFilterClass *klass)
 	klass->get_image8 = NULL;
 	klass->get_size = NULL;
 	klass->previous_changed = NULL;
+	klass->get_tile_border = NULL;
 
 	object_class->dispose = dispose;
 }
@@ -192,10 +194,71 @@ clamp_roi(const GdkRectangle *roi, RSFilter *filter, const RSFilterRequest *requ
 	new_roi->x = MAX(0, roi->x);
 	new_roi->y = MAX(0, roi->y);
 	new_roi->width = MIN(w - new_roi->x, roi->width);
-	new_roi->height = MAX(h - new_roi->y, roi->height);
+	new_roi->height = MIN(h - new_roi->y, roi->height);
 	return new_roi;
 }
 
+/* Places images only covering the ROI of response in whole images */
+static RSFilterResponse *
+whole_response(RSFilter *filter, const RSFilterRequest *request, RSFilterResponse *response)
+{
+	RSFilterResponse *whole;
+	gint x, y, width, height, row;
+
+	if (!rs_filter_response_get_origin(response, &x, &y))
+		return response;
+
+	if (!rs_filter_get_size_simple(filter, request, &width, &height))
+		return response;
+
+	whole = rs_filter_response_clone(response);
+
+	if (rs_filter_response_has_image(response))
+	{
+		RS_IMAGE16 *image = rs_filter_response_get_image(response);
+
+		if (image->w == width && image->h == height)
+			rs_filter_response_set_image(whole, image);
+		else
+		{
+			RS_IMAGE16 *output = rs_image16_new(width, height, image->channels, image->pixelsize);
+			const gint w = MIN(image->w, width - x);
+			const gint h = MIN(image->h, height - y);
+
+			for(row = 0; row < h; row++)
+				memcpy(GET_PIXEL(output, x, y + row), GET_PIXEL(image, 0, row), w * image->pixelsize * sizeof(gushort));
+
+			rs_filter_response_set_image(whole, output);
+			g_object_unref(output);
+		}
+		g_object_unref(image);
+	}
+
+	if (rs_filter_response_has_image8(response))
+	{
+		GdkPixbuf *image8 = rs_filter_response_get_image8(response);
+		const gint w = gdk_pixbuf_get_width(image8);
+		const gint h = gdk_pixbuf_get_height(image8);
+
+		if (w == width && h == height)
+			rs_filter_response_set_image8(whole, image8);
+		else
+		{
+			GdkPixbuf *output8 = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(image8), 8, width, height);
+
+			gdk_pixbuf_copy_area(image8, 0, 0, MIN(w, width - x), MIN(h, height - y), output8, x, y);
+
+			rs_filter_response_set_image8(whole, output8);
+			g_object_unref(output8);
+		}
+		g_object_unref(image8);
+	}
+
+	g_object_unref(response);
+
+	return whole;
+}
+
 /**
  * Get the output image from a RSFilter
  * @param filter A RSFilter
@@ -204,6 +267,23 @@ clamp_roi(const GdkRectangle *roi, RSFilter *filter, const RSFilterRequest *requ
  */
 RSFilterResponse *
 rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
+{
+	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
+
+	return whole_response(filter, request, rs_filter_get_image_roi(filter, request));
+}
+
+/**
+ * Get the output image from a RSFilter. Like rs_filter_get_image(), but if
+ * the request has a ROI, the image may only cover the ROI of the response,
+ * see rs_filter_response_get_origin()
+ * @param filter A RSFilter
+ * @param param A RSFilterRequest defining parameters for a image request
+ * @return A RS_IMAGE16, this must be unref'ed
+ */
+RSFilterResponse *
+rs_filter_get_image_roi(RSFilter *filter, const RSFilterRequest *request)
 {
 	GdkRectangle* roi = NULL;
 	RSFilterRequest *r = NULL;
@@ -211,19 +291,27 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
-	RS_DEBUG(FILTERS, "rs_filter_get_image(%s [%p])", RS_FILTER_NAME(filter), filter);
+	RS_DEBUG(FILTERS, "rs_filter_get_image_roi(%s [%p])", RS_FILTER_NAME(filter), filter);
 
 	/* This timer-hack will break badly when multithreaded! */
 	static gfloat last_elapsed = 0.0;
 	static gint count = -1;
 	gfloat elapsed;
 	static GTimer *gt = NULL;
+	static RSThreadPoolStats pool_stats;
 
 	RSFilterResponse *response;
 	RS_IMAGE16 *image;
 
+	/* Nobody wants the result anymore, don't bother the rest of the chain */
+	if (rs_filter_request_is_cancelled(request))
+		return rs_filter_response_new();
+
 	if (count == -1)
+	{
 		gt = g_timer_new();
+		rs_thread_pool_get_stats(&pool_stats);
+	}
 	count++;
 
 	if (filter->enabled && (roi = rs_filter_request_get_roi(request)))
@@ -240,7 +328,7 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 	if (RS_FILTER_GET_CLASS(filter)->get_image && filter->enabled)
 		response = RS_FILTER_GET_CLASS(filter)->get_image(filter, request);
 	else
-		response = rs_filter_get_image(filter->previous, request);
+		response = rs_filter_get_image_roi(filter->previous, request);
 
 	g_assert(RS_IS_FILTER_RESPONSE(response));
 
@@ -281,7 +369,15 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 	{
 		last_elapsed = 0.0;
 		if (g_timer_elapsed(gt,NULL) > CHAIN_PERF_ELAPSED_MIN)
+		{
+			RSThreadPoolStats now;
+			rs_thread_pool_get_stats(&now);
+			if (now.tasks > pool_stats.tasks)
+				filter_performance("Worker pool: %" G_GUINT64_FORMAT " tasks, \033[32m%.1f\033[0mus average dispatch latency\n",
+					now.tasks - pool_stats.tasks,
+					(gdouble) (now.wait_time - pool_stats.wait_time) / (gdouble) (now.tasks - pool_stats.tasks));
 			filter_performance("Complete 16 bit chain took: \033[32m%.0f\033[0mms\n\n", g_timer_elapsed(gt, NULL)*1000.0);
+		}
 		rs_filter_param_set_float(RS_FILTER_PARAM(response), "16-bit-time", g_timer_elapsed(gt, NULL));
 		g_timer_destroy(gt);
 	}
@@ -305,7 +401,24 @@ rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
-	RS_DEBUG(FILTERS, "rs_filter_get_image8(%s [%p])", RS_FILTER_NAME(filter), filter);
+	return whole_response(filter, request, rs_filter_get_image8_roi(filter, request));
+}
+
+/**
+ * Get 8 bit output image from a RSFilter. Like rs_filter_get_image8(), but
+ * if the request has a ROI, the image may only cover the ROI of the response,
+ * see rs_filter_response_get_origin()
+ * @param filter A RSFilter
+ * @param param A RSFilterRequest defining parameters for a image request
+ * @return A GdkPixbuf, this must be unref'ed
+ */
+RSFilterResponse *
+rs_filter_get_image8_roi(RSFilter *filter, const RSFilterRequest *request)
+{
+	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
+
+	RS_DEBUG(FILTERS, "rs_filter_get_image8_roi(%s [%p])", RS_FILTER_NAME(filter), filter);
 
 	/* This timer-hack will break badly when multithreaded! */
 	static gfloat last_elapsed = 0.0;
@@ -321,6 +434,10 @@ rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
+	/* Nobody wants the result anymore, don't bother the rest of the chain */
+	if (rs_filter_request_is_cancelled(request))
+		return rs_filter_response_new();
+
 	if (count == -1)
 		gt = g_timer_new();
 	count++;
@@ -339,7 +456,7 @@ rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 	if (RS_FILTER_GET_CLASS(filter)->get_image8 && filter->enabled)
 		response = RS_FILTER_GET_CLASS(filter)->get_image8(filter, request);
 	else if (filter->previous)
-		response = rs_filter_get_image8(filter->previous, request);
+		response = rs_filter_get_image8_roi(filter->previous, request);
 
 	g_assert(RS_IS_FILTER_RESPONSE(response));
 
@@ -393,6 +510,78 @@ rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 	return response;
 }
 
+/* The border a single filter needs around a tile, or -1 if it cannot render tiles */
+static gint
+tile_border(RSFilter *filter)
+{
+	RSFilterClass *klass = RS_FILTER_GET_CLASS(filter);
+
+	/* Filters only passing on images don't care */
+	if (!klass->get_image && !klass->get_image8)
+		return 0;
+
+	if (klass->get_tile_border)
+		return klass->get_tile_border(filter);
+
+	return -1;
+}
+
+/**
+ * Get how much a tile requested from a RSFilter grows on its way down the
+ * chain. A tile is a ROI request, filters that can render tiles implement
+ * get_tile_border, returning the pixels they need around the ROI asked for.
+ * Filters without it render the whole image for every tile
+ * @param filter A RSFilter
+ * @return The sum of the borders of filter and the filters below it down to
+ *         the first that cannot render tiles, or -1 if filter cannot
+ */
+gint
+rs_filter_get_tile_border(RSFilter *filter)
+{
+	gint total = 0;
+	gint border;
+
+	g_return_val_if_fail(RS_IS_FILTER(filter), -1);
+
+	if (tile_border(filter) < 0)
+		return -1;
+
+	for(; filter && (border = tile_border(filter)) >= 0; filter = filter->previous)
+		total += border;
+
+	return total;
+}
+
+/**
+ * Put an ignore-roi RSCache below the filters that can render tiles, so the
+ * filters below them render the whole image once for all tiles
+ * @param filter The last RSFilter in a chain
+ * @return The new RSCache, this must be unref'ed, or NULL if no cache is needed
+ */
+RSFilter *
+rs_filter_insert_tile_cache(RSFilter *filter)
+{
+	RSFilter *above = NULL;
+	RSFilter *cache;
+
+	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
+
+	for(; filter && tile_border(filter) >= 0; filter = filter->previous)
+		above = filter;
+
+	/* All of the chain can render tiles, or none of it */
+	if (!filter || !above)
+		return NULL;
+
+	cache = rs_filter_new("RSCache", filter);
+	if (!cache)
+		return NULL;
+	g_object_set(cache, "ignore-roi", TRUE, NULL);
+	rs_filter_set_previous(above, cache);
+
+	return cache;
+}
+
 /**
  * Get predicted size of a RSFilter
  * @param filter A RSFilter
@@ -99,6 +99,7 @@ struct _RSFilterClass {
 	RSFilterFunc get_image8;
 	RSFilterResponse *(*get_size)(RSFilter *filter, const RSFilterRequest *request);
 	void (*previous_changed)(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask);
+	gint (*get_tile_border)(RSFilter *filter);
 };
 
 GType rs_filter_get_type(void) G_GNUC_CONST;
@@ -134,6 +135,16 @@ extern void rs_filter_changed(RSFilter *filter, RSFilterChangedMask mask);
  */
 extern RSFilterResponse *rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request);
 
+/**
+ * Get the output image from a RSFilter. Like rs_filter_get_image(), but if
+ * the request has a ROI, the image may only cover the ROI of the response,
+ * see rs_filter_response_get_origin()
+ * @param filter A RSFilter
+ * @param param A RSFilterRequest defining parameters for a image request
+ * @return A RS_IMAGE16, this must be unref'ed
+ */
+extern RSFilterResponse *rs_filter_get_image_roi(RSFilter *filter, const RSFilterRequest *request);
+
 /**
  * Get 8 bit output image from a RSFilter
  * @param filter A RSFilter
@@ -142,6 +153,35 @@ extern RSFilterResponse *rs_filter_get_image(RSFilter *filter, const RSFilterReq
  */
 extern RSFilterResponse *rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request);
 
+/**
+ * Get 8 bit output image from a RSFilter. Like rs_filter_get_image8(), but
+ * if the request has a ROI, the image may only cover the ROI of the response,
+ * see rs_filter_response_get_origin()
+ * @param filter A RSFilter
+ * @param param A RSFilterRequest defining parameters for a image request
+ * @return A GdkPixbuf, this must be unref'ed
+ */
+extern RSFilterResponse *rs_filter_get_image8_roi(RSFilter *filter, const RSFilterRequest *request);
+
+/**
+ * Get how much a tile requested from a RSFilter grows on its way down the
+ * chain. A tile is a ROI request, filters that can render tiles implement
+ * get_tile_border, returning the pixels they need around the ROI asked for.
+ * Filters without it render the whole image for every tile
+ * @param filter A RSFilter
+ * @return The sum of the borders of filter and the filters below it down to
+ *         the first that cannot render tiles, or -1 if filter cannot
+ */
+extern gint rs_filter_get_tile_border(RSFilter *filter);
+
+/**
+ * Put an ignore-roi RSCache below the filters that can render tiles, so the
+ * filters below them render the whole image once for all tiles
+ * @param filter The last RSFilter in a chain
+ * @return The new RSCache, this must be unref'ed, or NULL if no cache is needed
+ */
+extern RSFilter *rs_filter_insert_tile_cache(RSFilter *filter);
+
 /**
  * Get predicted size of a RSFilter
  * @param filter A RSFilter
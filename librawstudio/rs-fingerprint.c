@@ -0,0 +1,248 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "rs-fingerprint.h"
+
+/*
+ * A fingerprint is two 64 bit hashes, with different seeds, of:
+ *  - The first HEAD_SIZE bytes. This holds the EXIF data of nearly all raw
+ *    formats, with timestamps and sequence numbers, which tells apart photos
+ *    from the same burst.
+ *  - SAMPLES regions of SAMPLE_SIZE bytes spread evenly over the file.
+ *  - The last SAMPLE_SIZE bytes.
+ *  - The size of the file.
+ * Files smaller than the samples are hashed completely.
+ */
+
+#define HEAD_SIZE (64*1024)
+#define SAMPLE_SIZE (16*1024)
+#define SAMPLES 4
+#define TOTAL_SIZE (HEAD_SIZE + (SAMPLES+1) * SAMPLE_SIZE)
+
+/* XXH64 by Yann Collet, see https://github.com/Cyan4973/xxHash */
+#define PRIME64_1 G_GUINT64_CONSTANT(11400714785074694791)
+#define PRIME64_2 G_GUINT64_CONSTANT(14029467366897019727)
+#define PRIME64_3 G_GUINT64_CONSTANT(1609587929392839161)
+#define PRIME64_4 G_GUINT64_CONSTANT(9650029242287828579)
+#define PRIME64_5 G_GUINT64_CONSTANT(2870177450012600261)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline guint64
+read64(const guchar *p)
+{
+	guint64 v;
+	memcpy(&v, p, sizeof(v));
+	return GUINT64_FROM_LE(v);
+}
+
+static inline guint32
+read32(const guchar *p)
+{
+	guint32 v;
+	memcpy(&v, p, sizeof(v));
+	return GUINT32_FROM_LE(v);
+}
+
+static inline guint64
+xxh64_round(guint64 acc, guint64 input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline guint64
+xxh64_merge(guint64 acc, guint64 val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+guint64
+rs_hash64(const void *data, gsize length, guint64 seed)
+{
+	const guchar *p = data;
+	const guchar *end = p + length;
+	guint64 h;
+
+	if (length >= 32)
+	{
+		const guchar *limit = end - 32;
+		guint64 v1 = seed + PRIME64_1 + PRIME64_2;
+		guint64 v2 = seed + PRIME64_2;
+		guint64 v3 = seed;
+		guint64 v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, read64(p));
+			v2 = xxh64_round(v2, read64(p+8));
+			v3 = xxh64_round(v3, read64(p+16));
+			v4 = xxh64_round(v4, read64(p+24));
+			p += 32;
+		} while (p <= limit);
+
+		h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+		h = xxh64_merge(h, v1);
+		h = xxh64_merge(h, v2);
+		h = xxh64_merge(h, v3);
+		h = xxh64_merge(h, v4);
+	}
+	else
+		h = seed + PRIME64_5;
+
+	h += length;
+
+	while (p + 8 <= end)
+	{
+		h ^= xxh64_round(0, read64(p));
+		h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end)
+	{
+		h ^= read32(p) * PRIME64_1;
+		h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end)
+	{
+		h ^= (*p) * PRIME64_5;
+		h = ROTL64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+typedef struct {
+	gint64 size;
+	gint64 mtime;
+	gchar fingerprint[RS_FINGERPRINT_LENGTH+1];
+} CacheEntry;
+
+static GMutex cache_lock;
+static GHashTable *cache = NULL; /* filename -> CacheEntry */
+
+static gboolean
+read_at(gint fd, guchar *buffer, gsize length, gint64 offset)
+{
+	while (length > 0)
+	{
+		gssize bytes_read = pread(fd, buffer, length, offset);
+		if (bytes_read <= 0)
+			return FALSE;
+		buffer += bytes_read;
+		offset += bytes_read;
+		length -= bytes_read;
+	}
+	return TRUE;
+}
+
+gchar *
+rs_file_fingerprint(const gchar *filename)
+{
+	CacheEntry *entry;
+	struct stat st;
+	guchar *buffer;
+	gsize length;
+	gboolean ok;
+	gint fd;
+	gint i;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	g_mutex_lock(&cache_lock);
+	if (!cache)
+		cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	entry = g_hash_table_lookup(cache, filename);
+	if (entry && entry->size == st.st_size && entry->mtime == st.st_mtime)
+	{
+		gchar *ret = g_strdup(entry->fingerprint);
+		g_mutex_unlock(&cache_lock);
+		close(fd);
+		return ret;
+	}
+	g_mutex_unlock(&cache_lock);
+
+	/* Read the samples, this is done without holding any locks, so any
+	 * number of threads can fingerprint files at once */
+	if (st.st_size <= TOTAL_SIZE)
+	{
+		length = st.st_size;
+		buffer = g_malloc(MAX(length, 1));
+		ok = read_at(fd, buffer, length, 0);
+	}
+	else
+	{
+		length = TOTAL_SIZE;
+		buffer = g_malloc(length);
+		ok = read_at(fd, buffer, HEAD_SIZE, 0);
+		for (i = 0; ok && i < SAMPLES; i++)
+			ok = read_at(fd, buffer + HEAD_SIZE + i * SAMPLE_SIZE, SAMPLE_SIZE,
+				st.st_size / (SAMPLES+1) * (i+1));
+		if (ok)
+			ok = read_at(fd, buffer + HEAD_SIZE + SAMPLES * SAMPLE_SIZE, SAMPLE_SIZE,
+				st.st_size - SAMPLE_SIZE);
+	}
+	close(fd);
+
+	if (!ok)
+	{
+		g_free(buffer);
+		return NULL;
+	}
+
+	entry = g_new(CacheEntry, 1);
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtime;
+	g_snprintf(entry->fingerprint, sizeof(entry->fingerprint), "%016" G_GINT64_MODIFIER "x%016" G_GINT64_MODIFIER "x",
+		rs_hash64(buffer, length, st.st_size),
+		rs_hash64(buffer, length, ~((guint64) st.st_size)));
+	g_free(buffer);
+
+	g_mutex_lock(&cache_lock);
+	g_hash_table_replace(cache, g_strdup(filename), entry);
+	g_mutex_unlock(&cache_lock);
+
+	return g_strdup(entry->fingerprint);
+}
@@ -0,0 +1,53 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_FINGERPRINT_H
+#define RS_FINGERPRINT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Length of a fingerprint in characters, not including the terminating zero */
+#define RS_FINGERPRINT_LENGTH 32
+
+/**
+ * Compute a fingerprint identifying the content of a file. Only a few
+ * regions of the file are read, so this is fast even for large photos, but
+ * still tells apart photos from the same burst. The fingerprint doesn't
+ * depend on the name or modification time, so it survives moving and
+ * copying the file. Results are cached until the size or modification time
+ * of the file changes. This is safe to call from any thread
+ * @param filename Absolute path to a file
+ * @return A newly allocated string of RS_FINGERPRINT_LENGTH hexadecimal characters or NULL on errors
+ */
+extern gchar *rs_file_fingerprint(const gchar *filename);
+
+/**
+ * Compute a 64 bit XXH64 hash of a buffer
+ * @param data The data to hash
+ * @param length Length of data in bytes
+ * @param seed A seed, different seeds give unrelated hashes
+ * @return The hash
+ */
+extern guint64 rs_hash64(const void *data, gsize length, guint64 seed);
+
+G_END_DECLS
+
+#endif /* RS_FINGERPRINT_H */
@@ -25,10 +25,131 @@
 #define	__USE_ISOC9X 1
 #define	__USE_ISOC99 1
 #include <math.h> /* floor() */
+#include <sys/mman.h>
 #include "rs-image16.h"
 
 #define PITCH(width) ((((width)+15)/16)*16)
 
+/*
+ * Pixel buffers of full size images are recycled instead of freed, as most
+ * filters allocate a new image for every request. Buffers are rounded up to
+ * size classes, an eighth of a power of two apart, so an image of about the
+ * same size can reuse a buffer. Reused buffers are already paged in, and are
+ * aligned for transparent huge pages. Idle buffers are freed, least recently
+ * released first, when they would take up more than the pool limit.
+ */
+
+#define POOL_MIN_SIZE (1024*1024)
+#define POOL_ALIGNMENT (2*1024*1024)
+#define POOL_DEFAULT_LIMIT (512*1024*1024)
+
+typedef struct {
+	gpointer pixels;
+	gsize size;
+} PoolBuffer;
+
+static GMutex pool_lock;
+static GQueue pool_idle = G_QUEUE_INIT; /* Most recently released first */
+static gsize pool_limit = POOL_DEFAULT_LIMIT;
+static RSImagePoolStats pool_stats = { 0 };
+
+static gsize
+pool_class_size(gsize size)
+{
+	gsize step = 1;
+
+	while (step <= size/2)
+		step <<= 1;
+	step = MAX(step/8, POOL_ALIGNMENT);
+
+	return ((size + step - 1) / step) * step;
+}
+
+/* Must be called with pool_lock held */
+static void
+pool_trim(gsize limit)
+{
+	PoolBuffer *buffer;
+
+	while (pool_stats.idle_bytes > limit && (buffer = g_queue_pop_tail(&pool_idle)))
+	{
+		pool_stats.idle_bytes -= buffer->size;
+		pool_stats.evicted++;
+		free(buffer->pixels);
+		g_slice_free(PoolBuffer, buffer);
+	}
+}
+
+static gpointer
+pool_alloc(gsize size)
+{
+	gpointer pixels = NULL;
+	PoolBuffer *buffer;
+	GList *node;
+
+	if (size < POOL_MIN_SIZE)
+		return (posix_memalign(&pixels, 16, size) == 0) ? pixels : NULL;
+
+	size = pool_class_size(size);
+
+	g_mutex_lock(&pool_lock);
+	pool_stats.allocations++;
+	for(node = pool_idle.head; node; node = node->next)
+	{
+		buffer = node->data;
+		if (buffer->size == size)
+		{
+			pixels = buffer->pixels;
+			g_queue_delete_link(&pool_idle, node);
+			g_slice_free(PoolBuffer, buffer);
+			pool_stats.idle_bytes -= size;
+			pool_stats.reused++;
+			break;
+		}
+	}
+	g_mutex_unlock(&pool_lock);
+
+	if (pixels)
+		return pixels;
+
+	if (posix_memalign(&pixels, POOL_ALIGNMENT, size) != 0)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(pixels, size, MADV_HUGEPAGE);
+#endif
+
+	return pixels;
+}
+
+static void
+pool_release(gpointer pixels, gsize size)
+{
+	PoolBuffer *buffer;
+
+	if (size < POOL_MIN_SIZE)
+	{
+		free(pixels);
+		return;
+	}
+
+	size = pool_class_size(size);
+
+	g_mutex_lock(&pool_lock);
+	if (size > pool_limit)
+		free(pixels);
+	else
+	{
+		pool_trim(pool_limit - size);
+		buffer = g_slice_new(PoolBuffer);
+		buffer->pixels = pixels;
+		buffer->size = size;
+		g_queue_push_head(&pool_idle, buffer);
+		pool_stats.idle_bytes += size;
+		pool_stats.idle_peak = MAX(pool_stats.idle_peak, pool_stats.idle_bytes);
+	}
+	g_mutex_unlock(&pool_lock);
+}
+
 G_DEFINE_TYPE (RS_IMAGE16, rs_image16, G_TYPE_OBJECT);
 
 static GObjectClass *parent_class = NULL;
@@ -51,7 +172,12 @@ rs_image16_finalize (GObject *obj)
 	RS_IMAGE16 *self = (RS_IMAGE16 *)obj;
 
 	if (self->pixels && (self->pixels_refcount == 1))
-		free(self->pixels);
+	{
+		if (self->pixels_destroy)
+			self->pixels_destroy(self->pixels_destroy_data);
+		else
+			pool_release(self->pixels, self->h*self->rowstride * sizeof(gushort));
+	}
 
 	self->pixels_refcount--;
 
@@ -76,6 +202,8 @@ rs_image16_init (RS_IMAGE16 *self)
 	self->filters = 0;
 	self->pixels = NULL;
 	self->pixels_refcount = 0;
+	self->pixels_destroy = NULL;
+	self->pixels_destroy_data = NULL;
 }
 
 void
@@ -120,7 +248,6 @@ rs_image16_transform_getwh(RS_IMAGE16 *in, RS_RECT *crop, gdouble angle, gint or
 RS_IMAGE16 *
 rs_image16_new(const guint width, const guint height, const guint channels, const guint pixelsize)
 {
-	gint ret;
 	RS_IMAGE16 *rsi;
 
 	g_return_val_if_fail(width < 65536, NULL);
@@ -142,8 +269,8 @@ rs_image16_new(const guint width, const guint height, const guint channels, cons
 	rsi->filters = 0;
 
 	/* Allocate actual pixels */
-	ret = posix_memalign((void **) &rsi->pixels, 16, rsi->h*rsi->rowstride * sizeof(gushort));
-	if (ret > 0)
+	rsi->pixels = pool_alloc(rsi->h*rsi->rowstride * sizeof(gushort));
+	if (!rsi->pixels)
 	{
 		rsi->pixels = NULL;
 		g_object_unref(rsi);
@@ -158,6 +285,53 @@ rs_image16_new(const guint width, const guint height, const guint channels, cons
 	return(rsi);
 }
 
+/**
+ * Initializes a new RS_IMAGE16 around existing pixel data, this allows
+ * loaders to hand over their buffer without copying it.
+ * @note Rows should be 16 byte aligned, unless the image is single channel
+ *       CFA data, which is only accessed pixel by pixel.
+ * @param pixels The pixel data
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param channels The number of channels per pixel
+ * @param pixelsize The number of shorts per pixel
+ * @param rowstride The number of shorts per row
+ * @param destroy Called with destroy_data when the pixels are no longer needed
+ * @param destroy_data Data to pass to destroy
+ * @return A new RS_IMAGE16 with a refcount of 1
+ */
+RS_IMAGE16 *
+rs_image16_new_from_data(gushort *pixels, const guint width, const guint height, const guint channels, const guint pixelsize, const guint rowstride, GDestroyNotify destroy, gpointer destroy_data)
+{
+	RS_IMAGE16 *rsi;
+
+	g_return_val_if_fail(pixels != NULL, NULL);
+	g_return_val_if_fail(width < 65536, NULL);
+	g_return_val_if_fail(height < 65536, NULL);
+
+	g_return_val_if_fail(width > 0, NULL);
+	g_return_val_if_fail(height > 0, NULL);
+
+	g_return_val_if_fail(channels > 0, NULL);
+	g_return_val_if_fail(pixelsize >= channels, NULL);
+	g_return_val_if_fail(rowstride >= width * pixelsize, NULL);
+
+	rsi = g_object_new(RS_TYPE_IMAGE16, NULL);
+	rsi->w = width;
+	rsi->h = height;
+	rsi->rowstride = rowstride;
+	rsi->pitch = rsi->rowstride / pixelsize;
+	rsi->channels = channels;
+	rsi->pixelsize = pixelsize;
+	rsi->filters = 0;
+	rsi->pixels = pixels;
+	rsi->pixels_refcount = 1;
+	rsi->pixels_destroy = destroy;
+	rsi->pixels_destroy_data = destroy_data;
+
+	return(rsi);
+}
+
 /**
  * Initializes a new RS_IMAGE16 with pixeldata from @input.
  * @note Pixeldata is NOT copied to new RS_IMAGE16.
@@ -259,8 +433,9 @@ rs_image16_copy(RS_IMAGE16 *in, gboolean copy_pixels)
 	out = rs_image16_new(in->w, in->h, in->channels, in->pixelsize);
 	if (copy_pixels)
 	{
+		/* Images created by rs_image16_new_from_data() can have a smaller rowstride */
 		bit_blt((char*)GET_PIXEL(out,0,0), out->rowstride * 2, 
-			(const char*)GET_PIXEL(in,0,0), in->rowstride * 2, out->rowstride * 2, in->h);
+			(const char*)GET_PIXEL(in,0,0), in->rowstride * 2, MIN(in->rowstride, out->rowstride) * 2, in->h);
 	}
 	return(out);
 }
@@ -328,3 +503,30 @@ rs_image16_get_checksum(RS_IMAGE16 *image)
 	}
 	return g_compute_checksum_for_data(G_CHECKSUM_SHA256, (guchar *) pixels, w*h*c);
 }
+
+/**
+ * Set the maximum amount of memory kept by the pool of idle pixel buffers
+ * @param limit The limit in bytes, 0 disables the pool
+ */
+void
+rs_image16_pool_set_limit(gsize limit)
+{
+	g_mutex_lock(&pool_lock);
+	pool_limit = limit;
+	pool_trim(pool_limit);
+	g_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Get statistics about the pool of pixel buffers
+ * @param stats A RSImagePoolStats to fill
+ */
+void
+rs_image16_pool_get_stats(RSImagePoolStats *stats)
+{
+	g_return_if_fail(stats != NULL);
+
+	g_mutex_lock(&pool_lock);
+	*stats = pool_stats;
+	g_mutex_unlock(&pool_lock);
+}
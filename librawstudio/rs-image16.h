@@ -39,12 +39,22 @@ struct _rs_image16 {
 	guint pixelsize; /* the size of a pixel in SHORTS */
 	gushort *pixels;
 	gint pixels_refcount;
+	GDestroyNotify pixels_destroy; /* If set, called instead of free() on the pixels */
+	gpointer pixels_destroy_data;
 	guint filters;
 	gboolean dispose_has_run;
 };
 
 typedef struct _RS_IMAGE16Class RS_IMAGE16Class;
 
+typedef struct {
+	guint64 allocations;    /* Allocations large enough to use the pool */
+	guint64 reused;         /* Allocations served by an idle buffer */
+	guint64 evicted;        /* Idle buffers freed to stay below the limit */
+	gsize idle_bytes;       /* Memory held by idle buffers */
+	gsize idle_peak;        /* Highest value of idle_bytes */
+} RSImagePoolStats;
+
 struct _RS_IMAGE16Class {
 	GObjectClass parent;
 };
@@ -63,6 +73,24 @@ GType rs_image16_get_type (void);
 
 extern RS_IMAGE16 *rs_image16_new(const guint width, const guint height, const guint channels, const guint pixelsize);
 
+/**
+ * Initializes a new RS_IMAGE16 around existing pixel data, this allows
+ * loaders to hand over their buffer without copying it.
+ * @note Rows should be 16 byte aligned, unless the image is single channel
+ *       CFA data, which is only accessed pixel by pixel.
+ * @param pixels The pixel data
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param channels The number of channels per pixel
+ * @param pixelsize The number of shorts per pixel
+ * @param rowstride The number of shorts per row
+ * @param destroy Called with destroy_data when the pixels are no longer needed
+ * @param destroy_data Data to pass to destroy
+ * @return A new RS_IMAGE16 with a refcount of 1
+ */
+extern RS_IMAGE16 *
+rs_image16_new_from_data(gushort *pixels, const guint width, const guint height, const guint channels, const guint pixelsize, const guint rowstride, GDestroyNotify destroy, gpointer destroy_data);
+
 /**
  * Initializes a new RS_IMAGE16 with pixeldata from @input.
  * @note Pixeldata is NOT copied to new RS_IMAGE16.
@@ -89,4 +117,16 @@ extern gushort *rs_image16_get_pixel(RS_IMAGE16 *image, gint x, gint y, gboolean
 
 extern gchar *rs_image16_get_checksum(RS_IMAGE16 *image);
 
+/**
+ * Set the maximum amount of memory kept by the pool of idle pixel buffers
+ * @param limit The limit in bytes, 0 disables the pool
+ */
+extern void rs_image16_pool_set_limit(gsize limit);
+
+/**
+ * Get statistics about the pool of pixel buffers
+ * @param stats A RSImagePoolStats to fill
+ */
+extern void rs_image16_pool_get_stats(RSImagePoolStats *stats);
+
 #endif /* RS_IMAGE16_H */
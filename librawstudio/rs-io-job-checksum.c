@@ -36,9 +36,8 @@ execute(RSIoJob *job)
 {
 	RSIoJobChecksum *checksum = RS_IO_JOB_CHECKSUM(job);
 
-	rs_io_lock();
-	checksum->checksum = rs_file_checksum(checksum->path);
-	rs_io_unlock();
+	/* Fingerprinting reads very little, so it doesn't take the io lock */
+	checksum->checksum = rs_file_fingerprint(checksum->path);
 }
 
 static void
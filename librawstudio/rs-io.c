@@ -17,83 +17,170 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
 #include "rs-io.h"
+#include "conf_interface.h"
 
-static GMutex init_lock;
-static GAsyncQueue *queue = NULL;
-static GRecMutex io_lock;
-static GTimer *io_lock_timer = NULL;
+/*
+ * Jobs are split in two pools. Disk bound jobs (prefetch, checksum and
+ * tagging) gets a few workers, more would only make the disk seek more, while
+ * CPU bound jobs (metadata and thumbnail decoding) gets one worker per core.
+ * Each pool keeps its queue sorted by priority, but a job gains one priority
+ * level for every AGING_INTERVAL it has waited, so a steady stream of high
+ * priority jobs cannot starve the rest. Since all jobs age at the same rate,
+ * this is the same as sorting by priority * AGING_INTERVAL + time queued.
+ */
+
+#define AGING_INTERVAL (100*1000) /* Microseconds per priority level */
+#define DISK_THREADS 2
+
+typedef struct {
+	RSIoJob *job;
+	gint64 sort_key;
+} QueueEntry;
+
+typedef struct {
+	const gchar *name;
+	GQueue queue;
+	GCond cond;
+	gint active;
+} IoPool;
+
+static GMutex lock;
+static IoPool disk_pool = { "io disk worker", G_QUEUE_INIT };
+static IoPool cpu_pool = { "io cpu worker", G_QUEUE_INIT };
+static gboolean initialized = FALSE;
 static gboolean pause_queue = FALSE;
-static gint queue_active_count = 0;
-static GMutex count_lock;
 
+/*
+ * The IO lock used to be a single mutex, serializing all file access in the
+ * process. It now limits the number of threads accessing each device at
+ * once instead. Rotating disks gets a queue depth of one, as seeking between
+ * several files is slower than reading them one by one, while solid state
+ * storage allows a few concurrent readers. The lock is recursive per thread
+ * for each device, and must be released in the reverse order it was taken.
+ */
+
+#define IO_LOCK_TIMEOUT (10*G_TIME_SPAN_SECOND)
+#define QUEUE_DEPTH_ROTATIONAL 1
+#define QUEUE_DEPTH_SOLID_STATE 4
+
+typedef struct {
+	guint64 id;
+	gint depth;
+	gint holders;
+	GCond cond;
+} IoDevice;
+
+typedef struct {
+	IoDevice *device;
+	const gchar *caller;
+	gint64 acquired;
+	gboolean nested;
+} IoLockHeld;
+
+typedef struct {
+	const gchar *caller;
+	guint64 locks;
+	guint64 contended;
+	gint64 wait_time;
+	gint64 wait_max;
+	gint64 hold_time;
+} IoLockStats;
+
+static GMutex device_lock;
+static GHashTable *devices = NULL;
+static GHashTable *lock_stats = NULL;
+static GPrivate held_locks; /* GSList of IoLockHeld, innermost first */
 
 static gint
 queue_sort(gconstpointer a, gconstpointer b, gpointer user_data)
 {
-	gint id1 = 0;
-	gint id2 = 0;
+	gint64 key1 = ((const QueueEntry *) a)->sort_key;
+	gint64 key2 = ((const QueueEntry *) b)->sort_key;
 
-	if (a)
-		id1 = RS_IO_JOB(a)->priority;
-	if (b)
-		id2 = RS_IO_JOB(b)->priority;
+	return (key1 > key2 ? +1 : key1 == key2 ? 0 : -1);
+}
 
-	return (id1 > id2 ? +1 : id1 == id2 ? 0 : -1);
+static IoPool *
+pool_for_job(RSIoJob *job)
+{
+	if (RS_IS_IO_JOB_PREFETCH(job) || RS_IS_IO_JOB_CHECKSUM(job) || RS_IS_IO_JOB_TAGGING(job))
+		return &disk_pool;
+	else
+		return &cpu_pool;
 }
 
 static gpointer
 queue_worker(gpointer data)
 {
-	GAsyncQueue *queue = data;
+	IoPool *pool = data;
+	QueueEntry *entry;
 	RSIoJob *job;
 
+	g_mutex_lock(&lock);
 	while (1)
 	{
-		if (pause_queue)
-			g_usleep(1000);
-		else
-		{
-			g_mutex_lock(&count_lock);
-			job = g_async_queue_try_pop(queue);
-			if (job)
-				queue_active_count++;
-			g_mutex_unlock(&count_lock);
-
-			/* If we somehow got NULL, continue. I'm not sure this will ever happen, but this is better than random segfaults :) */
-			if (job)
-			{
-				rs_io_job_execute(job);
-				rs_io_job_do_callback(job);
-				g_mutex_lock(&count_lock);
-				queue_active_count--;
-				g_mutex_unlock(&count_lock);
-			}
-			else
-			{
-				/* Sleep 1 ms */
-				g_usleep(1000);
-			}
-		}
+		while (pause_queue || g_queue_is_empty(&pool->queue))
+			g_cond_wait(&pool->cond, &lock);
+
+		entry = g_queue_pop_head(&pool->queue);
+		job = entry->job;
+		g_slice_free(QueueEntry, entry);
+		pool->active++;
+		g_mutex_unlock(&lock);
+
+		rs_io_job_execute(job);
+		rs_io_job_do_callback(job);
+
+		g_mutex_lock(&lock);
+		pool->active--;
 	}
+	g_mutex_unlock(&lock);
 
 	return NULL;
 }
 
+/* Must be called with lock held */
 static void
 init(void)
 {
-	int i;
-	g_mutex_lock(&init_lock);
-	if (!queue)
-	{
-		queue = g_async_queue_new();
-		for (i = 0; i < rs_get_number_of_processor_cores(); i++)
-			g_thread_new("io worker", queue_worker, queue);
+	gint i;
+
+	if (initialized)
+		return;
+
+	for (i = 0; i < MIN(DISK_THREADS, rs_get_number_of_processor_cores()); i++)
+		g_thread_unref(g_thread_new(disk_pool.name, queue_worker, &disk_pool));
+	for (i = 0; i < rs_get_number_of_processor_cores(); i++)
+		g_thread_unref(g_thread_new(cpu_pool.name, queue_worker, &cpu_pool));
 
-		io_lock_timer = g_timer_new();
+	initialized = TRUE;
+}
+
+/* Must be called with lock held */
+static void
+pool_cancel(IoPool *pool, RSIoJob *job, gint idle_class)
+{
+	GList *node = pool->queue.head;
+	GList *next;
+	QueueEntry *entry;
+
+	while (node)
+	{
+		next = node->next;
+		entry = node->data;
+		if ((job && entry->job == job) || (!job && entry->job->idle_class == idle_class))
+		{
+			g_queue_delete_link(&pool->queue, node);
+			g_slice_free(QueueEntry, entry);
+		}
+		node = next;
 	}
-	g_mutex_unlock(&init_lock);
 }
 
 /**
@@ -108,11 +195,21 @@ rs_io_idle_add_job(RSIoJob *job, gint idle_class, gint priority, gpointer user_d
 {
 	g_return_if_fail(RS_IS_IO_JOB(job));
 
+	QueueEntry *entry = g_slice_new(QueueEntry);
+	IoPool *pool = pool_for_job(job);
+
 	job->idle_class = idle_class;
 	job->priority = priority;
 	job->user_data = user_data;
 
-	g_async_queue_push_sorted(queue, job, queue_sort, NULL);
+	entry->job = job;
+	entry->sort_key = (gint64) priority * AGING_INTERVAL + g_get_monotonic_time();
+
+	g_mutex_lock(&lock);
+	init();
+	g_queue_insert_sorted(&pool->queue, entry, queue_sort, NULL);
+	g_cond_signal(&pool->cond);
+	g_mutex_unlock(&lock);
 }
 
 /**
@@ -127,8 +224,6 @@ rs_io_idle_prefetch_file(const gchar *path, gint idle_class)
 	g_return_val_if_fail(path != NULL, NULL);
 	g_return_val_if_fail(g_path_is_absolute(path), NULL);
 
-	init();
-
 	RSIoJob *job = rs_io_job_prefetch_new(path);
 	rs_io_idle_add_job(job, idle_class, 20, NULL);
 
@@ -149,8 +244,6 @@ rs_io_idle_read_metadata(const gchar *path, gint idle_class, RSGotMetadataCB cal
 	g_return_val_if_fail(path != NULL, NULL);
 	g_return_val_if_fail(g_path_is_absolute(path), NULL);
 
-	init();
-
 	RSIoJob *job = rs_io_job_metadata_new(path, callback);
 	rs_io_idle_add_job(job, idle_class, 10, user_data);
 
@@ -171,8 +264,6 @@ rs_io_idle_read_checksum(const gchar *path, gint idle_class, RSGotChecksumCB cal
 	g_return_val_if_fail(path != NULL, NULL);
 	g_return_val_if_fail(g_path_is_absolute(path), NULL);
 
-	init();
-
 	RSIoJob *job = rs_io_job_checksum_new(path, callback);
 	rs_io_idle_add_job(job, idle_class, 30, user_data);
 
@@ -193,8 +284,6 @@ rs_io_idle_add_tag(const gchar *filename, gint tag_id, gboolean auto_tag, gint i
 	g_return_val_if_fail(filename != NULL, NULL);
 	g_return_val_if_fail(g_path_is_absolute(filename), NULL);
 
-	init();
-
 	RSIoJob *job = rs_io_job_tagging_new(filename, tag_id, auto_tag);
 	rs_io_idle_add_job(job, idle_class, 50, NULL);
 
@@ -213,8 +302,6 @@ rs_io_idle_restore_tags(const gchar *path, gint idle_class)
 	g_return_val_if_fail(path != NULL, NULL);
 	g_return_val_if_fail(g_path_is_absolute(path), NULL);
 
-	init();
-
 	RSIoJob *job = rs_io_job_tagging_new(path, -1, FALSE);
 	rs_io_idle_add_job(job, idle_class, 50, NULL);
 
@@ -228,118 +315,276 @@ rs_io_idle_restore_tags(const gchar *path, gint idle_class)
 void
 rs_io_idle_cancel_class(gint idle_class)
 {
-	/* This behaves like rs_io_idle_cancel_class(), please see comments there */
-	RSIoJob *current_job;
-	RSIoJob *marker_job = rs_io_job_new();
+	g_mutex_lock(&lock);
+	pool_cancel(&disk_pool, NULL, idle_class);
+	pool_cancel(&cpu_pool, NULL, idle_class);
+	g_mutex_unlock(&lock);
+}
+
+/**
+ * Cancel an idle request
+ * @param request_id A request_id as returned by rs_io_idle_read_complete_file()
+ */
+void
+rs_io_idle_cancel(RSIoJob *job)
+{
+	g_return_if_fail(job != NULL);
 
-	init();
+	g_mutex_lock(&lock);
+	pool_cancel(&disk_pool, job, 0);
+	pool_cancel(&cpu_pool, job, 0);
+	g_mutex_unlock(&lock);
+}
+
+/* Guess a sensible queue depth for a device, must be called with device_lock held */
+static gint
+device_default_depth(guint64 id)
+{
+	gint depth = 0;
+	gboolean rotational = TRUE;
 
-	g_async_queue_lock(queue);
+	if (rs_conf_get_integer(CONF_IO_QUEUE_DEPTH, &depth) && depth > 0)
+		return depth;
 
-	/* Put a marker in the queue, we will rotate the complete queue, so we have to know when we're around */
-	g_async_queue_push_unlocked(queue, marker_job);
+	/* We know nothing about the device, behave like the old global lock */
+	if (id == 0)
+		return QUEUE_DEPTH_ROTATIONAL;
 
-	while((current_job = g_async_queue_pop_unlocked(queue)))
+#if defined(__linux__)
+	gchar *contents = NULL;
+	gchar *path = g_strdup_printf("/sys/dev/block/%u:%u/queue/rotational", major(id), minor(id));
+
+	/* Partitions has no queue, use the disk they belong to */
+	if (!g_file_test(path, G_FILE_TEST_EXISTS))
+	{
+		g_free(path);
+		path = g_strdup_printf("/sys/dev/block/%u:%u/../queue/rotational", major(id), minor(id));
+	}
+	if (g_file_get_contents(path, &contents, NULL, NULL))
 	{
-		/* If current job matches marker, we're done */
-		if (current_job == marker_job)
-			break;
+		rotational = (contents[0] != '0');
+		g_free(contents);
+	}
+	g_free(path);
+#endif
 
-		/* Of the job's idle_class doesn't match the class to cancel, we put the job back in the queue */
-		if (current_job->idle_class != idle_class)
-		{
-			g_async_queue_push_unlocked(queue, current_job);
-		}
+	return rotational ? QUEUE_DEPTH_ROTATIONAL : QUEUE_DEPTH_SOLID_STATE;
+}
+
+/* Must be called with device_lock held */
+static IoDevice *
+get_device(guint64 id)
+{
+	IoDevice *device;
+
+	if (!devices)
+		devices = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+	device = g_hash_table_lookup(devices, &id);
+	if (!device)
+	{
+		device = g_new0(IoDevice, 1);
+		device->id = id;
+		device->depth = device_default_depth(id);
+		g_cond_init(&device->cond);
+		g_hash_table_insert(devices, &device->id, device);
+		RS_DEBUG(PERFORMANCE, "Using IO queue depth %d for device %" G_GINT64_MODIFIER "x", device->depth, id);
 	}
 
-	/* Make sure the queue is sorted */
-	g_async_queue_sort_unlocked(queue, queue_sort, NULL);
+	return device;
+}
+
+/* Must be called with device_lock held */
+static IoLockStats *
+get_lock_stats(const gchar *caller)
+{
+	IoLockStats *stats;
 
-	g_async_queue_unlock(queue);
+	if (!lock_stats)
+		lock_stats = g_hash_table_new(g_str_hash, g_str_equal);
 
-	g_object_unref(marker_job);
+	stats = g_hash_table_lookup(lock_stats, caller);
+	if (!stats)
+	{
+		stats = g_new0(IoLockStats, 1);
+		stats->caller = caller;
+		g_hash_table_insert(lock_stats, (gpointer) caller, stats);
+	}
+
+	return stats;
 }
 
 /**
- * Cancel an idle request
- * @param request_id A request_id as returned by rs_io_idle_read_complete_file()
+ * Get the device a file is stored on, for use with rs_io_lock_real()
+ * @param path Absolute path to a file, the file doesn't have to exist yet
+ * @return A device identifier or 0 if unknown
  */
-void
-rs_io_idle_cancel(RSIoJob *job)
+guint64
+rs_io_get_device(const gchar *path)
 {
-	/* This behaves like rs_io_idle_cancel_class(), please see comments there */
-	RSIoJob *current_job;
-	RSIoJob *marker_job = rs_io_job_new();
-
-	init();
+	struct stat st;
+	guint64 id = 0;
 
-	g_async_queue_lock(queue);
+	if (!path)
+		return 0;
 
-	/* Put a marker in the queue, we will rotate the complete queue, so we have to know when we're around */
-	g_async_queue_push_unlocked(queue, marker_job);
+	if (stat(path, &st) == 0)
+		return st.st_dev;
 
-	while((current_job = g_async_queue_pop_unlocked(queue)))
-	{
-		/* If current job matches marker, we're done */
-		if (current_job == marker_job)
-			break;
+	/* Files about to be written doesn't exist yet, use the directory */
+	gchar *dirname = g_path_get_dirname(path);
+	if (stat(dirname, &st) == 0)
+		id = st.st_dev;
+	g_free(dirname);
 
-		if (current_job != job)
-			g_async_queue_push_unlocked(queue, current_job);
-	}
+	return id;
+}
 
-	/* Make sure the queue is sorted */
-	g_async_queue_sort_unlocked(queue, queue_sort, NULL);
+/**
+ * Get the device an open file is stored on, for use with rs_io_lock_real()
+ * @param fd A file descriptor
+ * @return A device identifier or 0 if unknown
+ */
+guint64
+rs_io_get_device_from_fd(gint fd)
+{
+	struct stat st;
 
-	g_async_queue_unlock(queue);
+	if (fd >= 0 && fstat(fd, &st) == 0)
+		return st.st_dev;
 
-	g_object_unref(marker_job);
+	return 0;
 }
 
 /**
- * Aquire the IO lock
+ * Set the number of threads allowed to access the device holding a file at once
+ * @param path Absolute path to a file or directory on the device
+ * @param depth The number of concurrent threads, at least 1
  */
 void
-rs_io_lock_real(const gchar *source_file, gint line, const gchar *caller)
+rs_io_set_queue_depth(const gchar *path, gint depth)
 {
-	RS_DEBUG(LOCKING, "[%s:%d %s()] \033[33mrequesting\033[0m IO lock (thread %p)",
-		source_file, line, caller,
-		(g_timer_start(io_lock_timer), g_thread_self()));
-
-	/* Each loop tries approx every millisecond, so we wait 10 secs */
-	int tries_left = 10*1000;
+	IoDevice *device;
+	guint64 id = rs_io_get_device(path);
+
+	g_mutex_lock(&device_lock);
+	device = get_device(id);
+	device->depth = MAX(1, depth);
+	g_cond_broadcast(&device->cond);
+	g_mutex_unlock(&device_lock);
+}
 
-	while (FALSE == g_rec_mutex_trylock(&io_lock))
+/**
+ * Aquire the IO lock of a device, this will block until less than the queue
+ * depth of the device is held by other threads
+ */
+void
+rs_io_lock_real(guint64 device_id, const gchar *source_file, gint line, const gchar *caller)
+{
+	GSList *held = g_private_get(&held_locks);
+	IoLockHeld *lock_held = g_slice_new0(IoLockHeld);
+	IoLockStats *stats;
+	GSList *iter;
+	gint64 start = g_get_monotonic_time();
+	gint64 wait;
+	gboolean contended = FALSE;
+	gboolean timed_out = FALSE;
+
+	RS_DEBUG(LOCKING, "[%s:%d %s()] \033[33mrequesting\033[0m IO lock on device %" G_GINT64_MODIFIER "x (thread %p)",
+		source_file, line, caller, device_id, g_thread_self());
+
+	g_mutex_lock(&device_lock);
+	lock_held->device = get_device(device_id);
+	lock_held->caller = caller;
+
+	for(iter = held; iter; iter = iter->next)
+		if (((IoLockHeld *) iter->data)->device == lock_held->device)
+			lock_held->nested = TRUE;
+
+	if (!lock_held->nested)
 	{
-		g_usleep(1000);
-		if (--tries_left <= 0)
+		while (lock_held->device->holders >= lock_held->device->depth && !timed_out)
 		{
-			RS_DEBUG(LOCKING, "[%s:%d %s()] \033[31mIO Lock was not released after \033[36m%.2f\033[0mms\033[0m, ignoring IO lock (thread %p)",
-				source_file, line, caller,
-				g_timer_elapsed(io_lock_timer, NULL)*1000.0,
-				(g_timer_start(io_lock_timer), g_thread_self()));
-			return;
+			contended = TRUE;
+			if (!g_cond_wait_until(&lock_held->device->cond, &device_lock, start + IO_LOCK_TIMEOUT))
+				timed_out = (lock_held->device->holders >= lock_held->device->depth);
 		}
+		/* Count ourselves even if we timed out, to keep the unlock balanced */
+		lock_held->device->holders++;
 	}
 
-	RS_DEBUG(LOCKING, "[%s:%d %s()] \033[32mgot\033[0m IO lock after \033[36m%.2f\033[0mms (thread %p)",
-		source_file, line, caller,
-		g_timer_elapsed(io_lock_timer, NULL)*1000.0,
-		(g_timer_start(io_lock_timer), g_thread_self()));
+	lock_held->acquired = g_get_monotonic_time();
+	wait = lock_held->acquired - start;
+
+	stats = get_lock_stats(caller);
+	stats->locks++;
+	if (contended)
+		stats->contended++;
+	stats->wait_time += wait;
+	stats->wait_max = MAX(stats->wait_max, wait);
+	g_mutex_unlock(&device_lock);
+
+	g_private_set(&held_locks, g_slist_prepend(held, lock_held));
+
+	if (timed_out)
+		RS_DEBUG(LOCKING, "[%s:%d %s()] \033[31mIO Lock was not released after \033[36m%.2f\033[0mms\033[0m, ignoring IO lock (thread %p)",
+			source_file, line, caller, wait/1000.0, g_thread_self());
+	else
+		RS_DEBUG(LOCKING, "[%s:%d %s()] \033[32mgot\033[0m IO lock after \033[36m%.2f\033[0mms (thread %p)",
+			source_file, line, caller, wait/1000.0, g_thread_self());
 }
 
 /**
- * Release the IO lock
+ * Release the IO lock most recently aquired by this thread
  */
 void
 rs_io_unlock_real(const gchar *source_file, gint line, const gchar *caller)
 {
+	GSList *held = g_private_get(&held_locks);
+	IoLockHeld *lock_held;
+	gint64 hold_time;
+
+	g_return_if_fail(held != NULL);
+
+	lock_held = held->data;
+	g_private_set(&held_locks, g_slist_delete_link(held, held));
+	hold_time = g_get_monotonic_time() - lock_held->acquired;
+
+	g_mutex_lock(&device_lock);
+	get_lock_stats(lock_held->caller)->hold_time += hold_time;
+	if (!lock_held->nested)
+	{
+		lock_held->device->holders--;
+		g_cond_signal(&lock_held->device->cond);
+	}
+	g_mutex_unlock(&device_lock);
+
 	RS_DEBUG(LOCKING, "[%s:%d %s()] releasing IO lock after \033[36m%.2f\033[0mms (thread %p)",
-		source_file, line, caller,
-		g_timer_elapsed(io_lock_timer, NULL)*1000.0,
-		g_thread_self());
+		source_file, line, caller, hold_time/1000.0, g_thread_self());
 
-	g_rec_mutex_unlock(&io_lock);
+	g_slice_free(IoLockHeld, lock_held);
+}
+
+/**
+ * Print statistics about the IO lock, for each function using it, if
+ * performance debugging is enabled
+ */
+void
+rs_io_print_lock_stats(void)
+{
+	GHashTableIter iter;
+	IoLockStats *stats;
+
+	g_mutex_lock(&device_lock);
+	if (lock_stats)
+	{
+		g_hash_table_iter_init(&iter, lock_stats);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &stats))
+			RS_DEBUG(PERFORMANCE, "IO lock held by %s(): %" G_GUINT64_FORMAT " times, %" G_GUINT64_FORMAT " contended, waited %.2fms (max %.2fms), held %.2fms",
+				stats->caller, stats->locks, stats->contended,
+				stats->wait_time/1000.0, stats->wait_max/1000.0, stats->hold_time/1000.0);
+	}
+	g_mutex_unlock(&device_lock);
 }
 
 /**
@@ -348,7 +593,9 @@ rs_io_unlock_real(const gchar *source_file, gint line, const gchar *caller)
 void
 rs_io_idle_pause(void)
 {
+	g_mutex_lock(&lock);
 	pause_queue = TRUE;
+	g_mutex_unlock(&lock);
 }
 
 /**
@@ -357,7 +604,11 @@ rs_io_idle_pause(void)
 void
 rs_io_idle_unpause(void)
 {
+	g_mutex_lock(&lock);
 	pause_queue = FALSE;
+	g_cond_broadcast(&disk_pool.cond);
+	g_cond_broadcast(&cpu_pool.cond);
+	g_mutex_unlock(&lock);
 }
 
 /**
@@ -366,8 +617,9 @@ rs_io_idle_unpause(void)
 gint
 rs_io_get_jobs_left(void)
 {
-	g_mutex_lock(&count_lock);
-	gint left = g_async_queue_length(queue) + queue_active_count;
-	g_mutex_unlock(&count_lock);
+	g_mutex_lock(&lock);
+	gint left = g_queue_get_length(&disk_pool.queue) + disk_pool.active
+		+ g_queue_get_length(&cpu_pool.queue) + cpu_pool.active;
+	g_mutex_unlock(&lock);
 	return left;
-}
\ No newline at end of file
+}
@@ -109,21 +109,57 @@ rs_io_idle_pause(void);
 void
 rs_io_idle_unpause(void);
 
-#define rs_io_lock() rs_io_lock_real(__FILE__, __LINE__, __FUNCTION__)
+/* Lock the device holding a file, use these around reads and writes */
+#define rs_io_lock_file(path) rs_io_lock_real(rs_io_get_device(path), __FILE__, __LINE__, __FUNCTION__)
+#define rs_io_lock_fd(fd) rs_io_lock_real(rs_io_get_device_from_fd(fd), __FILE__, __LINE__, __FUNCTION__)
+/* Lock an unknown device, this will serialize with other users of rs_io_lock() */
+#define rs_io_lock() rs_io_lock_real(0, __FILE__, __LINE__, __FUNCTION__)
 #define rs_io_unlock() rs_io_unlock_real(__FILE__, __LINE__, __FUNCTION__)
 
 /**
- * Aquire the IO lock
+ * Get the device a file is stored on, for use with rs_io_lock_real()
+ * @param path Absolute path to a file, the file doesn't have to exist yet
+ * @return A device identifier or 0 if unknown
+ */
+guint64
+rs_io_get_device(const gchar *path);
+
+/**
+ * Get the device an open file is stored on, for use with rs_io_lock_real()
+ * @param fd A file descriptor
+ * @return A device identifier or 0 if unknown
+ */
+guint64
+rs_io_get_device_from_fd(gint fd);
+
+/**
+ * Set the number of threads allowed to access the device holding a file at once
+ * @param path Absolute path to a file or directory on the device
+ * @param depth The number of concurrent threads, at least 1
+ */
+void
+rs_io_set_queue_depth(const gchar *path, gint depth);
+
+/**
+ * Aquire the IO lock of a device, this will block until less than the queue
+ * depth of the device is held by other threads
  */
 void
-rs_io_lock_real(const gchar *source_file, gint line, const gchar *caller);
+rs_io_lock_real(guint64 device_id, const gchar *source_file, gint line, const gchar *caller);
 
 /**
- * Release the IO lock
+ * Release the IO lock most recently aquired by this thread
  */
 void
 rs_io_unlock_real(const gchar *source_file, gint line, const gchar *caller);
 
+/**
+ * Print statistics about the IO lock, for each function using it, if
+ * performance debugging is enabled
+ */
+void
+rs_io_print_lock_stats(void);
+
 /**
  * Returns the number of jobs left
  */
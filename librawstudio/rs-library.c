@@ -28,7 +28,8 @@
  * library: Known photos
  *   id integer primary key: Photo serial
  *   filename varchar(1024): Path to photo file
- *   identifier varchar(32): "rawstudio-sum" of the photo
+ *   identifier varchar(32): Fingerprint of the photo, see rs_file_fingerprint()
+ *   fingerprinted integer: 1 once identifier holds a fingerprint, older rows hold an MD5 sum
  *
  * tags: Known tags
  *   id integer primary key: Tag serial
@@ -63,7 +64,7 @@
 #include <libxml/xmlwriter.h>
 #include <sqlite3.h>
 
-#define LIBRARY_VERSION 2
+#define LIBRARY_VERSION 4
 #define TAGS_XML_FILE "tags.xml"
 #define MAX_SEARCH_RESULTS 1000
 #include "rs-types.h"
@@ -75,14 +76,22 @@ struct _RSLibrary {
 	sqlite3 *db;
 	gchar *error_init;
 
-	/* This mutex must be used when inserting data in a table with an
-	   autocrementing column - which is ALWAYS for sqlite */
-	GMutex id_lock;
+	/* Prepared statements indexed by their SQL. All use of the database
+	   must hold statement_lock, this also keeps transactions started by
+	   different threads apart */
+	GRecMutex statement_lock;
+	GHashTable *statements;
+	gint transaction_depth;
 };
 
 G_DEFINE_TYPE(RSLibrary, rs_library, G_TYPE_OBJECT)
 
 static gint library_execute_sql(sqlite3 *db, const gchar *sql);
+static sqlite3_stmt *library_statement(RSLibrary *library, const gchar *sql);
+static void library_statement_done(RSLibrary *library, sqlite3_stmt *stmt);
+static void library_begin(RSLibrary *library);
+static void library_commit(RSLibrary *library);
+static void library_create_indexes(sqlite3 *db);
 static void library_sqlite_error(sqlite3 *db, const gint result);
 static gint library_create_tables(sqlite3 *db);
 static gint library_find_tag_id(RSLibrary *library, const gchar *tagname);
@@ -90,6 +99,7 @@ static gint library_find_photo_id(RSLibrary *library, const gchar *photo);
 static void library_photo_add_tag(RSLibrary *library, const gint photo_id, const gint tag_id, const gboolean autotag);
 static gboolean library_is_photo_tagged(RSLibrary *library, const gint photo_id, const gint tag_id);
 static gint library_add_photo(RSLibrary *library, const gchar *filename);
+static void got_checksum(const gchar *checksum, gpointer user_data);
 static gint library_add_tag(RSLibrary *library, const gchar *tagname);
 static void library_delete_photo(RSLibrary *library, const gint photo_id);
 static void library_delete_tag(RSLibrary *library, const gint tag_id);
@@ -109,6 +119,8 @@ rs_library_dispose(GObject *object)
 	{
 		library->dispose_has_run = TRUE;
 
+		/* Statements must be finalized before the database can be closed */
+		g_hash_table_destroy(library->statements);
 		sqlite3_close(library->db);
 	}
 
@@ -136,10 +148,11 @@ rs_library_has_database_connection(RSLibrary *library)
 {
 	g_return_val_if_fail(RS_IS_LIBRARY(library), FALSE);
 
-  if (library_execute_sql(library->db, "PRAGMA user_version;") == 0)
-    return TRUE;
-  else
-    return FALSE;
+	sqlite3_stmt *stmt = library_statement(library, "PRAGMA user_version;");
+	gboolean connected = (stmt && sqlite3_step(stmt) == SQLITE_ROW);
+	library_statement_done(library, stmt);
+
+	return connected;
 }
 
 gchar *
@@ -199,7 +212,7 @@ library_check_version(sqlite3 *db)
 				filename = (gchar *) sqlite3_column_text(stmt, 0);
 				if (g_file_test(filename, G_FILE_TEST_EXISTS))
 				{
-					identifier = rs_file_checksum(filename);
+					identifier = rs_file_fingerprint(filename);
 					rc = sqlite3_prepare_v2(db, "update library set identifier = ?1 WHERE filename = ?2;", -1, &stmt_update, NULL);
 					rc = sqlite3_bind_text(stmt_update, 1, identifier, -1, SQLITE_TRANSIENT);
 					rc = sqlite3_bind_text(stmt_update, 2, filename, -1, SQLITE_TRANSIENT);
@@ -237,6 +250,21 @@ library_check_version(sqlite3 *db)
 			library_execute_sql(db, "COMMIT;");
 			break;
 
+		case 2:
+			/* Mark all identifiers as old MD5 sums, library_resume_fingerprints()
+			 * replaces them in the background */
+			sqlite3_prepare_v2(db, "alter table library add column fingerprinted integer default 0", -1, &stmt, NULL);
+			rc = sqlite3_step(stmt);
+			library_sqlite_error(db, rc);
+			sqlite3_finalize(stmt);
+			library_set_version(db, version+1);
+			break;
+
+		case 3:
+			library_create_indexes(db);
+			library_set_version(db, version+1);
+			break;
+
 		default:
 			/* We should never hit this */
 			g_warning("Some error occured in library_check_version() - please notify developers");
@@ -248,6 +276,33 @@ library_check_version(sqlite3 *db)
 	}
 }
 
+/* Queue fingerprinting of every photo still identified by an MD5 sum. Rows
+ * are only marked when their fingerprint is stored, so work interrupted by
+ * quitting is picked up again next time */
+static void
+library_resume_fingerprints(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	const gchar *filename;
+	gint id, queued = 0;
+
+	sqlite3_prepare_v2(db, "select id,filename from library where fingerprinted = 0", -1, &stmt, NULL);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		id = (gint) sqlite3_column_int(stmt, 0);
+		filename = (const gchar *) sqlite3_column_text(stmt, 1);
+		if (filename && g_file_test(filename, G_FILE_TEST_EXISTS))
+		{
+			rs_io_idle_read_checksum(filename, -1, got_checksum, GINT_TO_POINTER(id));
+			queued++;
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if (queued)
+		RS_DEBUG(LIBRARY, "Fingerprinting %d photos in the background", queued);
+}
+
 static void
 rs_library_init(RSLibrary *library)
 {
@@ -255,6 +310,9 @@ rs_library_init(RSLibrary *library)
 
 	gchar *database = g_strdup_printf("%s/.rawstudio/library.db", g_get_home_dir());
 
+	g_rec_mutex_init(&library->statement_lock);
+	library->statements = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) sqlite3_finalize);
+
 	/* If unable to create database we exit */
 	if(sqlite3_open(database, &(library->db)))
 	{
@@ -278,8 +336,9 @@ rs_library_init(RSLibrary *library)
 	     some operations are as much as 50 or more times faster with synchronous OFF. " */
 	  library_execute_sql(library->db, "PRAGMA synchronous = OFF;");
 
-	  /* Move our journal to memory, we're not doing banking for the Mafia */
-	  library_execute_sql(library->db, "PRAGMA journal_mode = memory;");
+	  /* Use a write-ahead log, readers don't block writers and most commits
+	     only append to the log */
+	  library_execute_sql(library->db, "PRAGMA journal_mode = WAL;");
 
 	  /* Place temp tables in memory */
 	  library_execute_sql(library->db, "PRAGMA temp_store = memory;");
@@ -288,8 +347,7 @@ rs_library_init(RSLibrary *library)
 	  library_sqlite_error(library->db, rc);
 
 	  library_check_version(library->db);
-
-	  g_mutex_init(&library->id_lock);
+	  library_resume_fingerprints(library->db);
 	}
 }
 
@@ -320,6 +378,95 @@ library_execute_sql(sqlite3 *db, const gchar *sql)
 	return sqlite3_finalize(statement);
 }
 
+/**
+ * Get a prepared statement, the statement is prepared the first time it's
+ * used and kept for later calls. This locks the library until
+ * library_statement_done() is called
+ * @param library A RSLibrary
+ * @param sql The SQL of the statement
+ * @return A statement ready for binding or NULL on errors
+ */
+static sqlite3_stmt *
+library_statement(RSLibrary *library, const gchar *sql)
+{
+	sqlite3_stmt *stmt;
+	gint rc;
+
+	g_rec_mutex_lock(&library->statement_lock);
+
+	stmt = g_hash_table_lookup(library->statements, sql);
+	if (!stmt)
+	{
+		rc = sqlite3_prepare_v2(library->db, sql, -1, &stmt, NULL);
+		library_sqlite_error(library->db, rc);
+		if (stmt)
+			g_hash_table_insert(library->statements, g_strdup(sql), stmt);
+	}
+
+	return stmt;
+}
+
+/**
+ * Reset a statement from library_statement() and unlock the library. Text
+ * returned by sqlite3_column_text() is invalid after this
+ * @param library A RSLibrary
+ * @param stmt A statement returned by library_statement()
+ */
+static void
+library_statement_done(RSLibrary *library, sqlite3_stmt *stmt)
+{
+	if (stmt)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+
+	g_rec_mutex_unlock(&library->statement_lock);
+}
+
+/**
+ * Begin a transaction, transactions can be nested, only the outermost is
+ * committed. Other threads can't use the library until library_commit()
+ * @param library A RSLibrary
+ */
+static void
+library_begin(RSLibrary *library)
+{
+	g_rec_mutex_lock(&library->statement_lock);
+
+	if (library->transaction_depth++ == 0)
+		library_execute_sql(library->db, "BEGIN TRANSACTION;");
+}
+
+static void
+library_commit(RSLibrary *library)
+{
+	if (--library->transaction_depth == 0)
+		library_execute_sql(library->db, "COMMIT;");
+
+	g_rec_mutex_unlock(&library->statement_lock);
+}
+
+static void
+library_create_indexes(sqlite3 *db)
+{
+	GTimer *gt = g_timer_new();
+
+	library_execute_sql(db, "create index if not exists library_filename on library (filename);");
+	library_execute_sql(db, "create index if not exists library_identifier on library (identifier);");
+	library_execute_sql(db, "create index if not exists tags_tagname on tags (tagname);");
+	/* Searches are case insensitive */
+	library_execute_sql(db, "create index if not exists tags_tagname_nocase on tags (tagname collate nocase);");
+	library_execute_sql(db, "create index if not exists phototags_photo_tag on phototags (photo, tag);");
+	/* For finding photos by tag */
+	library_execute_sql(db, "create index if not exists phototags_tag_photo on phototags (tag, photo);");
+	library_execute_sql(db, "analyze;");
+
+	RS_DEBUG(LIBRARY, "Indexes created in %.0fms", g_timer_elapsed(gt, NULL)*1000.0);
+
+	g_timer_destroy(gt);
+}
+
 static void
 library_sqlite_error(sqlite3 *db, gint result)
 {
@@ -337,7 +484,7 @@ library_create_tables(sqlite3 *db)
 	GTimer *gt = g_timer_new();
        
 	/* Create table (library) to hold all known photos */
-	sqlite3_prepare_v2(db, "create table library (id integer primary key, filename varchar(1024), identifier varchar(32))", -1, &stmt, NULL);
+	sqlite3_prepare_v2(db, "create table library (id integer primary key, filename varchar(1024), identifier varchar(32), fingerprinted integer default 0)", -1, &stmt, NULL);
 	rc = sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
 
@@ -367,6 +514,8 @@ library_create_tables(sqlite3 *db)
 		rc = sqlite3_step(stmt);
 		sqlite3_finalize(stmt);
 
+		library_create_indexes(db);
+
 		rc = sqlite3_prepare_v2(db, "select identifier from library", -1, &stmt, NULL);
 		rc = sqlite3_step(stmt);
 		sqlite3_finalize(stmt);
@@ -388,16 +537,15 @@ library_create_tables(sqlite3 *db)
 static gint
 library_find_tag_id(RSLibrary *library, const gchar *tagname)
 {
-	sqlite3 *db = library->db;
 	sqlite3_stmt *stmt;
 	gint rc, tag_id = -1;
 
-	rc = sqlite3_prepare_v2(db, "SELECT id FROM tags WHERE tagname = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "SELECT id FROM tags WHERE tagname = ?1;");
 	rc = sqlite3_bind_text(stmt, 1, tagname, -1, SQLITE_TRANSIENT);
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW)
 		tag_id = sqlite3_column_int(stmt, 0);
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 	return tag_id;
 }
 
@@ -408,13 +556,13 @@ library_find_photo_id(RSLibrary *library, const gchar *photo)
 	sqlite3_stmt *stmt;
 	gint rc, photo_id = -1;
 
-	rc = sqlite3_prepare_v2(db, "SELECT id FROM library WHERE filename = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "SELECT id FROM library WHERE filename = ?1;");
 	rc = sqlite3_bind_text(stmt, 1, photo, -1, SQLITE_TRANSIENT);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW)
 		photo_id = sqlite3_column_int(stmt, 0);
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 	return photo_id;
 }
 
@@ -429,30 +577,27 @@ library_photo_add_tag(RSLibrary *library, const gint photo_id, const gint tag_id
 	if (autotag)
 		autotag_tag = 1;
 
-	g_mutex_lock(&library->id_lock);
-	rc = sqlite3_prepare_v2(db, "INSERT INTO phototags (photo, tag, autotag) VALUES (?1, ?2, ?3);", -1, &stmt, NULL);
+	stmt = library_statement(library, "INSERT INTO phototags (photo, tag, autotag) VALUES (?1, ?2, ?3);");
 	rc = sqlite3_bind_int (stmt, 1, photo_id);
 	rc = sqlite3_bind_int (stmt, 2, tag_id);
 	rc = sqlite3_bind_int (stmt, 3, autotag_tag);
 	rc = sqlite3_step(stmt);
-	g_mutex_unlock(&library->id_lock);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 }
 
 static gboolean
 library_is_photo_tagged(RSLibrary *library, gint photo_id, gint tag_id)
 {
-	sqlite3 *db = library->db;
 	gint rc;
 	sqlite3_stmt *stmt;
 
-	rc = sqlite3_prepare_v2(db, "SELECT * FROM phototags WHERE photo = ?1 AND tag = ?2;", -1, &stmt, NULL);
+	stmt = library_statement(library, "SELECT * FROM phototags WHERE photo = ?1 AND tag = ?2;");
 	rc = sqlite3_bind_int (stmt, 1, photo_id);
 	rc = sqlite3_bind_int (stmt, 2, tag_id);
 	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 
 	if (rc == SQLITE_ROW)
 		return TRUE;
@@ -464,14 +609,14 @@ static void
 got_checksum(const gchar *checksum, gpointer user_data)
 {
 	RSLibrary *library = rs_library_get_singleton();
-	sqlite3 *db = library->db;
 	sqlite3_stmt *stmt;
 
-	sqlite3_prepare_v2(db, "UPDATE LIBRARY SET  identifier=?1 WHERE id=?2;", -1, &stmt, NULL);
+	stmt = library_statement(library, "UPDATE LIBRARY SET  identifier=?1, fingerprinted=?2 WHERE id=?3;");
 	sqlite3_bind_text(stmt, 1, checksum, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_int(stmt, 2, GPOINTER_TO_INT(user_data));
+	sqlite3_bind_int(stmt, 2, checksum ? 1 : 0);
+	sqlite3_bind_int(stmt, 3, GPOINTER_TO_INT(user_data));
 	sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 }
 
 static gint
@@ -482,15 +627,13 @@ library_add_photo(RSLibrary *library, const gchar *filename)
 	gint rc;
 	sqlite3_stmt *stmt;
 
-	g_mutex_lock(&library->id_lock);
-	sqlite3_prepare_v2(db, "INSERT INTO library (filename) VALUES (?1);", -1, &stmt, NULL);
+	stmt = library_statement(library, "INSERT INTO library (filename) VALUES (?1);");
 	rc = sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
 	rc = sqlite3_step(stmt);
 	id = sqlite3_last_insert_rowid(db);
-	g_mutex_unlock(&library->id_lock);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 
 	rs_io_idle_read_checksum(filename, -1, got_checksum, GINT_TO_POINTER(id));
 
@@ -505,15 +648,13 @@ library_add_tag(RSLibrary *library, const gchar *tagname)
 	gint rc;
 	sqlite3_stmt *stmt;
 
-	g_mutex_lock(&library->id_lock);
-	sqlite3_prepare_v2(db, "INSERT INTO tags (tagname) VALUES (?1);", -1, &stmt, NULL);
+	stmt = library_statement(library, "INSERT INTO tags (tagname) VALUES (?1);");
 	rc = sqlite3_bind_text(stmt, 1, tagname, -1, SQLITE_TRANSIENT);
 	rc = sqlite3_step(stmt);
 	id = sqlite3_last_insert_rowid(db);
-	g_mutex_unlock(&library->id_lock);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 
 	return id;
 }
@@ -525,13 +666,13 @@ library_delete_photo(RSLibrary *library, gint photo_id)
 	sqlite3_stmt *stmt;
 	gint rc;
 
-	rc = sqlite3_prepare_v2(db, "DELETE FROM library WHERE id = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "DELETE FROM library WHERE id = ?1;");
 	rc = sqlite3_bind_int(stmt, 1, photo_id);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 }
 
 static void 
@@ -541,13 +682,13 @@ library_delete_tag(RSLibrary *library, gint tag_id)
 	sqlite3_stmt *stmt;
 	gint rc;
 
-	rc = sqlite3_prepare_v2(db, "DELETE FROM library WHERE filename = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "DELETE FROM library WHERE filename = ?1;");
 	rc = sqlite3_bind_int(stmt, 1, tag_id);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 }
 
 static void 
@@ -557,13 +698,13 @@ library_photo_delete_tags(RSLibrary *library, gint photo_id)
 	sqlite3_stmt *stmt;
 	gint rc;
 
-	rc = sqlite3_prepare_v2(db, "DELETE FROM phototags WHERE photo = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "DELETE FROM phototags WHERE photo = ?1;");
 	rc = sqlite3_bind_int(stmt, 1, photo_id);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 }
 
 static void
@@ -573,26 +714,25 @@ library_tag_delete_photos(RSLibrary *library, gint tag_id)
 	sqlite3_stmt *stmt;
 	gint rc;
 
-	rc = sqlite3_prepare_v2(db, "DELETE FROM phototags WHERE tag = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "DELETE FROM phototags WHERE tag = ?1;");
 	rc = sqlite3_bind_int(stmt, 1, tag_id);
 	library_sqlite_error(db, rc);
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE)
 		library_sqlite_error(db, rc);
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 }
 
 static gboolean
 library_tag_is_used(RSLibrary *library, gint tag_id)
 {
-	sqlite3 *db = library->db;
 	gint rc;
 	sqlite3_stmt *stmt;
 
-	rc = sqlite3_prepare_v2(db, "SELECT * FROM phototags WHERE tag = ?1;", -1, &stmt, NULL);
+	stmt = library_statement(library, "SELECT * FROM phototags WHERE tag = ?1;");
 	rc = sqlite3_bind_int (stmt, 1, tag_id);
 	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 
 	if (rc == SQLITE_ROW)
 		return TRUE;
@@ -658,16 +798,16 @@ rs_library_photo_add_tag(RSLibrary *library, const gchar *filename, gint tag_id,
 		return;
 	}
 
+	library_begin(library);
+
 	photo_id = library_find_photo_id(library, filename);
 	if (photo_id == -1)
-	{
 		g_warning("Photo not known...");
-		return;
-	}
-
-	if (!library_is_photo_tagged(library, photo_id, tag_id))
+	else if (!library_is_photo_tagged(library, photo_id, tag_id))
 		library_photo_add_tag(library, photo_id, tag_id, autotag);
 
+	library_commit(library);
+
 	return;
 }
 
@@ -734,58 +874,43 @@ rs_library_search(RSLibrary *library, const gchar *needle)
 	if (!rs_library_has_database_connection(library)) return NULL;
 
 	sqlite3_stmt *stmt;
-	gint rc;
+	gint rc = SQLITE_OK;
 	sqlite3 *db = library->db;
-	gchar *tag;
 	gint n, num_tags;
 	GList *photos = NULL;
 	GTimer *gt = g_timer_new();
 	gchar *filename;
 	gchar **needle_parts;
-
-	/* Create filter table */
-	sqlite3_prepare_v2(db, "create temp table filter (photo integer)", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
+	GString *sql;
 
 	needle_parts = g_strsplit_set(needle, " ", 0);
 	num_tags = g_strv_length(needle_parts);
 
-	/* Populate filter */
-	for (n = 0; n < num_tags; n++)
+	if (num_tags == 0)
 	{
-		tag = needle_parts[n];
-
-		g_mutex_lock(&library->id_lock);
-		sqlite3_prepare_v2(db, "insert into filter select phototags.photo from phototags, tags where phototags.tag = tags.id and lower(tags.tagname) = lower(?1) ;", -1, &stmt, NULL);
-		rc = sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_TRANSIENT);
-		rc = sqlite3_step(stmt);
-		sqlite3_finalize(stmt);
-		g_mutex_unlock(&library->id_lock);
+		g_strfreev(needle_parts);
+		g_timer_destroy(gt);
+		return NULL;
 	}
 
-	g_strfreev(needle_parts);
-
-	RS_DEBUG(LIBRARY, "Filter table populated @%.0fms", g_timer_elapsed(gt, NULL)*1000.0);
+	/* Photos having all tags, the statement is the same for all searches
+	   with the same number of tags */
+	sql = g_string_new("select filename from library where id in (");
+	for (n = 0; n < num_tags; n++)
+	{
+		if (n > 0)
+			g_string_append(sql, " intersect ");
+		g_string_append_printf(sql, "select photo from phototags where tag in (select id from tags where tagname = ?%d collate nocase)", n+1);
+	}
+	g_string_append(sql, ") order by filename;");
 
-	/* Create result table */
-	sqlite3_prepare_v2(db, "create temp table result (photo integer, count integer)", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
+	stmt = library_statement(library, sql->str);
+	g_string_free(sql, TRUE);
 
-	/* Populate result table */
-	g_mutex_lock(&library->id_lock);
-	sqlite3_prepare_v2(db, "insert into result select photo, count(photo) from filter group by photo;", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	g_mutex_unlock(&library->id_lock);
-	library_sqlite_error(db, rc);
+	for (n = 0; n < num_tags; n++)
+		rc = sqlite3_bind_text(stmt, n+1, needle_parts[n], -1, SQLITE_TRANSIENT);
 
-	/* Get filename */
-	sqlite3_prepare_v2(db, "select library.filename from library,result where library.id = result.photo and result.count = ?1 order by library.filename;", -1, &stmt, NULL);
-        rc = sqlite3_bind_int(stmt, 1, num_tags);
+	g_strfreev(needle_parts);
 
 	gint count = 0;
 	while (sqlite3_step(stmt) == SQLITE_ROW && count < MAX_SEARCH_RESULTS)
@@ -796,22 +921,10 @@ rs_library_search(RSLibrary *library, const gchar *needle)
 			photos = g_list_append(photos, filename);
 			count++;
 		}
-	}				       
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
-
-	RS_DEBUG(LIBRARY, "Search done @%.0fms", g_timer_elapsed(gt, NULL)*1000.0);
-
-	/* Empty filter */
-	sqlite3_prepare_v2(db, "delete from filter;", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	library_sqlite_error(db, rc);
-
-	/* Empty result */
-	sqlite3_prepare_v2(db, "delete from result;", -1, &stmt, NULL);
-	rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+		else
+			g_free(filename);
+	}
+	library_statement_done(library, stmt);
 	library_sqlite_error(db, rc);
 
 	RS_DEBUG(LIBRARY, "Search for '%s' in library took %.0fms seconds", needle, g_timer_elapsed(gt, NULL)*1000.0);
@@ -915,7 +1028,7 @@ library_photo_default_tags(RSLibrary *library, const gint photo_id, RSMetadata *
 	}
 
 	gint i, j;
-	library_execute_sql(library->db, "BEGIN TRANSACTION;");
+	library_begin(library);
 	gint *used_tags = g_malloc(g_list_length(tags) * sizeof(gint));
 	for(i = 0; i < g_list_length(tags); i++)
 	{
@@ -934,7 +1047,7 @@ library_photo_default_tags(RSLibrary *library, const gint photo_id, RSMetadata *
 		g_free(tag);
 	}
 	g_free(used_tags);
-	library_execute_sql(library->db, "COMMIT;");
+	library_commit(library);
 	g_list_free(tags);
 }
 
@@ -953,17 +1066,17 @@ rs_library_photo_tags(RSLibrary *library, const gchar *photo, const gboolean aut
 
 	if (autotag)
 	{
-		sqlite3_prepare_v2(db, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1;", -1, &stmt, NULL);
+		stmt = library_statement(library, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1;");
 		rc = sqlite3_bind_text(stmt, 1, photo, -1, NULL);
 	}
 	else
 	{
-		sqlite3_prepare_v2(db, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1 and phototags.autotag = 0;", -1, &stmt, NULL);
+		stmt = library_statement(library, "select tags.tagname from library,phototags,tags WHERE library.id=phototags.photo and phototags.tag=tags.id and library.filename = ?1 and phototags.autotag = 0;");
 		rc = sqlite3_bind_text(stmt, 1, photo, -1, NULL);
 	}
 	while (sqlite3_step(stmt) == SQLITE_ROW)
 		tags = g_list_append(tags, g_strdup((gchar *) sqlite3_column_text(stmt, 0)));
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 	library_sqlite_error(db, rc);
 
 	return tags;
@@ -982,14 +1095,14 @@ rs_library_find_tag(RSLibrary *library, const gchar *tag)
 	sqlite3 *db = library->db;
 	GList *tags = NULL;
 
-	rc = sqlite3_prepare_v2(db, "select tags.tagname from tags WHERE tags.tagname like ?1 order by tags.tagname;", -1, &stmt, NULL);
+	stmt = library_statement(library, "select tags.tagname from tags WHERE tags.tagname like ?1 order by tags.tagname;");
 	gchar *like = g_strdup_printf("%%%s%%", tag);
         rc = sqlite3_bind_text(stmt, 1, like, -1, NULL);
 	library_sqlite_error(db, rc);
 	
 	while (sqlite3_step(stmt) == SQLITE_ROW)
 		tags = g_list_append(tags, g_strdup((gchar *) sqlite3_column_text(stmt, 0)));
-	sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 	library_sqlite_error(db, rc);
 
 	g_free(like);
@@ -1018,12 +1131,17 @@ rs_library_add_photo_with_metadata(RSLibrary *library, const gchar *photo, RSMet
 
 	RS_DEBUG(LIBRARY, "Adding '%s' to library", photo);
 
+	/* The photo and its tags are written in one transaction */
+	library_begin(library);
+
 	/* Bail out if we already know the photo */
-	if (library_find_photo_id(library, photo) > -1)
-		return;
+	if (library_find_photo_id(library, photo) == -1)
+	{
+		gint photo_id = library_add_photo(library, photo);
+		library_photo_default_tags(library, photo_id, metadata);
+	}
 
-	gint photo_id = library_add_photo(library, photo);
-	library_photo_default_tags(library, photo_id, metadata);
+	library_commit(library);
 }
 
 static GMutex backup_lock;
@@ -1078,10 +1196,16 @@ rs_library_backup_tags(RSLibrary *library, const gchar *photo_filename)
 	xmlTextWriterStartElement(writer, BAD_CAST "rawstudio-tags");
 	xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "version", "%d", LIBRARY_VERSION);
 
-	const gchar *temp = g_strdup_printf("%s/%%", directory);
-	rc = sqlite3_prepare_v2(db, "select library.filename,library.identifier,tags.tagname,phototags.autotag from library,phototags,tags where library.filename like ?1 and phototags.photo = library.id and tags.id = phototags.tag order by library.filename;", -1, &stmt, NULL);
-	rc = sqlite3_bind_text(stmt, 1, temp, -1, SQLITE_TRANSIENT);
+	/* Everything from "directory/" up to "directory0" - '0' follows '/' - is
+	   inside directory. Unlike LIKE, this can use the filename index */
+	gchar *first = g_strdup_printf("%s/", directory);
+	gchar *last = g_strdup_printf("%s0", directory);
+	stmt = library_statement(library, "select library.filename,library.identifier,tags.tagname,phototags.autotag from library,phototags,tags where library.filename >= ?1 and library.filename < ?2 and phototags.photo = library.id and tags.id = phototags.tag order by library.filename;");
+	rc = sqlite3_bind_text(stmt, 1, first, -1, SQLITE_TRANSIENT);
+	rc = sqlite3_bind_text(stmt, 2, last, -1, SQLITE_TRANSIENT);
 	library_sqlite_error(db, rc);
+	g_free(first);
+	g_free(last);
 	while (sqlite3_step(stmt) == SQLITE_ROW)
 	{
 		t_filename = g_path_get_basename((gchar *) sqlite3_column_text(stmt, 0));
@@ -1105,7 +1229,7 @@ rs_library_backup_tags(RSLibrary *library, const gchar *photo_filename)
 	}
 	xmlTextWriterEndElement(writer);
 
-	rc = sqlite3_finalize(stmt);
+	library_statement_done(library, stmt);
 
 	xmlTextWriterEndDocument(writer);
 	xmlFreeTextWriter(writer);
@@ -1181,6 +1305,9 @@ rs_library_restore_tags(const gchar *directory)
 		}
 	}
 
+	/* All photos and tags are added in one transaction */
+	library_begin(library);
+
 	cur = cur->xmlChildrenNode;
 	while(cur)
 	{
@@ -1226,6 +1353,8 @@ rs_library_restore_tags(const gchar *directory)
 		cur = cur->next;
 	}
 
+	library_commit(library);
+
 	g_free(dotdir);
 	g_free(xmlfile);
 	xmlFreeDoc(doc);
@@ -0,0 +1,737 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h> /* flock() */
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "rs-metadata-pack.h"
+
+/*
+ * File layout, all values in host byte order:
+ *
+ *   PackHeader
+ *   PackRecord, name, strings, thumbnail pixels, padding to 8 bytes
+ *   PackRecord, ...
+ *
+ * A record with size -1 marks a photo as deleted. The last record for a
+ * name wins. A truncated record at the end of the file (from a crash while
+ * appending) ends the scan and is cut off by the next append.
+ *
+ * Several processes may share a pack. Appending and compacting is done
+ * holding an exclusive flock() on the pack, scanning holds a shared one.
+ * Compacting replaces the file, so a process that got the lock on a file
+ * no longer in place must open the pack again. Each process rescans the
+ * pack when its size or inode is not what it last saw.
+ */
+
+#define PACK_MAGIC "RSMP"
+#define PACK_VERSION 1
+#define PACK_RECORD_MAGIC 0x52534d52 /* "RSMR" */
+#define PACK_BYTEORDER 0x01020304
+
+/* Don't bother compacting packs smaller than this */
+#define PACK_COMPACT_MIN (256*1024)
+
+#define ALIGN8(x) (((x)+7) & ~((gsize)7))
+
+typedef struct {
+	gchar magic[4];
+	guint32 version;
+	guint32 byteorder;
+	guint32 record_size;
+} PackHeader;
+
+typedef struct {
+	guint32 magic;
+	guint32 length; /* Whole record including this header, multiple of 8 */
+
+	/* The photo as it was when the record was written */
+	gint64 mtime;
+	gint64 size;
+
+	gdouble cam_mul[4];
+	gdouble contrast;
+	gdouble saturation;
+	gdouble color_tone;
+	gdouble lens_min_focal;
+	gdouble lens_max_focal;
+	gdouble lens_min_aperture;
+	gdouble lens_max_aperture;
+	gfloat aperture;
+	gfloat exposurebias;
+	gfloat shutterspeed;
+	gint32 make;
+	gint32 timestamp;
+	gint32 lens_id;
+	guint16 orientation;
+	guint16 iso;
+	gint16 focallength;
+
+	/* String lengths including the terminating zero, 0 means NULL */
+	guint16 name_length;
+	guint16 make_ascii_length;
+	guint16 model_ascii_length;
+	guint16 time_ascii_length;
+	guint16 fixed_lens_identifier_length;
+
+	/* Thumbnail as raw 8 bit RGB(A) pixels, thumb_length 0 means none */
+	guint32 thumb_width;
+	guint32 thumb_height;
+	guint32 thumb_rowstride;
+	guint16 thumb_channels;
+	guint16 thumb_has_alpha;
+	guint32 thumb_length;
+	guint32 pad;
+} PackRecord;
+
+typedef struct {
+	gchar *filename;
+	GMappedFile *map;
+	GHashTable *offsets; /* basename -> record offset */
+	gsize length;        /* End of the last valid record */
+	gsize dead;          /* Bytes used by replaced or deleted records */
+
+	/* The file as it was when we last read or wrote it */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+} MetadataPack;
+
+/* Protects the registry and every pack in it */
+static GMutex lock;
+static GHashTable *packs = NULL; /* dotdir -> MetadataPack */
+
+static void
+pack_unmap(MetadataPack *pack)
+{
+	if (pack->map)
+		g_mapped_file_unref(pack->map);
+	pack->map = NULL;
+}
+
+/* Forget everything about the file, it is gone or unreadable */
+static void
+pack_forget(MetadataPack *pack)
+{
+	pack_unmap(pack);
+	g_hash_table_remove_all(pack->offsets);
+	pack->length = 0;
+	pack->dead = 0;
+	pack->dev = 0;
+	pack->ino = 0;
+	pack->size = 0;
+}
+
+static gboolean
+pack_is_file(MetadataPack *pack, const struct stat *st)
+{
+	return (st->st_dev == pack->dev && st->st_ino == pack->ino);
+}
+
+/* Make sure the map covers all known records, after we appended some */
+static gboolean
+pack_map(MetadataPack *pack)
+{
+	struct stat st;
+	gint fd;
+
+	if (pack->map && g_mapped_file_get_length(pack->map) >= pack->length)
+		return TRUE;
+
+	pack_unmap(pack);
+	fd = g_open(pack->filename, O_RDONLY, 0);
+	if (fd < 0)
+		return FALSE;
+
+	/* Our offsets are only good for the file we scanned */
+	if (fstat(fd, &st) == 0 && pack_is_file(pack, &st))
+		pack->map = g_mapped_file_new_from_fd(fd, FALSE, NULL);
+	close(fd);
+
+	return (pack->map && g_mapped_file_get_length(pack->map) >= pack->length);
+}
+
+static const PackRecord *
+pack_get_record(MetadataPack *pack, gsize offset)
+{
+	return (const PackRecord *) (g_mapped_file_get_contents(pack->map) + offset);
+}
+
+static const gchar *
+record_get_name(const PackRecord *record)
+{
+	return ((const gchar *) record) + sizeof(PackRecord);
+}
+
+/* Read all records and build the name index, fd must be open for reading
+ * and locked */
+static void
+pack_scan(MetadataPack *pack, gint fd)
+{
+	const PackHeader *header;
+	const gchar *contents;
+	struct stat st;
+	gsize length;
+	gsize offset;
+
+	pack_forget(pack);
+
+	if (fstat(fd, &st) != 0)
+		return;
+	pack->dev = st.st_dev;
+	pack->ino = st.st_ino;
+	pack->size = st.st_size;
+
+	pack->map = g_mapped_file_new_from_fd(fd, FALSE, NULL);
+	if (!pack->map)
+		return;
+
+	contents = g_mapped_file_get_contents(pack->map);
+	length = g_mapped_file_get_length(pack->map);
+
+	/* Anything we can't read will be overwritten by the next save */
+	if (length < sizeof(PackHeader))
+		return;
+	header = (const PackHeader *) contents;
+	if (memcmp(header->magic, PACK_MAGIC, 4) != 0
+		|| header->version != PACK_VERSION
+		|| header->byteorder != PACK_BYTEORDER
+		|| header->record_size != sizeof(PackRecord))
+		return;
+
+	offset = sizeof(PackHeader);
+	while (offset + sizeof(PackRecord) <= length)
+	{
+		const PackRecord *record = (const PackRecord *) (contents + offset);
+		gpointer old;
+
+		if (record->magic != PACK_RECORD_MAGIC
+			|| record->length < sizeof(PackRecord) + record->name_length
+			|| (record->length & 7)
+			|| offset + record->length > length
+			|| record->name_length == 0
+			|| record_get_name(record)[record->name_length-1] != '\0')
+			break;
+
+		if (g_hash_table_lookup_extended(pack->offsets, record_get_name(record), NULL, &old))
+			pack->dead += pack_get_record(pack, GPOINTER_TO_SIZE(old))->length;
+
+		if (record->size < 0)
+		{
+			g_hash_table_remove(pack->offsets, record_get_name(record));
+			pack->dead += record->length;
+		}
+		else
+			g_hash_table_insert(pack->offsets, g_strdup(record_get_name(record)), GSIZE_TO_POINTER(offset));
+
+		offset += record->length;
+	}
+
+	pack->length = offset;
+}
+
+/* Rescan the pack if another process has appended to or replaced it */
+static void
+pack_refresh(MetadataPack *pack)
+{
+	struct stat st;
+	gint fd;
+
+	if (g_stat(pack->filename, &st) != 0)
+	{
+		pack_forget(pack);
+		return;
+	}
+
+	if (pack_is_file(pack, &st) && st.st_size == pack->size)
+		return;
+
+	fd = g_open(pack->filename, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		pack_forget(pack);
+		return;
+	}
+	if (flock(fd, LOCK_SH) == 0)
+		pack_scan(pack, fd);
+	else
+		pack_forget(pack);
+	close(fd);
+}
+
+static MetadataPack *
+pack_get(const gchar *dotdir)
+{
+	MetadataPack *pack;
+
+	if (!packs)
+		packs = g_hash_table_new(g_str_hash, g_str_equal);
+
+	pack = g_hash_table_lookup(packs, dotdir);
+	if (!pack)
+	{
+		pack = g_new0(MetadataPack, 1);
+		pack->filename = g_build_filename(dotdir, DOTDIR_METAPACK, NULL);
+		pack->offsets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_insert(packs, g_strdup(dotdir), pack);
+	}
+
+	pack_refresh(pack);
+
+	return pack;
+}
+
+/* Looks up the pack for the directory holding filename, returns NULL if there's no cache directory */
+static MetadataPack *
+pack_get_for_file(const gchar *filename, gchar **basename)
+{
+	MetadataPack *pack;
+	gchar *dotdir;
+
+	dotdir = rs_dotdir_get(filename);
+	if (!dotdir)
+		return NULL;
+
+	pack = pack_get(dotdir);
+	*basename = g_path_get_basename(filename);
+	g_free(dotdir);
+
+	return pack;
+}
+
+static gboolean
+pack_write(gint fd, const void *data, gsize length)
+{
+	while (length > 0)
+	{
+		gssize written = write(fd, data, length);
+		if (written <= 0)
+			return FALSE;
+		data = ((const gchar *) data) + written;
+		length -= written;
+	}
+	return TRUE;
+}
+
+static gboolean
+pack_write_header(gint fd)
+{
+	PackHeader header;
+
+	memcpy(header.magic, PACK_MAGIC, 4);
+	header.version = PACK_VERSION;
+	header.byteorder = PACK_BYTEORDER;
+	header.record_size = sizeof(PackRecord);
+
+	return pack_write(fd, &header, sizeof(header));
+}
+
+/* Rewrite the pack with only the live records */
+static void
+pack_compact(MetadataPack *pack)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gchar *tmp_filename;
+	gsize offset = sizeof(PackHeader);
+	gint fd;
+	gboolean ok;
+
+	/* The exclusive lock on the old file must be held by the caller */
+	if (!pack_map(pack))
+		return;
+
+	tmp_filename = g_strconcat(pack->filename, ".tmp", NULL);
+	fd = g_open(tmp_filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd < 0)
+	{
+		g_free(tmp_filename);
+		return;
+	}
+
+	ok = pack_write_header(fd);
+	g_hash_table_iter_init(&iter, pack->offsets);
+	while (ok && g_hash_table_iter_next(&iter, &key, &value))
+	{
+		const PackRecord *record = pack_get_record(pack, GPOINTER_TO_SIZE(value));
+		ok = pack_write(fd, record, record->length);
+		offset += record->length;
+	}
+	ok = (close(fd) == 0) && ok;
+
+	if (ok && g_rename(tmp_filename, pack->filename) == 0)
+	{
+		RS_DEBUG(PERFORMANCE, "Compacted %s from %"G_GSIZE_FORMAT" to %"G_GSIZE_FORMAT" bytes", pack->filename, pack->length, offset);
+		pack_refresh(pack);
+	}
+	else
+		g_unlink(tmp_filename);
+
+	g_free(tmp_filename);
+}
+
+/* Open the pack for appending and lock it. Compacting replaces the file,
+ * if that happened while we waited for the lock, open the new one */
+static gint
+pack_open_locked(MetadataPack *pack)
+{
+	struct stat fd_st, path_st;
+	gint tries;
+	gint fd;
+
+	for(tries = 0; tries < 10; tries++)
+	{
+		fd = g_open(pack->filename, O_RDWR|O_CREAT|O_APPEND, 0666);
+		if (fd < 0)
+			return -1;
+
+		if (flock(fd, LOCK_EX) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+		if (fstat(fd, &fd_st) == 0 && g_stat(pack->filename, &path_st) == 0
+			&& fd_st.st_dev == path_st.st_dev && fd_st.st_ino == path_st.st_ino)
+			return fd;
+
+		close(fd);
+	}
+
+	return -1;
+}
+
+/* Append a record to the pack, record->length must be set */
+static void
+pack_append(MetadataPack *pack, const gchar *name, PackRecord *record)
+{
+	struct stat st;
+	gpointer old;
+	gint fd;
+
+	fd = pack_open_locked(pack);
+	if (fd < 0)
+		return;
+
+	/* Pick up what other processes wrote since we last looked */
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return;
+	}
+	if (!pack_is_file(pack, &st) || st.st_size != pack->size)
+		pack_scan(pack, fd);
+
+	if (pack->length < sizeof(PackHeader))
+	{
+		/* New or unreadable pack, start over */
+		pack_forget(pack);
+		if (ftruncate(fd, 0) != 0 || !pack_write_header(fd))
+		{
+			close(fd);
+			return;
+		}
+		pack->length = sizeof(PackHeader);
+	}
+	else if ((gsize) pack->size > pack->length && ftruncate(fd, pack->length) != 0)
+	{
+		/* Cut off a record left over from a crash, appending goes after it */
+		close(fd);
+		return;
+	}
+
+	if (!pack_write(fd, record, record->length) || fstat(fd, &st) != 0)
+	{
+		/* The next scan will stop before whatever made it to disk */
+		close(fd);
+		pack->size = -1;
+		return;
+	}
+
+	if (g_hash_table_lookup_extended(pack->offsets, name, NULL, &old) && pack_map(pack))
+		pack->dead += pack_get_record(pack, GPOINTER_TO_SIZE(old))->length;
+
+	if (record->size < 0)
+	{
+		g_hash_table_remove(pack->offsets, name);
+		pack->dead += record->length;
+	}
+	else
+		g_hash_table_insert(pack->offsets, g_strdup(name), GSIZE_TO_POINTER(pack->length));
+
+	pack->length += record->length;
+	pack->dev = st.st_dev;
+	pack->ino = st.st_ino;
+	pack->size = st.st_size;
+
+	if (pack->length > PACK_COMPACT_MIN && pack->dead > pack->length/2)
+		pack_compact(pack);
+
+	/* Closing drops the lock */
+	close(fd);
+}
+
+static gchar *
+record_string(const gchar **pos, guint16 length)
+{
+	gchar *ret = NULL;
+
+	if (length > 0)
+		ret = g_strndup(*pos, length-1);
+	*pos += length;
+
+	return ret;
+}
+
+static void
+pixels_free(guchar *pixels, gpointer data)
+{
+	g_free(pixels);
+}
+
+gboolean
+rs_metadata_pack_load(RSMetadata *metadata, const gchar *filename)
+{
+	MetadataPack *pack;
+	const PackRecord *record;
+	const gchar *pos;
+	guchar *pixels;
+	gchar *basename = NULL;
+	gpointer offset;
+	struct stat st;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(RS_IS_METADATA(metadata), FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	if (g_stat(filename, &st) != 0)
+		return FALSE;
+
+	g_mutex_lock(&lock);
+
+	pack = pack_get_for_file(filename, &basename);
+	if (!pack
+		|| !g_hash_table_lookup_extended(pack->offsets, basename, NULL, &offset)
+		|| !pack_map(pack)
+		|| GPOINTER_TO_SIZE(offset) + sizeof(PackRecord) > g_mapped_file_get_length(pack->map))
+		goto out;
+
+	record = pack_get_record(pack, GPOINTER_TO_SIZE(offset));
+
+	/* Make sure this is the record we're looking for */
+	if (record->magic != PACK_RECORD_MAGIC
+		|| GPOINTER_TO_SIZE(offset) + record->length > g_mapped_file_get_length(pack->map)
+		|| record->name_length != strlen(basename) + 1
+		|| record->length < sizeof(PackRecord) + record->name_length
+		|| memcmp(record_get_name(record), basename, record->name_length) != 0)
+		goto out;
+
+	/* The photo has changed since it was cached */
+	if (record->mtime != (gint64) st.st_mtime || record->size != (gint64) st.st_size)
+		goto out;
+
+	/* Make sure strings and pixels are inside the record */
+	if (sizeof(PackRecord) + record->name_length + record->make_ascii_length
+		+ record->model_ascii_length + record->time_ascii_length
+		+ record->fixed_lens_identifier_length + record->thumb_length > record->length)
+		goto out;
+
+	/* Like the XML cache, we need a thumbnail to consider the photo cached */
+	if (record->thumb_length == 0 || record->thumb_height == 0
+		|| (gsize) record->thumb_rowstride * (record->thumb_height - 1)
+			+ (gsize) record->thumb_width * record->thumb_channels > record->thumb_length)
+		goto out;
+
+	metadata->make = record->make;
+	metadata->timestamp = record->timestamp;
+	metadata->orientation = record->orientation;
+	metadata->aperture = record->aperture;
+	metadata->exposurebias = record->exposurebias;
+	metadata->iso = record->iso;
+	metadata->shutterspeed = record->shutterspeed;
+	memcpy(metadata->cam_mul, record->cam_mul, sizeof(metadata->cam_mul));
+	metadata->contrast = record->contrast;
+	metadata->saturation = record->saturation;
+	metadata->color_tone = record->color_tone;
+	metadata->focallength = record->focallength;
+	metadata->lens_id = record->lens_id;
+	metadata->lens_min_focal = record->lens_min_focal;
+	metadata->lens_max_focal = record->lens_max_focal;
+	metadata->lens_min_aperture = record->lens_min_aperture;
+	metadata->lens_max_aperture = record->lens_max_aperture;
+
+	pos = record_get_name(record) + record->name_length;
+	metadata->make_ascii = record_string(&pos, record->make_ascii_length);
+	metadata->model_ascii = record_string(&pos, record->model_ascii_length);
+	metadata->time_ascii = record_string(&pos, record->time_ascii_length);
+	metadata->fixed_lens_identifier = record_string(&pos, record->fixed_lens_identifier_length);
+
+	pixels = g_malloc(record->thumb_length);
+	memcpy(pixels, pos, record->thumb_length);
+	metadata->thumbnail = gdk_pixbuf_new_from_data(pixels, GDK_COLORSPACE_RGB,
+		record->thumb_has_alpha, 8, record->thumb_width, record->thumb_height,
+		record->thumb_rowstride, pixels_free, NULL);
+
+	ret = (metadata->thumbnail != NULL);
+
+out:
+	g_mutex_unlock(&lock);
+	g_free(basename);
+
+	return ret;
+}
+
+void
+rs_metadata_pack_save(RSMetadata *metadata, const gchar *filename)
+{
+	MetadataPack *pack;
+	PackRecord *record;
+	GdkPixbuf *thumbnail;
+	gchar *basename = NULL;
+	gchar *pos;
+	gsize thumb_length = 0;
+	gsize length;
+	struct stat st;
+
+	g_return_if_fail(RS_IS_METADATA(metadata));
+	g_return_if_fail(filename != NULL);
+
+	if (g_stat(filename, &st) != 0)
+		return;
+
+	thumbnail = metadata->thumbnail;
+	if (thumbnail && (gdk_pixbuf_get_colorspace(thumbnail) != GDK_COLORSPACE_RGB
+		|| gdk_pixbuf_get_bits_per_sample(thumbnail) != 8))
+		thumbnail = NULL;
+
+	if (thumbnail)
+		thumb_length = gdk_pixbuf_get_rowstride(thumbnail) * (gdk_pixbuf_get_height(thumbnail) - 1)
+			+ gdk_pixbuf_get_width(thumbnail) * gdk_pixbuf_get_n_channels(thumbnail);
+
+	basename = g_path_get_basename(filename);
+
+#define STRLEN(s) ((s) ? strlen(s) + 1 : 0)
+	length = ALIGN8(sizeof(PackRecord)
+		+ STRLEN(basename)
+		+ STRLEN(metadata->make_ascii)
+		+ STRLEN(metadata->model_ascii)
+		+ STRLEN(metadata->time_ascii)
+		+ STRLEN(metadata->fixed_lens_identifier)
+		+ thumb_length);
+
+	record = g_malloc0(length);
+	record->magic = PACK_RECORD_MAGIC;
+	record->length = length;
+	record->mtime = st.st_mtime;
+	record->size = st.st_size;
+	memcpy(record->cam_mul, metadata->cam_mul, sizeof(record->cam_mul));
+	record->contrast = metadata->contrast;
+	record->saturation = metadata->saturation;
+	record->color_tone = metadata->color_tone;
+	record->lens_min_focal = metadata->lens_min_focal;
+	record->lens_max_focal = metadata->lens_max_focal;
+	record->lens_min_aperture = metadata->lens_min_aperture;
+	record->lens_max_aperture = metadata->lens_max_aperture;
+	record->aperture = metadata->aperture;
+	record->exposurebias = metadata->exposurebias;
+	record->shutterspeed = metadata->shutterspeed;
+	record->make = metadata->make;
+	record->timestamp = metadata->timestamp;
+	record->lens_id = metadata->lens_id;
+	record->orientation = metadata->orientation;
+	record->iso = metadata->iso;
+	record->focallength = metadata->focallength;
+	record->name_length = STRLEN(basename);
+	record->make_ascii_length = STRLEN(metadata->make_ascii);
+	record->model_ascii_length = STRLEN(metadata->model_ascii);
+	record->time_ascii_length = STRLEN(metadata->time_ascii);
+	record->fixed_lens_identifier_length = STRLEN(metadata->fixed_lens_identifier);
+#undef STRLEN
+
+	pos = (gchar *) record + sizeof(PackRecord);
+	if (basename)
+		pos = g_stpcpy(pos, basename) + 1;
+	if (metadata->make_ascii)
+		pos = g_stpcpy(pos, metadata->make_ascii) + 1;
+	if (metadata->model_ascii)
+		pos = g_stpcpy(pos, metadata->model_ascii) + 1;
+	if (metadata->time_ascii)
+		pos = g_stpcpy(pos, metadata->time_ascii) + 1;
+	if (metadata->fixed_lens_identifier)
+		pos = g_stpcpy(pos, metadata->fixed_lens_identifier) + 1;
+
+	if (thumbnail)
+	{
+		record->thumb_width = gdk_pixbuf_get_width(thumbnail);
+		record->thumb_height = gdk_pixbuf_get_height(thumbnail);
+		record->thumb_rowstride = gdk_pixbuf_get_rowstride(thumbnail);
+		record->thumb_channels = gdk_pixbuf_get_n_channels(thumbnail);
+		record->thumb_has_alpha = gdk_pixbuf_get_has_alpha(thumbnail);
+		record->thumb_length = thumb_length;
+		memcpy(pos, gdk_pixbuf_get_pixels(thumbnail), thumb_length);
+	}
+
+	g_free(basename);
+	basename = NULL;
+
+	g_mutex_lock(&lock);
+	pack = pack_get_for_file(filename, &basename);
+	if (pack)
+		pack_append(pack, basename, record);
+	g_mutex_unlock(&lock);
+
+	g_free(basename);
+	g_free(record);
+}
+
+void
+rs_metadata_pack_delete(const gchar *filename)
+{
+	MetadataPack *pack;
+	PackRecord *record;
+	gchar *basename = NULL;
+	gsize length;
+
+	g_return_if_fail(filename != NULL);
+
+	g_mutex_lock(&lock);
+
+	pack = pack_get_for_file(filename, &basename);
+	if (pack && g_hash_table_lookup_extended(pack->offsets, basename, NULL, NULL))
+	{
+		length = ALIGN8(sizeof(PackRecord) + strlen(basename) + 1);
+		record = g_malloc0(length);
+		record->magic = PACK_RECORD_MAGIC;
+		record->length = length;
+		record->size = -1;
+		record->name_length = strlen(basename) + 1;
+		strcpy((gchar *) record + sizeof(PackRecord), basename);
+
+		pack_append(pack, basename, record);
+		g_free(record);
+	}
+
+	g_mutex_unlock(&lock);
+	g_free(basename);
+}
@@ -0,0 +1,57 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_METADATA_PACK_H
+#define RS_METADATA_PACK_H
+
+#include <glib.h>
+#include "rs-metadata.h"
+
+G_BEGIN_DECLS
+
+/* One file per cache directory holding metadata and decoded thumbnails for
+ * all photos in it. Records are only ever appended, newer records replace
+ * older ones for the same photo, and the file is compacted when most of it
+ * is stale */
+#define DOTDIR_METAPACK "metadata.pack"
+
+/**
+ * Load metadata and thumbnail for a photo from the pack in its cache directory
+ * @param metadata A RSMetadata to fill
+ * @param filename The full path to the photo
+ * @return TRUE if a record was found, and the photo hasn't changed since it was written
+ */
+extern gboolean rs_metadata_pack_load(RSMetadata *metadata, const gchar *filename);
+
+/**
+ * Append metadata and thumbnail for a photo to the pack in its cache directory
+ * @param metadata The RSMetadata to store
+ * @param filename The full path to the photo
+ */
+extern void rs_metadata_pack_save(RSMetadata *metadata, const gchar *filename);
+
+/**
+ * Forget the record for a photo
+ * @param filename The full path to the photo
+ */
+extern void rs_metadata_pack_delete(const gchar *filename);
+
+G_END_DECLS
+
+#endif /* RS_METADATA_PACK_H */
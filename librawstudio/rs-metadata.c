@@ -23,6 +23,7 @@
 #include <libxml/encoding.h>
 #include <libxml/xmlwriter.h>
 #include "gettext.h"
+#include "rs-metadata-pack.h"
 
 G_DEFINE_TYPE (RSMetadata, rs_metadata, G_TYPE_OBJECT)
 
@@ -117,80 +118,19 @@ rs_metadata_new (void)
 	return g_object_new (RS_TYPE_METADATA, NULL);
 }
 
-#define METACACHEVERSION 11
 void
 rs_metadata_cache_save(RSMetadata *metadata, const gchar *filename)
 {
 	if (!filename)
 	  return;
 
-	gchar *cache_filename;
 	gchar *thumb_filename;
-	xmlTextWriterPtr writer;
-	static GMutex lock;
 
 	g_return_if_fail(RS_IS_METADATA(metadata));
 
-	g_mutex_lock(&lock);
-
-	cache_filename = rs_metadata_dotdir_helper(filename, DOTDIR_METACACHE);
-
-	writer = xmlNewTextWriterFilename(cache_filename, 0);
-	if (writer)
-	{
-		xmlTextWriterSetIndent(writer, 1);
-
-		xmlTextWriterStartDocument(writer, NULL, "ISO-8859-1", NULL);
-		xmlTextWriterStartElement(writer, BAD_CAST "rawstudio-metadata");
-		xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "version", "%d", METACACHEVERSION);
-		if (metadata->make != MAKE_UNKNOWN)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "make", "%d", metadata->make);
-		if (metadata->make_ascii)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "make_ascii","%s", metadata->make_ascii);
-		if (metadata->model_ascii)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "model_ascii", "%s", metadata->model_ascii);
-		if (metadata->time_ascii)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "time_ascii", "%s", metadata->time_ascii);
-		if (metadata->timestamp > -1)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "timestamp", "%d", metadata->timestamp);
-		/* Can we make orientation conditional? */
-		xmlTextWriterWriteFormatElement(writer, BAD_CAST "orientation", "%u", metadata->orientation);
-		if (metadata->aperture > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "aperture", "%f", metadata->aperture);
-		if (metadata->exposurebias != -999.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "exposurebias", "%f", metadata->exposurebias);
-		if (metadata->iso > 0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "iso", "%u", metadata->iso);
-		if (metadata->shutterspeed > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "shutterspeed", "%f", metadata->shutterspeed);
-		if (metadata->cam_mul[0] > 0.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "cam_mul", "%f %f %f %f", metadata->cam_mul[0], metadata->cam_mul[1], metadata->cam_mul[2], metadata->cam_mul[3]);
-		if (metadata->contrast > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "contrast", "%f", metadata->contrast);
-		if (metadata->saturation > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "saturation", "%f", metadata->saturation);
-		if (metadata->color_tone > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "color_tone", "%f", metadata->color_tone);
-		if (metadata->focallength > 0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "focallength", "%d", metadata->focallength);
-		if (metadata->lens_id > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_id", "%d", metadata->lens_id);
-		if (metadata->lens_min_focal > -1)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_min_focal", "%f", metadata->lens_min_focal);
-		if (metadata->lens_max_focal > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_max_focal", "%f", metadata->lens_max_focal);
-		if (metadata->lens_min_aperture > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_min_aperture", "%f", metadata->lens_min_aperture);
-		if (metadata->lens_max_aperture > -1.0)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "lens_max_aperture", "%f", metadata->lens_max_aperture);
-		if (metadata->fixed_lens_identifier)
-			xmlTextWriterWriteFormatElement(writer, BAD_CAST "fixed_lens_identifier", "%s", metadata->fixed_lens_identifier);
-		xmlTextWriterEndDocument(writer);
-		xmlFreeTextWriter(writer);
-	}
-	g_free(cache_filename);
-	g_mutex_unlock(&lock);
+	rs_metadata_pack_save(metadata, filename);
 
+	/* The pack holds the thumbnail as well, but others expect to find it as a file */
 	if (metadata->thumbnail)
 	{
 		thumb_filename = rs_metadata_dotdir_helper(filename, DOTDIR_THUMB);
@@ -199,6 +139,8 @@ rs_metadata_cache_save(RSMetadata *metadata, const gchar *filename)
 	}
 }
 
+/* The XML cache used before metadata.pack, only read to migrate old caches */
+#define METACACHEVERSION 11
 static gboolean
 rs_metadata_cache_load(RSMetadata *metadata, const gchar *filename)
 {
@@ -215,6 +157,9 @@ rs_metadata_cache_load(RSMetadata *metadata, const gchar *filename)
 
 	g_return_val_if_fail(RS_IS_METADATA(metadata), FALSE);
 
+	if (rs_metadata_pack_load(metadata, filename))
+		return TRUE;
+
 	cache_filename = rs_metadata_dotdir_helper(filename, DOTDIR_METACACHE);
 	if (!g_file_test(cache_filename, G_FILE_TEST_IS_REGULAR))
 	{
@@ -409,6 +354,11 @@ rs_metadata_cache_load(RSMetadata *metadata, const gchar *filename)
 			ret = FALSE;
 	}
 
+	/* Copy the photo to the pack. The XML file is left alone, older
+	 * versions sharing the cache directory still read it */
+	if (ret == TRUE)
+		rs_metadata_pack_save(metadata, filename);
+
 	return ret;
 }
 #undef METACACHEVERSION
@@ -583,6 +533,7 @@ rs_metadata_delete_cache(const gchar *filename)
 	gchar *thumb_filename;
 
 	/* Delete the metadata cache itself */
+	rs_metadata_pack_delete(filename);
 	cache_filename = rs_metadata_dotdir_helper(filename, DOTDIR_METACACHE);
 	g_unlink(cache_filename);
 	g_free(cache_filename);
@@ -17,17 +17,162 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <libxml/encoding.h>
+#include <libxml/xmlwriter.h>
 #include "rs-dcp-file.h"
 #include "rs-profile-factory.h"
 #include "rs-profile-factory-model.h"
 #include "config.h"
 #include "rs-utils.h"
 #include "rs-profile-camera.h"
+#include "rs-debug.h"
 
 #define PROFILE_FACTORY_DEFAULT_SEARCH_PATH PACKAGE_DATA_DIR G_DIR_SEPARATOR_S PACKAGE G_DIR_SEPARATOR_S "profiles" G_DIR_SEPARATOR_S
 
 G_DEFINE_TYPE(RSProfileFactory, rs_profile_factory, G_TYPE_OBJECT)
 
+/* What we need to know about a DCP file without parsing it. Files are parsed
+ * again if size or modification time changes */
+typedef struct {
+	gint64 mtime;
+	gint64 size;
+	gchar *model; /* NULL if the file isn't a usable profile */
+	gchar *name;
+	gboolean seen; /* Found on disk during this run */
+} IndexEntry;
+
+/* Path -> IndexEntry, shared by all factories. Protected by index_lock */
+static GHashTable *dcp_index = NULL;
+static gboolean index_dirty = FALSE;
+static GMutex index_lock;
+
+static void
+index_entry_free(IndexEntry *entry)
+{
+	g_free(entry->model);
+	g_free(entry->name);
+	g_free(entry);
+}
+
+static gchar *
+index_get_path(void)
+{
+	return g_build_filename(rs_confdir_get(), "profile-index.xml", NULL);
+}
+
+/* Must be called with index_lock held */
+static void
+index_open(void)
+{
+	xmlDocPtr doc;
+	xmlNodePtr cur;
+	xmlNodePtr entry;
+	xmlChar *val;
+	gchar *path;
+
+	if (dcp_index)
+		return;
+
+	dcp_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) index_entry_free);
+
+	path = index_get_path();
+	doc = xmlParseFile(path);
+	g_free(path);
+	if (!doc)
+		return;
+
+	cur = xmlDocGetRootElement(doc);
+	if (cur && (xmlStrcmp(cur->name, BAD_CAST "rawstudio-profile-index") == 0))
+	{
+		cur = cur->xmlChildrenNode;
+		while(cur)
+		{
+			if ((!xmlStrcmp(cur->name, BAD_CAST "profile")))
+			{
+				IndexEntry *index_entry = g_new0(IndexEntry, 1);
+				gchar *filename = NULL;
+
+				entry = cur->xmlChildrenNode;
+				while (entry)
+				{
+					val = xmlNodeListGetString(doc, entry->xmlChildrenNode, 1);
+					if ((!xmlStrcmp(entry->name, BAD_CAST "path")))
+						filename = g_strdup((gchar *) val);
+					else if ((!xmlStrcmp(entry->name, BAD_CAST "mtime")))
+						index_entry->mtime = g_ascii_strtoll((gchar *) val, NULL, 10);
+					else if ((!xmlStrcmp(entry->name, BAD_CAST "size")))
+						index_entry->size = g_ascii_strtoll((gchar *) val, NULL, 10);
+					else if ((!xmlStrcmp(entry->name, BAD_CAST "model")))
+						index_entry->model = g_strdup((gchar *) val);
+					else if ((!xmlStrcmp(entry->name, BAD_CAST "name")))
+						index_entry->name = g_strdup((gchar *) val);
+					xmlFree(val);
+					entry = entry->next;
+				}
+
+				if (filename)
+					g_hash_table_replace(dcp_index, filename, index_entry);
+				else
+					index_entry_free(index_entry);
+			}
+			cur = cur->next;
+		}
+	}
+
+	xmlFreeDoc(doc);
+}
+
+/* Must be called with index_lock held */
+static void
+index_save(void)
+{
+	xmlTextWriterPtr writer;
+	GHashTableIter iter;
+	gpointer key, value;
+	gchar *path;
+
+	if (!dcp_index || !index_dirty)
+		return;
+
+	path = index_get_path();
+	writer = xmlNewTextWriterFilename(path, 0);
+	g_free(path);
+	if (!writer)
+		return;
+
+	xmlTextWriterSetIndent(writer, 1);
+	xmlTextWriterStartDocument(writer, NULL, "UTF-8", NULL);
+	xmlTextWriterStartElement(writer, BAD_CAST "rawstudio-profile-index");
+
+	g_hash_table_iter_init(&iter, dcp_index);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		const gchar *filename = key;
+		IndexEntry *entry = value;
+
+		/* Forget files that are gone. Files below paths that haven't been
+		 * searched this run are kept as long as they exist */
+		if (!entry->seen && !g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+			continue;
+
+		xmlTextWriterStartElement(writer, BAD_CAST "profile");
+			xmlTextWriterWriteFormatElement(writer, BAD_CAST "path", "%s", filename);
+			xmlTextWriterWriteFormatElement(writer, BAD_CAST "mtime", "%" G_GINT64_FORMAT, entry->mtime);
+			xmlTextWriterWriteFormatElement(writer, BAD_CAST "size", "%" G_GINT64_FORMAT, entry->size);
+			if (entry->model)
+				xmlTextWriterWriteFormatElement(writer, BAD_CAST "model", "%s", entry->model);
+			if (entry->name)
+				xmlTextWriterWriteFormatElement(writer, BAD_CAST "name", "%s", entry->name);
+		xmlTextWriterEndElement(writer);
+	}
+
+	xmlTextWriterEndDocument(writer);
+	xmlFreeTextWriter(writer);
+	index_dirty = FALSE;
+}
+
 static void
 rs_profile_factory_class_init(RSProfileFactoryClass *klass)
 {
@@ -65,13 +210,58 @@ add_icc_profile(RSProfileFactory *factory, const gchar *path)
 	return readable;
 }
 
+/* Returns the profile at path, from the index if the file is unchanged since
+ * it was last parsed */
+static RSDcpFile *
+open_dcp_profile(const gchar *path)
+{
+	struct stat st;
+	IndexEntry *entry;
+	RSDcpFile *profile = NULL;
+
+	if (g_stat(path, &st) != 0)
+		return NULL;
+
+	g_mutex_lock(&index_lock);
+	index_open();
+
+	entry = g_hash_table_lookup(dcp_index, path);
+	if (entry && entry->mtime == (gint64) st.st_mtime && entry->size == (gint64) st.st_size)
+	{
+		entry->seen = TRUE;
+		if (entry->model)
+			profile = rs_dcp_file_new_from_index(path, entry->model, entry->name);
+		g_mutex_unlock(&index_lock);
+		return profile;
+	}
+	g_mutex_unlock(&index_lock);
+
+	/* New or changed, parse it without holding the lock */
+	RS_DEBUG(PERFORMANCE, "Profile index: parsing %s", path);
+	profile = rs_dcp_file_new_from_file(path);
+
+	entry = g_new0(IndexEntry, 1);
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+	entry->model = g_strdup(rs_dcp_file_get_model(profile));
+	entry->name = g_strdup(rs_dcp_file_get_name(profile));
+	entry->seen = TRUE;
+
+	g_mutex_lock(&index_lock);
+	g_hash_table_replace(dcp_index, g_strdup(path), entry);
+	index_dirty = TRUE;
+	g_mutex_unlock(&index_lock);
+
+	return profile;
+}
+
 static gboolean
 add_dcp_profile(RSProfileFactory *factory, const gchar *path)
 {
 	gboolean readable = FALSE;
 
-	RSDcpFile *profile = rs_dcp_file_new_from_file(path);
-	const gchar *model = rs_dcp_file_get_model(profile);
+	RSDcpFile *profile = open_dcp_profile(path);
+	const gchar *model = profile ? rs_dcp_file_get_model(profile) : NULL;
 	if (model)
 	{
 		GtkTreeIter iter;
@@ -85,21 +275,19 @@ add_dcp_profile(RSProfileFactory *factory, const gchar *path)
 		readable = TRUE;
 		rs_tiff_free_data(RS_TIFF(profile));
 	}
+	else if (profile)
+		g_object_unref(profile);
 
 	return readable;
 }
 
-void
-rs_profile_factory_load_profiles(RSProfileFactory *factory, const gchar *path, gboolean load_dcp, gboolean load_icc)
+static void
+load_profiles(RSProfileFactory *factory, const gchar *path, gboolean load_dcp, gboolean load_icc)
 {
 	const gchar *basename;
 	gchar *filename;
 	GDir *dir;
 
-	g_return_if_fail(RS_IS_PROFILE_FACTORY(factory));
-	g_return_if_fail(path != NULL);
-	g_return_if_fail(g_path_is_absolute(path));
-
 	if (NULL == (dir = g_dir_open(path, 0, NULL)))
 		return;
 
@@ -111,7 +299,7 @@ rs_profile_factory_load_profiles(RSProfileFactory *factory, const gchar *path, g
 		filename = g_build_filename(path, basename, NULL);
 
 		if (g_file_test(filename, G_FILE_TEST_IS_DIR))
-			rs_profile_factory_load_profiles(factory, filename, load_dcp, load_icc);
+			load_profiles(factory, filename, load_dcp, load_icc);
 
 		else if (g_file_test(filename, G_FILE_TEST_IS_REGULAR))
 		{
@@ -130,6 +318,23 @@ rs_profile_factory_load_profiles(RSProfileFactory *factory, const gchar *path, g
 	g_dir_close(dir);
 }
 
+void
+rs_profile_factory_load_profiles(RSProfileFactory *factory, const gchar *path, gboolean load_dcp, gboolean load_icc)
+{
+	g_return_if_fail(RS_IS_PROFILE_FACTORY(factory));
+	g_return_if_fail(path != NULL);
+	g_return_if_fail(g_path_is_absolute(path));
+
+	gint64 start = g_get_monotonic_time();
+	load_profiles(factory, path, load_dcp, load_icc);
+	RS_DEBUG(PERFORMANCE, "Profiles in %s loaded in %.1f ms", path, (g_get_monotonic_time() - start) / 1000.0);
+
+	/* Store what we learned, next start will only parse new or changed files */
+	g_mutex_lock(&index_lock);
+	index_save();
+	g_mutex_unlock(&index_lock);
+}
+
 RSProfileFactory *
 rs_profile_factory_new(const gchar *search_path)
 {
@@ -201,7 +406,13 @@ rs_profile_factory_add_profile(RSProfileFactory *factory, const gchar *path)
 	g_return_val_if_fail(g_path_is_absolute(path), FALSE);
 
 	if (g_str_has_suffix(path, ".dcp") || g_str_has_suffix(path, ".DCP"))
-		return add_dcp_profile(factory, path);
+	{
+		gboolean ret = add_dcp_profile(factory, path);
+		g_mutex_lock(&index_lock);
+		index_save();
+		g_mutex_unlock(&index_lock);
+		return ret;
+	}
 	if (g_str_has_suffix(path, ".icc") || g_str_has_suffix(path, ".ICC"))
 		return add_icc_profile(factory, path);
 	if (g_str_has_suffix(path, ".icm") || g_str_has_suffix(path, ".ICM"))
@@ -25,6 +25,9 @@
 #include <arpa/inet.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
 #include "rs-rawfile.h"
 
 struct _RAWFILE {
@@ -281,6 +284,157 @@ raw_get_pixbuf(RAWFILE *rawfile, guint pos, guint length)
 	return(pixbuf);
 }
 
+/* libjpeg source reading straight from the map */
+static void
+jpeg_map_init_source(j_decompress_ptr cinfo)
+{
+}
+
+static boolean
+jpeg_map_fill_input_buffer(j_decompress_ptr cinfo)
+{
+	static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+
+	/* Out of data, end the image to let libjpeg finish what it has */
+	cinfo->src->next_input_byte = eoi;
+	cinfo->src->bytes_in_buffer = 2;
+	return TRUE;
+}
+
+static void
+jpeg_map_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+	if (num_bytes <= 0)
+		return;
+	if ((size_t) num_bytes > cinfo->src->bytes_in_buffer)
+		jpeg_map_fill_input_buffer(cinfo);
+	else
+	{
+		cinfo->src->next_input_byte += num_bytes;
+		cinfo->src->bytes_in_buffer -= num_bytes;
+	}
+}
+
+static void
+jpeg_map_term_source(j_decompress_ptr cinfo)
+{
+}
+
+struct jpeg_map_error {
+	struct jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+};
+
+static void
+jpeg_map_error_exit(j_common_ptr cinfo)
+{
+	longjmp(((struct jpeg_map_error *) cinfo->err)->setjmp_buffer, 1);
+}
+
+static void
+jpeg_map_output_message(j_common_ptr cinfo)
+{
+}
+
+/**
+ * Decodes an embedded image, like raw_get_pixbuf(), but lets libjpeg scale
+ * JPEG images down by 1/2, 1/4 or 1/8 while decoding as long as the longest
+ * side stays at least size pixels. This is much faster than decoding a
+ * full size preview only to throw most of it away
+ * @param rawfile A RAWFILE
+ * @param pos Offset of the image
+ * @param length Length of the image
+ * @param size The smallest acceptable longest side
+ * @return A new GdkPixbuf or NULL on errors
+ */
+GdkPixbuf *
+raw_get_pixbuf_scaled(RAWFILE *rawfile, guint pos, guint length, gint size)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_map_error jerr;
+	struct jpeg_source_mgr src;
+	GdkPixbuf * volatile pixbuf = NULL;
+	const guchar *data;
+	guint longest;
+	guint denom;
+
+	g_return_val_if_fail(rawfile != NULL, NULL);
+
+	if((rawfile->base+pos+length)>rawfile->size)
+		return(NULL);
+
+	data = ((const guchar *) rawfile->map)+rawfile->base+pos;
+
+	/* Let GdkPixbuf handle anything but JPEG */
+	if (length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+		return raw_get_pixbuf(rawfile, pos, length);
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = jpeg_map_error_exit;
+	jerr.pub.output_message = jpeg_map_output_message;
+	if (setjmp(jerr.setjmp_buffer))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		if (pixbuf)
+			g_object_unref(pixbuf);
+		return raw_get_pixbuf(rawfile, pos, length);
+	}
+
+	jpeg_create_decompress(&cinfo);
+
+	src.init_source = jpeg_map_init_source;
+	src.fill_input_buffer = jpeg_map_fill_input_buffer;
+	src.skip_input_data = jpeg_map_skip_input_data;
+	src.resync_to_restart = jpeg_resync_to_restart;
+	src.term_source = jpeg_map_term_source;
+	src.next_input_byte = data;
+	src.bytes_in_buffer = length;
+	cinfo.src = &src;
+
+	jpeg_read_header(&cinfo, TRUE);
+
+	longest = MAX(cinfo.image_width, cinfo.image_height);
+	denom = 1;
+	while (denom < 8 && longest/(denom*2) >= (guint) size)
+		denom *= 2;
+
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = JCS_RGB;
+	/* The result will be scaled down anyway, favour speed */
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress(&cinfo);
+
+	if (cinfo.output_components == 3)
+	{
+		guchar *pixels;
+		gint rowstride;
+
+		pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, cinfo.output_width, cinfo.output_height);
+		pixels = gdk_pixbuf_get_pixels(pixbuf);
+		rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+
+		while (cinfo.output_scanline < cinfo.output_height)
+		{
+			JSAMPROW row = pixels + cinfo.output_scanline * rowstride;
+			jpeg_read_scanlines(&cinfo, &row, 1);
+		}
+		jpeg_finish_decompress(&cinfo);
+	}
+	else
+		jpeg_abort_decompress(&cinfo);
+
+	jpeg_destroy_decompress(&cinfo);
+
+	/* Leave anything we can't decode as RGB to GdkPixbuf */
+	if (!pixbuf)
+		return raw_get_pixbuf(rawfile, pos, length);
+
+	return(pixbuf);
+}
+
 RAWFILE *
 raw_create_from_memory(void *memory, guint size, guint first_ifd_offset, gushort byteorder)
 {
@@ -409,6 +563,14 @@ get_first_ifd_offset(RAWFILE *rawfile)
 	return rawfile->first_ifd_offset;
 }
 
+gint
+raw_get_fd(RAWFILE *rawfile)
+{
+	g_return_val_if_fail(rawfile != NULL, -1);
+
+	return rawfile->is_map ? rawfile->fd : -1;
+}
+
 void *
 raw_get_map(RAWFILE *rawfile)
 {
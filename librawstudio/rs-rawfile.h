@@ -44,12 +44,14 @@ gboolean raw_strcmp(RAWFILE *rawfile, guint pos, const gchar *needle, gint len);
 gboolean raw_strcpy(RAWFILE *rawfile, guint pos, void *target, gint len);
 gchar *raw_strdup(RAWFILE *rawfile, guint pos, gint len);
 GdkPixbuf *raw_get_pixbuf(RAWFILE *rawfile, guint pos, guint length);
+GdkPixbuf *raw_get_pixbuf_scaled(RAWFILE *rawfile, guint pos, guint length, gint size);
 void raw_close_file(RAWFILE *rawfile);
 void raw_reset_base(RAWFILE *rawfile);
 gint raw_get_base(RAWFILE *rawfile);
 gushort raw_get_byteorder(RAWFILE *rawfile);
 void raw_set_byteorder(RAWFILE *rawfile, gushort byteorder);
 guint get_first_ifd_offset(RAWFILE *rawfile);
+gint raw_get_fd(RAWFILE *rawfile);
 void *raw_get_map(RAWFILE *rawfile);
 guint raw_get_filesize(RAWFILE *rawfile);
 
@@ -0,0 +1,350 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include "rs-thread-pool.h"
+
+/*
+ * All filters share this pool of long-lived workers instead of spawning
+ * threads per request. Every group keeps its own queue of pending tasks, and
+ * groups with pending tasks are kept in a list. Idle workers steal from the
+ * first group in that list, while a thread waiting for a group pulls tasks
+ * from its own group. The latter means that nested use of the pool can never
+ * deadlock, and that a request is never stalled behind an unrelated one.
+ */
+
+typedef struct {
+	GThreadFunc func;
+	gpointer data;
+	RSThreadPoolGroup *group;
+	gint64 queued;
+} RSThreadPoolTask;
+
+struct _RSThreadPoolGroup {
+	GQueue pending;
+	gint outstanding;
+	GCond done_cond;
+};
+
+typedef struct {
+	RSParallelForFunc func;
+	gpointer user_data;
+	gint start;
+	gint end;
+} ParallelForChunk;
+
+static GMutex lock;
+static GCond work_cond;
+static GQueue groups = G_QUEUE_INIT;
+static gint num_threads = 0;
+static gint running_threads = 0;
+static RSThreadPoolStats stats = { 0 };
+
+/* Must be called with lock held */
+static RSThreadPoolTask *
+steal_task(RSThreadPoolGroup *group)
+{
+	RSThreadPoolTask *task;
+
+	task = g_queue_pop_head(&group->pending);
+	if (task && g_queue_is_empty(&group->pending))
+		g_queue_remove(&groups, group);
+
+	return task;
+}
+
+/* Must be called with lock held, will release the lock while running */
+static void
+run_task(RSThreadPoolTask *task, gboolean is_inline)
+{
+	RSThreadPoolGroup *group = task->group;
+	gint64 start, end;
+
+	g_mutex_unlock(&lock);
+	start = g_get_monotonic_time();
+	task->func(task->data);
+	end = g_get_monotonic_time();
+	g_mutex_lock(&lock);
+
+	stats.tasks++;
+	if (is_inline)
+		stats.tasks_inline++;
+	stats.wait_time += start - task->queued;
+	stats.run_time += end - start;
+
+	g_slice_free(RSThreadPoolTask, task);
+
+	if (--group->outstanding == 0)
+		g_cond_broadcast(&group->done_cond);
+}
+
+static gpointer
+worker(gpointer unused)
+{
+	RSThreadPoolGroup *group;
+	RSThreadPoolTask *task;
+
+	g_mutex_lock(&lock);
+	while (running_threads <= num_threads)
+	{
+		group = g_queue_peek_head(&groups);
+		if (!group)
+		{
+			g_cond_wait(&work_cond, &lock);
+			continue;
+		}
+
+		task = steal_task(group);
+		run_task(task, FALSE);
+	}
+	running_threads--;
+	g_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/* Must be called with lock held */
+static void
+init(void)
+{
+	if (num_threads == 0)
+		num_threads = rs_get_number_of_processor_cores();
+
+	while (running_threads < num_threads)
+	{
+		g_thread_unref(g_thread_new("RSThreadPool worker", worker, NULL));
+		running_threads++;
+	}
+}
+
+/**
+ * Get the number of worker threads in the shared pool. Filters should use
+ * this to decide how many parts to split their work into
+ * @return The number of worker threads, at least 1
+ */
+gint
+rs_thread_pool_get_num_threads(void)
+{
+	gint ret;
+
+	g_mutex_lock(&lock);
+	if (num_threads == 0)
+		num_threads = rs_get_number_of_processor_cores();
+	ret = num_threads;
+	g_mutex_unlock(&lock);
+
+	return ret;
+}
+
+/**
+ * Set the number of worker threads in the shared pool
+ * @param threads The number of threads to use, or 0 to use one thread
+ *                    per processor core
+ */
+void
+rs_thread_pool_set_num_threads(gint threads)
+{
+	if (threads <= 0)
+		threads = rs_get_number_of_processor_cores();
+
+	g_mutex_lock(&lock);
+	num_threads = CLAMP(threads, 1, 127);
+	RS_DEBUG(PERFORMANCE, "Using %d worker threads.", num_threads);
+
+	/* Surplus workers will exit when they see this */
+	g_cond_broadcast(&work_cond);
+	g_mutex_unlock(&lock);
+}
+
+/**
+ * Create a new group of tasks, tasks added to the group will be started as
+ * soon as a worker is available
+ * @return A new RSThreadPoolGroup, this will be freed by rs_thread_pool_group_wait()
+ */
+RSThreadPoolGroup *
+rs_thread_pool_group_new(void)
+{
+	RSThreadPoolGroup *group = g_slice_new0(RSThreadPoolGroup);
+
+	g_queue_init(&group->pending);
+	g_cond_init(&group->done_cond);
+
+	return group;
+}
+
+/**
+ * Add a task to a group
+ * @note func must return normally, it must NOT call g_thread_exit()
+ * @param group A RSThreadPoolGroup
+ * @param func The function to call
+ * @param data Data to pass to func
+ */
+void
+rs_thread_pool_group_add(RSThreadPoolGroup *group, GThreadFunc func, gpointer data)
+{
+	g_return_if_fail(group != NULL);
+	g_return_if_fail(func != NULL);
+
+	RSThreadPoolTask *task = g_slice_new(RSThreadPoolTask);
+	task->func = func;
+	task->data = data;
+	task->group = group;
+	task->queued = g_get_monotonic_time();
+
+	g_mutex_lock(&lock);
+	init();
+
+	if (g_queue_is_empty(&group->pending))
+		g_queue_push_tail(&groups, group);
+	g_queue_push_tail(&group->pending, task);
+	group->outstanding++;
+
+	g_cond_signal(&work_cond);
+	g_mutex_unlock(&lock);
+}
+
+/**
+ * Wait until all tasks in a group has finished and free the group. The
+ * calling thread will help executing tasks from the group while waiting
+ * @param group A RSThreadPoolGroup
+ */
+void
+rs_thread_pool_group_wait(RSThreadPoolGroup *group)
+{
+	RSThreadPoolTask *task;
+
+	g_return_if_fail(group != NULL);
+
+	g_mutex_lock(&lock);
+	while (group->outstanding > 0)
+	{
+		task = steal_task(group);
+		if (task)
+			run_task(task, TRUE);
+		else
+			g_cond_wait(&group->done_cond, &lock);
+	}
+	stats.groups++;
+	g_mutex_unlock(&lock);
+
+	g_cond_clear(&group->done_cond);
+	g_slice_free(RSThreadPoolGroup, group);
+}
+
+/**
+ * Run func on every element of an array in parallel and wait for completion.
+ * This is meant as a drop-in for the usual "one ThreadInfo per thread" pattern
+ * @param func The function to call for each element
+ * @param elements An array of elements, a pointer to each element will be passed to func
+ * @param element_size The size of each element in bytes
+ * @param num_elements The number of elements in the array
+ */
+void
+rs_thread_pool_run(GThreadFunc func, gpointer elements, gsize element_size, guint num_elements)
+{
+	RSThreadPoolGroup *group;
+	guint i;
+
+	g_return_if_fail(func != NULL);
+
+	/* Don't bother the pool with a single task */
+	if (num_elements == 1)
+	{
+		func(elements);
+		return;
+	}
+
+	group = rs_thread_pool_group_new();
+	for(i = 0; i < num_elements; i++)
+		rs_thread_pool_group_add(group, func, ((guchar *) elements) + i * element_size);
+	rs_thread_pool_group_wait(group);
+}
+
+static gpointer
+parallel_for_chunk(gpointer _chunk)
+{
+	ParallelForChunk *chunk = _chunk;
+
+	chunk->func(chunk->start, chunk->end, chunk->user_data);
+
+	return NULL;
+}
+
+/**
+ * Split a range in chunks and process them in parallel, returns when all
+ * chunks are done
+ * @param start The first index to process
+ * @param end The index after the last index to process
+ * @param min_chunk The minimum number of indices to hand to one call of func
+ * @param func The function to call
+ * @param user_data Data to pass to func
+ */
+void
+rs_thread_pool_parallel_for(gint start, gint end, gint min_chunk, RSParallelForFunc func, gpointer user_data)
+{
+	gint i, num_chunks, per_chunk, offset;
+	ParallelForChunk *chunks;
+
+	g_return_if_fail(func != NULL);
+
+	if (end <= start)
+		return;
+
+	/* Use a few chunks per thread, this allows fast workers to steal the
+	 * work of slow workers */
+	num_chunks = rs_thread_pool_get_num_threads() * 2;
+	num_chunks = MIN(num_chunks, (end - start) / MAX(1, min_chunk));
+	num_chunks = MAX(1, num_chunks);
+
+	if (num_chunks == 1)
+	{
+		func(start, end, user_data);
+		return;
+	}
+
+	chunks = g_new(ParallelForChunk, num_chunks);
+	per_chunk = (end - start + num_chunks - 1) / num_chunks;
+	offset = start;
+	for(i = 0; i < num_chunks; i++)
+	{
+		chunks[i].func = func;
+		chunks[i].user_data = user_data;
+		chunks[i].start = offset;
+		offset = MIN(end, offset + per_chunk);
+		chunks[i].end = offset;
+	}
+
+	rs_thread_pool_run(parallel_for_chunk, chunks, sizeof(ParallelForChunk), num_chunks);
+
+	g_free(chunks);
+}
+
+/**
+ * Get statistics about the shared pool
+ * @param _stats A RSThreadPoolStats to fill
+ */
+void
+rs_thread_pool_get_stats(RSThreadPoolStats *_stats)
+{
+	g_return_if_fail(_stats != NULL);
+
+	g_mutex_lock(&lock);
+	*_stats = stats;
+	g_mutex_unlock(&lock);
+}
@@ -0,0 +1,119 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_THREAD_POOL_H
+#define RS_THREAD_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RSThreadPoolGroup RSThreadPoolGroup;
+
+typedef struct {
+	guint64 tasks;          /* Tasks executed in total */
+	guint64 tasks_inline;   /* Tasks executed by the submitting thread */
+	guint64 groups;         /* Number of completed groups */
+	gint64 wait_time;       /* Total time from submit until start of task (us) */
+	gint64 run_time;        /* Total time spent running tasks (us) */
+} RSThreadPoolStats;
+
+/**
+ * A function processing a range of rows (or any other index)
+ * @param start The first index to process
+ * @param end The index after the last index to process
+ * @param user_data As passed to rs_thread_pool_parallel_for()
+ */
+typedef void (*RSParallelForFunc)(gint start, gint end, gpointer user_data);
+
+/**
+ * Get the number of worker threads in the shared pool. Filters should use
+ * this to decide how many parts to split their work into
+ * @return The number of worker threads, at least 1
+ */
+gint
+rs_thread_pool_get_num_threads(void);
+
+/**
+ * Set the number of worker threads in the shared pool
+ * @param num_threads The number of threads to use, or 0 to use one thread
+ *                    per processor core
+ */
+void
+rs_thread_pool_set_num_threads(gint num_threads);
+
+/**
+ * Create a new group of tasks, tasks added to the group will be started as
+ * soon as a worker is available
+ * @return A new RSThreadPoolGroup, this will be freed by rs_thread_pool_group_wait()
+ */
+RSThreadPoolGroup *
+rs_thread_pool_group_new(void);
+
+/**
+ * Add a task to a group
+ * @note func must return normally, it must NOT call g_thread_exit()
+ * @param group A RSThreadPoolGroup
+ * @param func The function to call
+ * @param data Data to pass to func
+ */
+void
+rs_thread_pool_group_add(RSThreadPoolGroup *group, GThreadFunc func, gpointer data);
+
+/**
+ * Wait until all tasks in a group has finished and free the group. The
+ * calling thread will help executing tasks from the group while waiting
+ * @param group A RSThreadPoolGroup
+ */
+void
+rs_thread_pool_group_wait(RSThreadPoolGroup *group);
+
+/**
+ * Run func on every element of an array in parallel and wait for completion.
+ * This is meant as a drop-in for the usual "one ThreadInfo per thread" pattern
+ * @param func The function to call for each element
+ * @param elements An array of elements, a pointer to each element will be passed to func
+ * @param element_size The size of each element in bytes
+ * @param num_elements The number of elements in the array
+ */
+void
+rs_thread_pool_run(GThreadFunc func, gpointer elements, gsize element_size, guint num_elements);
+
+/**
+ * Split a range in chunks and process them in parallel, returns when all
+ * chunks are done
+ * @param start The first index to process
+ * @param end The index after the last index to process
+ * @param min_chunk The minimum number of indices to hand to one call of func
+ * @param func The function to call
+ * @param user_data Data to pass to func
+ */
+void
+rs_thread_pool_parallel_for(gint start, gint end, gint min_chunk, RSParallelForFunc func, gpointer user_data);
+
+/**
+ * Get statistics about the shared pool
+ * @param stats A RSThreadPoolStats to fill
+ */
+void
+rs_thread_pool_get_stats(RSThreadPoolStats *stats);
+
+G_END_DECLS
+
+#endif /* RS_THREAD_POOL_H */
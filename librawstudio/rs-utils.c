@@ -220,6 +220,20 @@ rs_detect_cpu_features(void)
        : "=a" (eax), "=c" (ecx),  "=d" (edx) \
        : "0" (cmd) \
      ); \
+} while(0)
+/* Same as above for leaves with sub-leaves, only ebx is returned */
+#define cpuid_ebx(cmd, subcmd, ebx) \
+  do { \
+     guint _eax = cmd, _ecx = subcmd; \
+     asm ( \
+       "push %%"REG_b"\n\t"\
+       "cpuid\n\t" \
+       "mov %%ebx, %%esi\n\t" \
+       "pop %%"REG_b"\n\t" \
+       : "+a" (_eax), "+c" (_ecx), "=S" (ebx) \
+       : \
+       : "edx" \
+     ); \
 } while(0)
 	guint eax;
 	guint edx;
@@ -260,9 +274,11 @@ rs_detect_cpu_features(void)
 		{
 			guint std_dsc;
 			guint ext_dsc;
+			guint max_level;
 
 			/* Get the standard level */
 			cpuid(0x00000000, std_dsc, ecx, edx);
+			max_level = std_dsc;
 
 			if (std_dsc)
 			{
@@ -290,10 +306,26 @@ rs_detect_cpu_features(void)
 				{
 					xgetbv(0, eax, edx);
 						if ((eax & 0x6) == 0x6)
+						{
 							cpuflags |= RS_CPU_FLAG_AVX;
+							if (ecx & 0x00001000)
+								cpuflags |= RS_CPU_FLAG_FMA;
+						}
 				}
 			}
 
+			/* Extended features, only usable if the OS saves the registers */
+			if (max_level >= 7 && (cpuflags & RS_CPU_FLAG_AVX))
+			{
+				guint ebx;
+				cpuid_ebx(0x00000007, 0, ebx);
+				if (ebx & 0x00000020)
+					cpuflags |= RS_CPU_FLAG_AVX2;
+				/* Opmask and upper ZMM state must be enabled too */
+				if ((ebx & 0x00010000) && (eax & 0xe6) == 0xe6)
+					cpuflags |= RS_CPU_FLAG_AVX512F;
+			}
+
 			/* Is there extensions */
 			cpuid(0x80000000, ext_dsc, ecx, edx);
 
@@ -331,10 +363,14 @@ rs_detect_cpu_features(void)
 	report("SSE4.1",RS_CPU_FLAG_SSE4_1);
 	report("SSE4.2",RS_CPU_FLAG_SSE4_2);
 	report("AVX",RS_CPU_FLAG_AVX);
+	report("AVX2",RS_CPU_FLAG_AVX2);
+	report("FMA",RS_CPU_FLAG_FMA);
+	report("AVX-512F",RS_CPU_FLAG_AVX512F);
 #undef report
 
 	return(stored_cpuflags);
 #undef cpuid
+#undef cpuid_ebx
 }
 
 #else
@@ -369,6 +405,45 @@ rs_confdir_get(void)
 	return dir;
 }
 
+/* The checksum used before fingerprints, only used to find old read-only caches */
+static gchar *
+file_checksum_md5(const gchar *filename)
+{
+	gchar *checksum = NULL;
+	struct stat st;
+	gint fd;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	fd = open(filename, O_RDONLY);
+	if (fd > 0)
+	{
+		fstat(fd, &st);
+
+		gint offset = 0;
+		gint length = st.st_size;
+
+		/* If the file is bigger than 2 KiB, we sample 1 KiB in the middle of the file */
+		if (st.st_size > 2048)
+		{
+			offset = st.st_size/2;
+			length = 1024;
+		}
+
+		guchar buffer[length];
+
+		lseek(fd, offset, SEEK_SET);
+		gint bytes_read = read(fd, buffer, length);
+
+		close(fd);
+
+		if (bytes_read == length)
+			checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5, buffer, length);
+	}
+
+	return checksum;
+}
+
 /**
  * Return a cache directory for filename
  * @param filename A complete path to a photo
@@ -421,8 +496,8 @@ rs_dotdir_get(const gchar *filename)
 	}
 
 	/* If we for some reason cannot write to the current directory, */
-	/* we save it to a new folder named as the md5 of the file content, */
-	/* not particularly fast, but ensures that the images can be moved */
+	/* we save it to a new folder named as the fingerprint of the file content, */
+	/* this ensures that the images can be moved */
 	if (ret == NULL)
 	{
 		if (dotdir)
@@ -431,9 +506,24 @@ rs_dotdir_get(const gchar *filename)
 			g_free(directory);
 		if (g_file_test(filename, G_FILE_TEST_IS_REGULAR))
 		{
-			gchar* md5 = rs_file_checksum(filename);
-			ret = g_strdup_printf("%s/read-only-cache/%s", rs_confdir_get(), md5);
-			g_free(md5);
+			gchar* fingerprint = rs_file_fingerprint(filename);
+			if (!fingerprint)
+				return NULL;
+			ret = g_strdup_printf("%s/read-only-cache/%s", rs_confdir_get(), fingerprint);
+			g_free(fingerprint);
+			if (!g_file_test(ret, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)))
+			{
+				/* Move caches made by older versions */
+				gchar *md5 = file_checksum_md5(filename);
+				if (md5)
+				{
+					gchar *old = g_strdup_printf("%s/read-only-cache/%s", rs_confdir_get(), md5);
+					if (g_file_test(old, G_FILE_TEST_IS_DIR))
+						g_rename(old, ret);
+					g_free(old);
+					g_free(md5);
+				}
+			}
 			if (!g_file_test(ret, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)))
 			{
 				if (g_mkdir_with_parents(ret, 0700) != 0)
@@ -715,39 +805,7 @@ rs_split_string(const gchar *str, const gchar *delimiters) {
 gchar *
 rs_file_checksum(const gchar *filename)
 {
-	gchar *checksum = NULL;
-	struct stat st;
-	gint fd;
-
-	g_return_val_if_fail(filename != NULL, NULL);
-
-	fd = open(filename, O_RDONLY);
-	if (fd > 0)
-	{
-		fstat(fd, &st);
-
-		gint offset = 0;
-		gint length = st.st_size;
-
-		/* If the file is bigger than 2 KiB, we sample 1 KiB in the middle of the file */
-		if (st.st_size > 2048)
-		{
-			offset = st.st_size/2;
-			length = 1024;
-		}
-
-		guchar buffer[length];
-
-		lseek(fd, offset, SEEK_SET);
-		gint bytes_read = read(fd, buffer, length);
-
-		close(fd);
-
-		if (bytes_read == length)
-			checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5, buffer, length);
-	}
-
-	return checksum;
+	return rs_file_fingerprint(filename);
 }
 
 const gchar *
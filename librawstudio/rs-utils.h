@@ -160,6 +160,10 @@ CanonEv(gint val);
 GList *
 rs_split_string(const gchar *str, const gchar *delimiters);
 
+/**
+ * Compute an identifier for the content of a file
+ * @deprecated Use rs_file_fingerprint(), which this is now an alias of
+ */
 gchar * rs_file_checksum(const gchar *photo);
 
 const gchar * rs_human_aperture(gdouble aperture);
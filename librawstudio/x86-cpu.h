@@ -13,7 +13,10 @@ typedef enum {
 	RS_CPU_FLAG_SSSE3 =  1<<8,
 	RS_CPU_FLAG_SSE4_1 =  1<<9,
 	RS_CPU_FLAG_SSE4_2 =  1<<10,
-	RS_CPU_FLAG_AVX =  1<<11
+	RS_CPU_FLAG_AVX =  1<<11,
+	RS_CPU_FLAG_AVX2 =  1<<12,
+	RS_CPU_FLAG_FMA =  1<<13,
+	RS_CPU_FLAG_AVX512F =  1<<14
 } RSCpuFlags;
 
 #if defined(__x86_64__)
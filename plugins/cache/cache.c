@@ -20,6 +20,7 @@
 /* Plugin tmpl version 4 */
 
 #include <rawstudio.h>
+#include <string.h> /* memcpy() */
 
 #if 0 /* Change to 1 to enable debugging info */
 #define filter_debug g_debug
@@ -35,15 +36,38 @@
 typedef struct _RSCache RSCache;
 typedef struct _RSCacheClass RSCacheClass;
 
+/* Keep at most this many responses, regardless of memory budget */
+#define MAX_ENTRIES 32
+
+/* Give up combining cached data after this many renders for one request */
+#define MAX_RENDERS 3
+
+typedef struct {
+	RSFilterResponse *response;
+	GdkRectangle roi;          /* The area of the image holding valid data */
+	GdkRectangle area;         /* Where the image is placed in the whole image */
+	gboolean image8;
+	gboolean quick;
+	RSColorSpace *colorspace;  /* The requested colorspace or NULL */
+	gint width;
+	gint height;
+	gsize size;                /* Bytes used by image data */
+} RSCacheEntry;
+
 struct _RSCache {
 	RSFilter parent;
 
-	RSFilterResponse *cached_image;
+	GList *entries;            /* Most recently used first */
+	gsize memory_used;
+	gint memory_budget;        /* In megabytes */
+	guint hits;
+	guint misses;
 	gboolean ignore_changed;
 	RSFilterChangedMask mask;
 	gboolean ignore_roi;
 	gint latency;
-	GMutex cache_mutex;
+	guint generation;          /* Bumped every time the cache is flushed */
+	GMutex cache_mutex;        /* Never held while calling the previous filter */
 };
 
 struct _RSCacheClass {
@@ -55,7 +79,10 @@ RS_DEFINE_FILTER(rs_cache, RSCache)
 enum {
 	PROP_0,
 	PROP_LATENCY,
-	PROP_IGNORE_ROI
+	PROP_IGNORE_ROI,
+	PROP_MEMORY_BUDGET,
+	PROP_HITS,
+	PROP_MISSES
 };
 
 static void finalize(GObject *object);
@@ -63,6 +90,7 @@ static void get_property (GObject *object, guint property_id, GValue *value, GPa
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_image8(RSFilter *filter, const RSFilterRequest *request);
+static gint get_tile_border(RSFilter *filter);
 static void flush(RSCache *cache);
 static void previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask);
 
@@ -94,11 +122,30 @@ rs_cache_class_init(RSCacheClass *klass)
 			FALSE,
 			G_PARAM_READWRITE)
 	);
+	g_object_class_install_property(object_class,
+		PROP_MEMORY_BUDGET, g_param_spec_int(
+			"memory-budget", "memory-budget", "Memory to use for cached responses in megabytes. The latest response will always be kept.",
+			0, 65536, 256,
+			G_PARAM_READWRITE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_HITS, g_param_spec_uint(
+			"hits", "hits", "Number of requests served entirely from cache",
+			0, G_MAXUINT, 0,
+			G_PARAM_READABLE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_MISSES, g_param_spec_uint(
+			"misses", "misses", "Number of requests passed on to the previous filter",
+			0, G_MAXUINT, 0,
+			G_PARAM_READABLE)
+	);
 
 	filter_class->name = "Listen for changes and caches image data";
 	filter_class->get_image = get_image;
 	filter_class->get_image8 = get_image8;
 	filter_class->previous_changed = previous_changed;
+	filter_class->get_tile_border = get_tile_border;
 }
 
 static void
@@ -107,7 +154,12 @@ rs_cache_init(RSCache *cache)
 	cache->ignore_changed = FALSE;
 	cache->ignore_roi = FALSE;
 	cache->latency = 0;
-	cache->cached_image = rs_filter_response_new();
+	cache->entries = NULL;
+	cache->memory_used = 0;
+	cache->memory_budget = 256;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->generation = 0;
 	g_mutex_init(&cache->cache_mutex);
 }
 
@@ -132,6 +184,15 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		case PROP_IGNORE_ROI:
 			g_value_set_boolean(value, cache->ignore_roi);
 			break;
+		case PROP_MEMORY_BUDGET:
+			g_value_set_int(value, cache->memory_budget);
+			break;
+		case PROP_HITS:
+			g_value_set_uint(value, cache->hits);
+			break;
+		case PROP_MISSES:
+			g_value_set_uint(value, cache->misses);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -150,186 +211,385 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 		case PROP_IGNORE_ROI:
 			cache->ignore_roi = g_value_get_boolean(value);
 			break;
+		case PROP_MEMORY_BUDGET:
+			cache->memory_budget = g_value_get_int(value);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
 }
 
+static void
+entry_free(RSCache *cache, RSCacheEntry *entry)
+{
+	cache->memory_used -= entry->size;
+	g_object_unref(entry->response);
+	if (entry->colorspace)
+		g_object_unref(entry->colorspace);
+	g_slice_free(RSCacheEntry, entry);
+}
+
+/* Can entry be used to answer a request with these properties? */
 static gboolean
-rectangle_is_inside(GdkRectangle *outer_rect, GdkRectangle *inner_rect)
+entry_matches(RSCacheEntry *entry, gboolean image8, gboolean quick, RSColorSpace *colorspace, gint width, gint height)
 {
-	return inner_rect->x >= outer_rect->x &&
-		inner_rect->x + inner_rect->width <= outer_rect->x + outer_rect->width &&
-		inner_rect->y >= outer_rect->y && 
-		inner_rect->y + inner_rect->height <= outer_rect->y + outer_rect->height;
+	if (entry->image8 != image8)
+		return FALSE;
+
+	/* A quick image cannot be used for a full quality request */
+	if (entry->quick && !quick)
+		return FALSE;
+
+	if (entry->colorspace != colorspace)
+		return FALSE;
+
+	return (entry->width == width && entry->height == height);
 }
 
-static gint get_cached_width(RSCache *cache)
+/* Remove rect from all rectangles in area, leaving up to four rectangles for each */
+static void
+subtract_rectangle(GArray *area, const GdkRectangle *rect)
 {
-	gint ret = -1;
-	if (rs_filter_response_has_image(cache->cached_image)) {
-		RS_IMAGE16 *img = rs_filter_response_get_image(cache->cached_image);
-		ret = img->w;
-		g_object_unref(img);
-	}
+	GArray *remaining = g_array_new(FALSE, FALSE, sizeof(GdkRectangle));
+	GdkRectangle inter, part;
+	guint i;
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
-		GdkPixbuf *img  =  rs_filter_response_get_image8(cache->cached_image);
-		ret = gdk_pixbuf_get_width(img);
-		g_object_unref(img);
+	for(i = 0; i < area->len; i++)
+	{
+		GdkRectangle *r = &g_array_index(area, GdkRectangle, i);
+
+		if (!gdk_rectangle_intersect(r, rect, &inter))
+		{
+			g_array_append_val(remaining, *r);
+			continue;
+		}
+
+		/* Above */
+		if (inter.y > r->y)
+		{
+			part.x = r->x; part.y = r->y; part.width = r->width; part.height = inter.y - r->y;
+			g_array_append_val(remaining, part);
+		}
+		/* Below */
+		if (inter.y + inter.height < r->y + r->height)
+		{
+			part.x = r->x; part.y = inter.y + inter.height; part.width = r->width; part.height = r->y + r->height - part.y;
+			g_array_append_val(remaining, part);
+		}
+		/* Left */
+		if (inter.x > r->x)
+		{
+			part.x = r->x; part.y = inter.y; part.width = inter.x - r->x; part.height = inter.height;
+			g_array_append_val(remaining, part);
+		}
+		/* Right */
+		if (inter.x + inter.width < r->x + r->width)
+		{
+			part.x = inter.x + inter.width; part.y = inter.y; part.width = r->x + r->width - part.x; part.height = inter.height;
+			g_array_append_val(remaining, part);
+		}
 	}
-	return ret;
+
+	g_array_set_size(area, 0);
+	g_array_append_vals(area, remaining->data, remaining->len);
+	g_array_free(remaining, TRUE);
 }
 
-static gint get_cached_height(RSCache *cache)
+/* Finds the bounding box of the part of wanted not covered by usable entries,
+ * returns FALSE if everything is covered */
+static gboolean
+find_uncovered(RSCache *cache, const GdkRectangle *wanted, gboolean image8, gboolean quick, RSColorSpace *colorspace, gint width, gint height, GdkRectangle *uncovered)
 {
-	gint ret = -1;
-	if (rs_filter_response_has_image(cache->cached_image)) {
-		RS_IMAGE16 *img = rs_filter_response_get_image(cache->cached_image);
-		ret = img->h;
-		g_object_unref(img);
+	GArray *area = g_array_new(FALSE, FALSE, sizeof(GdkRectangle));
+	GList *node;
+	guint i;
+	gboolean ret;
+
+	g_array_append_val(area, *wanted);
+
+	for(node = cache->entries; node && area->len > 0; node = node->next)
+	{
+		RSCacheEntry *entry = node->data;
+		if (entry_matches(entry, image8, quick, colorspace, width, height))
+			subtract_rectangle(area, &entry->roi);
 	}
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
-		GdkPixbuf *img  =  rs_filter_response_get_image8(cache->cached_image);
-		ret = gdk_pixbuf_get_height(img);
-		g_object_unref(img);
+	ret = (area->len > 0);
+	if (ret)
+	{
+		*uncovered = g_array_index(area, GdkRectangle, 0);
+		for(i = 1; i < area->len; i++)
+			gdk_rectangle_union(uncovered, &g_array_index(area, GdkRectangle, i), uncovered);
 	}
+
+	g_array_free(area, TRUE);
+
 	return ret;
 }
 
-static void
-set_roi_to_full(RSCache *cache) {
-	GdkRectangle *r = g_new(GdkRectangle, 1);
-	r->x = 0;
-	r->y = 0;
-
-	if (rs_filter_response_has_image(cache->cached_image)) {
-		RS_IMAGE16 *img = rs_filter_response_get_image(cache->cached_image);
-		r->width = img->w;
-		r->height = img->h;
-		rs_filter_response_set_roi(cache->cached_image,r);
-		g_object_unref(img);
-	}
+/* Find a single usable entry covering wanted, full quality entries are
+ * preferred over quick ones */
+static RSCacheEntry *
+find_covering(RSCache *cache, const GdkRectangle *wanted, gboolean image8, gboolean quick, RSColorSpace *colorspace, gint width, gint height)
+{
+	RSCacheEntry *quick_entry = NULL;
+	GList *node;
+	GdkRectangle inter;
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
-		GdkPixbuf *img  =  rs_filter_response_get_image8(cache->cached_image);
-		r->width = gdk_pixbuf_get_width(img);
-		r->height = gdk_pixbuf_get_height(img);
-		rs_filter_response_set_roi(cache->cached_image,r);
-		g_object_unref(img);
+	for(node = cache->entries; node; node = node->next)
+	{
+		RSCacheEntry *entry = node->data;
+		if (entry_matches(entry, image8, quick, colorspace, width, height)
+			&& gdk_rectangle_intersect(&entry->roi, wanted, &inter)
+			&& inter.width == wanted->width && inter.height == wanted->height)
+		{
+			if (!entry->quick)
+				return entry;
+			if (!quick_entry)
+				quick_entry = entry;
+		}
 	}
-	filter_debug("Cache[%p]: Setting request ROI to full from cache!", cache);
-	filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", cache, r->x, r->y, r->width, r->height);
+
+	return quick_entry;
 }
 
-static RSFilterResponse *
-get_image(RSFilter *filter, const RSFilterRequest *_request)
+static void
+evict(RSCache *cache)
 {
-	RSCache *cache = RS_CACHE(filter);
-	RSFilterRequest *request = rs_filter_request_clone(_request);
-	GdkRectangle *roi = rs_filter_request_get_roi(request);
-
-	filter_debug("Cache[%p]: getimage() called", filter);
+	const gsize budget = ((gsize) cache->memory_budget) * 1024 * 1024;
 
-	g_mutex_lock(&cache->cache_mutex);
-	if (roi && cache->ignore_roi)
+	/* Never evict the most recently used response */
+	while (cache->entries && cache->entries->next && (cache->memory_used > budget || g_list_length(cache->entries) > MAX_ENTRIES))
 	{
-		roi = NULL;
-		rs_filter_request_set_roi(request, NULL);
-		filter_debug("Cache[%p]: Disabling ROI for upward calls", filter);
+		GList *last = g_list_last(cache->entries);
+		entry_free(cache, last->data);
+		cache->entries = g_list_delete_link(cache->entries, last);
+		filter_debug("Cache[%p]: Evicted entry, %" G_GSIZE_FORMAT " bytes used", cache, cache->memory_used);
 	}
+}
 
-	if (rs_filter_response_has_image(cache->cached_image)) {
+/* Adds a response from the previous filter, returns the new entry or NULL
+ * if the response is unusable for caching */
+static RSCacheEntry *
+add_entry(RSCache *cache, RSFilterResponse *response, const GdkRectangle *roi, gboolean image8, gboolean quick, RSColorSpace *colorspace, gint width, gint height)
+{
+	RSCacheEntry *entry;
+	GdkRectangle area, inter;
+	gint w = -1, h = -1;
+	gsize size = 0;
 
-		if (rs_filter_response_get_quick(cache->cached_image) && !rs_filter_request_get_quick(request))
-		{
-			filter_debug("Cache[%p]: Cached image is quick and requested image is not!", filter);
-			flush(cache);
-		}
+	if (image8 && rs_filter_response_has_image8(response))
+	{
+		GdkPixbuf *img = rs_filter_response_get_image8(response);
+		w = gdk_pixbuf_get_width(img);
+		h = gdk_pixbuf_get_height(img);
+		size = gdk_pixbuf_get_rowstride(img) * h;
+		g_object_unref(img);
+	}
+	else if (!image8 && rs_filter_response_has_image(response))
+	{
+		RS_IMAGE16 *img = rs_filter_response_get_image(response);
+		w = img->w;
+		h = img->h;
+		size = img->rowstride * img->h * sizeof(gushort);
+		g_object_unref(img);
+	}
 
-		if (!rs_filter_response_get_roi(cache->cached_image) && roi)
-			set_roi_to_full(cache);
+	/* Images only covering the ROI of the response are placed at its origin */
+	rs_filter_response_get_origin(response, &area.x, &area.y);
+	area.width = w;
+	area.height = h;
 
-		if (!roi && rs_filter_response_get_roi(cache->cached_image))
-		{
-				roi = g_new(GdkRectangle, 1);
-				roi->x = 0;
-				roi->y = 0;
-				roi->width = get_cached_width(cache);
-				roi->height = get_cached_height(cache);
-				rs_filter_request_set_roi(request, roi);
-				filter_debug("Cache[%p]: Setting request ROI from cache!", filter);
-		}
-		if (rs_filter_response_get_roi(cache->cached_image) && roi)
-		{
-			roi->x = MAX(0, roi->x);
-			roi->y = MAX(0, roi->y);
-			roi->width = MIN(roi->width, get_cached_width(cache));
-			roi->height = MIN(roi->height, get_cached_height(cache));
-		}
+	/* We can only combine images inside the predicted size covering roi */
+	if (w < 0 || area.x + w > width || area.y + h > height
+		|| !gdk_rectangle_intersect(&area, roi, &inter)
+		|| inter.width != roi->width || inter.height != roi->height)
+	{
+		filter_debug("Cache[%p]: Response has unexpected size, not caching", cache);
+		return NULL;
+	}
 
-		if (!cache->ignore_roi && roi)
+	/* Full quality data replaces quick data for the same area */
+	if (!quick)
+	{
+		GList *node = cache->entries;
+		while (node)
 		{
-			if (rs_filter_response_get_roi(cache->cached_image)) 
-				if (!rectangle_is_inside(rs_filter_response_get_roi(cache->cached_image), roi))
-				{
-					filter_debug("Cache[%p]: Cached image ROI does not cover requested ROI!", filter);
-#if 0
-					GdkRectangle *r = rs_filter_response_get_roi(cache->cached_image);
-					filter_debug("Cache[%p]: Request ROI x:%d, y:%d, w:%d, h:%d", filter, roi->x, roi->y, roi->width, roi->height);
-					filter_debug("Cache[%p]: Cached  ROI x:%d, y:%d, w:%d, h:%d", filter, r->x, r->y, r->width, r->height);
-#endif
-					flush(cache);
-				}
+			GList *next = node->next;
+			RSCacheEntry *old = node->data;
+			if (old->quick && entry_matches(old, image8, TRUE, colorspace, width, height)
+				&& gdk_rectangle_intersect(&old->roi, roi, &inter)
+				&& inter.width == old->roi.width && inter.height == old->roi.height)
+			{
+				entry_free(cache, old);
+				cache->entries = g_list_delete_link(cache->entries, node);
+			}
+			node = next;
 		}
 	}
 
-	if (!rs_filter_response_has_image(cache->cached_image))
+	entry = g_slice_new(RSCacheEntry);
+	entry->response = g_object_ref(response);
+	entry->roi = *roi;
+	entry->area = area;
+	entry->image8 = image8;
+	entry->quick = quick;
+	entry->colorspace = colorspace ? g_object_ref(colorspace) : NULL;
+	entry->width = width;
+	entry->height = height;
+	entry->size = size;
+
+	if (quick)
+		rs_filter_response_set_quick(entry->response);
+
+	cache->entries = g_list_prepend(cache->entries, entry);
+	cache->memory_used += size;
+	filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", cache, roi->x, roi->y, roi->width, roi->height);
+
+	return entry;
+}
+
+/* Build a response for wanted by copying from all usable entries */
+static RSFilterResponse *
+stitch(RSCache *cache, const GdkRectangle *wanted, gboolean image8, gboolean quick, RSColorSpace *colorspace, gint width, gint height)
+{
+	RSFilterResponse *response = NULL;
+	RS_IMAGE16 *output = NULL;
+	GdkPixbuf *output8 = NULL;
+	GdkRectangle inter;
+	GList *node;
+	gint pass;
+	gint row;
+
+	/* Quick entries are copied in a first pass, and only for quick requests,
+	 * so full quality data always ends up on top. Within a pass we walk from
+	 * oldest to newest, newer data overwrites older */
+	for(pass = quick ? 0 : 1; pass < 2; pass++)
+	for(node = g_list_last(cache->entries); node; node = node->prev)
 	{
-		filter_debug("Cache[%p]: Cached image NOT found", filter);
-		g_object_unref(cache->cached_image);
-		cache->cached_image = rs_filter_get_image(filter->previous, request);
+		RSCacheEntry *entry = node->data;
 
-		if (cache->cached_image && !roi)
-			set_roi_to_full(cache);
-		else
+		if (!!entry->quick != (pass == 0))
+			continue;
+		if (!entry_matches(entry, image8, quick, colorspace, width, height))
+			continue;
+		if (!gdk_rectangle_intersect(&entry->roi, wanted, &inter))
+			continue;
+
+		if (!response)
+			response = rs_filter_response_clone(entry->response);
+		if (entry->quick)
+			rs_filter_response_set_quick(response);
+
+		if (image8)
 		{
-			rs_filter_response_set_roi(cache->cached_image, roi);
-			if (roi)
-				filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", filter, roi->x, roi->y, roi->width, roi->height);
+			GdkPixbuf *img = rs_filter_response_get_image8(entry->response);
+			const gint bpp = gdk_pixbuf_get_n_channels(img);
+			if (!output8)
+				output8 = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(img), 8, wanted->width, wanted->height);
+			for(row = inter.y; row < inter.y + inter.height; row++)
+				memcpy(GET_PIXBUF_PIXEL(output8, inter.x - wanted->x, row - wanted->y),
+					GET_PIXBUF_PIXEL(img, inter.x - entry->area.x, row - entry->area.y), inter.width * bpp);
+			g_object_unref(img);
 		}
-
-		if (rs_filter_request_get_quick(request))
+		else
 		{
-			rs_filter_response_set_quick(cache->cached_image);
-			filter_debug("Cache[%p]: Setting image as quick", filter);
+			RS_IMAGE16 *img = rs_filter_response_get_image(entry->response);
+			if (!output)
+				output = rs_image16_new(wanted->width, wanted->height, img->channels, img->pixelsize);
+			for(row = inter.y; row < inter.y + inter.height; row++)
+				memcpy(GET_PIXEL(output, inter.x - wanted->x, row - wanted->y),
+					GET_PIXEL(img, inter.x - entry->area.x, row - entry->area.y), inter.width * img->pixelsize * sizeof(gushort));
+			g_object_unref(img);
 		}
 	}
 
-	RSFilterResponse *fr = rs_filter_response_clone(cache->cached_image);
-	RS_IMAGE16* img = rs_filter_response_get_image(cache->cached_image);
-	rs_filter_response_set_image(fr, img);
+	g_assert(response != NULL);
 
-	if (img)
-		g_object_unref(img);
+	/* The output only covers wanted */
+	rs_filter_response_set_roi(response, (GdkRectangle *) wanted);
+	if (output)
+	{
+		rs_filter_response_set_image(response, output);
+		g_object_unref(output);
+	}
+	if (output8)
+	{
+		rs_filter_response_set_image8(response, output8);
+		g_object_unref(output8);
+	}
 
-	g_object_unref(request);
-	g_mutex_unlock(&cache->cache_mutex);
+	return response;
+}
+
+/* Return a response sharing image data with a cached response */
+static RSFilterResponse *
+response_from_entry(RSCacheEntry *entry)
+{
+	RSFilterResponse *fr = rs_filter_response_clone(entry->response);
+
+	/* An image only covering part of the whole image is described by its ROI */
+	if (entry->area.width != entry->width || entry->area.height != entry->height)
+		rs_filter_response_set_roi(fr, &entry->area);
+	else
+		rs_filter_response_set_roi(fr, &entry->roi);
+
+	if (entry->image8)
+	{
+		GdkPixbuf* img = rs_filter_response_get_image8(entry->response);
+		rs_filter_response_set_image8(fr, img);
+		if (img)
+			g_object_unref(img);
+	}
+	else
+	{
+		RS_IMAGE16* img = rs_filter_response_get_image(entry->response);
+		rs_filter_response_set_image(fr, img);
+		if (img)
+			g_object_unref(img);
+	}
 
 	return fr;
 }
 
+static gboolean
+rectangle_equal(const GdkRectangle *a, const GdkRectangle *b)
+{
+	return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
 
+/* Ask the previous filter for area, must be called without cache_mutex */
 static RSFilterResponse *
-get_image8(RSFilter *filter, const RSFilterRequest *_request)
+render_area(RSFilter *filter, RSFilterRequest *request, GdkRectangle *area, gint width, gint height, gboolean image8)
+{
+	gboolean is_full = (area->width == width && area->height == height);
+
+	filter_debug("Cache[%p]: Requesting x:%d, y:%d, w:%d, h:%d", filter, area->x, area->y, area->width, area->height);
+	rs_filter_request_set_roi(request, is_full ? NULL : area);
+
+	if (image8)
+		return rs_filter_get_image8_roi(filter->previous, request);
+	else
+		return rs_filter_get_image_roi(filter->previous, request);
+}
+
+static RSFilterResponse *
+get_any(RSFilter *filter, const RSFilterRequest *_request, gboolean image8)
 {
 	RSCache *cache = RS_CACHE(filter);
 	RSFilterRequest *request = rs_filter_request_clone(_request);
 	GdkRectangle *roi = rs_filter_request_get_roi(request);
-	filter_debug("Cache[%p]: getimage8() called", filter);
+	RSFilterResponse *fr;
+	RSCacheEntry *entry;
+	RSColorSpace *colorspace;
+	GdkRectangle full;
+	GdkRectangle wanted;
+	GdkRectangle uncovered;
+	gboolean quick;
+	gint width, height;
+	gint renders;
+	guint generation;
 
-	g_mutex_lock(&cache->cache_mutex);
 	if (roi && cache->ignore_roi)
 	{
 		roi = NULL;
@@ -337,78 +597,128 @@ get_image8(RSFilter *filter, const RSFilterRequest *_request)
 		filter_debug("Cache[%p]: Disabling ROI for upward calls", filter);
 	}
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
+	/* We need to know the size to combine responses */
+	if (!rs_filter_get_size_simple(filter->previous, request, &width, &height))
+	{
+		fr = image8 ? rs_filter_get_image8_roi(filter->previous, request) : rs_filter_get_image_roi(filter->previous, request);
+		g_object_unref(request);
+		return fr;
+	}
 
-		if (rs_filter_response_get_quick(cache->cached_image) && !rs_filter_request_get_quick(request))
-		{
-			filter_debug("Cache[%p]: Cached image is quick and requested image is not!", filter);
-			flush(cache);
-		}
+	full.x = 0;
+	full.y = 0;
+	full.width = width;
+	full.height = height;
+	wanted = full;
+	if (roi && !gdk_rectangle_intersect(roi, &full, &wanted))
+		wanted = full;
 
-		if (!rs_filter_response_get_roi(cache->cached_image) && roi)
-		{
-			set_roi_to_full(cache);
-		}
+	quick = rs_filter_request_get_quick(request);
+	colorspace = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
 
-		if (!cache->ignore_roi && roi) 
-			if (rs_filter_response_get_roi(cache->cached_image)) 
-				if (!rectangle_is_inside(rs_filter_response_get_roi(cache->cached_image), roi))
-				{
-					filter_debug("Cache[%p]: Cached image ROI does not cover requested ROI!", filter);
-					flush(cache);
-				}
+	/* Other threads may evict or flush entries while the lock is released
+	 * for rendering, so coverage is checked again after every render. The
+	 * last check and the copying below are done under the same lock */
+	g_mutex_lock(&cache->cache_mutex);
+	for(renders = 0; find_uncovered(cache, &wanted, image8, quick, colorspace, width, height, &uncovered); renders++)
+	{
+		RSFilterResponse *previous_response;
 
-		if (!roi && rs_filter_response_get_roi(cache->cached_image))
-		{
-			filter_debug("Cache[%p]: Cached image has ROI, but request does not.", filter);
-			flush(cache);
-		}
+		if (renders == 0)
+			cache->misses++;
+
+		/* Stop chasing the parts evicted by other threads, render all */
+		if (renders == MAX_RENDERS - 1)
+			uncovered = wanted;
 
-		RSColorSpace *cached_space = NULL;
-		if (cache->cached_image)
-			cached_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(cache->cached_image), "colorspace", RS_TYPE_COLOR_SPACE);
+		generation = cache->generation;
+		g_mutex_unlock(&cache->cache_mutex);
+		previous_response = render_area(filter, request, &uncovered, width, height, image8);
+		g_mutex_lock(&cache->cache_mutex);
 
-		RSColorSpace *requested_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
+		/* Don't cache anything rendered from settings that has changed since */
+		if (generation == cache->generation)
+			entry = add_entry(cache, previous_response, &uncovered, image8, quick, colorspace, width, height);
+		else
+			entry = NULL;
 
-		if (cached_space && requested_space)
-			if (cached_space != requested_space)
+		/* Pass on uncacheable responses, they must cover all of wanted */
+		if (!entry || renders == MAX_RENDERS - 1)
+		{
+			evict(cache);
+			g_mutex_unlock(&cache->cache_mutex);
+			if (!rectangle_equal(&uncovered, &wanted))
 			{
-				filter_debug("Cache[%p]: Colorspace does not match Cached:%s vs Requested:%s.", filter, 
-										 rs_color_space_get_name(cached_space), rs_color_space_get_name(requested_space));
-				flush(cache);
+				g_object_unref(previous_response);
+				previous_response = render_area(filter, request, &wanted, width, height, image8);
 			}
+			if (quick)
+				rs_filter_response_set_quick(previous_response);
+			if (colorspace)
+				g_object_unref(colorspace);
+			g_object_unref(request);
+			return previous_response;
+		}
+		g_object_unref(previous_response);
 	}
+	if (renders == 0)
+		cache->hits++;
 
-	if (!rs_filter_response_has_image8(cache->cached_image))
+	/* Serve directly from a single entry if possible */
+	if ((entry = find_covering(cache, &wanted, image8, quick, colorspace, width, height)))
 	{
-		filter_debug("Cache[%p]: Cached image8 NOT found", filter);
-		g_object_unref(cache->cached_image);
-		cache->cached_image = rs_filter_get_image8(filter->previous, request);
-		rs_filter_response_set_roi(cache->cached_image, roi);
-		if (rs_filter_request_get_quick(request))
-			rs_filter_response_set_quick(cache->cached_image);
+		cache->entries = g_list_remove(cache->entries, entry);
+		cache->entries = g_list_prepend(cache->entries, entry);
+		fr = response_from_entry(entry);
+	}
+	else
+	{
+		filter_debug("Cache[%p]: Stitching x:%d, y:%d, w:%d, h:%d", filter, wanted.x, wanted.y, wanted.width, wanted.height);
+		fr = stitch(cache, &wanted, image8, quick, colorspace, width, height);
 	}
 
-	RSFilterResponse *fr = rs_filter_response_clone(cache->cached_image);
-	GdkPixbuf* img = rs_filter_response_get_image8(cache->cached_image);
-	rs_filter_response_set_image8(fr, img);
-
-	if (img)
-		g_object_unref(img);
+	evict(cache);
 
+	if (colorspace)
+		g_object_unref(colorspace);
 	g_object_unref(request);
 	g_mutex_unlock(&cache->cache_mutex);
 
 	return fr;
 }
 
+/* Tiles are passed on, or cut from what is cached */
+static gint
+get_tile_border(RSFilter *filter)
+{
+	return 0;
+}
+
+static RSFilterResponse *
+get_image(RSFilter *filter, const RSFilterRequest *request)
+{
+	filter_debug("Cache[%p]: getimage() called", filter);
+
+	return get_any(filter, request, FALSE);
+}
+
+static RSFilterResponse *
+get_image8(RSFilter *filter, const RSFilterRequest *request)
+{
+	filter_debug("Cache[%p]: getimage8() called", filter);
+
+	return get_any(filter, request, TRUE);
+}
 
 static void
 flush(RSCache *cache)
 {
 	filter_debug("Cache[%p]: Cache flushed", cache);
-	g_object_unref(cache->cached_image);
-	cache->cached_image = rs_filter_response_new();
+	while (cache->entries)
+	{
+		entry_free(cache, cache->entries->data);
+		cache->entries = g_list_delete_link(cache->entries, cache->entries);
+	}
 }
 
 static void
@@ -419,7 +729,10 @@ previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask)
 	filter_debug("Cache[%p]: Previous Changed (%x)", filter, mask);
 	g_mutex_lock(&cache->cache_mutex);
 	if (mask & RS_FILTER_CHANGED_PIXELDATA)
+	{
 		flush(cache);
+		cache->generation++;
+	}
 	g_mutex_unlock(&cache->cache_mutex);
 	rs_filter_changed(filter, mask);
 }
@@ -22,6 +22,7 @@
 #include <rawstudio.h>
 #include <config.h>
 #include <lcms2.h>
+#include <string.h> /* memcpy() */
 #include "rs-cmm.h"
 #include "colorspace_transform.h"
 
@@ -47,6 +48,7 @@ enum {
 
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_image8(RSFilter *filter, const RSFilterRequest *request);
+static gint get_tile_border(RSFilter *filter);
 static gboolean convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, RS_IMAGE16 *output_image, RSColorSpace *input_space, RSColorSpace *output_space, GdkRectangle *_roi);
 static void convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, GdkRectangle *roi);
 
@@ -78,6 +80,7 @@ rs_colorspace_transform_class_init(RSColorspaceTransformClass *klass)
 	filter_class->name = "ColorspaceTransform filter";
 	filter_class->get_image = get_image;
 	filter_class->get_image8 = get_image8;
+	filter_class->get_tile_border = get_tile_border;
 }
 
 static void
@@ -85,7 +88,14 @@ rs_colorspace_transform_init(RSColorspaceTransform *colorspace_transform)
 {
 	/* FIXME: unref this at some point */
 	colorspace_transform->cmm = rs_cmm_new();
-	rs_cmm_set_num_threads(colorspace_transform->cmm, rs_get_number_of_processor_cores());
+	rs_cmm_set_num_threads(colorspace_transform->cmm, rs_thread_pool_get_num_threads());
+}
+
+/* Pixels are converted one by one */
+static gint
+get_tile_border(RSFilter *filter)
+{
+	return 0;
 }
 
 static RSFilterResponse *
@@ -97,14 +107,19 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output = NULL;
 	GdkRectangle *roi;
+	GdkRectangle area;
+	gint x, y;
 	int i;
 
 	roi = rs_filter_request_get_roi(request);
-	previous_response = rs_filter_get_image(filter->previous, request);
+	previous_response = rs_filter_get_image_roi(filter->previous, request);
 	input = rs_filter_response_get_image(previous_response);
 	if (!RS_IS_IMAGE16(input))
 		return previous_response;
 
+	/* Where input is placed in the whole image */
+	rs_filter_response_get_origin(previous_response, &x, &y);
+
 	RSColorSpace *input_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(previous_response), "colorspace", RS_TYPE_COLOR_SPACE);
 	RSColorSpace *output_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
 
@@ -120,13 +135,39 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			colorspace_transform->has_premul = rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", colorspace_transform->premul);
 		rs_cmm_set_premul(colorspace_transform->cmm, colorspace_transform->premul);
 
+		if (roi)
+		{
+			GdkRectangle inside = {0, 0, input->w, input->h};
+			RS_IMAGE16 *tile;
+			gint row;
+
+			/* Only convert the ROI, the response tells where it is placed.
+			 * The ROI is copied out, as the converters expect input and
+			 * output images with the same layout */
+			area.x = roi->x - x;
+			area.y = roi->y - y;
+			area.width = roi->width;
+			area.height = roi->height;
+			if (!gdk_rectangle_intersect(&area, &inside, &area))
+				area = inside;
+
+			tile = rs_image16_new(area.width, area.height, input->channels, input->pixelsize);
+			for(row = 0; row < area.height; row++)
+				memcpy(GET_PIXEL(tile, 0, row), GET_PIXEL(input, area.x, area.y + row), area.width * input->pixelsize * sizeof(gushort));
+			g_object_unref(input);
+			input = tile;
+			area.x += x;
+			area.y += y;
+		}
 		output = rs_image16_copy(input, FALSE);
 
-		if (convert_colorspace16(colorspace_transform, input, output, input_space, output_space, roi))
+		if (convert_colorspace16(colorspace_transform, input, output, input_space, output_space, NULL))
 		{
 			/* Image was converted */
 			response = rs_filter_response_clone(previous_response);
 			g_object_unref(previous_response);
+			if (roi)
+				rs_filter_response_set_roi(response, &area);
 			if (colorspace_transform->has_premul)
 				rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "is-premultiplied", TRUE);
 			rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", output_space);
@@ -159,13 +200,17 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *input;
 	GdkPixbuf *output = NULL;
 	GdkRectangle *roi;
+	gint x, y;
 	int i;
 
-	previous_response = rs_filter_get_image(filter->previous, request);
+	previous_response = rs_filter_get_image_roi(filter->previous, request);
 	input = rs_filter_response_get_image(previous_response);
 	if (!RS_IS_IMAGE16(input))
 		return previous_response;
 
+	/* Where input is placed in the whole image */
+	rs_filter_response_get_origin(previous_response, &x, &y);
+
 	roi = rs_filter_request_get_roi(request);
 	RSColorSpace *input_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(previous_response), "colorspace", RS_TYPE_COLOR_SPACE);
 	RSColorSpace *output_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
@@ -191,10 +236,39 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	printf("\033[33m8 output_space: %s\n\033[0m", (output_space) ? G_OBJECT_TYPE_NAME(output_space) : "none");
 #endif
 
-	output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
+	if (roi)
+	{
+		GdkRectangle area, inside = {0, 0, input->w, input->h};
+		RS_IMAGE16 *sub;
+
+		/* Only allocate the ROI, the response tells where it is placed */
+		area.x = roi->x - x;
+		area.y = roi->y - y;
+		area.width = roi->width;
+		area.height = roi->height;
+		gdk_rectangle_intersect(&area, &inside, &area);
+
+		/* Align so we start at even pixel counts */
+		area.width += (area.x&1);
+		area.x -= (area.x&1);
+		sub = rs_image16_new_subframe(input, &area);
+		g_object_unref(input);
+		input = sub;
 
-	/* Process output */
-	convert_colorspace8(colorspace_transform, input, output, input_space, output_space, roi);
+		output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
+		convert_colorspace8(colorspace_transform, input, output, input_space, output_space, NULL);
+
+		area.x += x;
+		area.y += y;
+		area.width = input->w;
+		area.height = input->h;
+		rs_filter_response_set_roi(response, &area);
+	}
+	else
+	{
+		output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
+		convert_colorspace8(colorspace_transform, input, output, input_space, output_space, NULL);
+	}
 
 	rs_filter_response_set_image8(response, output);
 	rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", output_space);
@@ -491,7 +565,7 @@ convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *inp
 
 		gint i;
 		guint y_offset, y_per_thread, threaded_h;
-		guint threads = rs_get_number_of_processor_cores();
+		guint threads = rs_thread_pool_get_num_threads();
 		if (roi->height * roi->width < 200*200)
 			threads = 1;
 		
@@ -516,16 +590,9 @@ convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *inp
 			t[i].end_y = y_offset;
 			t[i].matrix = &mat;
 			t[i].table8 = NULL;
-			t[i].single_thread = (threads == 1);
-			if (threads == 1)
-				start_single_cs8_transform_thread(&t[0]);
-			else
-				t[i].threadid = g_thread_new("RSColorspaceTransform worker", start_single_cs8_transform_thread, &t[i]);
 		}
 
-		/* Wait for threads to finish */
-		for(i = 0; threads > 1 && i < threads; i++)
-			g_thread_join(t[i].threadid);
+		rs_thread_pool_run(start_single_cs8_transform_thread, t, sizeof(ThreadInfo), threads);
 
 		g_free(t);
 	}
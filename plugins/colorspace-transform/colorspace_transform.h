@@ -34,7 +34,6 @@ typedef struct _RSColorspaceTransformClass RSColorspaceTransformClass;
 
 typedef struct {
 	RSColorspaceTransform *cst;
-	GThread *threadid;
 	gint start_x;
 	gint start_y;
 	gint end_x;
@@ -52,7 +51,6 @@ typedef struct {
 	GCond* transform_finished;
 	GMutex* transform_finished_mutex;
 	gboolean do_run_transform;
-	gboolean single_thread;
 } ThreadInfo;
 
 /* SSE2 optimized functions */
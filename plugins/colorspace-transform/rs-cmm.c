@@ -25,6 +25,16 @@
 
 static gushort gammatable22[65536];
 
+/* Compiled transforms are shared by all instances, keep at most this many */
+#define TRANSFORM_CACHE_SIZE 8
+
+typedef struct {
+	gchar *key;                   /* Checksums of the profiles, intent and formats */
+	cmsHTRANSFORM lcms_transform;
+	gboolean is_gamma_corrected;  /* Only probed for 16 bit transforms */
+	gint refcount;
+} CmmTransform;
+
 struct _RSCmm {
 	GObject parent;
 
@@ -38,26 +48,30 @@ struct _RSCmm {
 	gfloat premul[3];
 	gushort clip[3];
 
-	cmsHPROFILE lcms_input_profile;
-	cmsHPROFILE lcms_output_profile;
+	gchar *input_checksum;
+	gchar *output_checksum;
 
-	cmsHTRANSFORM lcms_transform8;
-	cmsHTRANSFORM lcms_transform16;
+	CmmTransform *transform8;
+	CmmTransform *transform16;
 	const GdkRectangle *roi;
 	gboolean is_gamma_corrected;
 };
 
 G_DEFINE_TYPE (RSCmm, rs_cmm, G_TYPE_OBJECT)
 
-static void load_profile(RSCmm *cmm, const RSIccProfile *profile, const RSIccProfile **profile_target, cmsHPROFILE *lcms_target);
+static void load_profile(RSCmm *cmm, const RSIccProfile *profile, const RSIccProfile **profile_target, gchar **checksum_target);
 static void prepare8(RSCmm *cmm);
 static void prepare16(RSCmm *cmm);
+static gboolean is_profile_gamma_22_corrected(cmsHPROFILE *profile);
+static void transform_unref(CmmTransform *transform);
 
 static GMutex is_profile_gamma_22_corrected_linear_lock;
 
+static GMutex transform_lock;
+static GQueue transform_cache = G_QUEUE_INIT; /* Most recently used first */
+
 typedef struct {
 	RSCmm *cmm;
-	GThread *threadid;
 	gint start_y;
 	gint end_y;
 	gint start_x;
@@ -74,6 +88,21 @@ rs_cmm_dispose(GObject *object)
 	G_OBJECT_CLASS(rs_cmm_parent_class)->dispose (object);
 }
 
+static void
+rs_cmm_finalize(GObject *object)
+{
+	RSCmm *cmm = RS_CMM(object);
+
+	if (cmm->transform8)
+		transform_unref(cmm->transform8);
+	if (cmm->transform16)
+		transform_unref(cmm->transform16);
+	g_free(cmm->input_checksum);
+	g_free(cmm->output_checksum);
+
+	G_OBJECT_CLASS(rs_cmm_parent_class)->finalize (object);
+}
+
 static void
 rs_cmm_class_init(RSCmmClass *klass)
 {
@@ -82,6 +111,7 @@ rs_cmm_class_init(RSCmmClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
 	object_class->dispose = rs_cmm_dispose;
+	object_class->finalize = rs_cmm_finalize;
 
 	/* Build our 2.2 gamma table */
 	for (n=0;n<65536;n++)
@@ -116,7 +146,7 @@ rs_cmm_set_input_profile(RSCmm *cmm, const RSIccProfile *input_profile)
 	g_return_if_fail(RS_IS_CMM(cmm));
 	g_return_if_fail(RS_IS_ICC_PROFILE(input_profile));
 
-	load_profile(cmm, input_profile, &cmm->input_profile, &cmm->lcms_input_profile);
+	load_profile(cmm, input_profile, &cmm->input_profile, &cmm->input_checksum);
 }
 
 void
@@ -125,7 +155,7 @@ rs_cmm_set_output_profile(RSCmm *cmm, const RSIccProfile *output_profile)
 	g_return_if_fail(RS_IS_CMM(cmm));
 	g_return_if_fail(RS_IS_ICC_PROFILE(output_profile));
 
-	load_profile(cmm, output_profile, &cmm->output_profile, &cmm->lcms_output_profile);
+	load_profile(cmm, output_profile, &cmm->output_profile, &cmm->output_checksum);
 }
 
 void
@@ -224,7 +254,7 @@ rs_cmm_transform16(RSCmm *cmm, RS_IMAGE16 *input, RS_IMAGE16 *output, gint start
 				buffer_pointer++;
 			}
 		}
-		cmsDoTransform(cmm->lcms_transform16, buffer, out, w);
+		cmsDoTransform(cmm->transform16->lcms_transform, buffer, out, w);
 	}
 	g_free(buffer);
 }
@@ -246,7 +276,7 @@ rs_cmm_transform8(RSCmm *cmm, RS_IMAGE16 *input, GdkPixbuf *output, gint start_x
 	{
 		gushort *in = GET_PIXEL(input, start_x, y);
 		guchar *out = GET_PIXBUF_PIXEL(output, start_x, y);
-		cmsDoTransform(cmm->lcms_transform8, in, out, w);
+		cmsDoTransform(cmm->transform8->lcms_transform, in, out, w);
 		/* Set alpha */
 		for (i = 0; i < w; i++)
 			out[i*4+3] = 0xff;
@@ -275,7 +305,7 @@ rs_cmm_transform(RSCmm *cmm, RS_IMAGE16 *input, void *output, gboolean sixteen_t
 	gint i;
 	guint y_offset, y_per_thread, threaded_h;
 	gint threads = cmm->num_threads;
-	ThreadInfo *t = g_new(ThreadInfo, threads);
+	ThreadInfo *t;
 
 	const GdkRectangle *roi = cmm->roi;
 	threaded_h = roi->height;
@@ -286,13 +316,19 @@ rs_cmm_transform(RSCmm *cmm, RS_IMAGE16 *input, void *output, gboolean sixteen_t
 	{
 		if (cmm->dirty16)
 			prepare16(cmm);
+		if (!cmm->transform16)
+			return;
 	}
 	else
 	{
 		if (cmm->dirty8)
 			prepare8(cmm);
+		if (!cmm->transform8)
+			return;
 	}
 
+	t = g_new(ThreadInfo, threads);
+
 	for (i = 0; i < threads; i++)
 	{
 		t[i].cmm = cmm;
@@ -305,19 +341,15 @@ rs_cmm_transform(RSCmm *cmm, RS_IMAGE16 *input, void *output, gboolean sixteen_t
 		y_offset += y_per_thread;
 		y_offset = MIN(input->h, y_offset);
 		t[i].end_y = y_offset;
-
-		t[i].threadid = g_thread_new("RSCmm worker", start_single_transform_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	rs_thread_pool_run(start_single_transform_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 }
 
 static void
-load_profile(RSCmm *cmm, const RSIccProfile *profile, const RSIccProfile **profile_target, cmsHPROFILE *lcms_target)
+load_profile(RSCmm *cmm, const RSIccProfile *profile, const RSIccProfile **profile_target, gchar **checksum_target)
 {
 	gchar *data;
 	gsize length;
@@ -327,33 +359,133 @@ load_profile(RSCmm *cmm, const RSIccProfile *profile, const RSIccProfile **profi
 
 	*profile_target = profile;
 
-	if (*lcms_target)
-		cmsCloseProfile(*lcms_target);
+	/* Transforms are looked up by the contents of the profiles, the lcms
+	 * profile is only opened if a transform must be built */
+	g_free(*checksum_target);
+	*checksum_target = NULL;
 
 	if (rs_icc_profile_get_data(profile, &data, &length))
-		*lcms_target = cmsOpenProfileFromMem(data, length);
+	{
+		*checksum_target = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *) data, length);
+		g_free(data);
+	}
 
-	g_warn_if_fail(*lcms_target != NULL);
+	g_warn_if_fail(*checksum_target != NULL);
 
 	cmm->dirty8 = TRUE;
 	cmm->dirty16 = TRUE;
 }
 
+static cmsHPROFILE
+open_profile(const RSIccProfile *profile)
+{
+	cmsHPROFILE lcms_profile = NULL;
+	gchar *data;
+	gsize length;
+
+	if (rs_icc_profile_get_data(profile, &data, &length))
+	{
+		lcms_profile = cmsOpenProfileFromMem(data, length);
+		g_free(data);
+	}
+
+	return lcms_profile;
+}
+
+static void
+transform_unref(CmmTransform *transform)
+{
+	if (g_atomic_int_dec_and_test(&transform->refcount))
+	{
+		if (transform->lcms_transform)
+			cmsDeleteTransform(transform->lcms_transform);
+		g_free(transform->key);
+		g_free(transform);
+	}
+}
+
+/* Get a transform between the current profiles of cmm from the cache shared
+ * by all instances, building it if needed. Must be released with
+ * transform_unref(). Returns NULL if no transform could be built */
+static CmmTransform *
+transform_get(RSCmm *cmm, cmsUInt32Number input_format, cmsUInt32Number output_format, cmsUInt32Number flags, gboolean probe_gamma)
+{
+	CmmTransform *transform;
+	cmsHPROFILE input, output;
+	GList *node;
+	gchar *key;
+
+	if (!cmm->input_checksum || !cmm->output_checksum)
+		return NULL;
+
+	key = g_strdup_printf("%s %s %d %x %x %x", cmm->input_checksum, cmm->output_checksum,
+		INTENT_PERCEPTUAL, input_format, output_format, flags);
+
+	g_mutex_lock(&transform_lock);
+	for (node = transform_cache.head; node; node = node->next)
+	{
+		transform = node->data;
+		if (g_str_equal(transform->key, key))
+		{
+			g_queue_unlink(&transform_cache, node);
+			g_queue_push_head_link(&transform_cache, node);
+			g_atomic_int_inc(&transform->refcount);
+			g_mutex_unlock(&transform_lock);
+			g_free(key);
+			return transform;
+		}
+	}
+
+	/* Built with the lock held, so instances don't build the same transform twice */
+	input = open_profile(cmm->input_profile);
+	output = open_profile(cmm->output_profile);
+
+	transform = g_new0(CmmTransform, 1);
+	transform->key = key;
+	if (input && output)
+		transform->lcms_transform = cmsCreateTransform(input, input_format, output, output_format, INTENT_PERCEPTUAL, flags);
+
+	g_warn_if_fail(transform->lcms_transform != NULL);
+
+	/* If we estimate that the input profile will apply gamma correction,
+	   we try to undo it in 16 bit transform */
+	if (probe_gamma && transform->lcms_transform)
+		transform->is_gamma_corrected = is_profile_gamma_22_corrected(input);
+
+	if (input)
+		cmsCloseProfile(input);
+	if (output)
+		cmsCloseProfile(output);
+
+	if (!transform->lcms_transform)
+	{
+		g_mutex_unlock(&transform_lock);
+		transform_unref(transform);
+		return NULL;
+	}
+
+	/* One reference for the cache, one for the caller */
+	transform->refcount = 2;
+	g_queue_push_head(&transform_cache, transform);
+
+	if (g_queue_get_length(&transform_cache) > TRANSFORM_CACHE_SIZE)
+		transform_unref(g_queue_pop_tail(&transform_cache));
+	g_mutex_unlock(&transform_lock);
+
+	return transform;
+}
+
 static void
 prepare8(RSCmm *cmm)
 {
 	if (!cmm->dirty8)
 		return;
 
-	if (cmm->lcms_transform8)
-		cmsDeleteTransform(cmm->lcms_transform8);
+	if (cmm->transform8)
+		transform_unref(cmm->transform8);
 
-	cmm->lcms_transform8 = cmsCreateTransform(
-		cmm->lcms_input_profile, TYPE_RGBA_16,
-		cmm->lcms_output_profile, TYPE_RGBA_8,
-		INTENT_PERCEPTUAL, 0);
+	cmm->transform8 = transform_get(cmm, TYPE_RGBA_16, TYPE_RGBA_8, 0, FALSE);
 
-	g_warn_if_fail(cmm->lcms_transform8 != NULL);
 	cmm->dirty8 = FALSE;
 }
 
@@ -361,7 +493,7 @@ static gboolean
 is_profile_gamma_22_corrected(cmsHPROFILE *profile)
 {
 	cmsHTRANSFORM testtransform;
-	cmsHPROFILE linear = NULL;
+	static cmsHPROFILE linear = NULL;
 	gint n;
 	gint lin = 0;
 	gint g045 = 0;
@@ -434,19 +566,12 @@ prepare16(RSCmm *cmm)
 	if (!cmm->dirty16)
 		return;
 
-	if (cmm->lcms_transform16)
-		cmsDeleteTransform(cmm->lcms_transform16);
-
-	cmm->lcms_transform16 = cmsCreateTransform(
-		cmm->lcms_input_profile, TYPE_RGBA_16,
-		cmm->lcms_output_profile, TYPE_RGBA_16,
-		INTENT_PERCEPTUAL, cmsFLAGS_NOCACHE);
-	g_warn_if_fail(cmm->lcms_transform16 != NULL);
+	if (cmm->transform16)
+		transform_unref(cmm->transform16);
 
 	/* Enable packing/unpacking for pixelsize==4 */
-	/* If we estimate that the input profile will apply gamma correction,
-	   we try to undo it in 16 bit transform */
-	cmm->is_gamma_corrected = is_profile_gamma_22_corrected(cmm->lcms_input_profile);
+	cmm->transform16 = transform_get(cmm, TYPE_RGBA_16, TYPE_RGBA_16, cmsFLAGS_NOCACHE, TRUE);
+	cmm->is_gamma_corrected = cmm->transform16 && cmm->transform16->is_gamma_corrected;
 
 	cmm->dirty16 = FALSE;
 }
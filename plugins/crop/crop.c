@@ -33,6 +33,7 @@ typedef struct _RSCropClass RSCropClass;
 struct _RSCrop {
 	RSFilter parent;
 
+	GMutex lock; /* Protects target, effective, width, height and scale */
 	RS_RECT target;
 	RS_RECT effective;
 	gint width;
@@ -63,9 +64,11 @@ enum {
 
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
-static void calc(RSCrop *crop);
+static void calc(RSCrop *crop, RS_RECT *effective, gint *width, gint *height);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
+static gint get_tile_border(RSFilter *filter);
 static RSFilterResponse *get_size(RSFilter *filter, const RSFilterRequest *request);
+static void finalize(GObject *object);
 
 static RSFilterClass *rs_crop_parent_class = NULL;
 
@@ -86,6 +89,7 @@ rs_crop_class_init (RSCropClass *klass)
 
 	object_class->get_property = get_property;
 	object_class->set_property = set_property;
+	object_class->finalize = finalize;
 
 	g_object_class_install_property(object_class,
 		PROP_RECTANGLE, g_param_spec_pointer (
@@ -129,6 +133,7 @@ rs_crop_class_init (RSCropClass *klass)
 
 	filter_class->name = "Crop filter";
 	filter_class->get_image = get_image;
+	filter_class->get_tile_border = get_tile_border;
 	filter_class->get_size = get_size;
 }
 
@@ -140,6 +145,17 @@ rs_crop_init (RSCrop *crop)
 	crop->target.y1 = 0;
 	crop->target.y2 = 65535;
 	crop->scale = 1.0f;
+	g_mutex_init(&crop->lock);
+}
+
+static void
+finalize(GObject *object)
+{
+	RSCrop *crop = RS_CROP(object);
+
+	g_mutex_clear(&crop->lock);
+
+	G_OBJECT_CLASS(rs_crop_parent_class)->finalize(object);
 }
 
 static void
@@ -147,8 +163,9 @@ get_property (GObject *object, guint property_id, GValue *value, GParamSpec *psp
 {
 	RSCrop *crop = RS_CROP(object);
 
-	calc(crop);
+	calc(crop, NULL, NULL, NULL);
 
+	g_mutex_lock(&crop->lock);
 	switch (property_id)
 	{
 		case PROP_RECTANGLE:
@@ -187,6 +204,7 @@ get_property (GObject *object, guint property_id, GValue *value, GParamSpec *psp
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&crop->lock);
 }
 
 static void
@@ -195,8 +213,10 @@ set_property (GObject *object, guint property_id, const GValue *value, GParamSpe
 	RSCrop *crop = RS_CROP(object);
 	RSFilter *filter = RS_FILTER(crop);
 	RS_RECT *rect;
+	gboolean changed = FALSE;
 	int n;
 
+	g_mutex_lock(&crop->lock);
 	switch (property_id)
 	{
 		case PROP_RECTANGLE:
@@ -206,7 +226,7 @@ set_property (GObject *object, guint property_id, const GValue *value, GParamSpe
 				if (crop->target.x1 != rect->x1 || crop->target.x2 != rect->x2 || crop->target.y1 != rect->y1 || crop->target.y2 != rect->y2)
 				{
 					crop->target = *rect;
-					rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
+					changed = TRUE;
 				}
 			}
 			else
@@ -217,7 +237,7 @@ set_property (GObject *object, guint property_id, const GValue *value, GParamSpe
 					crop->target.x2 = 65535;
 					crop->target.y1 = 0;
 					crop->target.y2 = 65535;
-					rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
+					changed = TRUE;
 				}
 			}
 			break;
@@ -225,64 +245,95 @@ set_property (GObject *object, guint property_id, const GValue *value, GParamSpe
 			n = g_value_get_int(value);
 			if (n != crop->target.x1)
 			{
-				rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
 				crop->target.x1 = n;
+				changed = TRUE;
 			}
 			break;
 		case PROP_Y1:
 			n = g_value_get_int(value);
 			if (n != crop->target.y1)
 			{
-				rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
 				crop->target.y1 = n;
+				changed = TRUE;
 			}
 			break;
 		case PROP_X2:
 			n = g_value_get_int(value);
 			if (n != crop->target.x2)
 			{
-				rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
 				crop->target.x2 = n;
+				changed = TRUE;
 			}
 			break;
 		case PROP_Y2:
 			n = g_value_get_int(value);
 			if (n != crop->target.y2)
 			{
-				rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
 				crop->target.y2 = n;
+				changed = TRUE;
 			}
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&crop->lock);
+
+	/* Never emit while holding the lock, listeners may read us back */
+	if (changed)
+		rs_filter_changed(filter, RS_FILTER_CHANGED_DIMENSION);
 }
 
+/**
+ * Updates the effective crop from the target and the size of the parent.
+ * The results are copied to effective, width and height if non-NULL, so
+ * callers can keep using a consistent crop while the main loop changes it
+ */
 static void
-calc(RSCrop *crop)
+calc(RSCrop *crop, RS_RECT *effective, gint *width, gint *height)
 {
 	RSFilter *filter = RS_FILTER(crop);
-	if (!filter->previous)
-		return;
-	crop->scale = 1.0f;
-	rs_filter_get_recursive(filter->previous, "scale", &crop->scale, NULL);
+	RSFilterResponse *response = NULL;
+	gfloat scale = 1.0f;
 
-	RSFilterResponse *response = rs_filter_get_size(filter->previous, RS_FILTER_REQUEST_QUICK);
+	/* Ask the parents before locking, they may take their own locks */
+	if (filter->previous)
+	{
+		rs_filter_get_recursive(filter->previous, "scale", &scale, NULL);
+		response = rs_filter_get_size(filter->previous, RS_FILTER_REQUEST_QUICK);
+	}
 
-	if (!response)
-		return;
+	g_mutex_lock(&crop->lock);
+	if (response)
+	{
+		gint parent_width = rs_filter_response_get_width(response);
+		gint parent_height = rs_filter_response_get_height(response);
 
-	gint parent_width = rs_filter_response_get_width(response);
-	gint parent_height = rs_filter_response_get_height(response);
-	g_object_unref(response);
+		crop->scale = scale;
+		crop->effective.x1 = CLAMP((float)crop->target.x1 * crop->scale + 0.5f, 0, parent_width-1);
+		crop->effective.x2 = CLAMP((float)crop->target.x2 * crop->scale + 0.5f, 0, parent_width-1);
+		crop->effective.y1 = CLAMP((float)crop->target.y1 * crop->scale + 0.5f, 0, parent_height-1);
+		crop->effective.y2 = CLAMP((float)crop->target.y2 * crop->scale + 0.5f, 0, parent_height-1);
 
-	crop->effective.x1 = CLAMP((float)crop->target.x1 * crop->scale + 0.5f, 0, parent_width-1);
-	crop->effective.x2 = CLAMP((float)crop->target.x2 * crop->scale + 0.5f, 0, parent_width-1);
-	crop->effective.y1 = CLAMP((float)crop->target.y1 * crop->scale + 0.5f, 0, parent_height-1);
-	crop->effective.y2 = CLAMP((float)crop->target.y2 * crop->scale + 0.5f, 0, parent_height-1);
+		crop->width = crop->effective.x2 - crop->effective.x1 + 1;
+		crop->height = crop->effective.y2 - crop->effective.y1 + 1;
+	}
+	if (effective)
+		*effective = crop->effective;
+	if (width)
+		*width = crop->width;
+	if (height)
+		*height = crop->height;
+	g_mutex_unlock(&crop->lock);
+
+	if (response)
+		g_object_unref(response);
+}
 
-	crop->width = crop->effective.x2 - crop->effective.x1 + 1;
-	crop->height = crop->effective.y2 - crop->effective.y1 + 1;
+/* Tiles are copied from the same area of the parent */
+static gint
+get_tile_border(RSFilter *filter)
+{
+	return 0;
 }
 
 static RSFilterResponse *
@@ -294,6 +345,11 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response;
 	RS_IMAGE16 *output;
 	RS_IMAGE16 *input;
+	RS_RECT effective;
+	GdkRectangle *roi;
+	GdkRectangle area, parent_roi;
+	gint width, height;
+	gint x, y;
 	gint row;
 
 	/* We request response twice, is that wise? */
@@ -302,60 +358,67 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	gint parent_height = rs_filter_response_get_height(response);
 	g_object_unref(response);
 
-	calc(crop);
+	calc(crop, &effective, &width, &height);
 
 	/* Special case for full crop */
-	if ((crop->width == parent_width) && (crop->height==parent_height))
-		return rs_filter_get_image(filter->previous, request);
-	
-	/* Add ROI for cropped region */
-	if (!rs_filter_request_get_roi(request))
-	{
-		GdkRectangle* roi = g_new(GdkRectangle, 1);
-		roi->x = crop->effective.x1;
-		roi->y = crop->effective.y1;
-		roi->width = crop->width;
-		roi->height = crop->height;
-		RSFilterRequest *new_request = rs_filter_request_clone(request);
-		rs_filter_request_set_roi(new_request, roi);
-		previous_response = rs_filter_get_image(filter->previous, new_request);
-		g_free(roi);
-		g_object_unref(new_request);
-	} 
-	else 
-	{
-		/* Add crop to ROI */
-		GdkRectangle* org_roi = rs_filter_request_get_roi(request);
-		GdkRectangle* roi = g_new(GdkRectangle, 1);
-		roi->x = org_roi->x + crop->effective.x1;
-		roi->y = org_roi->y + crop->effective.y1;
-		roi->width = MIN(org_roi->width, crop->width - org_roi->x);
-		roi->height = MIN(org_roi->height, crop->height - org_roi->y);
-		RSFilterRequest *new_request = rs_filter_request_clone(request);
-		rs_filter_request_set_roi(new_request, roi);
-		previous_response = rs_filter_get_image(filter->previous, new_request);
-		g_free(roi);
-		g_object_unref(new_request);
-	}
+	if ((width == parent_width) && (height==parent_height))
+		return rs_filter_get_image_roi(filter->previous, request);
 	
+	/* The part of the crop to render */
+	area.x = 0;
+	area.y = 0;
+	area.width = width;
+	area.height = height;
+	if ((roi = rs_filter_request_get_roi(request)) && !gdk_rectangle_intersect(roi, &area, &area))
+		roi = NULL;
+
+	/* Ask for the same area of the parent */
+	parent_roi = area;
+	parent_roi.x += effective.x1;
+	parent_roi.y += effective.y1;
+	RSFilterRequest *new_request = rs_filter_request_clone(request);
+	rs_filter_request_set_roi(new_request, &parent_roi);
+	previous_response = rs_filter_get_image_roi(filter->previous, new_request);
+	g_object_unref(new_request);
+
 	input = rs_filter_response_get_image(previous_response);
 
 	if (!RS_IS_IMAGE16(input))
 		return previous_response;
 
+	/* Where input is placed in the parent */
+	rs_filter_response_get_origin(previous_response, &x, &y);
+
 	response = rs_filter_response_clone(previous_response);
 	gboolean half_size = FALSE;
 	rs_filter_param_get_boolean(RS_FILTER_PARAM(previous_response), "half-size", &half_size);
 	g_object_unref(previous_response);
 
+	/* Half size images are whole images, render all of the crop */
+	if (half_size)
+	{
+		area.x = 0;
+		area.y = 0;
+		area.width = width;
+		area.height = height;
+		roi = NULL;
+	}
+
 	int shift = half_size ? 1 : 0;
-	output = rs_image16_new(crop->width>>shift, crop->height>>shift, 3, input->pixelsize);
+	output = rs_image16_new(area.width>>shift, area.height>>shift, 3, input->pixelsize);
 	rs_filter_response_set_image(response, output);
+	rs_filter_response_set_roi(response, roi ? &area : NULL);
 	g_object_unref(output);
 
+	/* The parent may have changed size since calc(), never read outside input */
+	gint src_x = ((area.x + effective.x1)>>shift) - x;
+	gint src_y = ((area.y + effective.y1)>>shift) - y;
+	gint copy_w = MIN(output->w, input->w - src_x);
+	gint copy_h = MIN(output->h, input->h - src_y);
+
 	/* Copy a row at a time */
-	for(row=0; row<output->h; row++)
-		memcpy(GET_PIXEL(output, 0, row), GET_PIXEL(input, crop->effective.x1>>shift, row+(crop->effective.y1>>shift)), output->rowstride*sizeof(gushort));
+	for(row=0; row<copy_h && copy_w > 0 && src_x >= 0 && src_y >= 0; row++)
+		memcpy(GET_PIXEL(output, 0, row), GET_PIXEL(input, src_x, row + src_y), copy_w*output->pixelsize*sizeof(gushort));
 
 	g_object_unref(input);
 
@@ -366,8 +429,9 @@ static RSFilterResponse *
 get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSCrop *crop = RS_CROP(filter);
+	gint width, height;
 
-	calc(crop);
+	calc(crop, NULL, &width, &height);
 
 	RSFilterResponse *previous_response = rs_filter_get_size(filter->previous, request);
 	if (!previous_response)
@@ -376,8 +440,8 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	rs_filter_response_set_width(response, crop->width);
-	rs_filter_response_set_height(response, crop->height);
+	rs_filter_response_set_width(response, width);
+	rs_filter_response_set_height(response, height);
 
 	return response;
 }
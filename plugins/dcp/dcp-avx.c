@@ -617,7 +617,7 @@ gboolean
 render_AVX(ThreadInfo* t)
 {
 	RS_IMAGE16 *image = t->tmp;
-	RSDcp *dcp = t->dcp;
+	RSDcpState *dcp = t->state;
 	gint x, y;
 	__m128 h, s, v;
 	__m128i p1,p2;
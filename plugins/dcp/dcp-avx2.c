@@ -0,0 +1,521 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "dcp.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+#include <math.h> /* powf() */
+#include <pow-sse2.h> /* _mm_fastpow_ps() */
+
+/* This is the AVX2 version of render_SSE4(), processing 8 pixels per
+ * iteration. Table lookups (huesat maps, curve and tone curve) are done
+ * with gathers instead of per-lane loads. */
+
+#define LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define LE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define GE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define EQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+
+static inline void
+RGBtoHSV_AVX2(__m256 *c0, __m256 *c1, __m256 *c2)
+{
+	__m256 zero_ps = _mm256_setzero_ps();
+	__m256 small_ps = _mm256_set1_ps(1e-15);
+	__m256 ones_ps = _mm256_set1_ps(1.0f);
+
+	/* Any number > 1 */
+	__m256 add_v = _mm256_set1_ps(2.0f);
+
+	/* Clamp */
+	__m256 r = _mm256_min_ps(_mm256_max_ps(*c0, small_ps), ones_ps);
+	__m256 g = _mm256_min_ps(_mm256_max_ps(*c1, small_ps), ones_ps);
+	__m256 b = _mm256_min_ps(_mm256_max_ps(*c2, small_ps), ones_ps);
+
+	__m256 v = _mm256_max_ps(b, _mm256_max_ps(r, g));
+	__m256 m = _mm256_min_ps(b, _mm256_min_ps(r, g));
+	__m256 gap = _mm256_sub_ps(v, m);
+	__m256 v_mask = EQ(gap, zero_ps);
+	v = _mm256_add_ps(v, _mm256_and_ps(add_v, v_mask));
+
+	/* Set gap to one where sat = 0, this will avoid divisions by zero, these values will not be used */
+	gap = _mm256_or_ps(gap, _mm256_and_ps(ones_ps, v_mask));
+	__m256 gap_inv = _mm256_rcp_ps(gap);
+
+	/* if r == v: h = (g - b) / gap; */
+	__m256 mask = EQ(r, v);
+	__m256 h = _mm256_and_ps(mask, _mm256_mul_ps(gap_inv, _mm256_sub_ps(g, b)));
+	v = _mm256_add_ps(v, _mm256_and_ps(add_v, mask));
+
+	/* if g == v: h = 2.0f + (b - r) / gap; */
+	mask = EQ(g, v);
+	h = _mm256_blendv_ps(h, _mm256_fmadd_ps(_mm256_sub_ps(b, r), gap_inv, _mm256_set1_ps(2.0f)), mask);
+	v = _mm256_add_ps(v, _mm256_and_ps(add_v, mask));
+
+	/* if b == v: h = 4.0f + (r - g) / gap; */
+	mask = EQ(b, v);
+	h = _mm256_blendv_ps(h, _mm256_fmadd_ps(_mm256_sub_ps(r, g), gap_inv, _mm256_set1_ps(4.0f)), mask);
+	v = _mm256_add_ps(v, _mm256_and_ps(add_v, mask));
+
+	/* Fill s, if gap > 0 */
+	v = _mm256_sub_ps(v, add_v);
+	__m256 s = _mm256_andnot_ps(v_mask, _mm256_mul_ps(gap, _mm256_rcp_ps(v)));
+
+	/* Check if h < 0 */
+	h = _mm256_add_ps(h, _mm256_and_ps(LT(h, zero_ps), _mm256_set1_ps(6.0f-1e-15)));
+
+	*c0 = h;
+	*c1 = s;
+	*c2 = v;
+}
+
+static inline void
+HSVtoRGB_AVX2(__m256 *c0, __m256 *c1, __m256 *c2)
+{
+	__m256 h = *c0;
+	__m256 s = *c1;
+	__m256 v = *c2;
+	__m256 r, g, b, m;
+	__m256 ones_ps = _mm256_set1_ps(1.0f);
+
+	__m256 h_fraction = _mm256_sub_ps(h, _mm256_floor_ps(h));
+
+	/* p = v * (1.0f - s)  */
+	__m256 p = _mm256_fnmadd_ps(v, s, v);
+	/* q = (v * (1.0f - s * f)) */
+	__m256 q = _mm256_mul_ps(v, _mm256_fnmadd_ps(s, h_fraction, ones_ps));
+	/* t = (v * (1.0f - s * (1.0f - f))) */
+	__m256 t = _mm256_mul_ps(v, _mm256_fnmadd_ps(s, _mm256_sub_ps(ones_ps, h_fraction), ones_ps));
+
+	/* Start from case 5: r = v; g = p; b = q; and overwrite with the
+	 * lower cases from the top */
+	r = v; g = p; b = q;
+
+	/* case 4: r = t; g = p; b = v; */
+	m = LT(h, _mm256_set1_ps(5.0f));
+	r = _mm256_blendv_ps(r, t, m);
+	b = _mm256_blendv_ps(b, v, m);
+
+	/* case 3: r = p; g = q; b = v; */
+	m = LT(h, _mm256_set1_ps(4.0f));
+	r = _mm256_blendv_ps(r, p, m);
+	g = _mm256_blendv_ps(g, q, m);
+
+	/* case 2: r = p; g = v; b = t; */
+	m = LT(h, _mm256_set1_ps(3.0f));
+	g = _mm256_blendv_ps(g, v, m);
+	b = _mm256_blendv_ps(b, t, m);
+
+	/* case 1: r = q; g = v; b = p; */
+	m = LT(h, _mm256_set1_ps(2.0f));
+	r = _mm256_blendv_ps(r, q, m);
+	b = _mm256_blendv_ps(b, p, m);
+
+	/* case 0: r = v; g = t; b = p; */
+	m = LT(h, ones_ps);
+	r = _mm256_blendv_ps(r, v, m);
+	g = _mm256_blendv_ps(g, t, m);
+
+	*c0 = r;
+	*c1 = g;
+	*c2 = b;
+}
+
+/* Apply _mm_fastpow_ps() to both halves */
+static inline __m256
+fastpow_AVX2(__m256 x, gfloat y)
+{
+	__m128 e = _mm_set1_ps(y);
+	__m128 lo = _mm_fastpow_ps(_mm256_castps256_ps128(x), e);
+	__m128 hi = _mm_fastpow_ps(_mm256_extractf128_ps(x, 1), e);
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+/* Bilinear interpolation between entry and entry + 4 (next saturation) of
+ * the precalculated table, for all three components */
+static inline void
+hsm_gather_AVX2(const gfloat *table, __m256i offsets, __m256 s0, __m256 s1, __m256 w, __m256 *hue, __m256 *sat, __m256 *val)
+{
+	__m256i next = _mm256_add_epi32(offsets, _mm256_set1_epi32(4));
+	__m256 a, b;
+
+	a = _mm256_i32gather_ps(table, offsets, 4);
+	b = _mm256_i32gather_ps(table, next, 4);
+	*hue = _mm256_fmadd_ps(w, _mm256_fmadd_ps(a, s0, _mm256_mul_ps(b, s1)), *hue);
+
+	a = _mm256_i32gather_ps(table + 1, offsets, 4);
+	b = _mm256_i32gather_ps(table + 1, next, 4);
+	*sat = _mm256_fmadd_ps(w, _mm256_fmadd_ps(a, s0, _mm256_mul_ps(b, s1)), *sat);
+
+	a = _mm256_i32gather_ps(table + 2, offsets, 4);
+	b = _mm256_i32gather_ps(table + 2, next, 4);
+	*val = _mm256_fmadd_ps(w, _mm256_fmadd_ps(a, s0, _mm256_mul_ps(b, s1)), *val);
+}
+
+static void
+huesat_map_AVX2(RSHuesatMap *map, const PrecalcHSM* precalc, __m256 *_h, __m256 *_s, __m256 *_v)
+{
+	__m256 zero_ps = _mm256_setzero_ps();
+	__m256 ones_ps = _mm256_set1_ps(1.0f);
+	const gfloat *table = precalc->lookups;
+
+	__m256 h = *_h;
+	/* Clamp - H must be pre-clamped */
+	__m256 s = _mm256_min_ps(_mm256_max_ps(*_s, zero_ps), ones_ps);
+	__m256 v = _mm256_min_ps(_mm256_max_ps(*_v, zero_ps), ones_ps);
+
+	__m256 hueShift = zero_ps;
+	__m256 satScale = zero_ps;
+	__m256 valScale = zero_ps;
+
+	if (map->val_divisions >= 2 && map->v_encoding == 1)
+		v = fastpow_AVX2(v, 1.0f / 2.2f);
+
+	__m256 hScaled = _mm256_mul_ps(h, _mm256_set1_ps(precalc->hScale[0]));
+	__m256 sScaled = _mm256_mul_ps(s, _mm256_set1_ps(precalc->sScale[0]));
+	__m256i hIndex0 = _mm256_cvttps_epi32(hScaled);
+	__m256i sIndex0 = _mm256_cvttps_epi32(sScaled);
+	__m256i hIndex1 = _mm256_add_epi32(hIndex0, _mm256_set1_epi32(1));
+
+	/* We must max here, since otherwise we might get -0 values */
+	__m256 hFract1 = _mm256_max_ps(zero_ps, _mm256_sub_ps(hScaled, _mm256_cvtepi32_ps(hIndex0)));
+	__m256 sFract1 = _mm256_max_ps(zero_ps, _mm256_sub_ps(sScaled, _mm256_cvtepi32_ps(sIndex0)));
+	__m256 hFract0 = _mm256_sub_ps(ones_ps, hFract1);
+	__m256 sFract0 = _mm256_sub_ps(ones_ps, sFract1);
+
+	__m256i hueStep = _mm256_set1_epi32(precalc->hueStep[0]);
+	__m256i offsets0 = _mm256_add_epi32(sIndex0, _mm256_mullo_epi32(hIndex0, hueStep));
+	__m256i offsets1 = _mm256_add_epi32(sIndex0, _mm256_mullo_epi32(hIndex1, hueStep));
+
+	if (map->val_divisions < 2)
+	{
+		offsets0 = _mm256_slli_epi32(offsets0, 2);
+		offsets1 = _mm256_slli_epi32(offsets1, 2);
+		hsm_gather_AVX2(table, offsets0, sFract0, sFract1, hFract0, &hueShift, &satScale, &valScale);
+		hsm_gather_AVX2(table, offsets1, sFract0, sFract1, hFract1, &hueShift, &satScale, &valScale);
+	}
+	else
+	{
+		__m256 vScaled = _mm256_mul_ps(v, _mm256_set1_ps(precalc->vScale[0]));
+		__m256i vIndex0 = _mm256_cvttps_epi32(vScaled);
+		__m256 vFract1 = _mm256_max_ps(zero_ps, _mm256_sub_ps(vScaled, _mm256_cvtepi32_ps(vIndex0)));
+		__m256 vFract0 = _mm256_sub_ps(ones_ps, vFract1);
+		__m256i valStep = _mm256_set1_epi32(precalc->valStep[0]);
+		__m256i vOffset = _mm256_mullo_epi32(vIndex0, valStep);
+
+		offsets0 = _mm256_slli_epi32(_mm256_add_epi32(offsets0, vOffset), 2);
+		offsets1 = _mm256_slli_epi32(_mm256_add_epi32(offsets1, vOffset), 2);
+		__m256i valStep4 = _mm256_slli_epi32(valStep, 2);
+
+		hsm_gather_AVX2(table, offsets0, sFract0, sFract1, _mm256_mul_ps(hFract0, vFract0), &hueShift, &satScale, &valScale);
+		hsm_gather_AVX2(table, offsets1, sFract0, sFract1, _mm256_mul_ps(hFract1, vFract0), &hueShift, &satScale, &valScale);
+		hsm_gather_AVX2(table, _mm256_add_epi32(offsets0, valStep4), sFract0, sFract1, _mm256_mul_ps(hFract0, vFract1), &hueShift, &satScale, &valScale);
+		hsm_gather_AVX2(table, _mm256_add_epi32(offsets1, valStep4), sFract0, sFract1, _mm256_mul_ps(hFract1, vFract1), &hueShift, &satScale, &valScale);
+	}
+
+	v = _mm256_min_ps(ones_ps, _mm256_mul_ps(v, valScale));
+
+	/* sRGB encoded V */
+	if (map->val_divisions >= 2 && map->v_encoding == 1)
+		v = fastpow_AVX2(v, 2.2f);
+
+	*_h = _mm256_add_ps(h, hueShift);
+	*_s = _mm256_min_ps(ones_ps, _mm256_mul_ps(s, satScale));
+	*_v = v;
+}
+
+/* Interpolated lookup in a table of (v0, v1) pairs */
+static inline __m256
+curve_interpolate_lookup_AVX2(__m256 value, gfloat scale, const gfloat * const lut)
+{
+	__m256 mul = _mm256_mul_ps(value, _mm256_set1_ps(scale));
+	__m256 fl = _mm256_floor_ps(mul);
+	__m256i lookup = _mm256_slli_epi32(_mm256_cvttps_epi32(fl), 1);
+	__m256 frac = _mm256_sub_ps(mul, fl);
+
+	__m256 v0 = _mm256_i32gather_ps(lut, lookup, 4);
+	__m256 v1 = _mm256_i32gather_ps(lut + 1, lookup, 4);
+	return _mm256_fmadd_ps(frac, _mm256_sub_ps(v1, v0), v0);
+}
+
+static inline void
+rgb_tone_AVX2(__m256* _r, __m256* _g, __m256* _b, const gfloat * const tone_lut)
+{
+	__m256 small_ps = _mm256_set1_ps(1e-15);
+	__m256 ones_ps = _mm256_set1_ps(1.0f);
+
+	/* Clamp to avoid lookups out of table */
+	__m256 r = _mm256_min_ps(_mm256_max_ps(*_r, small_ps), ones_ps);
+	__m256 g = _mm256_min_ps(_mm256_max_ps(*_g, small_ps), ones_ps);
+	__m256 b = _mm256_min_ps(_mm256_max_ps(*_b, small_ps), ones_ps);
+
+	/* Find largest and smallest values */
+	__m256 lg = _mm256_max_ps(b, _mm256_max_ps(r, g));
+	__m256 sm = _mm256_min_ps(b, _mm256_min_ps(r, g));
+
+	/* Lookup */
+	__m256 LG = curve_interpolate_lookup_AVX2(lg, 1023.99999f, tone_lut);
+	__m256 SM = curve_interpolate_lookup_AVX2(sm, 1023.99999f, tone_lut);
+
+	/* Create masks for largest, smallest and medium values */
+	__m256 is_r_lg = EQ(r, lg);
+	__m256 is_g_lg = EQ(g, lg);
+	__m256 is_b_lg = EQ(b, lg);
+	__m256 is_r_sm = _mm256_andnot_ps(is_r_lg, EQ(r, sm));
+	__m256 is_g_sm = _mm256_andnot_ps(is_g_lg, EQ(g, sm));
+	__m256 is_b_sm = _mm256_andnot_ps(is_b_lg, EQ(b, sm));
+	__m256 is_r_md = _mm256_andnot_ps(_mm256_or_ps(is_r_lg, is_r_sm), EQ(r, r));
+	__m256 is_g_md = _mm256_andnot_ps(_mm256_or_ps(is_g_lg, is_g_sm), EQ(g, g));
+	__m256 is_b_md = _mm256_andnot_ps(_mm256_or_ps(is_b_lg, is_b_sm), EQ(b, b));
+
+	/* Find all medium values based on masks */
+	__m256 md = _mm256_or_ps(_mm256_or_ps(_mm256_and_ps(r, is_r_md), _mm256_and_ps(g, is_g_md)), _mm256_and_ps(b, is_b_md));
+
+	/* Calculate tone corrected medium value */
+	__m256 p = _mm256_rcp_ps(_mm256_sub_ps(lg, sm));
+	__m256 q = _mm256_sub_ps(md, sm);
+	__m256 o = _mm256_sub_ps(LG, SM);
+	__m256 MD = _mm256_fmadd_ps(o, _mm256_mul_ps(p, q), SM);
+
+	/* Combine corrected values to output RGB */
+	*_r = _mm256_or_ps(_mm256_or_ps(_mm256_and_ps(LG, is_r_lg), _mm256_and_ps(SM, is_r_sm)), _mm256_and_ps(MD, is_r_md));
+	*_g = _mm256_or_ps(_mm256_or_ps(_mm256_and_ps(LG, is_g_lg), _mm256_and_ps(SM, is_g_sm)), _mm256_and_ps(MD, is_g_md));
+	*_b = _mm256_or_ps(_mm256_or_ps(_mm256_and_ps(LG, is_b_lg), _mm256_and_ps(SM, is_b_sm)), _mm256_and_ps(MD, is_b_md));
+}
+
+/* Wrap hue into [0, 6) */
+static inline __m256
+hue_wrap_AVX2(__m256 h)
+{
+	__m256 six_ps = _mm256_set1_ps(6.0f-1e-15);
+	h = _mm256_sub_ps(h, _mm256_and_ps(six_ps, GE(h, six_ps)));
+	return _mm256_add_ps(h, _mm256_and_ps(six_ps, LT(h, _mm256_setzero_ps())));
+}
+
+/* See exposure_ramp() */
+static inline __m256
+exposure_ramp_AVX2(RSDcpState *dcp, __m256 x)
+{
+	__m256 black_minus_radius = _mm256_set1_ps(dcp->exposure_black - dcp->exposure_radius);
+	__m256 black_plus_radius = _mm256_set1_ps(dcp->exposure_black + dcp->exposure_radius);
+
+	__m256 y = _mm256_sub_ps(x, black_minus_radius);
+	y = _mm256_mul_ps(_mm256_set1_ps(dcp->exposure_qscale), _mm256_mul_ps(y, y));
+	__m256 y2 = _mm256_mul_ps(_mm256_set1_ps(dcp->exposure_slope), _mm256_sub_ps(x, _mm256_set1_ps(dcp->exposure_black)));
+
+	y = _mm256_blendv_ps(y, y2, GT(x, black_plus_radius));
+	return _mm256_andnot_ps(LE(x, black_minus_radius), y);
+}
+
+gboolean
+render_AVX2(ThreadInfo* t)
+{
+	RS_IMAGE16 *image = t->tmp;
+	RSDcpState *dcp = t->state;
+	gint x, y;
+	__m256 h, s, v;
+	__m256 r, g, b, r2, g2, b2;
+	int _mm_rounding = _MM_GET_ROUNDING_MODE();
+	_MM_SET_ROUNDING_MODE(_MM_ROUND_DOWN);
+
+	gboolean do_contrast = (dcp->contrast > 1.001f);
+	gboolean do_highrec = (dcp->contrast < 0.999f);
+	float exposure_simple = MAX(1.0, powf(2.0f, dcp->exposure));
+	float __recover_radius = 0.5 * exposure_simple;
+
+	const __m256 ones_ps = _mm256_set1_ps(1.0f);
+	const __m256 min_val = _mm256_set1_ps(1e-15);
+	const __m256 hue_add = _mm256_set1_ps(dcp->hue);
+	const __m256 sat = _mm256_set1_ps(dcp->saturation > 1.0 ? dcp->saturation - 1.0f : dcp->saturation);
+	const __m256 inv_recover_radius = _mm256_set1_ps(1.0f / __recover_radius);
+	const __m256 recover_radius = _mm256_set1_ps(1.0 - __recover_radius);
+	const __m256 contrast = _mm256_set1_ps(dcp->contrast);
+	const __m256 inv_contrast = _mm256_set1_ps(1.0f - dcp->contrast);
+	const __m256 contr_base = _mm256_set1_ps(0.5f);
+	const __m256 rgb_div = _mm256_set1_ps(1.0/65535.0);
+	const __m256 rgb_mul = _mm256_set1_ps(65535.0);
+	const __m256i low_word = _mm256_set1_epi32(0xffff);
+
+	__m256 min_cam_r = ones_ps, min_cam_g = ones_ps, min_cam_b = ones_ps;
+	if (dcp->use_profile)
+	{
+		min_cam_r = _mm256_set1_ps(dcp->camera_white.x);
+		min_cam_g = _mm256_set1_ps(dcp->camera_white.y);
+		min_cam_b = _mm256_set1_ps(dcp->camera_white.z);
+	}
+
+	__m256 cam_prof[9];
+	const gfloat mixer[3] = { dcp->channelmixer_red, dcp->channelmixer_green, dcp->channelmixer_blue };
+	for (x = 0; x < 9; x++)
+		cam_prof[x] = _mm256_set1_ps(dcp->camera_to_prophoto.coeff[x/3][x%3] * mixer[x/3]);
+
+	gint end_x = image->w - (image->w & 7);
+
+	for(y = t->start_y ; y < t->end_y; y++)
+	{
+		gushort *pixel = GET_PIXEL(image, 0, y);
+
+		for(x = 0; x < end_x; x += 8)
+		{
+			/* Load 8 pixels, split into R B and G x words */
+			__m256i p1 = _mm256_loadu_si256((__m256i*)pixel);
+			__m256i p2 = _mm256_loadu_si256((__m256i*)(pixel + 16));
+			__m256 rb1 = _mm256_castsi256_ps(_mm256_and_si256(p1, low_word));
+			__m256 rb2 = _mm256_castsi256_ps(_mm256_and_si256(p2, low_word));
+			__m256 gx1 = _mm256_castsi256_ps(_mm256_srli_epi32(p1, 16));
+			__m256 gx2 = _mm256_castsi256_ps(_mm256_srli_epi32(p2, 16));
+
+			/* Convert to planar, the shuffles leave pixels in 0 1 4 5 2 3 6 7 order */
+			__m256i r_i = _mm256_castps_si256(_mm256_shuffle_ps(rb1, rb2, _MM_SHUFFLE(2,0,2,0)));
+			__m256i g_i = _mm256_castps_si256(_mm256_shuffle_ps(gx1, gx2, _MM_SHUFFLE(2,0,2,0)));
+			__m256i b_i = _mm256_castps_si256(_mm256_shuffle_ps(rb1, rb2, _MM_SHUFFLE(3,1,3,1)));
+			r_i = _mm256_permute4x64_epi64(r_i, _MM_SHUFFLE(3,1,2,0));
+			g_i = _mm256_permute4x64_epi64(g_i, _MM_SHUFFLE(3,1,2,0));
+			b_i = _mm256_permute4x64_epi64(b_i, _MM_SHUFFLE(3,1,2,0));
+
+			/* Normalize to 0 to 1 range, restrict to camera white */
+			r = _mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(r_i), rgb_div), min_cam_r);
+			g = _mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(g_i), rgb_div), min_cam_g);
+			b = _mm256_min_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(b_i), rgb_div), min_cam_b);
+
+			/* Convert to Prophoto */
+			r2 = _mm256_fmadd_ps(r, cam_prof[0], _mm256_fmadd_ps(g, cam_prof[1], _mm256_mul_ps(b, cam_prof[2])));
+			g2 = _mm256_fmadd_ps(r, cam_prof[3], _mm256_fmadd_ps(g, cam_prof[4], _mm256_mul_ps(b, cam_prof[5])));
+			b2 = _mm256_fmadd_ps(r, cam_prof[6], _mm256_fmadd_ps(g, cam_prof[7], _mm256_mul_ps(b, cam_prof[8])));
+
+			RGBtoHSV_AVX2(&r2, &g2, &b2);
+			h = r2; s = g2; v = b2;
+
+			if (dcp->huesatmap)
+				huesat_map_AVX2(dcp->huesatmap, dcp->huesatmap_precalc, &h, &s, &v);
+
+			/* Saturation */
+			if (dcp->saturation > 1.0)
+			{
+				/* out = (sat) * (x*2-x^2.0) + ((1.0-sat)*x) */
+				__m256 s_curved = _mm256_mul_ps(sat, _mm256_fmsub_ps(s, _mm256_set1_ps(2.0f), _mm256_mul_ps(s, s)));
+				s = _mm256_min_ps(ones_ps, _mm256_fmadd_ps(s, _mm256_sub_ps(ones_ps, sat), s_curved));
+			}
+			else
+			{
+				s = _mm256_max_ps(min_val, _mm256_min_ps(ones_ps, _mm256_mul_ps(s, sat)));
+			}
+
+			/* Hue */
+			h = hue_wrap_AVX2(_mm256_add_ps(h, hue_add));
+			__m256 v_stored = v;
+
+			HSVtoRGB_AVX2(&h, &s, &v);
+			r = h; g = s; b = v;
+
+			/* Exposure */
+			r = exposure_ramp_AVX2(dcp, r);
+			g = exposure_ramp_AVX2(dcp, g);
+			b = exposure_ramp_AVX2(dcp, b);
+
+			/* Contrast in gamma 2.0 */
+			if (do_contrast)
+			{
+				r = _mm256_max_ps(r, min_val);
+				g = _mm256_max_ps(g, min_val);
+				b = _mm256_max_ps(b, min_val);
+				r = _mm256_fmadd_ps(contrast, _mm256_sub_ps(_mm256_mul_ps(r, _mm256_rsqrt_ps(r)), contr_base), contr_base);
+				g = _mm256_fmadd_ps(contrast, _mm256_sub_ps(_mm256_mul_ps(g, _mm256_rsqrt_ps(g)), contr_base), contr_base);
+				b = _mm256_fmadd_ps(contrast, _mm256_sub_ps(_mm256_mul_ps(b, _mm256_rsqrt_ps(b)), contr_base), contr_base);
+				r = _mm256_max_ps(r, min_val);
+				g = _mm256_max_ps(g, min_val);
+				b = _mm256_max_ps(b, min_val);
+				r = _mm256_mul_ps(r, r);
+				g = _mm256_mul_ps(g, g);
+				b = _mm256_mul_ps(b, b);
+			}
+			else if (do_highrec)
+			{
+				/* Distance from 1.0 - radius, normalized and clamped */
+				__m256 dist_scaled = _mm256_min_ps(ones_ps, _mm256_mul_ps(_mm256_sub_ps(v_stored, recover_radius), inv_recover_radius));
+				__m256 mul_val = _mm256_fnmadd_ps(dist_scaled, inv_contrast, ones_ps);
+
+				r = _mm256_mul_ps(r, mul_val);
+				g = _mm256_mul_ps(g, mul_val);
+				b = _mm256_mul_ps(b, mul_val);
+			}
+
+			/* Convert to HSV */
+			RGBtoHSV_AVX2(&r, &g, &b);
+			h = r; s = g; v = b;
+
+			if (!dcp->curve_is_flat)
+				v = curve_interpolate_lookup_AVX2(v, 255.9999f, dcp->curve_samples);
+
+			/* Apply looktable */
+			if (dcp->looktable)
+				huesat_map_AVX2(dcp->looktable, dcp->looktable_precalc, &h, &s, &v);
+
+			/* Ensure that hue is within range */
+			h = hue_wrap_AVX2(h);
+
+			/* s always slightly > 0 when converting to RGB */
+			s = _mm256_max_ps(s, min_val);
+
+			HSVtoRGB_AVX2(&h, &s, &v);
+			r = h; g = s; b = v;
+
+			/* Apply Tone Curve in RGB space */
+			if (dcp->tone_curve_lut)
+				rgb_tone_AVX2(&r, &g, &b, dcp->tone_curve_lut);
+
+			/* Convert to 16 bit */
+			__m256 zero_ps = _mm256_setzero_ps();
+			r_i = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(r, rgb_mul), zero_ps), rgb_mul));
+			g_i = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(g, rgb_mul), zero_ps), rgb_mul));
+			b_i = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(b, rgb_mul), zero_ps), rgb_mul));
+
+			/* Interleave to R G B B, like the SSE versions */
+			__m256i rg = _mm256_or_si256(r_i, _mm256_slli_epi32(g_i, 16));
+			__m256i bb = _mm256_or_si256(b_i, _mm256_slli_epi32(b_i, 16));
+			__m256i lo = _mm256_unpacklo_epi32(rg, bb);
+			__m256i hi = _mm256_unpackhi_epi32(rg, bb);
+
+			/* Store processed pixels */
+			_mm256_storeu_si256((__m256i*)pixel, _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)(pixel + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+			pixel += 32;
+		}
+	}
+	_MM_SET_ROUNDING_MODE(_mm_rounding);
+	return TRUE;
+}
+
+#undef LT
+#undef LE
+#undef GE
+#undef GT
+#undef EQ
+
+#else // if not __AVX2__ and __FMA__
+
+gboolean
+render_AVX2(ThreadInfo* t)
+{
+	return FALSE;
+}
+
+#endif
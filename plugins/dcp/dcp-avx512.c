@@ -0,0 +1,527 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "dcp.h"
+
+#ifdef __AVX512F__
+
+#include <immintrin.h>
+#include <math.h> /* powf() */
+#include <pow-sse2.h> /* _mm_fastpow_ps() */
+
+/* This is the AVX-512 version of render_AVX2(), processing 16 pixels per
+ * iteration. Only AVX-512F is used, so all selections are done with mask
+ * registers, since the float logic instructions need AVX-512DQ. */
+
+#define LT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define LE(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ)
+#define GE(a, b) _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#define GT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ)
+#define EQ(a, b) _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ)
+
+static inline void
+RGBtoHSV_AVX512(__m512 *c0, __m512 *c1, __m512 *c2)
+{
+	__m512 zero_ps = _mm512_setzero_ps();
+	__m512 small_ps = _mm512_set1_ps(1e-15);
+	__m512 ones_ps = _mm512_set1_ps(1.0f);
+
+	/* Any number > 1 */
+	__m512 add_v = _mm512_set1_ps(2.0f);
+
+	/* Clamp */
+	__m512 r = _mm512_min_ps(_mm512_max_ps(*c0, small_ps), ones_ps);
+	__m512 g = _mm512_min_ps(_mm512_max_ps(*c1, small_ps), ones_ps);
+	__m512 b = _mm512_min_ps(_mm512_max_ps(*c2, small_ps), ones_ps);
+
+	__m512 v = _mm512_max_ps(b, _mm512_max_ps(r, g));
+	__m512 m = _mm512_min_ps(b, _mm512_min_ps(r, g));
+	__m512 gap = _mm512_sub_ps(v, m);
+	__mmask16 v_mask = EQ(gap, zero_ps);
+	v = _mm512_mask_add_ps(v, v_mask, v, add_v);
+
+	/* Set gap to one where sat = 0, this will avoid divisions by zero, these values will not be used */
+	gap = _mm512_mask_mov_ps(gap, v_mask, ones_ps);
+	__m512 gap_inv = _mm512_rcp14_ps(gap);
+
+	/* if r == v: h = (g - b) / gap; */
+	__mmask16 mask = EQ(r, v);
+	__m512 h = _mm512_maskz_mul_ps(mask, gap_inv, _mm512_sub_ps(g, b));
+	v = _mm512_mask_add_ps(v, mask, v, add_v);
+
+	/* if g == v: h = 2.0f + (b - r) / gap; */
+	mask = EQ(g, v);
+	h = _mm512_mask_mov_ps(h, mask, _mm512_fmadd_ps(_mm512_sub_ps(b, r), gap_inv, _mm512_set1_ps(2.0f)));
+	v = _mm512_mask_add_ps(v, mask, v, add_v);
+
+	/* if b == v: h = 4.0f + (r - g) / gap; */
+	mask = EQ(b, v);
+	h = _mm512_mask_mov_ps(h, mask, _mm512_fmadd_ps(_mm512_sub_ps(r, g), gap_inv, _mm512_set1_ps(4.0f)));
+	v = _mm512_mask_add_ps(v, mask, v, add_v);
+
+	/* Fill s, if gap > 0 */
+	v = _mm512_sub_ps(v, add_v);
+	__m512 s = _mm512_maskz_mul_ps((__mmask16) ~v_mask, gap, _mm512_rcp14_ps(v));
+
+	/* Check if h < 0 */
+	h = _mm512_mask_add_ps(h, LT(h, zero_ps), h, _mm512_set1_ps(6.0f-1e-15));
+
+	*c0 = h;
+	*c1 = s;
+	*c2 = v;
+}
+
+static inline void
+HSVtoRGB_AVX512(__m512 *c0, __m512 *c1, __m512 *c2)
+{
+	__m512 h = *c0;
+	__m512 s = *c1;
+	__m512 v = *c2;
+	__m512 r, g, b;
+	__mmask16 m;
+	__m512 ones_ps = _mm512_set1_ps(1.0f);
+
+	__m512 h_fraction = _mm512_sub_ps(h, _mm512_floor_ps(h));
+
+	/* p = v * (1.0f - s)  */
+	__m512 p = _mm512_fnmadd_ps(v, s, v);
+	/* q = (v * (1.0f - s * f)) */
+	__m512 q = _mm512_mul_ps(v, _mm512_fnmadd_ps(s, h_fraction, ones_ps));
+	/* t = (v * (1.0f - s * (1.0f - f))) */
+	__m512 t = _mm512_mul_ps(v, _mm512_fnmadd_ps(s, _mm512_sub_ps(ones_ps, h_fraction), ones_ps));
+
+	/* Start from case 5: r = v; g = p; b = q; and overwrite with the
+	 * lower cases from the top */
+	r = v; g = p; b = q;
+
+	/* case 4: r = t; g = p; b = v; */
+	m = LT(h, _mm512_set1_ps(5.0f));
+	r = _mm512_mask_mov_ps(r, m, t);
+	b = _mm512_mask_mov_ps(b, m, v);
+
+	/* case 3: r = p; g = q; b = v; */
+	m = LT(h, _mm512_set1_ps(4.0f));
+	r = _mm512_mask_mov_ps(r, m, p);
+	g = _mm512_mask_mov_ps(g, m, q);
+
+	/* case 2: r = p; g = v; b = t; */
+	m = LT(h, _mm512_set1_ps(3.0f));
+	g = _mm512_mask_mov_ps(g, m, v);
+	b = _mm512_mask_mov_ps(b, m, t);
+
+	/* case 1: r = q; g = v; b = p; */
+	m = LT(h, _mm512_set1_ps(2.0f));
+	r = _mm512_mask_mov_ps(r, m, q);
+	b = _mm512_mask_mov_ps(b, m, p);
+
+	/* case 0: r = v; g = t; b = p; */
+	m = LT(h, ones_ps);
+	r = _mm512_mask_mov_ps(r, m, v);
+	g = _mm512_mask_mov_ps(g, m, t);
+
+	*c0 = r;
+	*c1 = g;
+	*c2 = b;
+}
+
+/* Apply _mm_fastpow_ps() to all four quarters */
+static inline __m512
+fastpow_AVX512(__m512 x, gfloat y)
+{
+	__m128 e = _mm_set1_ps(y);
+	x = _mm512_insertf32x4(x, _mm_fastpow_ps(_mm512_extractf32x4_ps(x, 0), e), 0);
+	x = _mm512_insertf32x4(x, _mm_fastpow_ps(_mm512_extractf32x4_ps(x, 1), e), 1);
+	x = _mm512_insertf32x4(x, _mm_fastpow_ps(_mm512_extractf32x4_ps(x, 2), e), 2);
+	x = _mm512_insertf32x4(x, _mm_fastpow_ps(_mm512_extractf32x4_ps(x, 3), e), 3);
+	return x;
+}
+
+/* Bilinear interpolation between entry and entry + 4 (next saturation) of
+ * the precalculated table, for all three components */
+static inline void
+hsm_gather_AVX512(const gfloat *table, __m512i offsets, __m512 s0, __m512 s1, __m512 w, __m512 *hue, __m512 *sat, __m512 *val)
+{
+	__m512i next = _mm512_add_epi32(offsets, _mm512_set1_epi32(4));
+	__m512 a, b;
+
+	a = _mm512_i32gather_ps(offsets, table, 4);
+	b = _mm512_i32gather_ps(next, table, 4);
+	*hue = _mm512_fmadd_ps(w, _mm512_fmadd_ps(a, s0, _mm512_mul_ps(b, s1)), *hue);
+
+	a = _mm512_i32gather_ps(offsets, table + 1, 4);
+	b = _mm512_i32gather_ps(next, table + 1, 4);
+	*sat = _mm512_fmadd_ps(w, _mm512_fmadd_ps(a, s0, _mm512_mul_ps(b, s1)), *sat);
+
+	a = _mm512_i32gather_ps(offsets, table + 2, 4);
+	b = _mm512_i32gather_ps(next, table + 2, 4);
+	*val = _mm512_fmadd_ps(w, _mm512_fmadd_ps(a, s0, _mm512_mul_ps(b, s1)), *val);
+}
+
+static void
+huesat_map_AVX512(RSHuesatMap *map, const PrecalcHSM* precalc, __m512 *_h, __m512 *_s, __m512 *_v)
+{
+	__m512 zero_ps = _mm512_setzero_ps();
+	__m512 ones_ps = _mm512_set1_ps(1.0f);
+	const gfloat *table = precalc->lookups;
+
+	__m512 h = *_h;
+	/* Clamp - H must be pre-clamped */
+	__m512 s = _mm512_min_ps(_mm512_max_ps(*_s, zero_ps), ones_ps);
+	__m512 v = _mm512_min_ps(_mm512_max_ps(*_v, zero_ps), ones_ps);
+
+	__m512 hueShift = zero_ps;
+	__m512 satScale = zero_ps;
+	__m512 valScale = zero_ps;
+
+	if (map->val_divisions >= 2 && map->v_encoding == 1)
+		v = fastpow_AVX512(v, 1.0f / 2.2f);
+
+	__m512 hScaled = _mm512_mul_ps(h, _mm512_set1_ps(precalc->hScale[0]));
+	__m512 sScaled = _mm512_mul_ps(s, _mm512_set1_ps(precalc->sScale[0]));
+	__m512i hIndex0 = _mm512_cvttps_epi32(hScaled);
+	__m512i sIndex0 = _mm512_cvttps_epi32(sScaled);
+	__m512i hIndex1 = _mm512_add_epi32(hIndex0, _mm512_set1_epi32(1));
+
+	/* We must max here, since otherwise we might get -0 values */
+	__m512 hFract1 = _mm512_max_ps(zero_ps, _mm512_sub_ps(hScaled, _mm512_cvtepi32_ps(hIndex0)));
+	__m512 sFract1 = _mm512_max_ps(zero_ps, _mm512_sub_ps(sScaled, _mm512_cvtepi32_ps(sIndex0)));
+	__m512 hFract0 = _mm512_sub_ps(ones_ps, hFract1);
+	__m512 sFract0 = _mm512_sub_ps(ones_ps, sFract1);
+
+	__m512i hueStep = _mm512_set1_epi32(precalc->hueStep[0]);
+	__m512i offsets0 = _mm512_add_epi32(sIndex0, _mm512_mullo_epi32(hIndex0, hueStep));
+	__m512i offsets1 = _mm512_add_epi32(sIndex0, _mm512_mullo_epi32(hIndex1, hueStep));
+
+	if (map->val_divisions < 2)
+	{
+		offsets0 = _mm512_slli_epi32(offsets0, 2);
+		offsets1 = _mm512_slli_epi32(offsets1, 2);
+		hsm_gather_AVX512(table, offsets0, sFract0, sFract1, hFract0, &hueShift, &satScale, &valScale);
+		hsm_gather_AVX512(table, offsets1, sFract0, sFract1, hFract1, &hueShift, &satScale, &valScale);
+	}
+	else
+	{
+		__m512 vScaled = _mm512_mul_ps(v, _mm512_set1_ps(precalc->vScale[0]));
+		__m512i vIndex0 = _mm512_cvttps_epi32(vScaled);
+		__m512 vFract1 = _mm512_max_ps(zero_ps, _mm512_sub_ps(vScaled, _mm512_cvtepi32_ps(vIndex0)));
+		__m512 vFract0 = _mm512_sub_ps(ones_ps, vFract1);
+		__m512i valStep = _mm512_set1_epi32(precalc->valStep[0]);
+		__m512i vOffset = _mm512_mullo_epi32(vIndex0, valStep);
+
+		offsets0 = _mm512_slli_epi32(_mm512_add_epi32(offsets0, vOffset), 2);
+		offsets1 = _mm512_slli_epi32(_mm512_add_epi32(offsets1, vOffset), 2);
+		__m512i valStep4 = _mm512_slli_epi32(valStep, 2);
+
+		hsm_gather_AVX512(table, offsets0, sFract0, sFract1, _mm512_mul_ps(hFract0, vFract0), &hueShift, &satScale, &valScale);
+		hsm_gather_AVX512(table, offsets1, sFract0, sFract1, _mm512_mul_ps(hFract1, vFract0), &hueShift, &satScale, &valScale);
+		hsm_gather_AVX512(table, _mm512_add_epi32(offsets0, valStep4), sFract0, sFract1, _mm512_mul_ps(hFract0, vFract1), &hueShift, &satScale, &valScale);
+		hsm_gather_AVX512(table, _mm512_add_epi32(offsets1, valStep4), sFract0, sFract1, _mm512_mul_ps(hFract1, vFract1), &hueShift, &satScale, &valScale);
+	}
+
+	v = _mm512_min_ps(ones_ps, _mm512_mul_ps(v, valScale));
+
+	/* sRGB encoded V */
+	if (map->val_divisions >= 2 && map->v_encoding == 1)
+		v = fastpow_AVX512(v, 2.2f);
+
+	*_h = _mm512_add_ps(h, hueShift);
+	*_s = _mm512_min_ps(ones_ps, _mm512_mul_ps(s, satScale));
+	*_v = v;
+}
+
+/* Interpolated lookup in a table of (v0, v1) pairs */
+static inline __m512
+curve_interpolate_lookup_AVX512(__m512 value, gfloat scale, const gfloat * const lut)
+{
+	__m512 mul = _mm512_mul_ps(value, _mm512_set1_ps(scale));
+	__m512 fl = _mm512_floor_ps(mul);
+	__m512i lookup = _mm512_slli_epi32(_mm512_cvttps_epi32(fl), 1);
+	__m512 frac = _mm512_sub_ps(mul, fl);
+
+	__m512 v0 = _mm512_i32gather_ps(lookup, lut, 4);
+	__m512 v1 = _mm512_i32gather_ps(lookup, lut + 1, 4);
+	return _mm512_fmadd_ps(frac, _mm512_sub_ps(v1, v0), v0);
+}
+
+static inline void
+rgb_tone_AVX512(__m512* _r, __m512* _g, __m512* _b, const gfloat * const tone_lut)
+{
+	__m512 small_ps = _mm512_set1_ps(1e-15);
+	__m512 ones_ps = _mm512_set1_ps(1.0f);
+
+	/* Clamp to avoid lookups out of table */
+	__m512 r = _mm512_min_ps(_mm512_max_ps(*_r, small_ps), ones_ps);
+	__m512 g = _mm512_min_ps(_mm512_max_ps(*_g, small_ps), ones_ps);
+	__m512 b = _mm512_min_ps(_mm512_max_ps(*_b, small_ps), ones_ps);
+
+	/* Find largest and smallest values */
+	__m512 lg = _mm512_max_ps(b, _mm512_max_ps(r, g));
+	__m512 sm = _mm512_min_ps(b, _mm512_min_ps(r, g));
+
+	/* Lookup */
+	__m512 LG = curve_interpolate_lookup_AVX512(lg, 1023.99999f, tone_lut);
+	__m512 SM = curve_interpolate_lookup_AVX512(sm, 1023.99999f, tone_lut);
+
+	/* Create masks for largest, smallest and medium values */
+	__mmask16 is_r_lg = EQ(r, lg);
+	__mmask16 is_g_lg = EQ(g, lg);
+	__mmask16 is_b_lg = EQ(b, lg);
+	__mmask16 is_r_sm = EQ(r, sm) & ~is_r_lg;
+	__mmask16 is_g_sm = EQ(g, sm) & ~is_g_lg;
+	__mmask16 is_b_sm = EQ(b, sm) & ~is_b_lg;
+	__mmask16 is_r_md = ~(is_r_lg | is_r_sm);
+	__mmask16 is_g_md = ~(is_g_lg | is_g_sm);
+
+	/* Find the medium value, if there's none, it will not be used */
+	__m512 md = _mm512_mask_mov_ps(_mm512_mask_mov_ps(b, is_g_md, g), is_r_md, r);
+
+	/* Calculate tone corrected medium value */
+	__m512 p = _mm512_rcp14_ps(_mm512_sub_ps(lg, sm));
+	__m512 q = _mm512_sub_ps(md, sm);
+	__m512 o = _mm512_sub_ps(LG, SM);
+	__m512 MD = _mm512_fmadd_ps(o, _mm512_mul_ps(p, q), SM);
+
+	/* Combine corrected values to output RGB */
+	*_r = _mm512_mask_mov_ps(_mm512_mask_mov_ps(MD, is_r_sm, SM), is_r_lg, LG);
+	*_g = _mm512_mask_mov_ps(_mm512_mask_mov_ps(MD, is_g_sm, SM), is_g_lg, LG);
+	*_b = _mm512_mask_mov_ps(_mm512_mask_mov_ps(MD, is_b_sm, SM), is_b_lg, LG);
+}
+
+/* Wrap hue into [0, 6) */
+static inline __m512
+hue_wrap_AVX512(__m512 h)
+{
+	__m512 six_ps = _mm512_set1_ps(6.0f-1e-15);
+	h = _mm512_mask_sub_ps(h, GE(h, six_ps), h, six_ps);
+	return _mm512_mask_add_ps(h, LT(h, _mm512_setzero_ps()), h, six_ps);
+}
+
+/* See exposure_ramp() */
+static inline __m512
+exposure_ramp_AVX512(RSDcpState *dcp, __m512 x)
+{
+	__m512 black_minus_radius = _mm512_set1_ps(dcp->exposure_black - dcp->exposure_radius);
+	__m512 black_plus_radius = _mm512_set1_ps(dcp->exposure_black + dcp->exposure_radius);
+
+	__m512 y = _mm512_sub_ps(x, black_minus_radius);
+	y = _mm512_mul_ps(_mm512_set1_ps(dcp->exposure_qscale), _mm512_mul_ps(y, y));
+	__m512 y2 = _mm512_mul_ps(_mm512_set1_ps(dcp->exposure_slope), _mm512_sub_ps(x, _mm512_set1_ps(dcp->exposure_black)));
+
+	y = _mm512_mask_mov_ps(y, GT(x, black_plus_radius), y2);
+	return _mm512_mask_mov_ps(y, LE(x, black_minus_radius), _mm512_setzero_ps());
+}
+
+gboolean
+render_AVX512(ThreadInfo* t)
+{
+	RS_IMAGE16 *image = t->tmp;
+	RSDcpState *dcp = t->state;
+	gint x, y;
+	__m512 h, s, v;
+	__m512 r, g, b, r2, g2, b2;
+	int _mm_rounding = _MM_GET_ROUNDING_MODE();
+	_MM_SET_ROUNDING_MODE(_MM_ROUND_DOWN);
+
+	gboolean do_contrast = (dcp->contrast > 1.001f);
+	gboolean do_highrec = (dcp->contrast < 0.999f);
+	float exposure_simple = MAX(1.0, powf(2.0f, dcp->exposure));
+	float __recover_radius = 0.5 * exposure_simple;
+
+	const __m512 ones_ps = _mm512_set1_ps(1.0f);
+	const __m512 min_val = _mm512_set1_ps(1e-15);
+	const __m512 hue_add = _mm512_set1_ps(dcp->hue);
+	const __m512 sat = _mm512_set1_ps(dcp->saturation > 1.0 ? dcp->saturation - 1.0f : dcp->saturation);
+	const __m512 inv_recover_radius = _mm512_set1_ps(1.0f / __recover_radius);
+	const __m512 recover_radius = _mm512_set1_ps(1.0 - __recover_radius);
+	const __m512 contrast = _mm512_set1_ps(dcp->contrast);
+	const __m512 inv_contrast = _mm512_set1_ps(1.0f - dcp->contrast);
+	const __m512 contr_base = _mm512_set1_ps(0.5f);
+	const __m512 rgb_div = _mm512_set1_ps(1.0/65535.0);
+	const __m512 rgb_mul = _mm512_set1_ps(65535.0);
+	const __m512i low_word = _mm512_set1_epi32(0xffff);
+	const __m512i planar_order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+	const __m512i first_half = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+	const __m512i second_half = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+
+	__m512 min_cam_r = ones_ps, min_cam_g = ones_ps, min_cam_b = ones_ps;
+	if (dcp->use_profile)
+	{
+		min_cam_r = _mm512_set1_ps(dcp->camera_white.x);
+		min_cam_g = _mm512_set1_ps(dcp->camera_white.y);
+		min_cam_b = _mm512_set1_ps(dcp->camera_white.z);
+	}
+
+	__m512 cam_prof[9];
+	const gfloat mixer[3] = { dcp->channelmixer_red, dcp->channelmixer_green, dcp->channelmixer_blue };
+	for (x = 0; x < 9; x++)
+		cam_prof[x] = _mm512_set1_ps(dcp->camera_to_prophoto.coeff[x/3][x%3] * mixer[x/3]);
+
+	gint end_x = image->w - (image->w & 15);
+
+	for(y = t->start_y ; y < t->end_y; y++)
+	{
+		gushort *pixel = GET_PIXEL(image, 0, y);
+
+		for(x = 0; x < end_x; x += 16)
+		{
+			/* Load 16 pixels, split into R B and G x words */
+			__m512i p1 = _mm512_loadu_si512(pixel);
+			__m512i p2 = _mm512_loadu_si512(pixel + 32);
+			__m512 rb1 = _mm512_castsi512_ps(_mm512_and_si512(p1, low_word));
+			__m512 rb2 = _mm512_castsi512_ps(_mm512_and_si512(p2, low_word));
+			__m512 gx1 = _mm512_castsi512_ps(_mm512_srli_epi32(p1, 16));
+			__m512 gx2 = _mm512_castsi512_ps(_mm512_srli_epi32(p2, 16));
+
+			/* Convert to planar, the shuffles leave pairs of pixels in
+			 * 0 8 2 10 4 12 6 14 order */
+			__m512i r_i = _mm512_castps_si512(_mm512_shuffle_ps(rb1, rb2, _MM_SHUFFLE(2,0,2,0)));
+			__m512i g_i = _mm512_castps_si512(_mm512_shuffle_ps(gx1, gx2, _MM_SHUFFLE(2,0,2,0)));
+			__m512i b_i = _mm512_castps_si512(_mm512_shuffle_ps(rb1, rb2, _MM_SHUFFLE(3,1,3,1)));
+			r_i = _mm512_permutexvar_epi64(planar_order, r_i);
+			g_i = _mm512_permutexvar_epi64(planar_order, g_i);
+			b_i = _mm512_permutexvar_epi64(planar_order, b_i);
+
+			/* Normalize to 0 to 1 range, restrict to camera white */
+			r = _mm512_min_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(r_i), rgb_div), min_cam_r);
+			g = _mm512_min_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(g_i), rgb_div), min_cam_g);
+			b = _mm512_min_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(b_i), rgb_div), min_cam_b);
+
+			/* Convert to Prophoto */
+			r2 = _mm512_fmadd_ps(r, cam_prof[0], _mm512_fmadd_ps(g, cam_prof[1], _mm512_mul_ps(b, cam_prof[2])));
+			g2 = _mm512_fmadd_ps(r, cam_prof[3], _mm512_fmadd_ps(g, cam_prof[4], _mm512_mul_ps(b, cam_prof[5])));
+			b2 = _mm512_fmadd_ps(r, cam_prof[6], _mm512_fmadd_ps(g, cam_prof[7], _mm512_mul_ps(b, cam_prof[8])));
+
+			RGBtoHSV_AVX512(&r2, &g2, &b2);
+			h = r2; s = g2; v = b2;
+
+			if (dcp->huesatmap)
+				huesat_map_AVX512(dcp->huesatmap, dcp->huesatmap_precalc, &h, &s, &v);
+
+			/* Saturation */
+			if (dcp->saturation > 1.0)
+			{
+				/* out = (sat) * (x*2-x^2.0) + ((1.0-sat)*x) */
+				__m512 s_curved = _mm512_mul_ps(sat, _mm512_fmsub_ps(s, _mm512_set1_ps(2.0f), _mm512_mul_ps(s, s)));
+				s = _mm512_min_ps(ones_ps, _mm512_fmadd_ps(s, _mm512_sub_ps(ones_ps, sat), s_curved));
+			}
+			else
+			{
+				s = _mm512_max_ps(min_val, _mm512_min_ps(ones_ps, _mm512_mul_ps(s, sat)));
+			}
+
+			/* Hue */
+			h = hue_wrap_AVX512(_mm512_add_ps(h, hue_add));
+			__m512 v_stored = v;
+
+			HSVtoRGB_AVX512(&h, &s, &v);
+			r = h; g = s; b = v;
+
+			/* Exposure */
+			r = exposure_ramp_AVX512(dcp, r);
+			g = exposure_ramp_AVX512(dcp, g);
+			b = exposure_ramp_AVX512(dcp, b);
+
+			/* Contrast in gamma 2.0 */
+			if (do_contrast)
+			{
+				r = _mm512_max_ps(r, min_val);
+				g = _mm512_max_ps(g, min_val);
+				b = _mm512_max_ps(b, min_val);
+				r = _mm512_fmadd_ps(contrast, _mm512_sub_ps(_mm512_mul_ps(r, _mm512_rsqrt14_ps(r)), contr_base), contr_base);
+				g = _mm512_fmadd_ps(contrast, _mm512_sub_ps(_mm512_mul_ps(g, _mm512_rsqrt14_ps(g)), contr_base), contr_base);
+				b = _mm512_fmadd_ps(contrast, _mm512_sub_ps(_mm512_mul_ps(b, _mm512_rsqrt14_ps(b)), contr_base), contr_base);
+				r = _mm512_max_ps(r, min_val);
+				g = _mm512_max_ps(g, min_val);
+				b = _mm512_max_ps(b, min_val);
+				r = _mm512_mul_ps(r, r);
+				g = _mm512_mul_ps(g, g);
+				b = _mm512_mul_ps(b, b);
+			}
+			else if (do_highrec)
+			{
+				/* Distance from 1.0 - radius, normalized and clamped */
+				__m512 dist_scaled = _mm512_min_ps(ones_ps, _mm512_mul_ps(_mm512_sub_ps(v_stored, recover_radius), inv_recover_radius));
+				__m512 mul_val = _mm512_fnmadd_ps(dist_scaled, inv_contrast, ones_ps);
+
+				r = _mm512_mul_ps(r, mul_val);
+				g = _mm512_mul_ps(g, mul_val);
+				b = _mm512_mul_ps(b, mul_val);
+			}
+
+			/* Convert to HSV */
+			RGBtoHSV_AVX512(&r, &g, &b);
+			h = r; s = g; v = b;
+
+			if (!dcp->curve_is_flat)
+				v = curve_interpolate_lookup_AVX512(v, 255.9999f, dcp->curve_samples);
+
+			/* Apply looktable */
+			if (dcp->looktable)
+				huesat_map_AVX512(dcp->looktable, dcp->looktable_precalc, &h, &s, &v);
+
+			/* Ensure that hue is within range */
+			h = hue_wrap_AVX512(h);
+
+			/* s always slightly > 0 when converting to RGB */
+			s = _mm512_max_ps(s, min_val);
+
+			HSVtoRGB_AVX512(&h, &s, &v);
+			r = h; g = s; b = v;
+
+			/* Apply Tone Curve in RGB space */
+			if (dcp->tone_curve_lut)
+				rgb_tone_AVX512(&r, &g, &b, dcp->tone_curve_lut);
+
+			/* Convert to 16 bit */
+			__m512 zero_ps = _mm512_setzero_ps();
+			r_i = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(r, rgb_mul), zero_ps), rgb_mul));
+			g_i = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(g, rgb_mul), zero_ps), rgb_mul));
+			b_i = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(b, rgb_mul), zero_ps), rgb_mul));
+
+			/* Interleave to R G B B, like the SSE versions */
+			__m512i rg = _mm512_or_si512(r_i, _mm512_slli_epi32(g_i, 16));
+			__m512i bb = _mm512_or_si512(b_i, _mm512_slli_epi32(b_i, 16));
+			__m512i lo = _mm512_unpacklo_epi32(rg, bb);
+			__m512i hi = _mm512_unpackhi_epi32(rg, bb);
+
+			/* Store processed pixels */
+			_mm512_storeu_si512(pixel, _mm512_permutex2var_epi64(lo, first_half, hi));
+			_mm512_storeu_si512(pixel + 32, _mm512_permutex2var_epi64(lo, second_half, hi));
+			pixel += 64;
+		}
+	}
+	_MM_SET_ROUNDING_MODE(_mm_rounding);
+	return TRUE;
+}
+
+#undef LT
+#undef LE
+#undef GE
+#undef GT
+#undef EQ
+
+#else // if not __AVX512F__
+
+gboolean
+render_AVX512(ThreadInfo* t)
+{
+	return FALSE;
+}
+
+#endif
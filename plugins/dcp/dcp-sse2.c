@@ -675,7 +675,7 @@ gboolean
 render_SSE2(ThreadInfo* t)
 {
 	RS_IMAGE16 *image = t->tmp;
-	RSDcp *dcp = t->dcp;
+	RSDcpState *dcp = t->state;
 	gint x, y;
 	__m128 h, s, v;
 	__m128i p1,p2;
@@ -1000,6 +1000,141 @@ render_SSE2(ThreadInfo* t)
 	return TRUE;
 }
 
+
+/* Interpolate pixel k of four from the table, the weights and node offsets
+ * are vectors holding one lane per pixel */
+#define LUT_PIXEL(k, out) do { \
+	const __m128 _w0 = _mm_shuffle_ps(w0, w0, _MM_SHUFFLE(k,k,k,k)); \
+	const __m128 _wa = _mm_shuffle_ps(wa, wa, _MM_SHUFFLE(k,k,k,k)); \
+	const __m128 _wb = _mm_shuffle_ps(wb, wb, _MM_SHUFFLE(k,k,k,k)); \
+	const __m128 _wc = _mm_shuffle_ps(wc, wc, _MM_SHUFFLE(k,k,k,k)); \
+	__m128 _v = _mm_mul_ps(_mm_load_ps(lut + node[k]), _w0); \
+	_v = _mm_add_ps(_v, _mm_mul_ps(_mm_load_ps(lut + node_a[k]), _wa)); \
+	_v = _mm_add_ps(_v, _mm_mul_ps(_mm_load_ps(lut + node_b[k]), _wb)); \
+	_v = _mm_add_ps(_v, _mm_mul_ps(_mm_load_ps(lut + node[k] + c111), _wc)); \
+	out = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_v, zero), out_max)); \
+} while (0)
+
+/* SSE2 version of render_lut(), four pixels at a time. The tetrahedron is
+ * found without branches: from c000 we step along the axis with the largest
+ * fraction to reach a, and further along the middle one to reach b, which is
+ * c111 minus a step along the axis with the smallest fraction. Only the node
+ * lookups are done per pixel, SSE2 has no gather */
+gboolean
+render_lut_SSE2(ThreadInfo* t)
+{
+	RS_IMAGE16 *image = t->tmp;
+	const gfloat *lut = t->state->lut;
+	const gint c111 = 4 + DCP_LUT_SIZE * 4 + DCP_LUT_SIZE * DCP_LUT_SIZE * 4;
+	const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+	const __m128 grid_max = _mm_set1_ps(DCP_LUT_SIZE - 1);
+	const __m128 index_max = _mm_set1_ps(DCP_LUT_SIZE - 2);
+	const __m128 ones = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 out_max = _mm_set1_ps(65535.0f);
+	const __m128 step_x = _mm_set1_ps(4.0f);
+	const __m128 step_y = _mm_set1_ps(DCP_LUT_SIZE * 4);
+	const __m128 step_z = _mm_set1_ps(DCP_LUT_SIZE * DCP_LUT_SIZE * 4);
+	const __m128 step_xyz = _mm_set1_ps(c111);
+	const __m128i sub_32 = _mm_load_si128((__m128i*)_15_bit_epi32);
+	const __m128i signxor = _mm_load_si128((__m128i*)_16_bit_sign);
+	/* The fourth value of every pixel is left as it was */
+	const __m128i keep = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	gint node[4] __attribute__ ((aligned (16)));
+	gint node_a[4] __attribute__ ((aligned (16)));
+	gint node_b[4] __attribute__ ((aligned (16)));
+	gint x, y;
+
+	if (image->pixelsize != 4)
+		return FALSE;
+
+	const gint end_x = image->w - (image->w & 3);
+
+	for(y = t->start_y ; y < t->end_y; y++)
+	{
+		__m128i* pixel = (__m128i*)GET_PIXEL(image, 0, y);
+
+		for(x = 0; x < end_x; x += 4)
+		{
+			__m128i izero = _mm_setzero_si128();
+			__m128i p1 = _mm_load_si128(pixel);
+			__m128i p2 = _mm_load_si128(pixel + 1);
+
+			/* Unpack to R G B x */
+			__m128 p1f = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p1, izero));
+			__m128 p2f = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p1, izero));
+			__m128 p3f = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p2, izero));
+			__m128 p4f = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p2, izero));
+
+			/* Convert to planar */
+			__m128 g1g0r1r0 = _mm_unpacklo_ps(p1f, p2f);
+			__m128 b1b0 = _mm_unpackhi_ps(p1f, p2f);
+			__m128 g3g2r3r2 = _mm_unpacklo_ps(p3f, p4f);
+			__m128 b3b2 = _mm_unpackhi_ps(p3f, p4f);
+			__m128 fx = _mm_movelh_ps(g1g0r1r0, g3g2r3r2);
+			__m128 fy = _mm_movehl_ps(g3g2r3r2, g1g0r1r0);
+			__m128 fz = _mm_movelh_ps(b1b0, b3b2);
+
+			/* Grid coordinates, truncation is floor for positive values */
+			fx = _mm_mul_ps(_mm_sqrt_ps(_mm_mul_ps(fx, scale)), grid_max);
+			fy = _mm_mul_ps(_mm_sqrt_ps(_mm_mul_ps(fy, scale)), grid_max);
+			fz = _mm_mul_ps(_mm_sqrt_ps(_mm_mul_ps(fz, scale)), grid_max);
+			__m128 ix = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(fx)), index_max);
+			__m128 iy = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(fy)), index_max);
+			__m128 iz = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(fz)), index_max);
+			fx = _mm_sub_ps(fx, ix);
+			fy = _mm_sub_ps(fy, iy);
+			fz = _mm_sub_ps(fz, iz);
+
+			/* Sort the fractions, the differences are the weights */
+			__m128 max = _mm_max_ps(_mm_max_ps(fx, fy), fz);
+			__m128 min = _mm_min_ps(_mm_min_ps(fx, fy), fz);
+			__m128 mid = _mm_max_ps(_mm_min_ps(fx, fy), _mm_min_ps(_mm_max_ps(fx, fy), fz));
+			__m128 w0 = _mm_sub_ps(ones, max);
+			__m128 wa = _mm_sub_ps(max, mid);
+			__m128 wb = _mm_sub_ps(mid, min);
+			__m128 wc = min;
+
+			/* Step along the largest fraction to a, ties don't matter since
+			 * the corresponding weight is zero */
+			__m128 x_max = _mm_and_ps(_mm_cmpge_ps(fx, fy), _mm_cmpge_ps(fx, fz));
+			__m128 y_max = _mm_andnot_ps(x_max, _mm_cmpge_ps(fy, fz));
+			__m128 step_a = _mm_or_ps(_mm_and_ps(x_max, step_x), _mm_and_ps(y_max, step_y));
+			step_a = _mm_or_ps(step_a, _mm_andnot_ps(_mm_or_ps(x_max, y_max), step_z));
+
+			/* ..and step back from c111 along the smallest to b */
+			__m128 x_min = _mm_and_ps(_mm_cmple_ps(fx, fy), _mm_cmple_ps(fx, fz));
+			__m128 y_min = _mm_andnot_ps(x_min, _mm_cmple_ps(fy, fz));
+			__m128 step_b = _mm_or_ps(_mm_and_ps(x_min, step_x), _mm_and_ps(y_min, step_y));
+			step_b = _mm_or_ps(step_b, _mm_andnot_ps(_mm_or_ps(x_min, y_min), step_z));
+			step_b = _mm_sub_ps(step_xyz, step_b);
+
+			/* Offsets are below 2^24, so float is exact */
+			__m128 base = _mm_add_ps(_mm_mul_ps(ix, step_x), _mm_add_ps(_mm_mul_ps(iy, step_y), _mm_mul_ps(iz, step_z)));
+			_mm_store_si128((__m128i*)node, _mm_cvtps_epi32(base));
+			_mm_store_si128((__m128i*)node_a, _mm_cvtps_epi32(_mm_add_ps(base, step_a)));
+			_mm_store_si128((__m128i*)node_b, _mm_cvtps_epi32(_mm_add_ps(base, step_b)));
+
+			__m128i o1, o2, o3, o4;
+			LUT_PIXEL(0, o1);
+			LUT_PIXEL(1, o2);
+			LUT_PIXEL(2, o3);
+			LUT_PIXEL(3, o4);
+
+			/* Subtract 32768 to avoid saturation, pack and convert sign back */
+			__m128i q1 = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(o1, sub_32), _mm_sub_epi32(o2, sub_32)), signxor);
+			__m128i q2 = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(o3, sub_32), _mm_sub_epi32(o4, sub_32)), signxor);
+
+			_mm_store_si128(pixel, _mm_or_si128(_mm_and_si128(keep, p1), _mm_andnot_si128(keep, q1)));
+			_mm_store_si128(pixel + 1, _mm_or_si128(_mm_and_si128(keep, p2), _mm_andnot_si128(keep, q2)));
+			pixel += 2;
+		}
+	}
+	return TRUE;
+}
+
+#undef LUT_PIXEL
+
 #undef SETFLOAT4
 #undef SETFLOAT4_SAME
 
@@ -1011,6 +1146,12 @@ render_SSE2(ThreadInfo* t)
 	return FALSE;
 }
 
+gboolean
+render_lut_SSE2(ThreadInfo* t)
+{
+	return FALSE;
+}
+
 void
 calc_hsm_constants(const RSHuesatMap *map, PrecalcHSM* table)  
 {
@@ -33,25 +33,31 @@ enum {
 	PROP_SETTINGS,
 	PROP_PROFILE,
 	PROP_USE_PROFILE,
-	PROP_READ_OUT_CURVE
+	PROP_READ_OUT_CURVE,
+	PROP_USE_LUT
 };
 
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
+static gint get_tile_border(RSFilter *filter);
 static void settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp);
 static void settings_weak_notify(gpointer data, GObject *where_the_object_was);
 static RS_xy_COORD neutral_to_xy(RSDcp *dcp, const RS_VECTOR3 *neutral);
 static RS_MATRIX3 find_xyz_to_camera(RSDcp *dcp, const RS_xy_COORD *white_xy, RS_MATRIX3 *forward_matrix);
 static void set_white_xy(RSDcp *dcp, const RS_xy_COORD *xy);
 static void precalc(RSDcp *dcp);
-static void pre_cache_tables(RSDcp *dcp);
+static void pre_cache_tables(RSDcpState *state);
 static void render(ThreadInfo* t);
 static void read_profile(RSDcp *dcp, RSDcpFile *dcp_file);
 static void free_dcp_profile(RSDcp *dcp);
 static void set_prophoto_wb(RSDcp *dcp, gfloat warmth, gfloat tint);
 static void calculate_huesat_maps(RSDcp *dcp, gfloat temp);
-static GRecMutex dcp_mutex;
+static void render_lut(ThreadInfo* t);
+static void lut_build(RSDcpState *state);
+static void lut_check(RSDcpState *state);
+static void invalidate_state(RSDcp *dcp);
+static void render_state_unref(RSDcpState *state);
 
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
@@ -66,10 +72,9 @@ finalize(GObject *object)
 
 	if (dcp->curve_samples)
 		free(dcp->curve_samples);
-	g_free(dcp->_huesatmap_precalc_unaligned);
-	g_free(dcp->_looktable_precalc_unaligned);
 
 	free_dcp_profile(dcp);	
+	invalidate_state(dcp);
 	
 	if (dcp->settings_signal_id && dcp->settings)
 	{
@@ -79,6 +84,7 @@ finalize(GObject *object)
 	dcp->settings_signal_id = 0;
 	dcp->settings = NULL;
 	dcp->read_out_curve = NULL;
+	g_rec_mutex_clear(&dcp->lock);
 }
 
 static void
@@ -115,8 +121,15 @@ rs_dcp_class_init(RSDcpClass *klass)
 			RS_CURVE_TYPE_WIDGET, G_PARAM_READWRITE)
 	);
 
+	g_object_class_install_property(object_class,
+		PROP_USE_LUT, g_param_spec_boolean(
+			"use-lut", "use-lut", "Render from a 3D table, even when the request isn't quick",
+			FALSE, G_PARAM_READWRITE)
+	);
+
 	filter_class->name = "Adobe DNG camera profile filter";
 	filter_class->get_image = get_image;
+	filter_class->get_tile_border = get_tile_border;
 }
 
 static void
@@ -124,6 +137,8 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 {
 	gboolean changed = FALSE;
 
+	g_rec_mutex_lock(&dcp->lock);
+
 	if (mask & MASK_EXPOSURE)
 	{
 		g_object_get(settings, "exposure", &dcp->exposure, NULL);
@@ -290,9 +305,12 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 	}
 
 	if (changed)
-	{
+		invalidate_state(dcp);
+
+	g_rec_mutex_unlock(&dcp->lock);
+
+	if (changed)
 		rs_filter_changed(RS_FILTER(dcp), RS_FILTER_CHANGED_PIXELDATA);
-	}
 }
 
 /* This will free all ressources that are related to a DCP profile */
@@ -319,16 +337,6 @@ free_dcp_profile(RSDcp *dcp)
 	dcp->looktable = NULL;
 	dcp->tone_curve_lut = NULL;
 	dcp->use_profile = FALSE;
-	if (dcp->huesatmap_precalc->lookups)
-	{
-		free(dcp->huesatmap_precalc->lookups);
-		dcp->huesatmap_precalc->lookups = NULL;
-	}
-	if (dcp->looktable_precalc->lookups)
-	{
-		free(dcp->looktable_precalc->lookups);
-		dcp->looktable_precalc->lookups = NULL;
-	}
 	dcp->temp1 = dcp->temp2 = 0;
 	dcp->has_color_matrix1 = dcp->has_color_matrix2 = dcp->has_forward_matrix1 = dcp->has_forward_matrix2 = FALSE;
 	
@@ -345,6 +353,9 @@ rs_dcp_init(RSDcp *dcp)
 	dcp->use_profile = FALSE;
 	dcp->curve_is_flat = TRUE;
 	dcp->read_out_curve = NULL;
+	dcp->use_lut = FALSE;
+	dcp->state = NULL;
+	g_rec_mutex_init(&dcp->lock);
 	/* Standard D65, this default should really not be used */
 	dcp->white_xy.x = 0.31271f;
 	dcp->white_xy.y = 0.32902f;
@@ -353,20 +364,10 @@ rs_dcp_init(RSDcp *dcp)
 	 * be loaded yet at that time :( */
 	if (!klass->prophoto)
 		klass->prophoto = rs_color_space_new_singleton("RSProphoto");
-
-	/* Allocate aligned precalc tables */
-	dcp->_huesatmap_precalc_unaligned = g_malloc(sizeof(PrecalcHSM)+16);
-	dcp->_looktable_precalc_unaligned = g_malloc(sizeof(PrecalcHSM)+16);
-	dcp->huesatmap_precalc = (PrecalcHSM*)ALIGNTO16(dcp->_huesatmap_precalc_unaligned);
-	dcp->looktable_precalc = (PrecalcHSM*)ALIGNTO16(dcp->_looktable_precalc_unaligned);
-	memset(dcp->huesatmap_precalc, 0, sizeof(PrecalcHSM));
-	memset(dcp->looktable_precalc, 0, sizeof(PrecalcHSM));
 }
 
-#undef ALIGNTO16
-
 static void
-init_exposure(RSDcp *dcp)
+init_exposure(RSDcpState *dcp)
 {
 	/* Adobe applies negative exposure to the tone curve instead */
 	
@@ -390,6 +391,117 @@ init_exposure(RSDcp *dcp)
 }
 
 
+/* Copy everything needed for rendering, must be called with dcp->lock held */
+static RSDcpState *
+render_state_new(RSDcp *dcp)
+{
+	RSDcpState *state = g_new0(RSDcpState, 1);
+
+	state->ref_count = 1;
+	state->exposure = dcp->exposure;
+	state->saturation = dcp->saturation;
+	state->contrast = dcp->contrast;
+	state->hue = dcp->hue;
+	state->channelmixer_red = dcp->channelmixer_red;
+	state->channelmixer_green = dcp->channelmixer_green;
+	state->channelmixer_blue = dcp->channelmixer_blue;
+	state->curve_is_flat = dcp->curve_is_flat;
+	state->use_profile = dcp->use_profile;
+	state->camera_white = dcp->camera_white;
+	state->camera_to_prophoto = dcp->camera_to_prophoto;
+	state->read_out_curve = dcp->read_out_curve;
+
+	g_assert(0 == posix_memalign((void**)&state->curve_samples, 16, sizeof(gfloat)*2*257));
+	memcpy(state->curve_samples, dcp->curve_samples, sizeof(gfloat)*2*257);
+
+	if (dcp->tone_curve_lut)
+	{
+		g_assert(0 == posix_memalign((void**)&state->tone_curve_lut, 16, sizeof(gfloat)*2*1025));
+		memcpy(state->tone_curve_lut, dcp->tone_curve_lut, sizeof(gfloat)*2*1025);
+	}
+
+	/* The maps themselves are never changed, a new interpolated map is
+	 * created instead, so a reference is enough */
+	if (dcp->huesatmap)
+		state->huesatmap = g_object_ref(dcp->huesatmap);
+	if (dcp->looktable)
+		state->looktable = g_object_ref(dcp->looktable);
+
+	/* Allocate aligned precalc tables */
+	state->_huesatmap_precalc_unaligned = g_malloc0(sizeof(PrecalcHSM)+16);
+	state->_looktable_precalc_unaligned = g_malloc0(sizeof(PrecalcHSM)+16);
+	state->huesatmap_precalc = (PrecalcHSM*)ALIGNTO16(state->_huesatmap_precalc_unaligned);
+	state->looktable_precalc = (PrecalcHSM*)ALIGNTO16(state->_looktable_precalc_unaligned);
+	if (state->huesatmap && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
+		calc_hsm_constants(state->huesatmap, state->huesatmap_precalc); 
+	if (state->looktable && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
+		calc_hsm_constants(state->looktable, state->looktable_precalc); 
+
+	init_exposure(state);
+
+	g_mutex_init(&state->lut_lock);
+	state->lut_valid = FALSE;
+	state->lut = NULL;
+
+	return state;
+}
+
+#undef ALIGNTO16
+
+static RSDcpState *
+render_state_ref(RSDcpState *state)
+{
+	g_atomic_int_inc(&state->ref_count);
+	return state;
+}
+
+static void
+render_state_unref(RSDcpState *state)
+{
+	if (!g_atomic_int_dec_and_test(&state->ref_count))
+		return;
+
+	free(state->curve_samples);
+	free(state->tone_curve_lut);
+	if (state->huesatmap)
+		g_object_unref(state->huesatmap);
+	if (state->looktable)
+		g_object_unref(state->looktable);
+	free(state->huesatmap_precalc->lookups);
+	free(state->looktable_precalc->lookups);
+	g_free(state->_huesatmap_precalc_unaligned);
+	g_free(state->_looktable_precalc_unaligned);
+	g_mutex_clear(&state->lut_lock);
+	free(state->lut);
+	g_free(state);
+}
+
+/* Returns a reference to the state matching the current settings */
+static RSDcpState *
+get_render_state(RSDcp *dcp)
+{
+	RSDcpState *state;
+
+	g_rec_mutex_lock(&dcp->lock);
+	if (!dcp->state)
+		dcp->state = render_state_new(dcp);
+	state = render_state_ref(dcp->state);
+	g_rec_mutex_unlock(&dcp->lock);
+
+	return state;
+}
+
+/* Settings have changed, renders already running keep their own state */
+static void
+invalidate_state(RSDcp *dcp)
+{
+	g_rec_mutex_lock(&dcp->lock);
+	if (dcp->state)
+		render_state_unref(dcp->state);
+	dcp->state = NULL;
+	g_rec_mutex_unlock(&dcp->lock);
+}
+
 static void
 get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
 {
@@ -405,6 +517,9 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		case PROP_READ_OUT_CURVE:
 			g_value_set_object(value, dcp->read_out_curve);
 			break;
+		case PROP_USE_LUT:
+			g_value_set_boolean(value, dcp->use_lut);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -437,25 +552,37 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			g_object_weak_ref(G_OBJECT(dcp->settings), settings_weak_notify, dcp);
 			break;
 		case PROP_PROFILE:
-			g_rec_mutex_lock(&dcp_mutex);
+			g_rec_mutex_lock(&dcp->lock);
 			read_profile(dcp, g_value_get_object(value));
+			invalidate_state(dcp);
 			changed = TRUE;
-			g_rec_mutex_unlock(&dcp_mutex);
+			g_rec_mutex_unlock(&dcp->lock);
 			break;
 		case PROP_READ_OUT_CURVE:
 			temp = g_value_get_object(value);
+			g_rec_mutex_lock(&dcp->lock);
 			if (temp != dcp->read_out_curve)
+			{
 				changed = TRUE;
+				invalidate_state(dcp);
+			}
 			dcp->read_out_curve = temp;
+			g_rec_mutex_unlock(&dcp->lock);
 			break;
 		case PROP_USE_PROFILE:
-			g_rec_mutex_lock(&dcp_mutex);
+			g_rec_mutex_lock(&dcp->lock);
 			dcp->use_profile = g_value_get_boolean(value);
 			if (!dcp->use_profile)
 				free_dcp_profile(dcp);
 			else
 				precalc(dcp);
-			g_rec_mutex_unlock(&dcp_mutex);
+			invalidate_state(dcp);
+			g_rec_mutex_unlock(&dcp->lock);
+			break;
+		case PROP_USE_LUT:
+			if (dcp->use_lut != g_value_get_boolean(value))
+				changed = TRUE;
+			dcp->use_lut = g_value_get_boolean(value);
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -478,51 +605,53 @@ start_single_dcp_thread(gpointer _thread_info)
 {
 	ThreadInfo* t = _thread_info;
 	RS_IMAGE16 *tmp = t->tmp;
+	guint cpu = rs_detect_cpu_features();
 
-	pre_cache_tables(t->dcp);
-	if (tmp->pixelsize == 4  && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2) && !t->dcp->read_out_curve)
+	if (t->use_lut)
 	{
-		if ((rs_detect_cpu_features() & RS_CPU_FLAG_AVX) && render_AVX(t))
-		{
-			/* AVX routine renders 4 pixels in parallel, but any remaining must be */
-			/* calculated using C routines */
-			if (tmp->w & 3)
-			{
-				t->start_x = tmp->w - (tmp->w & 3);
-				render(t);
-			}
-		} 
-		else if ((rs_detect_cpu_features() & RS_CPU_FLAG_SSE4_1) && render_SSE4(t))
-		{
-			/* SSE4 routine renders 4 pixels in parallel, but any remaining must be */
-			/* calculated using C routines */
-			if (tmp->w & 3)
-			{
-				t->start_x = tmp->w - (tmp->w & 3);
-				render(t);
-			}
-		} 
+		/* The SIMD routine does four pixels at a time, the rest is done in C */
+		if (tmp->pixelsize == 4 && (cpu & RS_CPU_FLAG_SSE2) && render_lut_SSE2(t))
+			t->start_x = tmp->w - (tmp->w & 3);
+		render_lut(t);
+		return NULL;
+	}
+
+	pre_cache_tables(t->state);
+	if (tmp->pixelsize == 4  && (cpu & RS_CPU_FLAG_SSE2) && !t->state->read_out_curve)
+	{
+		/* Pixels processed per iteration by the SIMD routine used */
+		gint width;
+
+		if ((cpu & RS_CPU_FLAG_AVX512F) && (cpu & RS_CPU_FLAG_FMA) && render_AVX512(t))
+			width = 16;
+		else if ((cpu & RS_CPU_FLAG_AVX2) && (cpu & RS_CPU_FLAG_FMA) && render_AVX2(t))
+			width = 8;
+		else if ((cpu & RS_CPU_FLAG_AVX) && render_AVX(t))
+			width = 4;
+		else if ((cpu & RS_CPU_FLAG_SSE4_1) && render_SSE4(t))
+			width = 4;
 		else if (render_SSE2(t))
+			width = 4;
+		else
+			width = 0;
+
+		if (width == 0)
 		{
-			/* SSE2 routine renders 4 pixels in parallel, but any remaining must be */
-			/* calculated using C routines */
-			if (tmp->w & 3)
-			{
-				t->start_x = tmp->w - (tmp->w & 3);
-				render(t);
-			}
-		} else {
 			/* Not SSE2 compiled, render using plain C */
 			render(t);
 		}
+		else if (tmp->w & (width-1))
+		{
+			/* Any pixels remaining after the last full vector must be */
+			/* calculated using C routines */
+			t->start_x = tmp->w - (tmp->w & (width-1));
+			render(t);
+		}
 	}
 	else
 		render(t);
 
-	if (!t->single_thread)
-		g_thread_exit(NULL);
-
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 static inline void 
@@ -543,68 +672,102 @@ bit_blt(char* dstp, int dst_pitch, const char* srcp, int src_pitch, int row_size
 	}
 }
 
-static RSFilterResponse *
-get_image(RSFilter *filter, const RSFilterRequest *request)
+static gboolean
+render_C(ThreadInfo* t)
 {
-	RSDcp *dcp = RS_DCP(filter);
-	RSDcpClass *klass = RS_DCP_GET_CLASS(dcp);
-	GdkRectangle *roi;
-	RSFilterResponse *previous_response;
-	RSFilterResponse *response;
-	RS_IMAGE16 *input;
-	RS_IMAGE16 *output;
-	RS_IMAGE16 *tmp;
+	render(t);
+	return TRUE;
+}
 
-	gint j;
+/* Time every render routine supported by this CPU on the same image, this is
+ * done once, when performance debugging is enabled */
+static void
+benchmark_kernels(RSDcpState *state)
+{
+	static gsize done = 0;
+	static const struct {
+		const gchar *name;
+		guint cpu_flags;
+		gboolean (*kernel)(ThreadInfo* t);
+	} kernels[] = {
+		{ "C", 0, render_C },
+		{ "SSE2", RS_CPU_FLAG_SSE2, render_SSE2 },
+		{ "SSE4.1", RS_CPU_FLAG_SSE4_1, render_SSE4 },
+		{ "AVX", RS_CPU_FLAG_AVX, render_AVX },
+		{ "AVX2/FMA", RS_CPU_FLAG_AVX2 | RS_CPU_FLAG_FMA, render_AVX2 },
+		{ "AVX-512", RS_CPU_FLAG_AVX512F | RS_CPU_FLAG_FMA, render_AVX512 },
+	};
+	const gint w = 1024, h = 256;
+	RS_IMAGE16 *source, *image;
+	GRand *rand;
+	ThreadInfo t;
+	gint i, x, y, c;
+
+	if (!g_once_init_enter(&done))
+		return;
 
-	RSFilterRequest *request_clone = rs_filter_request_clone(request);
+	source = rs_image16_new(w, h, 3, 4);
+	rand = g_rand_new_with_seed(42);
+	for(y = 0; y < h; y++)
+		for(x = 0; x < w; x++)
+		{
+			gushort *pixel = GET_PIXEL(source, x, y);
+			for(c = 0; c < 3; c++)
+				pixel[c] = g_rand_int_range(rand, 0, 65536);
+		}
+	g_rand_free(rand);
 
-	if (!dcp->use_profile)
+	pre_cache_tables(state);
+	for(i = 0; i < G_N_ELEMENTS(kernels); i++)
 	{
-		gfloat premul[4] = {dcp->pre_mul.x, dcp->pre_mul.y, dcp->pre_mul.z, 1.0};
-		rs_filter_param_set_float4(RS_FILTER_PARAM(request_clone), "premul", premul);
-	}
+		if ((rs_detect_cpu_features() & kernels[i].cpu_flags) != kernels[i].cpu_flags)
+			continue;
 
-	rs_filter_param_set_object(RS_FILTER_PARAM(request_clone), "colorspace", klass->prophoto);
-	previous_response = rs_filter_get_image(filter->previous, request_clone);
-	g_object_unref(request_clone);
+		image = rs_image16_copy(source, TRUE);
+		memset(&t, 0, sizeof(ThreadInfo));
+		t.state = state;
+		t.tmp = image;
+		t.end_y = h;
 
-	if (!RS_IS_FILTER(filter->previous))
-		return previous_response;
+		gint64 start = g_get_monotonic_time();
+		gboolean ok = kernels[i].kernel(&t);
+		gint64 elapsed = MAX(1, g_get_monotonic_time() - start);
 
-	input = rs_filter_response_get_image(previous_response);
-	if (!input) return previous_response;
-	response = rs_filter_response_clone(previous_response);
+		if (ok)
+			RS_DEBUG(PERFORMANCE, "DCP: %s routine renders %.1f Mpix/s on one thread", kernels[i].name, (gdouble) w * h / elapsed);
+		else
+			RS_DEBUG(PERFORMANCE, "DCP: %s routine not compiled in", kernels[i].name);
+		g_object_unref(image);
+	}
+	g_object_unref(source);
+	g_once_init_leave(&done, 1);
+}
 
-	/* We always deliver in ProPhoto */
-	rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", klass->prophoto);
-	g_object_unref(previous_response);
+/* Render tmp in place from state, using the baked table if use_lut is set.
+ * If curve_values is non-NULL, the curve input histogram is added to it */
+static void
+render_with_state(RSDcpState *state, RS_IMAGE16 *tmp, gboolean use_lut, gint *curve_values)
+{
+	gint j;
+	gboolean built = FALSE;
 
-	if ((roi = rs_filter_request_get_roi(request)))
-	{
-		/* Align so we start at even pixel counts */
-		roi->width += (roi->x&1);
-		roi->x -= (roi->x&1);
-		roi->width = MIN(input->w - roi->x, roi->width);
-		output = rs_image16_copy(input, FALSE);
-		tmp = rs_image16_new_subframe(output, roi);
-		bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
-			(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
-	}
-	else
+	if (use_lut)
 	{
-		output = rs_image16_copy(input, TRUE);
-		tmp = g_object_ref(output);
-	}
-	g_object_unref(input);
-	rs_filter_response_set_image(response, output);
-	g_object_unref(output);
+		/* Renders sharing the state wait for the first one to build it */
+		g_mutex_lock(&state->lut_lock);
+		if (!state->lut_valid)
+		{
+			lut_build(state);
+			built = TRUE;
+		}
+		g_mutex_unlock(&state->lut_lock);
 
-	g_rec_mutex_lock(&dcp_mutex);
-	init_exposure(dcp);
+		if (built && (rs_debug_flags & RS_DEBUG_PERFORMANCE))
+			lut_check(state);
+	}
 
 	guint i, y_offset, y_per_thread, threaded_h;
-	guint threads = rs_get_number_of_processor_cores();
+	guint threads = rs_thread_pool_get_num_threads();
 	if (tmp->h * tmp->w < 200*200)
 		threads = 1;
 
@@ -619,38 +782,142 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		t[i].tmp = tmp;
 		t[i].start_y = y_offset;
 		t[i].start_x = 0;
-		t[i].dcp = dcp;
+		t[i].state = state;
+		t[i].use_lut = use_lut;
 		y_offset += y_per_thread;
 		y_offset = MIN(tmp->h, y_offset);
 		t[i].end_y = y_offset;
 		for(j = 0; j < 256; j++)
 			t[i].curve_input_values[j] = 0;
-		t[i].single_thread = (threads == 1);
-		if (threads == 1)
-			start_single_dcp_thread(&t[0]);
-		else	
-			t[i].threadid = g_thread_new("RSDcp worker", start_single_dcp_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; threads > 1 && i < threads; i++)
-		g_thread_join(t[i].threadid);
+	rs_thread_pool_run(start_single_dcp_thread, t, sizeof(ThreadInfo), threads);
 
-	/* Settings can change now */
-	g_rec_mutex_unlock(&dcp_mutex);
-
-	/* If we must deliver histogram data, do it now */
-	if (dcp->read_out_curve)
-	{
-		gint *values = g_malloc0(256*sizeof(gint));
+	if (curve_values)
 		for(i = 0; i < threads; i++)
 			for(j = 0; j < 256; j++)
-				values[j] += t[i].curve_input_values[j];
-		rs_curve_set_histogram_data(RS_CURVE_WIDGET(dcp->read_out_curve), values);
+				curve_values[j] += t[i].curve_input_values[j];
+	g_free(t);
+}
+
+/* Render tmp in place using the current settings, from the baked table if use_lut is set */
+static void
+render_image(RSDcp *dcp, RS_IMAGE16 *tmp, gboolean deliver_curve, gboolean use_lut)
+{
+	gint64 start = g_get_monotonic_time();
+	gint *values = NULL;
+
+	/* Settings can change while we render, we keep using this state */
+	RSDcpState *state = get_render_state(dcp);
+
+	if (rs_debug_flags & RS_DEBUG_PERFORMANCE)
+		benchmark_kernels(state);
+
+	/* The table doesn't collect histogram data, the next full render will */
+	if (deliver_curve && !use_lut && state->read_out_curve)
+		values = g_malloc0(256*sizeof(gint));
+
+	render_with_state(state, tmp, use_lut, values);
+
+	if (tmp->h * tmp->w >= 200*200)
+	{
+		gint64 elapsed = MAX(1, g_get_monotonic_time() - start);
+		RS_DEBUG(PERFORMANCE, "DCP: %dx%d rendered %s at %.1f Mpix/s", tmp->w, tmp->h,
+			use_lut ? "from table" : "directly", (gdouble) tmp->w * tmp->h / elapsed);
+	}
+
+	if (values)
+	{
+		rs_curve_set_histogram_data(RS_CURVE_WIDGET(state->read_out_curve), values);
 		g_free(values);
 	}
-	g_free(t);
-	g_object_unref(tmp);
+	render_state_unref(state);
+}
+
+/* Returns the request to pass on to the previous filter */
+static RSFilterRequest *
+previous_request(RSDcp *dcp, const RSFilterRequest *request)
+{
+	RSDcpClass *klass = RS_DCP_GET_CLASS(dcp);
+	RSFilterRequest *request_clone = rs_filter_request_clone(request);
+
+	g_rec_mutex_lock(&dcp->lock);
+	if (!dcp->use_profile)
+	{
+		gfloat premul[4] = {dcp->pre_mul.x, dcp->pre_mul.y, dcp->pre_mul.z, 1.0};
+		rs_filter_param_set_float4(RS_FILTER_PARAM(request_clone), "premul", premul);
+	}
+	g_rec_mutex_unlock(&dcp->lock);
+
+	rs_filter_param_set_object(RS_FILTER_PARAM(request_clone), "colorspace", klass->prophoto);
+
+	return request_clone;
+}
+
+/* Every pixel is rendered on its own */
+static gint
+get_tile_border(RSFilter *filter)
+{
+	return 0;
+}
+
+static RSFilterResponse *
+get_image(RSFilter *filter, const RSFilterRequest *request)
+{
+	RSDcp *dcp = RS_DCP(filter);
+	RSDcpClass *klass = RS_DCP_GET_CLASS(dcp);
+	GdkRectangle *request_roi;
+	GdkRectangle roi, area;
+	RSFilterResponse *previous_response;
+	RSFilterResponse *response;
+	RS_IMAGE16 *input;
+	RS_IMAGE16 *output;
+	gint x, y;
+
+	RSFilterRequest *request_clone = previous_request(dcp, request);
+	previous_response = rs_filter_get_image_roi(filter->previous, request_clone);
+	g_object_unref(request_clone);
+
+	if (!RS_IS_FILTER(filter->previous))
+		return previous_response;
+
+	input = rs_filter_response_get_image(previous_response);
+	if (!input) return previous_response;
+	response = rs_filter_response_clone(previous_response);
+
+	/* We always deliver in ProPhoto */
+	rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", klass->prophoto);
+
+	/* Where input is placed in the whole image */
+	rs_filter_response_get_origin(previous_response, &x, &y);
+	g_object_unref(previous_response);
+
+	if ((request_roi = rs_filter_request_get_roi(request)))
+	{
+		/* Align so we start at even pixel counts */
+		roi = *request_roi;
+		roi.width += (roi.x&1);
+		roi.x -= (roi.x&1);
+		area.x = x;
+		area.y = y;
+		area.width = input->w;
+		area.height = input->h;
+		gdk_rectangle_intersect(&roi, &area, &roi);
+
+		/* Only allocate the ROI, the response tells where it is placed */
+		output = rs_image16_new(roi.width, roi.height, input->channels, input->pixelsize);
+		bit_blt((char*)GET_PIXEL(output,0,0), output->rowstride * 2,
+			(const char*)GET_PIXEL(input,roi.x-x,roi.y-y), input->rowstride * 2, output->w * output->pixelsize * 2, output->h);
+		rs_filter_response_set_roi(response, &roi);
+	}
+	else
+		output = rs_image16_copy(input, TRUE);
+
+	g_object_unref(input);
+	rs_filter_response_set_image(response, output);
+
+	render_image(dcp, output, TRUE, dcp->use_lut || rs_filter_request_get_quick(request));
+	g_object_unref(output);
 
 	return response;
 }
@@ -724,7 +991,7 @@ RGBtoHSV(gfloat r, gfloat g, gfloat b, gfloat *h, gfloat *s, gfloat *v)
 }
 
 inline gfloat
-exposure_ramp (RSDcp *dcp, gfloat x)
+exposure_ramp (RSDcpState *dcp, gfloat x)
 {
 	if (x <= dcp->exposure_black - dcp->exposure_radius)
 		return 0.0;
@@ -1035,7 +1302,7 @@ rgb_tone(gfloat *_r, gfloat *_g, gfloat *_b, const gfloat * const tone_lut)
 }
 
 static void 
-pre_cache_tables(RSDcp *dcp)
+pre_cache_tables(RSDcpState *dcp)
 {
 	int i;
 	gfloat unused = 0;
@@ -1101,7 +1368,7 @@ static void
 render(ThreadInfo* t)
 {
 	RS_IMAGE16 *image = t->tmp;
-	RSDcp *dcp = t->dcp;
+	RSDcpState *dcp = t->state;
 
 	gint x, y;
 	gfloat h, s, v;
@@ -1255,6 +1522,192 @@ render(ThreadInfo* t)
 #undef _F
 #undef _S
 
+/* Map a 16 bit input value to a grid coordinate */
+static inline gint
+lut_coord(gushort value, gfloat *frac)
+{
+	gfloat f = sqrtf(value * (1.0f / 65535.0f)) * (DCP_LUT_SIZE - 1);
+	gint i = MIN((gint) f, DCP_LUT_SIZE - 2);
+
+	*frac = f - i;
+	return i;
+}
+
+/* Tetrahedral interpolation in the baked table */
+static void
+render_lut(ThreadInfo* t)
+{
+	RS_IMAGE16 *image = t->tmp;
+	const gfloat *lut = t->state->lut;
+	const gint dy = DCP_LUT_SIZE * 4;
+	const gint dz = DCP_LUT_SIZE * DCP_LUT_SIZE * 4;
+	gint x, y, c;
+	gfloat fx, fy, fz;
+
+	for(y = t->start_y ; y < t->end_y; y++)
+	{
+		gushort *pixel = GET_PIXEL(image, t->start_x, y);
+		for(x = t->start_x; x < image->w; x++)
+		{
+			gint ix = lut_coord(pixel[R], &fx);
+			gint iy = lut_coord(pixel[G], &fy);
+			gint iz = lut_coord(pixel[B], &fz);
+			const gfloat *c000 = lut + iz * dz + iy * dy + ix * 4;
+			const gfloat *c111 = c000 + dz + dy + 4;
+			const gfloat *a, *b;
+			gfloat wa, wb, wc;
+
+			/* Pick the tetrahedron containing the point, a and b are the two
+			 * corners between c000 and c111 */
+			if (fx >= fy)
+			{
+				if (fy >= fz)
+				{
+					a = c000 + 4; b = c000 + dy + 4;
+					wa = fx - fy; wb = fy - fz; wc = fz;
+					fx = 1.0f - fx;
+				}
+				else if (fx >= fz)
+				{
+					a = c000 + 4; b = c000 + dz + 4;
+					wa = fx - fz; wb = fz - fy; wc = fy;
+					fx = 1.0f - fx;
+				}
+				else
+				{
+					a = c000 + dz; b = c000 + dz + 4;
+					wa = fz - fx; wb = fx - fy; wc = fy;
+					fx = 1.0f - fz;
+				}
+			}
+			else
+			{
+				if (fz >= fy)
+				{
+					a = c000 + dz; b = c000 + dz + dy;
+					wa = fz - fy; wb = fy - fx; wc = fx;
+					fx = 1.0f - fz;
+				}
+				else if (fz >= fx)
+				{
+					a = c000 + dy; b = c000 + dz + dy;
+					wa = fy - fz; wb = fz - fx; wc = fx;
+					fx = 1.0f - fy;
+				}
+				else
+				{
+					a = c000 + dy; b = c000 + dy + 4;
+					wa = fy - fx; wb = fx - fz; wc = fz;
+					fx = 1.0f - fy;
+				}
+			}
+
+			for(c = 0; c < 3; c++)
+			{
+				gfloat v = fx * c000[c] + wa * a[c] + wb * b[c] + wc * c111[c];
+				pixel[c] = (gushort) CLAMP((gint) (v + 0.5f), 0, 65535);
+			}
+			pixel += image->pixelsize;
+		}
+	}
+}
+
+/* Compare the table against a direct render of some random colors */
+static void
+lut_check(RSDcpState *state)
+{
+	RS_IMAGE16 *exact = rs_image16_new(64, 64, 3, 4);
+	RS_IMAGE16 *baked;
+	GRand *rand = g_rand_new_with_seed(42);
+	gint x, y, c, max_error = 0;
+	gdouble sum = 0.0;
+
+	for(y = 0; y < exact->h; y++)
+		for(x = 0; x < exact->w; x++)
+		{
+			gushort *pixel = GET_PIXEL(exact, x, y);
+			for(c = 0; c < 3; c++)
+			{
+				/* Same distribution as the nodes */
+				gdouble v = g_rand_double(rand);
+				pixel[c] = (gushort) (v * v * 65535.0);
+			}
+		}
+	g_rand_free(rand);
+
+	baked = rs_image16_copy(exact, TRUE);
+	render_with_state(state, exact, FALSE, NULL);
+	render_with_state(state, baked, TRUE, NULL);
+
+	for(y = 0; y < exact->h; y++)
+		for(x = 0; x < exact->w; x++)
+		{
+			gushort *p1 = GET_PIXEL(exact, x, y);
+			gushort *p2 = GET_PIXEL(baked, x, y);
+			for(c = 0; c < 3; c++)
+			{
+				gint error = ABS(p1[c] - p2[c]);
+				max_error = MAX(max_error, error);
+				sum += error;
+			}
+		}
+
+	RS_DEBUG(PERFORMANCE, "DCP: table error max %d, mean %.2f (of 65535)", max_error, sum / (exact->w * exact->h * 3));
+
+	g_object_unref(exact);
+	g_object_unref(baked);
+}
+
+/* Bake state into state->lut by rendering an image containing every node.
+ * Must be called with state->lut_lock held */
+static void
+lut_build(RSDcpState *state)
+{
+	const gint n = DCP_LUT_SIZE;
+	RS_IMAGE16 *grid = rs_image16_new(n * n, n, 3, 4);
+	gushort node_value[DCP_LUT_SIZE];
+	gint64 start = g_get_monotonic_time();
+	gint x, y, z;
+
+	for(x = 0; x < n; x++)
+	{
+		gfloat v = (gfloat) x / (n - 1);
+		node_value[x] = (gushort) (v * v * 65535.0f + 0.5f);
+	}
+
+	for(z = 0; z < n; z++)
+		for(y = 0; y < n; y++)
+			for(x = 0; x < n; x++)
+			{
+				gushort *pixel = GET_PIXEL(grid, y * n + x, z);
+				pixel[R] = node_value[x];
+				pixel[G] = node_value[y];
+				pixel[B] = node_value[z];
+			}
+
+	if (!state->lut)
+		g_assert(0 == posix_memalign((void**)&state->lut, 16, sizeof(gfloat)*4*n*n*n));
+
+	/* Render directly, the table is not valid yet */
+	render_with_state(state, grid, FALSE, NULL);
+
+	for(z = 0; z < n; z++)
+		for(y = 0; y < n; y++)
+			for(x = 0; x < n; x++)
+			{
+				gushort *pixel = GET_PIXEL(grid, y * n + x, z);
+				gfloat *node = state->lut + ((z * n + y) * n + x) * 4;
+				node[R] = pixel[R];
+				node[G] = pixel[G];
+				node[B] = pixel[B];
+				node[3] = 0.0f;
+			}
+	g_object_unref(grid);
+
+	state->lut_valid = TRUE;
+	RS_DEBUG(PERFORMANCE, "DCP: %d^3 table built in %.1f ms", n, (g_get_monotonic_time() - start) / 1000.0);
+}
+
 const static RS_MATRIX3 xyz_to_prophoto = {{
 	{  1.3459433, -0.2556075, -0.0511118 },
 	{ -0.5445989,  1.5081673,  0.0205351 },
@@ -1457,15 +1910,9 @@ precalc(RSDcp *dcp)
 		{  0.0000000,  0.0000000,  1.2118128 }
 	}};
 
-	/* Camera to ProPhoto */
-	g_rec_mutex_lock(&dcp_mutex);
+	/* Camera to ProPhoto, the huesat precalc is done per render state */
 	if (dcp->use_profile)
 		matrix3_multiply(&xyz_to_prophoto, &dcp->camera_to_pcs, &dcp->camera_to_prophoto); /* verified by SDK */
-	if (dcp->huesatmap && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
-		calc_hsm_constants(dcp->huesatmap, dcp->huesatmap_precalc); 
-	if (dcp->looktable && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
-		calc_hsm_constants(dcp->looktable, dcp->looktable_precalc); 
-	g_rec_mutex_unlock(&dcp_mutex);
 }
 
 static void
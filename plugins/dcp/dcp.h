@@ -41,6 +41,51 @@ typedef struct {
 	gfloat* lookups;
 } PrecalcHSM;
 
+/* Everything the render routines read, copied from RSDcp when a render starts.
+ * A state is never changed after it has been created, apart from building the
+ * baked table under lut_lock, so any number of renders can share it without
+ * locking. Settings changes in RSDcp simply start a new state */
+typedef struct {
+	gint ref_count;
+
+	gfloat exposure;
+	gfloat saturation;
+	gfloat contrast;
+	gfloat hue;
+	gfloat channelmixer_red;
+	gfloat channelmixer_green;
+	gfloat channelmixer_blue;
+
+	gfloat *curve_samples;
+	gboolean curve_is_flat;
+
+	gboolean use_profile;
+	gfloat *tone_curve_lut;
+
+	RSHuesatMap *looktable;
+	RSHuesatMap *huesatmap;
+
+	RS_VECTOR3 camera_white;
+	RS_MATRIX3 camera_to_prophoto;
+
+	gfloat exposure_slope;
+	gfloat exposure_black;
+	gfloat exposure_radius;
+	gfloat exposure_qscale;
+
+	PrecalcHSM *huesatmap_precalc;
+	PrecalcHSM *looktable_precalc;
+	void* _huesatmap_precalc_unaligned;
+	void* _looktable_precalc_unaligned;
+	gfloat junk_value;
+	RSCurveWidget* read_out_curve;
+
+	/* The complete transform baked into a 3D table, see lut_build() */
+	GMutex lut_lock;
+	gboolean lut_valid;
+	gfloat *lut;
+} RSDcpState;
+
 
 struct _RSDcp {
 	RSFilter parent;
@@ -94,17 +139,15 @@ struct _RSDcp {
 	RS_VECTOR3 camera_white;
 	RS_MATRIX3 camera_to_prophoto;
 
-	gfloat exposure_slope;
-	gfloat exposure_black;
-	gfloat exposure_radius;
-	gfloat exposure_qscale;
-
-	PrecalcHSM *huesatmap_precalc;
-	PrecalcHSM *looktable_precalc;
-	void* _huesatmap_precalc_unaligned;
-	void* _looktable_precalc_unaligned;
-	gfloat junk_value;
 	RSCurveWidget* read_out_curve;
+
+	/* Render from the baked table, even for full quality requests */
+	gboolean use_lut;
+
+	/* Protects all of the above against concurrent renders taking a state */
+	GRecMutex lock;
+	/* Snapshot of the current settings, NULL until the next render needs it */
+	RSDcpState *state;
 };
 
 struct _RSDcpClass {
@@ -113,20 +156,27 @@ struct _RSDcpClass {
 	RSIccProfile *prophoto_profile;
 };
 
+/* Nodes per axis in the baked table. Nodes are spaced evenly in sqrt(input)
+ * to give shadows more precision. Each node holds R, G, B and a pad value, red
+ * varies fastest */
+#define DCP_LUT_SIZE 33
+
 typedef struct {
-	RSDcp *dcp;
-	GThread *threadid;
+	RSDcpState *state;
 	gint start_x;
 	gint start_y;
 	gint end_y;
 	RS_IMAGE16 *tmp;
+	gboolean use_lut;
 	guint curve_input_values[256];
-	gboolean single_thread;
 } ThreadInfo;
 
 gboolean render_SSE2(ThreadInfo* t);
 gboolean render_SSE4(ThreadInfo* t);
 gboolean render_AVX(ThreadInfo* t);
+gboolean render_AVX2(ThreadInfo* t);
+gboolean render_AVX512(ThreadInfo* t);
+gboolean render_lut_SSE2(ThreadInfo* t);
 void calc_hsm_constants(const RSHuesatMap *map, PrecalcHSM* table); 
 
 #endif /* DCP_H */
@@ -33,7 +33,7 @@ typedef struct {
 	RS_IMAGE16 *image;
 	RS_IMAGE16 *output;
 	guint filters;
-	GThread *threadid;
+	gint bin;
 } ThreadInfo;
 
 typedef enum {
@@ -41,7 +41,8 @@ typedef enum {
 	RS_DEMOSAIC_BILINEAR,
 	RS_DEMOSAIC_PPG,
 	RS_DEMOSAIC_MAX,
-	RS_DEMOSAIC_NONE_HALF
+	RS_DEMOSAIC_NONE_HALF,
+	RS_DEMOSAIC_BIN
 } RS_DEMOSAIC;
 
 const static gchar *rs_demosaic_ascii[RS_DEMOSAIC_MAX] = {
@@ -58,6 +59,7 @@ struct _RSDemosaic {
 
 	RS_DEMOSAIC method;
 	gboolean allow_half;
+	gint bin_size;
 };
 
 struct _RSDemosaicClass {
@@ -70,6 +72,7 @@ enum {
 	PROP_0,
 	PROP_METHOD,
 	PROP_ALLOW_HALF, 
+	PROP_BIN_SIZE,
 };
 
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
@@ -80,6 +83,7 @@ static void border_interpolate_INDI (const ThreadInfo* t, int colors, int border
 static void lin_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors);
 static void ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors);
 static void none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, gboolean half_size);
+static void bin_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, gint bin);
 static void hotpixel_detect(const ThreadInfo* t);
 static void expand_cfa_data(const ThreadInfo* t);
 
@@ -115,6 +119,12 @@ rs_demosaic_class_init(RSDemosaicClass *klass)
 			FALSE, G_PARAM_READWRITE)
 	);
 
+	g_object_class_install_property(object_class,
+		PROP_BIN_SIZE, g_param_spec_int(
+			"demosaic-bin-size", "demosaic-bin-size", "Bin CFA blocks for quick requests, keeping the longest side at least this size (0 to disable)",
+			0, G_MAXINT, 0, G_PARAM_READWRITE)
+	);
+
 	filter_class->name = "Demosaic filter";
 	filter_class->get_image = get_image;
 }
@@ -123,6 +133,7 @@ static void
 rs_demosaic_init(RSDemosaic *demosaic)
 {
 	demosaic->method = RS_DEMOSAIC_PPG;
+	demosaic->bin_size = 0;
 }
 
 static void
@@ -138,6 +149,9 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		case PROP_ALLOW_HALF:
 			g_value_set_boolean(value, demosaic->allow_half);
 			break;			
+		case PROP_BIN_SIZE:
+			g_value_set_int(value, demosaic->bin_size);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -163,6 +177,9 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 		case PROP_ALLOW_HALF:
 			demosaic->allow_half = g_value_get_boolean(value);
 			break;
+		case PROP_BIN_SIZE:
+			demosaic->bin_size = g_value_get_int(value);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -188,6 +205,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *output = NULL;
 	guint filters;
 	RS_DEMOSAIC method;
+	gint bin = 0;
 
 	previous_response = rs_filter_get_image(filter->previous, request);
 
@@ -211,7 +229,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	gint fuji_width;
 	if (rs_filter_param_get_integer(RS_FILTER_PARAM(response), "fuji-width", &fuji_width) && (fuji_width > 0))
+	{
 		demosaic->allow_half = FALSE;
+		demosaic->bin_size = 0;
+	}
 
 	method = demosaic->method;
 	if (rs_filter_request_get_quick(request))
@@ -231,7 +252,21 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			(filters & 0xff) == ((filters >> 24) &0xff)))
 				method = RS_DEMOSAIC_PPG;
 
-	if (method == RS_DEMOSAIC_NONE)
+	/* For thumbnails, average whole blocks of the mosaic into each output
+	 * pixel, this is the cheapest way to get a small image */
+	if (method == RS_DEMOSAIC_NONE && demosaic->bin_size > 0)
+	{
+		bin = 2 * MAX(1, MAX(input->w, input->h) / (2 * demosaic->bin_size));
+		if (bin < 4 || input->w < bin || input->h < bin)
+			bin = 0;
+	}
+
+	if (bin > 0)
+	{
+		output = rs_image16_new(input->w/bin, input->h/bin, 3, 4);
+		method = RS_DEMOSAIC_BIN;
+	}
+	else if (method == RS_DEMOSAIC_NONE)
 	{
 		if (demosaic->allow_half)
 		{
@@ -265,6 +300,9 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		case RS_DEMOSAIC_NONE_HALF:
 			none_interpolate_INDI(input, output, filters, 3, TRUE);
 			break;
+		case RS_DEMOSAIC_BIN:
+			bin_interpolate_INDI(input, output, filters, bin);
+			break;
 		default:
 			/* Do nothing */
 			break;
@@ -509,16 +547,15 @@ start_interp_thread(gpointer _thread_info)
 	expand_cfa_data(t);
 	border_interpolate_INDI (t, 3, 3);
 	interpolate_INDI_part(t);
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 static void
 ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors)
 {
 	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
+	const guint threads = rs_thread_pool_get_num_threads();
 	ThreadInfo *t = g_new(ThreadInfo, threads);
 
 	threaded_h = image->h;
@@ -534,13 +571,9 @@ ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int f
 		y_offset += y_per_thread;
 		y_offset = MIN(image->h, y_offset);
 		t[i].end_y = y_offset;
-
-		t[i].threadid = g_thread_new("RSDemosaic worker (ppg)", start_interp_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	rs_thread_pool_run(start_interp_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 }
@@ -621,9 +654,8 @@ start_none_thread(gpointer _thread_info)
 			memcpy(GET_PIXEL(t->output, 0, 0), GET_PIXEL(t->output, 0, 1), t->output->rowstride * 2);
 		}
 	}
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 
@@ -671,9 +703,8 @@ start_none_thread_half(gpointer _thread_info)
 		}
 
 	}
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 
@@ -681,7 +712,7 @@ static void
 none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, gboolean half_size)
 {
 	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
+	const guint threads = rs_thread_pool_get_num_threads();
 	ThreadInfo *t = g_new(ThreadInfo, threads);
 
 	/* Subtract 1 from bottom  */
@@ -698,16 +729,78 @@ none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filter
 		y_offset += y_per_thread;
 		y_offset = MIN(out->h-1, y_offset);
 		t[i].end_y = y_offset;
+	}
 
-		if (half_size)
-			t[i].threadid = g_thread_new("RSDemosaic worker (none) (half-size)", start_none_thread_half, &t[i]);
-		else
-			t[i].threadid = g_thread_new("RSDemosaic worker (none)", start_none_thread, &t[i]);
+	if (half_size)
+		rs_thread_pool_run(start_none_thread_half, t, sizeof(ThreadInfo), threads);
+	else
+		rs_thread_pool_run(start_none_thread, t, sizeof(ThreadInfo), threads);
+
+	g_free(t);
+}
+
+gpointer
+start_bin_thread(gpointer _thread_info)
+{
+	ThreadInfo* t = _thread_info;
+	const guint filters = t->filters;
+	const gint bin = t->bin;
+	gint row, col, x, y;
+
+	for(row=t->start_y; row < t->end_y; row++)
+	{
+		gushort *dest = GET_PIXEL(t->output, 0, row);
+
+		for(col=0; col < t->output->w; col++)
+		{
+			guint sum[3] = {0, 0, 0};
+			guint count[3] = {0, 0, 0};
+
+			for(y = row*bin; y < (row+1)*bin; y++)
+			{
+				gushort *src = GET_PIXEL(t->image, col*bin, y);
+				for(x = 0; x < bin; x++)
+				{
+					const gint c = FC(y, x);
+					sum[c] += src[x];
+					count[c]++;
+				}
+			}
+
+			dest[R] = sum[R] / count[R];
+			dest[G] = sum[G] / count[G];
+			dest[B] = sum[B] / count[B];
+			dest += t->output->pixelsize;
+		}
+	}
+
+	return NULL;
+}
+
+/* Every output pixel is the average of a bin x bin block of the mosaic, bin must be even */
+static void
+bin_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, gint bin)
+{
+	guint i, y_offset, y_per_thread;
+	const guint threads = rs_thread_pool_get_num_threads();
+	ThreadInfo *t = g_new(ThreadInfo, threads);
+
+	y_per_thread = (out->h + threads-1)/threads;
+	y_offset = 0;
+
+	for (i = 0; i < threads; i++)
+	{
+		t[i].image = in;
+		t[i].output = out;
+		t[i].filters = filters;
+		t[i].bin = bin;
+		t[i].start_y = y_offset;
+		y_offset += y_per_thread;
+		y_offset = MIN(out->h, y_offset);
+		t[i].end_y = y_offset;
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	rs_thread_pool_run(start_bin_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 }
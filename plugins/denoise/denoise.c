@@ -25,6 +25,10 @@
 #include "denoiseinterface.h"
 #include <string.h> /* memcpy */
 
+/* The FFT denoiser works on 128 pixel blocks that overlap by 24 pixels on
+ * each side (fftdenoiser.h), block centers are 80 pixels apart */
+#define FFT_BLOCK_STEP (128 - 2 * 24)
+
 #define RS_TYPE_DENOISE (rs_denoise_type)
 #define RS_DENOISE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), RS_TYPE_DENOISE, RSDenoise))
 #define RS_DENOISE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_DENOISE, RSDenoiseClass))
@@ -39,7 +43,9 @@ struct _RSDenoise {
 	RSSettings *settings;
 	gulong settings_signal_id;
 
+	GMutex info_lock; /* Serializes use of info */
 	FFTDenoiseInfo info;
+	GMutex lock; /* Protects sharpen, denoise_luma and denoise_chroma */
 	gint sharpen;
 	gint denoise_luma;
 	gint denoise_chroma;
@@ -63,6 +69,7 @@ static void get_property (GObject *object, guint property_id, GValue *value, GPa
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
 static void settings_weak_notify(gpointer data, GObject *where_the_object_was);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
+static gint get_tile_border(RSFilter *filter);
 static void settings_changed(RSSettings *settings, RSSettingsMask mask, RSDenoise *denoise);
 
 static RSFilterClass *rs_denoise_parent_class = NULL;
@@ -85,6 +92,10 @@ finalize(GObject *object)
 	}
 	denoise->settings_signal_id = 0;
 	denoise->settings = NULL;
+	g_mutex_clear(&denoise->info_lock);
+	g_mutex_clear(&denoise->lock);
+
+	G_OBJECT_CLASS(rs_denoise_parent_class)->finalize(object);
 }
 
 static void
@@ -107,6 +118,7 @@ rs_denoise_class_init(RSDenoiseClass *klass)
 
 	filter_class->name = "FFT denoise filter";
 	filter_class->get_image = get_image;
+	filter_class->get_tile_border = get_tile_border;
 }
 
 
@@ -126,6 +138,7 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDenoise *denoise)
 			"denoise_luma", &denoise_luma,
 			"denoise_chroma", &denoise_chroma,
 			NULL);
+		g_mutex_lock(&denoise->lock);
 		if (ABS(((gint) sharpen) - denoise->sharpen) > 0
 			|| ABS(((gint) denoise_luma) - denoise->denoise_luma) > 0
 			|| ABS(((gint) denoise_chroma) - denoise->denoise_chroma) > 0)
@@ -135,6 +148,7 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDenoise *denoise)
 			denoise->denoise_luma = (gint) denoise_luma;
 			denoise->denoise_chroma = (gint) denoise_chroma;
 		}
+		g_mutex_unlock(&denoise->lock);
 	}
 
 	if (changed)
@@ -149,6 +163,8 @@ rs_denoise_init(RSDenoise *denoise)
 	denoise->sharpen = 0;
 	denoise->denoise_luma = 0;
 	denoise->denoise_chroma = 0;
+	g_mutex_init(&denoise->info_lock);
+	g_mutex_init(&denoise->lock);
 }
 
 static void
@@ -156,6 +172,7 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 {
 	RSDenoise *denoise = RS_DENOISE(object);
 
+	g_mutex_lock(&denoise->lock);
 	switch (property_id)
 	{
 		case PROP_SHARPEN:
@@ -172,6 +189,7 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&denoise->lock);
 }
 
 static void
@@ -224,23 +242,73 @@ bit_blt(char* dstp, int dst_pitch, const char* srcp, int src_pitch, int row_size
 }
 
 
+/* Pads start..end, so the blocks denoising it are computed from the same
+ * pixels as when denoising all of 0..size. The padded area starts on the
+ * block grid of the whole image, one block before start. It ends one block
+ * after end, to keep the extra block the denoiser puts at the very end of
+ * an area away from it */
+static void
+pad_to_block_grid(gint start, gint end, gint size, gint *padded_start, gint *padded_end)
+{
+	*padded_start = MAX(0, (start / FFT_BLOCK_STEP - 1) * FFT_BLOCK_STEP);
+	*padded_end = MIN(size, ((end + FFT_BLOCK_STEP - 1) / FFT_BLOCK_STEP + 1) * FFT_BLOCK_STEP);
+}
+
+/* pad_to_block_grid() adds less than two blocks on each side */
+static gint
+get_tile_border(RSFilter *filter)
+{
+	return 2 * FFT_BLOCK_STEP;
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSDenoise *denoise = RS_DENOISE(filter);
-	GdkRectangle *roi;
+	GdkRectangle *request_roi;
+	GdkRectangle roi, area, border;
+	gint border_end;
+	RSFilterRequest *border_request = NULL;
 	RSFilterResponse *previous_response;
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output;
-	RS_IMAGE16 *tmp;
+	gint x, y, width, height;
+	gint sharpen, denoise_luma, denoise_chroma;
+	gboolean seamless_roi = FALSE;
+
+	g_mutex_lock(&denoise->lock);
+	sharpen = denoise->sharpen;
+	denoise_luma = denoise->denoise_luma;
+	denoise_chroma = denoise->denoise_chroma;
+	g_mutex_unlock(&denoise->lock);
+
+	/* When strips of an image are put together, as on export, pixels near
+	 * the edges of a ROI must be denoised exactly as in the whole image, or
+	 * the strips will show seams. The preview doesn't need this */
+	request_roi = rs_filter_request_get_roi(request);
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(request), "seamless-roi", &seamless_roi);
+	if (request_roi && seamless_roi && !rs_filter_request_get_quick(request)
+		&& (sharpen + denoise_luma + denoise_chroma) != 0
+		&& rs_filter_get_size_simple(filter->previous, request, &width, &height))
+	{
+		pad_to_block_grid(request_roi->x, request_roi->x + request_roi->width, width, &border.x, &border_end);
+		border.width = border_end - border.x;
+		pad_to_block_grid(request_roi->y, request_roi->y + request_roi->height, height, &border.y, &border_end);
+		border.height = border_end - border.y;
+		border_request = rs_filter_request_clone(request);
+		rs_filter_request_set_roi(border_request, &border);
+		request_roi = &border;
+	}
 
-	previous_response = rs_filter_get_image(filter->previous, request);
+	previous_response = rs_filter_get_image_roi(filter->previous, border_request ? border_request : request);
+	if (border_request)
+		g_object_unref(border_request);
 
 	if (!RS_IS_FILTER(filter->previous))
 		return previous_response;
 
-	if ((denoise->sharpen + denoise->denoise_luma + denoise->denoise_chroma) == 0)
+	if ((sharpen + denoise_luma + denoise_chroma) == 0)
 		return previous_response;
 
 	input = rs_filter_response_get_image(previous_response);
@@ -249,6 +317,9 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		return previous_response;
 
 	response = rs_filter_response_clone(previous_response);
+
+	/* Where input is placed in the whole image */
+	rs_filter_response_get_origin(previous_response, &x, &y);
 	g_object_unref(previous_response);
 
 	/* If the request is marked as "quick", bail out, we're slow */
@@ -263,32 +334,37 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	gfloat scale = 1.0;
 	rs_filter_get_recursive(RS_FILTER(denoise), "scale", &scale, NULL);
 
-	if ((roi = rs_filter_request_get_roi(request)))
+	if (request_roi)
 	{
 		/* Align so we start at even pixel counts */
-		roi->width += (roi->x&1);
-		roi->x -= (roi->x&1);
-		roi->width = MIN(input->w - roi->x, roi->width);
-		output = rs_image16_copy(input, FALSE);
-		tmp = rs_image16_new_subframe(output, roi);
-		bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
-			(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
+		roi = *request_roi;
+		roi.width += (roi.x&1);
+		roi.x -= (roi.x&1);
+		area.x = x;
+		area.y = y;
+		area.width = input->w;
+		area.height = input->h;
+		gdk_rectangle_intersect(&roi, &area, &roi);
+
+		/* Only allocate the ROI, the response tells where it is placed */
+		output = rs_image16_new(roi.width, roi.height, input->channels, input->pixelsize);
+		bit_blt((char*)GET_PIXEL(output,0,0), output->rowstride * 2,
+			(const char*)GET_PIXEL(input,roi.x-x,roi.y-y), input->rowstride * 2, output->w * output->pixelsize * 2, output->h);
+		rs_filter_response_set_roi(response, &roi);
 	}
 	else
-	{
 		output = rs_image16_copy(input, TRUE);
-		tmp = g_object_ref(output);
-	}
 
 	g_object_unref(input);
 	rs_filter_response_set_image(response, output);
-	g_object_unref(output);
 
-	denoise->info.image = tmp;
-	denoise->info.sigmaLuma = ((float) denoise->denoise_luma * scale) / 3.0;
-	denoise->info.sigmaChroma = ((float) denoise->denoise_chroma * scale) / 2.0;
-	denoise->info.sharpenLuma = 1.5f * (float) denoise->sharpen / 20.0f;
-	denoise->info.sharpenLuma *= fminf(1.0f, 0.25 + ((100.0f - fminf(100.0f,denoise->denoise_luma)) / 100.0f));
+	/* The preview and an export may both be rendering through us */
+	g_mutex_lock(&denoise->info_lock);
+	denoise->info.image = output;
+	denoise->info.sigmaLuma = ((float) denoise_luma * scale) / 3.0;
+	denoise->info.sigmaChroma = ((float) denoise_chroma * scale) / 2.0;
+	denoise->info.sharpenLuma = 1.5f * (float) sharpen / 20.0f;
+	denoise->info.sharpenLuma *= fminf(1.0f, 0.25 + ((100.0f - fminf(100.0f,denoise_luma)) / 100.0f));
 	denoise->info.sharpenCutoffLuma = 0.07f * scale;
 	denoise->info.betaLuma = 1.0 + denoise->info.sigmaLuma * 0.015;
 	denoise->info.sharpenChroma = 0.0f;
@@ -298,7 +374,8 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	denoise->info.blueCorrection = 1.0f;
 
 	denoiseImage(&denoise->info);
-	g_object_unref(tmp);
+	g_mutex_unlock(&denoise->info_lock);
+	g_object_unref(output);
 
 	return response;
 }
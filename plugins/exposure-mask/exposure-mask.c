@@ -129,12 +129,16 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	guchar *out_pixel;
 	gint channels;
 
-	previous_response = rs_filter_get_image8(filter->previous, request);
+	/* We work on single pixels, so an image only covering the ROI can be used as is */
+	previous_response = rs_filter_get_image8_roi(filter->previous, request);
 	input = rs_filter_response_get_image8(previous_response);
+	if (!input)
+		return previous_response;
+
 	response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	/* FIXME: Support ROI */
+	/* FIXME: Support ROI of whole images */
 	if (exposure_mask->exposure_mask)
 	{
 		output = gdk_pixbuf_copy(input);
@@ -182,11 +186,8 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	else
 		output = input;
 
-	if (output)
-	{
-		rs_filter_response_set_image8(response, output);
-		g_object_unref(output);
-	}
+	rs_filter_response_set_image8(response, output);
+	g_object_unref(output);
 
 	return response;
 }
@@ -32,6 +32,7 @@ typedef struct _RSInputImage16Class RSInputImage16Class;
 struct _RSInputImage16 {
 	RSFilter parent;
 
+	GMutex lock; /* Protects image_response, image and colorspace */
 	RSFilterResponse *image_response;
 	RS_IMAGE16 *image;
 	gchar *filename;
@@ -56,6 +57,7 @@ static void set_property (GObject *object, guint property_id, const GValue *valu
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_size(RSFilter *filter, const RSFilterRequest *request);
 static void dispose (GObject *object);
+static void finalize (GObject *object);
 
 static RSFilterClass *rs_input_image16_parent_class = NULL;
 
@@ -77,6 +79,7 @@ rs_input_image16_class_init (RSInputImage16Class *klass)
 	object_class->get_property = get_property;
 	object_class->set_property = set_property;
 	object_class->dispose = dispose;
+	object_class->finalize = finalize;
 
 	g_object_class_install_property(object_class,
 		PROP_IMAGE, g_param_spec_object (
@@ -103,6 +106,7 @@ rs_input_image16_class_init (RSInputImage16Class *klass)
 static void
 rs_input_image16_init (RSInputImage16 *input_image16)
 {
+	g_mutex_init(&input_image16->lock);
 	input_image16->image = NULL;
 	input_image16->image_response = NULL;
 }
@@ -111,6 +115,7 @@ static void
 get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
 {
 	RSInputImage16 *input_image16 = RS_INPUT_IMAGE16(object);
+	g_mutex_lock(&input_image16->lock);
 	switch (property_id)
 	{
 		case PROP_IMAGE:
@@ -125,39 +130,60 @@ get_property (GObject *object, guint property_id, GValue *value, GParamSpec *psp
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&input_image16->lock);
 }
 
 static void
 set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
 {
 	RSInputImage16 *input_image16 = RS_INPUT_IMAGE16(object);
+	RSFilterResponse *old_response = NULL;
+	RS_IMAGE16 *old_image = NULL;
+	RSColorSpace *old_colorspace = NULL;
+	gboolean changed = FALSE;
+
+	/* Other threads may be reading from us, old objects are unref'ed
+	 * outside the lock, they keep their own references while in use */
+	g_mutex_lock(&input_image16->lock);
 	switch (property_id)
 	{
 		case PROP_IMAGE:
-			/* Clean up */
-			if (input_image16->image)
-				g_object_unref(input_image16->image);
+			old_image = input_image16->image;
+			old_response = input_image16->image_response;
 			input_image16->image = NULL;
-			if (input_image16->image_response)
-				g_object_unref(input_image16->image_response);
-			
-			input_image16->image_response = g_object_ref(g_value_get_object(value));
-			input_image16->image = rs_filter_response_get_image(input_image16->image_response);
-			rs_filter_changed(RS_FILTER(input_image16), RS_FILTER_CHANGED_DIMENSION);
+			input_image16->image_response = NULL;
+
+			/* NULL is allowed, to release the image */
+			if (g_value_get_object(value))
+			{
+				input_image16->image_response = g_object_ref(g_value_get_object(value));
+				input_image16->image = rs_filter_response_get_image(input_image16->image_response);
+			}
+			changed = TRUE;
 			break;
 		case PROP_FILENAME:
 			g_free(input_image16->filename);
 			input_image16->filename = g_value_dup_string(value);
 			break;
 		case PROP_COLOR_SPACE:
-			if (input_image16->colorspace)
-				g_object_unref(input_image16->colorspace);
+			old_colorspace = input_image16->colorspace;
 			input_image16->colorspace = g_object_ref(g_value_get_object(value));
-			rs_filter_changed(RS_FILTER(input_image16), RS_FILTER_CHANGED_DIMENSION);
+			changed = TRUE;
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&input_image16->lock);
+
+	if (old_image)
+		g_object_unref(old_image);
+	if (old_response)
+		g_object_unref(old_response);
+	if (old_colorspace)
+		g_object_unref(old_colorspace);
+
+	if (changed)
+		rs_filter_changed(RS_FILTER(input_image16), RS_FILTER_CHANGED_DIMENSION);
 }
 
 static void
@@ -174,23 +200,38 @@ dispose (GObject *object)
 	G_OBJECT_CLASS (rs_input_image16_parent_class)->dispose (object);
 }
 
+static void
+finalize (GObject *object)
+{
+	RSInputImage16 *input_image16 = RS_INPUT_IMAGE16(object);
+
+	g_mutex_clear(&input_image16->lock);
+
+	/* Chain up */
+	G_OBJECT_CLASS (rs_input_image16_parent_class)->finalize (object);
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSInputImage16 *input_image16 = RS_INPUT_IMAGE16(filter);
+	RSFilterResponse *response;
+
+	/* The response holds its own references once we let go of the lock */
+	g_mutex_lock(&input_image16->lock);
 	if (RS_IS_FILTER_RESPONSE(input_image16->image_response))
 	{
-		RSFilterResponse *response;
 		response = rs_filter_response_clone(RS_FILTER_RESPONSE(input_image16->image_response));
 		rs_filter_response_set_image(response, input_image16->image);
 
 		if (RS_IS_COLOR_SPACE(input_image16->colorspace))
 			rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", input_image16->colorspace);
-
-		return response;
 	}
+	else
+		response = rs_filter_response_new();
+	g_mutex_unlock(&input_image16->lock);
 
-	return rs_filter_response_new();
+	return response;
 }
 
 static RSFilterResponse *
@@ -198,6 +239,7 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSInputImage16 *input_image16 = RS_INPUT_IMAGE16(filter);
 
+	g_mutex_lock(&input_image16->lock);
 	RSFilterResponse *response = rs_filter_response_clone(RS_FILTER_RESPONSE(input_image16->image_response));
 
 	if (input_image16->image)
@@ -205,6 +247,7 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 		rs_filter_response_set_width(response, input_image16->image->w);
 		rs_filter_response_set_height(response, input_image16->image->h);
 	}
+	g_mutex_unlock(&input_image16->lock);
 
 	return response;
 }
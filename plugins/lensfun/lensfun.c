@@ -41,6 +41,7 @@ typedef struct _RSLensfunClass RSLensfunClass;
 struct _RSLensfun {
 	RSFilter parent;
 
+	GMutex lock; /* Protects the settings and the selected camera and lens */
 	lfDatabase *ldb;
 
 	gchar *make;
@@ -123,6 +124,9 @@ finalize(GObject *object)
 	g_free(lensfun->make);
 	if (lensfun->lens)
 		g_object_unref(lensfun->lens);
+	g_mutex_clear(&lensfun->lock);
+
+	G_OBJECT_CLASS(rs_lensfun_parent_class)->finalize(object);
 }
 
 static void
@@ -210,6 +214,7 @@ rs_lensfun_init(RSLensfun *lensfun)
 	lensfun->defish = FALSE;
 	lensfun->settings_signal_id = 0;
 	lensfun->settings = NULL;
+	g_mutex_init(&lensfun->lock);
 
 	/* Initialize Lensfun database */
 	lensfun->ldb = lf_db_new ();
@@ -221,6 +226,7 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 {
 	RSLensfun *lensfun = RS_LENSFUN(object);
 
+	g_mutex_lock(&lensfun->lock);
 	switch (property_id)
 	{
 		case PROP_SETTINGS:
@@ -256,6 +262,7 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&lensfun->lock);
 }
 
 static gboolean
@@ -277,6 +284,7 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSLensfun *lensfun)
 	if (NULL == settings || NULL == lensfun)
 		return;
 
+	g_mutex_lock(&lensfun->lock);
 	gboolean changed = ! (float_closeto(settings->tca_kb, lensfun->tca_kb,0.001f) && 
 	float_closeto(settings->tca_kr, lensfun->tca_kr,0.001f) && 
 	float_closeto(settings->vignetting, lensfun->vignetting,0.001f));
@@ -285,8 +293,11 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSLensfun *lensfun)
 		lensfun->tca_kb = settings->tca_kb;
 		lensfun->tca_kr = settings->tca_kr;
 		lensfun->vignetting = settings->vignetting;
-		rs_filter_changed(RS_FILTER(lensfun), RS_FILTER_CHANGED_PIXELDATA);
 	}
+	g_mutex_unlock(&lensfun->lock);
+
+	if (changed)
+		rs_filter_changed(RS_FILTER(lensfun), RS_FILTER_CHANGED_PIXELDATA);
 }
 
 static void
@@ -313,35 +324,49 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			g_object_weak_ref(G_OBJECT(lensfun->settings), settings_weak_notify, lensfun);
 			break;
 		case PROP_MAKE:
+			g_mutex_lock(&lensfun->lock);
 			g_free(lensfun->make);
 			lensfun->make = g_value_dup_string(value);
 			lensfun->DIRTY = TRUE;
+			g_mutex_unlock(&lensfun->lock);
 			break;
 		case PROP_MODEL:
+			g_mutex_lock(&lensfun->lock);
 			g_free(lensfun->model);
 			lensfun->model = g_value_dup_string(value);
 			lensfun->DIRTY = TRUE;
+			g_mutex_unlock(&lensfun->lock);
 			break;
 		case PROP_LENS:
+			g_mutex_lock(&lensfun->lock);
 			if (lensfun->lens)
 				g_object_unref(lensfun->lens);
 			lensfun->lens = g_value_dup_object(value);
 			lensfun->DIRTY = TRUE;
+			g_mutex_unlock(&lensfun->lock);
 			break;
 		case PROP_FOCAL:
+			g_mutex_lock(&lensfun->lock);
 			lensfun->focal = g_value_get_float(value);
+			g_mutex_unlock(&lensfun->lock);
 			break;
 		case PROP_APERTURE:
+			g_mutex_lock(&lensfun->lock);
 			lensfun->aperture = g_value_get_float(value);
+			g_mutex_unlock(&lensfun->lock);
 			break;
 		case PROP_DISTORTION_ENABLED:
+			g_mutex_lock(&lensfun->lock);
 			lensfun->DIRTY = TRUE;
 			lensfun->distortion_enabled = g_value_get_boolean(value);
+			g_mutex_unlock(&lensfun->lock);
 			rs_filter_changed(RS_FILTER(lensfun), RS_FILTER_CHANGED_PIXELDATA);
 			break;
 		case PROP_DEFISH:
+			g_mutex_lock(&lensfun->lock);
 			lensfun->DIRTY = TRUE;
 			lensfun->defish = g_value_get_boolean(value);
+			g_mutex_unlock(&lensfun->lock);
 			rs_filter_changed(RS_FILTER(lensfun), RS_FILTER_CHANGED_PIXELDATA);
 			break;
 		default:
@@ -355,7 +380,6 @@ typedef struct {
 	lfModifier *mod;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output;
-	GThread *threadid;
 	gint effective_flags;
 	GdkRectangle *roi;
 	gint stage;
@@ -485,6 +509,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		return response;
 	}
 
+	/* The selected lens is modified below, the main loop must wait until
+	 * our modifier is set up */
+	g_mutex_lock(&lensfun->lock);
+
 	if(lensfun->DIRTY)
 	{
 		if (lensfun->selected_lens)
@@ -537,6 +565,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			
 			if (ABS(lensfun->tca_kr) + ABS(lensfun->tca_kb) + ABS(lensfun->vignetting) < 0.001) 
 			{
+				g_mutex_unlock(&lensfun->lock);
 				rs_filter_response_set_image(response, input);
 				g_object_unref(input);
 				return response;
@@ -575,9 +604,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	vign_roi->height = MIN(input->h - vign_roi->y, roi->height + ((roi->height + 2) / 2));
 
 	/* Proceed if we got everything */
+	lfModifier *mod = NULL;
+	gint effective_flags = 0;
 	if (lensfun->selected_lens && lf_lens_check((lfLens *) lensfun->selected_lens))
 	{
-		gint effective_flags;
 		/* Set TCA */
 		if (ABS(lensfun->tca_kr) > 0.01f || ABS(lensfun->tca_kb) > 0.01f) 
 		{
@@ -624,7 +654,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			lf_lens_remove_calib_vignetting(lensfun->selected_lens, 2);
 		}
 
-		lfModifier *mod = lf_modifier_new (lensfun->selected_lens, lensfun->selected_camera->CropFactor, input->w, input->h);
+		mod = lf_modifier_new (lensfun->selected_lens, lensfun->selected_camera->CropFactor, input->w, input->h);
 		effective_flags = lf_modifier_initialize (mod, lensfun->selected_lens,
 			LF_PF_U16, /* lfPixelFormat */
 			lensfun->focal, /* focal */
@@ -654,10 +684,16 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		g_debug("Effective flags:%s", flags->str);
 		g_string_free(flags, TRUE);
 #endif
-			
+	}
+
+	/* The modifier has computed everything it needs from the lens */
+	g_mutex_unlock(&lensfun->lock);
+
+	if (mod)
+	{
 		if (effective_flags > 0)
 		{
-			const guint threads = rs_get_number_of_processor_cores();
+			const guint threads = rs_thread_pool_get_num_threads();
 			ThreadInfo *t = g_new(ThreadInfo, threads);
 
 			/* Set up job description for individual threads */
@@ -686,12 +722,9 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 					y_offset += y_per_thread;
 					y_offset = MIN(vign_roi->y + vign_roi->height, y_offset);
 					t[i].end_y = y_offset;
-					t[i].threadid = g_thread_new("RSLensfun worker (phase 2)", thread_func, &t[i]);
 				}
-				
-				/* Wait for threads to finish */
-				for(i = 0; i < threads; i++)
-					g_thread_join(t[i].threadid);
+
+				rs_thread_pool_run(thread_func, t, sizeof(ThreadInfo), threads);
 
 				input = output;
 			}
@@ -715,12 +748,9 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 					y_offset = MIN(roi->y + roi->height, y_offset);
 					t[i].end_y = y_offset;
 					t[i].stage = 3;
-					t[i].threadid = g_thread_new("RSLensfun worker (phase 1+3)", thread_func, &t[i]);
 				}
-				
-				/* Wait for threads to finish */
-				for(i = 0; i < threads; i++)
-					g_thread_join(t[i].threadid);
+
+				rs_thread_pool_run(thread_func, t, sizeof(ThreadInfo), threads);
 			}
 			else
 			{
@@ -17,6 +17,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include <rawstudio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "StdAfx.h"
 #include "FileReader.h"
 #include "RawParser.h"
@@ -28,6 +33,81 @@
 
 using namespace RawSpeed;
 
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+/* RawSpeed may read a few bytes beyond the end of the file */
+#define MAP_MARGIN 16
+
+typedef struct {
+	void *area;
+	gsize length;
+} MappedFile;
+
+/*
+ * Map a file for RawSpeed to decode from, instead of reading it into a buffer.
+ * The mapping is followed by zeroed pages, so reading past the end of the
+ * file is harmless. It is private and writable, as some decoders modify the
+ * data in place.
+ */
+static FileMap *
+map_file(const gchar *filename, MappedFile *mapped)
+{
+	struct stat st;
+	gint fd;
+	gsize page = sysconf(_SC_PAGESIZE);
+	void *map;
+
+	mapped->area = NULL;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > (G_MAXINT32 - MAP_MARGIN))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	mapped->length = ((st.st_size + MAP_MARGIN + page - 1) / page) * page;
+	mapped->area = mmap(NULL, mapped->length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (mapped->area == MAP_FAILED)
+	{
+		mapped->area = NULL;
+		close(fd);
+		return NULL;
+	}
+
+	/* Populate read-only while we hold the IO lock, a writable mapping would
+	 * make the kernel copy every page up front */
+	map = mmap(mapped->area, st.st_size, PROT_READ, MAP_PRIVATE|MAP_FIXED|MAP_POPULATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED || mprotect(mapped->area, mapped->length, PROT_READ|PROT_WRITE) != 0)
+	{
+		munmap(mapped->area, mapped->length);
+		mapped->area = NULL;
+		return NULL;
+	}
+
+	return new FileMap((uchar8 *) mapped->area, (uint32) st.st_size);
+}
+
+static void
+unmap_file(MappedFile *mapped)
+{
+	if (mapped->area)
+		munmap(mapped->area, mapped->length);
+	mapped->area = NULL;
+}
+
+/* Keeps the decoded RawSpeed image alive while a RS_IMAGE16 uses its pixels */
+static void
+free_raw_image(gpointer data)
+{
+	delete (RawImage *) data;
+}
+
 extern "C" {
 
 RSFilterResponse*
@@ -60,6 +140,7 @@ load_rawspeed(const gchar *filename)
 	FileReader f((LPCWSTR) filename);
 	RawDecoder *d = 0;
 	FileMap* m = 0;
+	MappedFile mapped = { NULL, 0 };
 
 #ifdef TIME_LOAD
 		GTimer *gt = g_timer_new();
@@ -68,8 +149,10 @@ load_rawspeed(const gchar *filename)
 
 	try
 	{
-		rs_io_lock();
-		m = f.readFile();
+		rs_io_lock_file(filename);
+		m = map_file(filename, &mapped);
+		if (!m)
+			m = f.readFile();
 		rs_io_unlock();
 	}
 	catch (FileIOException &e)
@@ -113,6 +196,7 @@ load_rawspeed(const gchar *filename)
 			RawImage r = d->mRaw;
 			delete d; d = NULL;
 			delete m; m = NULL;
+			unmap_file(&mapped);
 
       r->scaleBlackWhite();
 
@@ -121,11 +205,8 @@ load_rawspeed(const gchar *filename)
       g_timer_destroy(gt);
 #endif
 			cpp = r->getCpp();
-			if (cpp == 1) 
-				image = rs_image16_new(r->dim.x, r->dim.y, cpp, cpp);
-			else if (cpp == 3) 
-				image = rs_image16_new(r->dim.x, r->dim.y, 3, 4);
-			else {
+			if (cpp != 1 && cpp != 3)
+			{
 				g_warning("RawSpeed: Unsupported component per pixel count\n");
 				return rs_filter_response_new();
 			}
@@ -136,29 +217,33 @@ load_rawspeed(const gchar *filename)
 				return rs_filter_response_new();
 			}
 
+			if (cpp == 1)
+			{
+				/* Use the RawSpeed buffer directly, CFA data is only read
+				 * pixel by pixel, so row alignment doesn't matter */
+				image = rs_image16_new_from_data((gushort *) r->getData(0,0), r->dim.x, r->dim.y, 1, 1,
+					r->pitch/2, free_raw_image, new RawImage(r));
+			}
+			else
+			{
+				/* We need four shorts per pixel, this has to be copied */
+				image = rs_image16_new(r->dim.x, r->dim.y, 3, 4);
+				for(row=0;row<image->h;row++)
+				{
+					gushort *inpixel = (gushort*)&r->getData()[row*r->pitch];
+					gushort *outpixel = GET_PIXEL(image, 0, row);
+					for(col=0;col<image->w;col++)
+					{
+						*outpixel++ =  *inpixel++;
+						*outpixel++ =  *inpixel++;
+						*outpixel++ =  *inpixel++;
+						outpixel++;
+					}
+				}
+			}
+
 			if (r->isCFA)
 				image->filters = r->cfa.getDcrawFilter();
-
-
-      if (cpp == 1) 
-      {
-        BitBlt((uchar8 *)(GET_PIXEL(image,0,0)),image->pitch*2,
-          r->getData(0,0), r->pitch, r->getBpp()*r->dim.x, r->dim.y);
-      } else 
-      {
-        for(row=0;row<image->h;row++)
-        {
-          gushort *inpixel = (gushort*)&r->getData()[row*r->pitch];
-          gushort *outpixel = GET_PIXEL(image, 0, row);
-          for(col=0;col<image->w;col++)
-          {
-            *outpixel++ =  *inpixel++;
-            *outpixel++ =  *inpixel++;
-            *outpixel++ =  *inpixel++;
-            outpixel++;
-          }
-        }
-      }
 	}
 		catch (RawDecoderException &e)
 		{
@@ -176,6 +261,7 @@ load_rawspeed(const gchar *filename)
 
 	if (d) delete d;
 	if (m) delete m;
+	unmap_file(&mapped);
 
 	RSFilterResponse* response = rs_filter_response_new();
 	if (image)
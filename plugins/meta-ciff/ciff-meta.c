@@ -222,10 +222,13 @@ ciff_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata
 	gdouble ratio;
 	guint start=0, length=0;//, root=0;
 
-	rs_io_lock();
+	rs_io_lock_fd(raw_get_fd(rawfile));
 	raw_init_file_tiff(rawfile, offset);
 	if (!raw_strcmp(rawfile, 6, "HEAPCCDR", 8))
+	{
+		rs_io_unlock();
 		return FALSE;
+	}
 	raw_get_uint(rawfile, 2, &root);
 	raw_crw_walker(rawfile, root, raw_get_filesize(rawfile)-root, meta);
 	rs_io_unlock();
@@ -244,8 +247,8 @@ ciff_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata
 
 	if ((start>0) && (length>0))
 	{
-		rs_io_lock();
-		pixbuf = raw_get_pixbuf(rawfile, start, length);
+		rs_io_lock_fd(raw_get_fd(rawfile));
+		pixbuf = raw_get_pixbuf_scaled(rawfile, start, length, 128);
 		rs_io_unlock();
 
 		ratio = ((gdouble) gdk_pixbuf_get_width(pixbuf))/((gdouble) gdk_pixbuf_get_height(pixbuf));
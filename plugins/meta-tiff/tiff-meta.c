@@ -1827,7 +1827,7 @@ tiff_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata
 	gushort ifd_num = 0;
 	guchar version;
 
-	rs_io_lock();
+	rs_io_lock_fd(raw_get_fd(rawfile));
 
 	version = raw_init_file_tiff(rawfile, offset);
 
@@ -1895,7 +1895,7 @@ tif_load_meta(const gchar *service, RAWFILE *rawfile, guint offset, RSMetadata *
 static gboolean
 thumbnail_reader(const gchar *service, RAWFILE *rawfile, guint offset, guint length, RSMetadata *meta)
 {
-	rs_io_lock();
+	rs_io_lock_fd(raw_get_fd(rawfile));
 	GdkPixbuf *pixbuf=NULL;
 	if ((offset>0) && (length>0) && (length<5000000))
 	{
@@ -1928,8 +1928,10 @@ thumbnail_reader(const gchar *service, RAWFILE *rawfile, guint offset, guint len
 					meta->preview_width, meta->preview_height,
 					meta->preview_width * 3, NULL, NULL);
 			else
-				/* Try to guess file format based on contents (JPEG previews) */
-			pixbuf = raw_get_pixbuf(rawfile, offset, length);
+				/* Try to guess file format based on contents (JPEG previews).
+				 * Scaled previews must stay larger than 160 pixels, or thumbnail_store()
+				 * would mistake them for letterboxed 160x120 thumbnails */
+				pixbuf = raw_get_pixbuf_scaled(rawfile, offset, length, 161);
 	}
 	rs_io_unlock();
 
@@ -2026,6 +2028,8 @@ raw_thumbnail_reader(const gchar *service, RSMetadata *meta)
 		g_object_set(fdcp, "use-profile", FALSE, NULL);
 	
 	rs_filter_set_recursive(RS_FILTER(fdemosaic), "demosaic-allow-downscale",  TRUE, NULL);
+	/* Average the mosaic straight down to thumbnail size instead of demosaicing it */
+	g_object_set(fdemosaic, "demosaic-bin-size", 256, NULL);
 	
 	RSFilterRequest *request = rs_filter_request_new();
 	rs_filter_request_set_roi(request, FALSE);
@@ -213,40 +213,98 @@ rs_jpeg_write_icc_profile(j_compress_ptr cinfo, const JOCTET *icc_data_ptr, guin
 	return;
 }
 
-static gboolean
-execute(RSOutput *output, RSFilter *filter)
+/* At least this many rows are pulled from the filter chain at a time, and
+ * split in one segment per thread to be encoded in parallel */
+#define CHUNK_HEIGHT 1024
+
+/* The encoder writes each segment to memory, the segments are put together
+ * as restart intervals of a single baseline JPEG */
+typedef struct {
+	struct jpeg_destination_mgr pub;
+	GByteArray *data;
+	JOCTET buffer[4096];
+} MemoryDestination;
+
+typedef struct {
+	RSJpegfile *jpegfile;
+	GdkPixbuf *pixbuf;          /* The chunk of the image holding the segment */
+	gint start_y;               /* First row in pixbuf */
+	gint rows;
+	guint restart_interval;
+	gboolean first;             /* The first segment carries the headers */
+	GByteArray *data;           /* The complete JPEG of the segment */
+	gint64 encode_time;
+} JpegSegment;
+
+static void
+memory_init_destination(j_compress_ptr cinfo)
 {
-	RSJpegfile *jpegfile = RS_JPEGFILE(output);
+	MemoryDestination *dest = (MemoryDestination *) cinfo->dest;
+
+	dest->pub.next_output_byte = dest->buffer;
+	dest->pub.free_in_buffer = sizeof(dest->buffer);
+}
+
+static boolean
+memory_empty_output_buffer(j_compress_ptr cinfo)
+{
+	MemoryDestination *dest = (MemoryDestination *) cinfo->dest;
+
+	g_byte_array_append(dest->data, dest->buffer, sizeof(dest->buffer));
+	dest->pub.next_output_byte = dest->buffer;
+	dest->pub.free_in_buffer = sizeof(dest->buffer);
+
+	return TRUE;
+}
+
+static void
+memory_term_destination(j_compress_ptr cinfo)
+{
+	MemoryDestination *dest = (MemoryDestination *) cinfo->dest;
+
+	g_byte_array_append(dest->data, dest->buffer, sizeof(dest->buffer) - dest->pub.free_in_buffer);
+}
+
+static void
+set_defaults(RSJpegfile *jpegfile, j_compress_ptr cinfo)
+{
+	cinfo->input_components = 3;
+	cinfo->in_color_space = JCS_RGB;
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, jpegfile->quality, TRUE);
+	/* All segments must share the standard Huffman tables */
+	cinfo->optimize_coding = FALSE;
+}
+
+static gpointer
+encode_segment(gpointer _segment)
+{
+	JpegSegment *segment = _segment;
+	RSJpegfile *jpegfile = segment->jpegfile;
 	struct jpeg_compress_struct cinfo;
 	struct jpeg_error_mgr jerr;
-	FILE * outfile;
+	MemoryDestination dest;
 	JSAMPROW row_pointer[1];
-	gint x,y;
-	
-	
-	RSFilterRequest *request = rs_filter_request_new();
-	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
-	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", jpegfile->color_space);
-	RSFilterResponse *response = rs_filter_get_image8(filter, request);
-	
-	g_object_unref(request);
-	GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
-	g_object_unref(response);
+	guchar *row = NULL;
+	gint x;
+	gint64 start = g_get_monotonic_time();
+	const gint channels = gdk_pixbuf_get_n_channels(segment->pixbuf);
 
 	cinfo.err = jpeg_std_error(&jerr);
 	jpeg_create_compress(&cinfo);
-	if ((outfile = fopen(jpegfile->filename, "wb")) == NULL)
-		return(FALSE);
-	jpeg_stdio_dest(&cinfo, outfile);
-	cinfo.image_width = gdk_pixbuf_get_width(pixbuf);
-	cinfo.image_height = gdk_pixbuf_get_height(pixbuf);
-	cinfo.input_components = 3;
-	cinfo.in_color_space = JCS_RGB;
-	jpeg_set_defaults(&cinfo);
-	jpeg_set_quality(&cinfo, jpegfile->quality, TRUE);
-	rs_io_lock();
+	dest.pub.init_destination = memory_init_destination;
+	dest.pub.empty_output_buffer = memory_empty_output_buffer;
+	dest.pub.term_destination = memory_term_destination;
+	dest.data = segment->data;
+	cinfo.dest = &dest.pub;
+
+	cinfo.image_width = gdk_pixbuf_get_width(segment->pixbuf);
+	cinfo.image_height = segment->rows;
+	set_defaults(jpegfile, &cinfo);
+	cinfo.restart_interval = segment->restart_interval;
 	jpeg_start_compress(&cinfo, TRUE);
-	if (jpegfile->color_space && !g_str_equal(G_OBJECT_TYPE_NAME(jpegfile->color_space), "RSSrgb"))
+
+	if (segment->first && jpegfile->color_space && !g_str_equal(G_OBJECT_TYPE_NAME(jpegfile->color_space), "RSSrgb"))
 	{
 		const RSIccProfile *profile = rs_color_space_get_icc_profile(jpegfile->color_space, FALSE);
 		if (profile)
@@ -259,45 +317,294 @@ execute(RSOutput *output, RSFilter *filter)
 		}
 	}
 
-	if (gdk_pixbuf_get_n_channels(pixbuf) == 4)
+	if (channels == 4)
+		row = g_new(guchar, cinfo.image_width * 3);
+
+	while (cinfo.next_scanline < cinfo.image_height)
 	{
-		GdkPixbuf *out = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, cinfo.image_width, cinfo.image_height);
-		for( y = 0; y < cinfo.image_height; y++){
-			gint* in = (gint*)GET_PIXBUF_PIXEL(pixbuf, 0, y);
-			guchar* o = GET_PIXBUF_PIXEL(out, 0, y);
-			for( x = 0; x < cinfo.image_width ; x++) {
-				guint i = *in++;
-				o[0] = i&0xff;
-				o[1] = (i>>8)&0xff;
-				o[2] = (i>>16)&0xff;
-				o+=3;
+		guchar *in = GET_PIXBUF_PIXEL(segment->pixbuf, 0, segment->start_y + cinfo.next_scanline);
+		if (row)
+		{
+			guchar *o = row;
+			for(x = 0; x < cinfo.image_width; x++)
+			{
+				o[0] = in[0];
+				o[1] = in[1];
+				o[2] = in[2];
+				o += 3;
+				in += 4;
 			}
+			in = row;
+		}
+		row_pointer[0] = in;
+		if (jpeg_write_scanlines(&cinfo, row_pointer, 1) != 1)
+			break;
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	g_free(row);
+
+	segment->encode_time = g_get_monotonic_time() - start;
+
+	return NULL;
+}
+
+/* Returns the length of the headers of a JPEG, up to and including the SOS
+ * marker segment, optionally setting the height in the frame header */
+static gsize
+header_length(GByteArray *jpeg, gint height)
+{
+	guint8 *data = jpeg->data;
+	gsize pos = 2; /* SOI */
+	gsize length;
+	guint8 marker;
+
+	while (pos + 4 <= jpeg->len && data[pos] == 0xFF)
+	{
+		marker = data[pos+1];
+		length = (data[pos+2] << 8) | data[pos+3];
+		if (marker == 0xC0 && height > 0)
+		{
+			data[pos+5] = height >> 8;
+			data[pos+6] = height & 0xff;
 		}
+		pos += 2 + length;
+		if (marker == 0xDA)
+			return pos;
+	}
+
+	g_warn_if_reached();
+	return jpeg->len;
+}
+
+static gboolean
+covers(const GdkRectangle *rect, gint width, gint start_y, gint rows)
+{
+	return rect->x <= 0 && rect->x + rect->width >= width
+		&& rect->y <= start_y && rect->y + rect->height >= start_y + rows;
+}
+
+/* Gets rows from start_y from the chain. A response is only kept in whole and
+ * used for the remaining chunks if it holds all of the image, any other
+ * response must cover all the rows asked for */
+static GdkPixbuf *
+get_chunk(RSFilter *filter, RSFilterRequest *request, gint width, gint height, gint start_y, gint rows, GdkPixbuf **whole, gint *offset)
+{
+	RSFilterResponse *response;
+	GdkPixbuf *pixbuf;
+	GdkRectangle roi, *response_roi;
+	GdkRectangle image;
+
+	if (*whole)
+	{
+		*offset = start_y;
+		return g_object_ref(*whole);
+	}
+
+	roi.x = 0;
+	roi.y = start_y;
+	roi.width = width;
+	roi.height = rows;
+	rs_filter_request_set_roi(request, &roi);
+
+	response = rs_filter_get_image8_roi(filter, request);
+	pixbuf = rs_filter_response_get_image8(response);
+	if (!pixbuf)
+	{
+		g_object_unref(response);
+		return NULL;
+	}
+
+	rs_filter_response_get_origin(response, &image.x, &image.y);
+	image.width = gdk_pixbuf_get_width(pixbuf);
+	image.height = gdk_pixbuf_get_height(pixbuf);
+	response_roi = rs_filter_response_get_roi(response);
+
+	/* A full size image may only be rendered inside the returned ROI */
+	if (!covers(&image, width, start_y, rows) || (response_roi && !covers(response_roi, width, start_y, rows)))
+	{
+		g_warning("JPEG: Chain returned %dx%d at %d,%d, which does not cover rows %d to %d",
+			image.width, image.height, image.x, image.y, start_y, start_y + rows);
 		g_object_unref(pixbuf);
-		pixbuf = out;
+		g_object_unref(response);
+		return NULL;
 	}
 
-	while (cinfo.next_scanline < cinfo.image_height)
+	if (covers(&image, width, 0, height) && (!response_roi || covers(response_roi, width, 0, height)))
+		*whole = g_object_ref(pixbuf);
+	*offset = start_y - image.y;
+	g_object_unref(response);
+
+	return pixbuf;
+}
+
+static gboolean
+execute(RSOutput *output, RSFilter *filter)
+{
+	RSJpegfile *jpegfile = RS_JPEGFILE(output);
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	FILE * outfile;
+	RSThreadPoolGroup *group;
+	JpegSegment *segments;
+	GdkPixbuf *chunk, *next;
+	GdkPixbuf *whole = NULL;
+	gint width, height;
+	gint mcu_width, mcu_height;
+	gint segment_rows, chunk_rows, chunk_height;
+	gint chunk_y, offset, next_offset = 0;
+	gint num_segments, i;
+	gint segment_index = 0;
+	gboolean complete;
+	gint64 encode_time = 0;
+	gint64 start = g_get_monotonic_time();
+	const gint threads = rs_thread_pool_get_num_threads();
+	const guint8 rst[2] = {0xFF, 0xD0};
+	const guint8 eoi[2] = {0xFF, 0xD9};
+
+	RSFilterRequest *request = rs_filter_request_new();
+	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
+	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", jpegfile->color_space);
+	/* The image is requested in strips, ask filters to hide the seams */
+	rs_filter_param_set_boolean(RS_FILTER_PARAM(request), "seamless-roi", TRUE);
+
+	if (!rs_filter_get_size_simple(filter, request, &width, &height))
 	{
-		row_pointer[0] = GET_PIXBUF_PIXEL(pixbuf, 0, cinfo.next_scanline);
-		if (jpeg_write_scanlines(&cinfo, row_pointer, 1) != 1)
-			break;
+		RSFilterResponse *response = rs_filter_get_image8(filter, request);
+		whole = rs_filter_response_get_image8(response);
+		g_object_unref(response);
+		if (!whole)
+		{
+			g_object_unref(request);
+			return FALSE;
+		}
+		width = gdk_pixbuf_get_width(whole);
+		height = gdk_pixbuf_get_height(whole);
+	}
+
+	/* Segments are restart intervals and must be whole rows of MCUs. The
+	 * restart interval is a 16 bit count of MCUs */
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	set_defaults(jpegfile, &cinfo);
+	mcu_width = mcu_height = DCTSIZE;
+	for(i = 0; i < cinfo.num_components; i++)
+	{
+		mcu_width = MAX(mcu_width, cinfo.comp_info[i].h_samp_factor * DCTSIZE);
+		mcu_height = MAX(mcu_height, cinfo.comp_info[i].v_samp_factor * DCTSIZE);
 	}
-	jpeg_finish_compress(&cinfo);
-	fclose(outfile);
 	jpeg_destroy_compress(&cinfo);
-	g_object_unref(pixbuf);
+
+	/* Every chunk renders the tile border of the chain once more, keep
+	 * that below a quarter of the rows. If the chain cannot render
+	 * tiles, every chunk would render the whole image */
+	const gint border = rs_filter_get_tile_border(filter);
+	if (border < 0)
+		chunk_height = height;
+	else
+		chunk_height = MAX(CHUNK_HEIGHT, 8 * border);
+
+	const gint mcus_per_row = (width + mcu_width - 1) / mcu_width;
+	segment_rows = (chunk_height / threads + mcu_height - 1) / mcu_height;
+	segment_rows = CLAMP(segment_rows, 1, 65535 / mcus_per_row) * mcu_height;
+	chunk_rows = segment_rows * threads;
+
+	chunk = get_chunk(filter, request, width, height, 0, MIN(chunk_rows, height), &whole, &offset);
+
+	if (!chunk || (outfile = fopen(jpegfile->filename, "wb")) == NULL)
+	{
+		if (chunk)
+			g_object_unref(chunk);
+		if (whole)
+			g_object_unref(whole);
+		g_object_unref(request);
+		return(FALSE);
+	}
+
+	segments = g_new(JpegSegment, threads);
+
+	for(chunk_y = 0; chunk && chunk_y < height; chunk_y += chunk_rows)
+	{
+		const gint rows = MIN(chunk_rows, height - chunk_y);
+
+		/* Encode while the next chunk is pulled from the chain */
+		group = rs_thread_pool_group_new();
+		num_segments = (rows + segment_rows - 1) / segment_rows;
+		for(i = 0; i < num_segments; i++)
+		{
+			segments[i].jpegfile = jpegfile;
+			segments[i].pixbuf = chunk;
+			segments[i].start_y = offset + i * segment_rows;
+			segments[i].rows = MIN(segment_rows, rows - i * segment_rows);
+			segments[i].restart_interval = mcus_per_row * (segment_rows / mcu_height);
+			segments[i].first = (chunk_y == 0 && i == 0);
+			segments[i].data = g_byte_array_new();
+			rs_thread_pool_group_add(group, encode_segment, &segments[i]);
+		}
+
+		next = NULL;
+		if (chunk_y + chunk_rows < height)
+			next = get_chunk(filter, request, width, height, chunk_y + chunk_rows, MIN(chunk_rows, height - chunk_y - chunk_rows), &whole, &next_offset);
+
+		rs_thread_pool_group_wait(group);
+		g_object_unref(chunk);
+
+		/* Only hold the lock while actually writing */
+		rs_io_lock_file(jpegfile->filename);
+		for(i = 0; i < num_segments; i++)
+		{
+			GByteArray *data = segments[i].data;
+			gsize header = header_length(data, segments[i].first ? height : 0);
+
+			if (segments[i].first)
+				fwrite(data->data, 1, header, outfile);
+			else
+			{
+				guint8 marker[2] = {rst[0], rst[1] + ((segment_index - 1) & 7)};
+				fwrite(marker, 1, 2, outfile);
+			}
+
+			/* Leave out the EOI marker */
+			fwrite(data->data + header, 1, data->len - header - 2, outfile);
+
+			encode_time += segments[i].encode_time;
+			g_byte_array_free(data, TRUE);
+			segment_index++;
+		}
+		rs_io_unlock();
+
+		chunk = next;
+		offset = next_offset;
+	}
+
+	/* The chain may have failed to deliver a chunk */
+	complete = (chunk_y >= height);
+
+	rs_io_lock_file(jpegfile->filename);
+	fwrite(eoi, 1, 2, outfile);
+	fclose(outfile);
+	rs_io_unlock();
+
+	g_free(segments);
+	if (whole)
+		g_object_unref(whole);
+	g_object_unref(request);
+
+	RS_DEBUG(PERFORMANCE, "JPEG: %dx%d in %d segments at %.1f Mpix/s, encoding alone %.1f Mpix/s per thread",
+		width, height, segment_index, (gdouble) width * height / MAX(1, g_get_monotonic_time() - start),
+		(gdouble) width * height / MAX(1, encode_time));
 
 	gchar *input_filename = NULL;
 	rs_filter_get_recursive(filter, "filename", &input_filename, NULL);
 
+	rs_io_lock_file(jpegfile->filename);
 	if (jpegfile->copy_metadata)
 		rs_exif_copy(input_filename, jpegfile->filename, G_OBJECT_TYPE_NAME(jpegfile->color_space), RS_EXIF_FILE_TYPE_JPEG);
 	else
 		rs_exif_add_colorspace(jpegfile->filename, G_OBJECT_TYPE_NAME(jpegfile->color_space), RS_EXIF_FILE_TYPE_JPEG);
-
 	rs_io_unlock();
+
 	g_free(input_filename);
 
-	return(TRUE);
+	return(complete);
 }
@@ -240,7 +240,7 @@ execute(RSOutput *output, RSFilter *filter)
 
 		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 16);
 		printf("pixelsize: %d\n", image->pixelsize);
-		rs_io_lock();
+		rs_io_lock_file(tifffile->filename);
 		for(row=0;row<image->h;row++)
 		{
 			gushort *buf = GET_PIXEL(image, 0, row);
@@ -269,7 +269,7 @@ execute(RSOutput *output, RSFilter *filter)
 		gchar *line = g_new(gchar, width * 3);
 
 		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 8);
-		rs_io_lock();
+		rs_io_lock_file(tifffile->filename);
 		for(row=0;row<height;row++)
 		{
 			guchar *buf = GET_PIXBUF_PIXEL(pixbuf, 0, row);
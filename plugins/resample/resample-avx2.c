@@ -0,0 +1,124 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Plugin tmpl version 4 */
+
+#include <rawstudio.h>
+#include "resample.h"
+
+/* Horizontal AVX2 resampler. Works like ResizeH_SSE4(), but applies four
+ * taps per pmaddwd, two in each 128 bit lane. Results are bit identical
+ * to ResizeH().
+ */
+
+#if defined (__AVX2__)
+#include <immintrin.h>
+
+void
+ResizeH_AVX2(ResampleInfo *info)
+{
+	const RS_IMAGE16 *input = info->input;
+	const RS_IMAGE16 *output = info->output;
+	const guint new_size = info->new_size;
+
+	g_return_if_fail(input->pixelsize == 4);
+	g_return_if_fail(input->channels == 3);
+
+	ResampleWeights *weights = resample_weights_get(info->old_size, new_size);
+
+	if (!weights)
+		return ResizeH_fast(info);
+
+	const gint *offsets = weights->offsets;
+	/* Taps that don't fill a 32 byte load are done in 128 bits, so we don't read past the line */
+	const gint odd_tap = weights->fir_filter_size & 1;
+	const gint full_pairs = weights->fir_pairs - odd_tap;
+	const gint quads = full_pairs / 2;
+
+	/* Compensate for signed input and add rounder */
+	__m128i add_32 = _mm_set1_epi32(32768 * FPScale + (FPScale >> 1));
+	__m128i sign = _mm_set1_epi16((gshort) 0x8000);
+	__m128i zero = _mm_setzero_si128();
+	__m256i sign256 = _mm256_set1_epi16((gshort) 0x8000);
+	/* Spreads two weight pairs to the low and high lane */
+	__m256i lanes = _mm256_set_epi32(1, 1, 1, 1, 0, 0, 0, 0);
+
+	guint y,x;
+	gint i;
+	for (y = info->dest_offset_other; y < info->dest_end_other ; y++)
+	{
+		gushort *in_line = GET_PIXEL(input, 0, y);
+		gushort *out = GET_PIXEL(output, 0, y);
+		const guint32 *wg = weights->weight_pairs + info->dest_offset * weights->fir_pairs;
+
+		for (x = info->dest_offset; x < info->dest_end; x++)
+		{
+			const gushort *in = &in_line[(offsets[x] - info->input_offset) * 4];
+			__m256i acc256 = _mm256_setzero_si256();
+			__m128i acc;
+
+			for (i = 0; i < quads; i++)
+			{
+				/* Load four pixels and interleave pairs within each lane */
+				__m256i src = _mm256_loadu_si256((__m256i*)&in[i * 16]);
+				src = _mm256_unpacklo_epi16(src, _mm256_srli_si256(src, 8));
+				src = _mm256_xor_si256(src, sign256);
+				__m256i w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((__m128i*)&wg[i * 2])), lanes);
+				acc256 = _mm256_add_epi32(acc256, _mm256_madd_epi16(src, w));
+			}
+			acc = _mm_add_epi32(_mm256_castsi256_si128(acc256), _mm256_extracti128_si256(acc256, 1));
+
+			i *= 2;
+			if (i < full_pairs)
+			{
+				__m128i src = _mm_loadu_si128((__m128i*)&in[i * 8]);
+				src = _mm_unpacklo_epi16(src, _mm_srli_si128(src, 8));
+				src = _mm_xor_si128(src, sign);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(src, _mm_set1_epi32(wg[i])));
+				i++;
+			}
+			if (odd_tap)
+			{
+				/* Weight of the second tap is 0 */
+				__m128i src = _mm_loadl_epi64((__m128i*)&in[i * 8]);
+				src = _mm_unpacklo_epi16(_mm_xor_si128(src, sign), zero);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(src, _mm_set1_epi32(wg[i])));
+			}
+
+			/* Add rounder, shift down and clamp */
+			acc = _mm_add_epi32(acc, add_32);
+			acc = _mm_srai_epi32(acc, FPScaleShift);
+			acc = _mm_packus_epi32(acc, acc);
+			_mm_storel_epi64((__m128i*)&out[(x - info->output_offset) * 4], acc);
+			wg += weights->fir_pairs;
+		}
+	}
+
+	resample_weights_unref(weights);
+}
+
+#else // not defined (__AVX2__)
+
+void
+ResizeH_AVX2(ResampleInfo *info)
+{
+	ResizeH_SSE4(info);
+}
+
+#endif // not defined (__AVX2__)
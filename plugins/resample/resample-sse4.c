@@ -20,7 +20,7 @@
 /* Plugin tmpl version 4 */
 
 #include <rawstudio.h>
-#include <math.h>
+#include "resample.h"
 
 
 /* Special Vertical SSE4 resampler, that has massive parallism.
@@ -28,59 +28,6 @@
  * in a 16 byte aligned memory pointer.
  */
 
-typedef struct {
-	RS_IMAGE16 *input;			/* Input Image to Resampler */
-	RS_IMAGE16 *output;			/* Output Image from Resampler */
-	guint old_size;				/* Old dimension in the direction of the resampler*/
-	guint new_size;				/* New size in the direction of the resampler */
-	guint dest_offset_other;	/* Where in the unchanged direction should we begin writing? */
-	guint dest_end_other;		/* Where in the unchanged direction should we stop writing? */
-	guint (*resample_support)(void);
-	gfloat (*resample_func)(gfloat);
-	GThread *threadid;
-	gboolean use_compatible;	/* Use compatible resampler if pixelsize != 4 */
-	gboolean use_fast;		/* Use nearest neighbour resampler, also compatible*/
-} ResampleInfo;
-
-extern void ResizeV_SSE2(ResampleInfo *info);
-extern void ResizeV(ResampleInfo *info);
-extern void ResizeV_fast(ResampleInfo *info);
-static inline guint clampbits(gint x, guint n) { guint32 _y_temp; if( (_y_temp=x>>n) ) x = ~_y_temp >> (32-n); return x;}
-
-static guint
-lanczos_taps(void)
-{
-	return 3;
-}
-
-static gfloat
-sinc(gfloat value)
-{
-	if (value != 0.0f)
-	{
-		value *= M_PI;
-		return sinf(value) / value;
-	}
-	else
-		return 1.0f;
-}
-
-static gfloat
-lanczos_weight(gfloat value)
-{
-	value = fabsf(value);
-	if (value < lanczos_taps())
-	{
-		return (sinc(value) * sinc(value / lanczos_taps()));
-	}
-	else
-		return 0.0f;
-}
-
-const static gint FPScale = 16384; /* fixed point scaler */
-const static gint FPScaleShift = 14; /* fixed point scaler */
-
-
 #if defined (__x86_64__) && defined(__SSE4_1__)
 #include <smmintrin.h>
 
@@ -94,62 +41,17 @@ ResizeV_SSE4(ResampleInfo *info)
 	const guint start_x = info->dest_offset_other * input->pixelsize;
 	const guint end_x = info->dest_end_other * input->pixelsize;
 
-	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
-	gfloat filter_step = MIN(1.0f / pos_step, 1.0f);
-	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
-	gint fir_filter_size = (gint) (ceil(filter_support*2));
+	ResampleWeights *weights = resample_weights_get(old_size, new_size);
 
-	if (old_size <= fir_filter_size)
+	if (!weights)
 		return ResizeV_fast(info);
 
-	gint *weights = g_new(gint, new_size * fir_filter_size);
-	gint *offsets = g_new(gint, new_size);
-
-	gfloat pos = 0.0;
-
-	gint i,j,k;
-
-	for (i=0; i<new_size; ++i)
-	{
-		gint end_pos = (gint) (pos + filter_support);
-		if (end_pos > old_size-1)
-			end_pos = old_size-1;
-
-		gint start_pos = end_pos - fir_filter_size + 1;
-
-		if (start_pos < 0)
-			start_pos = 0;
-
-		offsets[i] = start_pos;
-
-		/* The following code ensures that the coefficients add to exactly FPScale */
-		gfloat total = 0.0;
-
-		/* Ensure that we have a valid position */
-		gfloat ok_pos = MAX(0.0,MIN(old_size-1,pos));
-
-		for (j=0; j<fir_filter_size; ++j)
-		{
-			/* Accumulate all coefficients */
-			total += lanczos_weight((start_pos+j - ok_pos) * filter_step);
-		}
-
-		g_assert(total > 0.0f);
-
-		gfloat total2 = 0.0;
-
-		for (k=0; k<fir_filter_size; ++k)
-		{
-			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
-			weights[i*fir_filter_size+k] = ((gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5));
-			
-			total2 = total3;
-		}
-		pos += pos_step;
-	}
+	const gint fir_filter_size = weights->fir_filter_size;
+	const gint *offsets = weights->offsets;
+	gint i;
 
 	guint y,x;
-	gint *wg = weights;
+	gint *wg = weights->weights + info->dest_offset * fir_filter_size;
 
 	/* 24 pixels = 48 bytes/loop */
 	gint end_x_sse = (end_x/24)*24;
@@ -159,13 +61,13 @@ ResizeV_SSE4(ResampleInfo *info)
 	
 	__m128i add_32 = _mm_set_epi32(add_round_sub, add_round_sub, add_round_sub, add_round_sub);
 
-	for (y = 0; y < new_size ; y++)
+	for (y = info->dest_offset; y < info->dest_end ; y++)
 	{
-		gushort *in = GET_PIXEL(input, start_x / input->pixelsize, offsets[y]);
-		gushort *out = GET_PIXEL(output, 0, y);
+		gushort *in = GET_PIXEL(input, start_x / input->pixelsize, offsets[y] - info->input_offset);
+		gushort *out = GET_PIXEL(output, 0, y - info->output_offset);
 		__m128i zero;
 		zero = _mm_setzero_si128();
-		for (x = start_x; x <= (end_x_sse-24); x+=24)
+		for (x = start_x; x + 24 <= end_x_sse; x+=24)
 		{
 			/* Accumulators, set to 0 */
 			__m128i acc1, acc2,  acc3, acc1_h, acc2_h, acc3_h;
@@ -253,8 +155,7 @@ ResizeV_SSE4(ResampleInfo *info)
 		wg += fir_filter_size;
 	}
 	_mm_sfence();
-	g_free(weights);
-	g_free(offsets);
+	resample_weights_unref(weights);
 }
 
 #elif defined (__SSE4_1__)
@@ -270,62 +171,17 @@ ResizeV_SSE4(ResampleInfo *info)
 	const guint start_x = info->dest_offset_other * input->pixelsize;
 	const guint end_x = info->dest_end_other * input->pixelsize;
 
-	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
-	gfloat filter_step = MIN(1.0f / pos_step, 1.0f);
-	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
-	gint fir_filter_size = (gint) (ceil(filter_support*2));
+	ResampleWeights *weights = resample_weights_get(old_size, new_size);
 
-	if (old_size <= fir_filter_size)
+	if (!weights)
 		return ResizeV_fast(info);
 
-	gint *weights = g_new(gint, new_size * fir_filter_size);
-	gint *offsets = g_new(gint, new_size);
-
-	gfloat pos = 0.0;
-
-	gint i,j,k;
-
-	for (i=0; i<new_size; ++i)
-	{
-		gint end_pos = (gint) (pos + filter_support);
-		if (end_pos > old_size-1)
-			end_pos = old_size-1;
-
-		gint start_pos = end_pos - fir_filter_size + 1;
-
-		if (start_pos < 0)
-			start_pos = 0;
-
-		offsets[i] = start_pos;
-
-		/* The following code ensures that the coefficients add to exactly FPScale */
-		gfloat total = 0.0;
-
-		/* Ensure that we have a valid position */
-		gfloat ok_pos = MAX(0.0f,MIN(old_size-1,pos));
-
-		for (j=0; j<fir_filter_size; ++j)
-		{
-			/* Accumulate all coefficients */
-			total += lanczos_weight((start_pos+j - ok_pos) * filter_step);
-		}
-
-		g_assert(total > 0.0f);
-
-		gfloat total2 = 0.0;
-
-		for (k=0; k<fir_filter_size; ++k)
-		{
-			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
-			weights[i*fir_filter_size+k] = ((gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5));
-			
-			total2 = total3;
-		}
-		pos += pos_step;
-	}
+	const gint fir_filter_size = weights->fir_filter_size;
+	const gint *offsets = weights->offsets;
+	gint i;
 
 	guint y,x;
-	gint *wg = weights;
+	gint *wg = weights->weights + info->dest_offset * fir_filter_size;
 
 	/* 8 pixels = 16 bytes/loop */
 	gint end_x_sse = (end_x/8)*8;
@@ -335,13 +191,13 @@ ResizeV_SSE4(ResampleInfo *info)
 	/* 0.5 pixel value is lost to rounding times fir_filter_size, compensate */
 	add_round_sub += fir_filter_size * (FPScale >> 1);
 
-	for (y = 0; y < new_size ; y++)
+	for (y = info->dest_offset; y < info->dest_end ; y++)
 	{
-		gushort *in = GET_PIXEL(input, start_x / input->pixelsize, offsets[y]);
-		gushort *out = GET_PIXEL(output, 0, y);
+		gushort *in = GET_PIXEL(input, start_x / input->pixelsize, offsets[y] - info->input_offset);
+		gushort *out = GET_PIXEL(output, 0, y - info->output_offset);
 		__m128i zero;
 		zero = _mm_setzero_si128();
-		for (x = start_x; x <= (end_x_sse-8); x+=8)
+		for (x = start_x; x + 8 <= end_x_sse; x+=8)
 		{
 			/* Accumulators, set to 0 */
 			__m128i acc1, acc1_h;
@@ -401,8 +257,7 @@ ResizeV_SSE4(ResampleInfo *info)
 		}
 		wg += fir_filter_size;
 	}
-	g_free(weights);
-	g_free(offsets);
+	resample_weights_unref(weights);
 }
 
 #else // not defined (__SSE4__)
@@ -415,4 +270,88 @@ ResizeV_SSE4(ResampleInfo *info)
 
 #endif // not defined (__x86_64__) and not defined (__SSE4__)
 
+/* Horizontal SSE4 resampler. Two neighbouring input pixels are interleaved,
+ * so pmaddwd applies two taps to all channels at once. pmaddwd is signed,
+ * so input is offset by -32768 and added back after accumulation, which is
+ * exact since the weights add up to FPScale. Results are bit identical
+ * to ResizeH().
+ */
+
+#if defined (__SSE4_1__)
+#include <smmintrin.h>
+
+void
+ResizeH_SSE4(ResampleInfo *info)
+{
+	const RS_IMAGE16 *input = info->input;
+	const RS_IMAGE16 *output = info->output;
+	const guint new_size = info->new_size;
+
+	g_return_if_fail(input->pixelsize == 4);
+	g_return_if_fail(input->channels == 3);
+
+	ResampleWeights *weights = resample_weights_get(info->old_size, new_size);
+
+	if (!weights)
+		return ResizeH_fast(info);
+
+	const gint *offsets = weights->offsets;
+	/* An odd last tap is loaded alone, so we don't read past the line */
+	const gint odd_tap = weights->fir_filter_size & 1;
+	const gint full_pairs = weights->fir_pairs - odd_tap;
+
+	/* Compensate for signed input and add rounder */
+	__m128i add_32 = _mm_set1_epi32(32768 * FPScale + (FPScale >> 1));
+	__m128i sign = _mm_set1_epi16((gshort) 0x8000);
+	__m128i zero = _mm_setzero_si128();
+
+	guint y,x;
+	gint i;
+	for (y = info->dest_offset_other; y < info->dest_end_other ; y++)
+	{
+		gushort *in_line = GET_PIXEL(input, 0, y);
+		gushort *out = GET_PIXEL(output, 0, y);
+		const guint32 *wg = weights->weight_pairs + info->dest_offset * weights->fir_pairs;
+
+		for (x = info->dest_offset; x < info->dest_end; x++)
+		{
+			const gushort *in = &in_line[(offsets[x] - info->input_offset) * 4];
+			__m128i acc = zero;
+
+			for (i = 0; i < full_pairs; i++)
+			{
+				/* Load two pixels and interleave to r0 r1 g0 g1 b0 b1 p0 p1 */
+				__m128i src = _mm_loadu_si128((__m128i*)&in[i * 8]);
+				src = _mm_unpacklo_epi16(src, _mm_srli_si128(src, 8));
+				src = _mm_xor_si128(src, sign);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(src, _mm_set1_epi32(wg[i])));
+			}
+			if (odd_tap)
+			{
+				/* Weight of the second tap is 0 */
+				__m128i src = _mm_loadl_epi64((__m128i*)&in[i * 8]);
+				src = _mm_unpacklo_epi16(_mm_xor_si128(src, sign), zero);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(src, _mm_set1_epi32(wg[i])));
+			}
+
+			/* Add rounder, shift down and clamp */
+			acc = _mm_add_epi32(acc, add_32);
+			acc = _mm_srai_epi32(acc, FPScaleShift);
+			acc = _mm_packus_epi32(acc, acc);
+			_mm_storel_epi64((__m128i*)&out[(x - info->output_offset) * 4], acc);
+			wg += weights->fir_pairs;
+		}
+	}
+
+	resample_weights_unref(weights);
+}
+
+#else // not defined (__SSE4_1__)
+
+void
+ResizeH_SSE4(ResampleInfo *info)
+{
+	ResizeH(info);
+}
 
+#endif // not defined (__SSE4_1__)
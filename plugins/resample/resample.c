@@ -22,7 +22,7 @@
 #include <rawstudio.h>
 #include <math.h>
 #include <string.h>  /*memcpy */
-
+#include "resample.h"
 
 
 #define RS_TYPE_RESAMPLE (rs_resample_type)
@@ -43,26 +43,15 @@ struct _RSResample {
 	gfloat scale;
 	gboolean bounding_box;
 	gboolean never_quick;
+
+	/* Protects the dimensions above, never held while resampling */
+	GMutex lock;
 };
 
 struct _RSResampleClass {
 	RSFilterClass parent_class;
 };
 
-typedef struct {
-	RS_IMAGE16 *input;			/* Input Image to Resampler */
-	RS_IMAGE16 *output;			/* Output Image from Resampler */
-	guint old_size;				/* Old dimension in the direction of the resampler*/
-	guint new_size;				/* New size in the direction of the resampler */
-	guint dest_offset_other;	/* Where in the unchanged direction should we begin writing? */
-	guint dest_end_other;		/* Where in the unchanged direction should we stop writing? */
-	guint (*resample_support)(void);
-	gfloat (*resample_func)(gfloat);
-	GThread *threadid;
-	gboolean use_compatible;	/* Use compatible resampler if pixelsize != 4 */
-	gboolean use_fast;		/* Use nearest neighbour resampler, also compatible*/
-} ResampleInfo;
-
 RS_DEFINE_FILTER(rs_resample, RSResample)
 
 enum {
@@ -76,23 +65,16 @@ enum {
 
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
+static void finalize(GObject *object);
 static void previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask);
 static RSFilterChangedMask recalculate_dimensions(RSResample *resample);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_size(RSFilter *filter, const RSFilterRequest *request);
-static void ResizeH(ResampleInfo *info);
-void ResizeV(ResampleInfo *info);
-extern void ResizeV_SSE2(ResampleInfo *info);
-extern void ResizeV_SSE4(ResampleInfo *info);
-extern void ResizeV_AVX(ResampleInfo *info);
+static gint get_tile_border(RSFilter *filter);
 static void ResizeH_compatible(ResampleInfo *info);
 static void ResizeV_compatible(ResampleInfo *info);
-static void ResizeH_fast(ResampleInfo *info);
-void ResizeV_fast(ResampleInfo *info);
 
 static RSFilterClass *rs_resample_parent_class = NULL;
-static inline guint clampbits(gint x, guint n) { guint32 _y_temp; if( (_y_temp=x>>n) ) x = ~_y_temp >> (32-n); return x;}
-static GRecMutex resampler_mutex;
 
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
@@ -110,6 +92,7 @@ rs_resample_class_init(RSResampleClass *klass)
 
 	object_class->get_property = get_property;
 	object_class->set_property = set_property;
+	object_class->finalize = finalize;
 
 	g_object_class_install_property(object_class,
 		PROP_WIDTH, g_param_spec_int(
@@ -141,6 +124,7 @@ rs_resample_class_init(RSResampleClass *klass)
 	filter_class->get_image = get_image;
 	filter_class->get_size = get_size;
 	filter_class->previous_changed = previous_changed;
+	filter_class->get_tile_border = get_tile_border;
 }
 
 static void
@@ -153,6 +137,16 @@ rs_resample_init(RSResample *resample)
 	resample->bounding_box = FALSE;
 	resample->scale = 1.0;
 	resample->never_quick = FALSE;
+	g_mutex_init(&resample->lock);
+}
+
+static void
+finalize(GObject *object)
+{
+	RSResample *resample = RS_RESAMPLE(object);
+	g_mutex_clear(&resample->lock);
+
+	G_OBJECT_CLASS(rs_resample_parent_class)->finalize(object);
 }
 
 static void
@@ -188,8 +182,6 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 	RSResample *resample = RS_RESAMPLE(object);
 	RSFilterChangedMask mask = 0;
 
-	g_rec_mutex_lock(&resampler_mutex);
-
 	switch (property_id)
 	{
 		case PROP_WIDTH:
@@ -216,7 +208,9 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 		case PROP_NEVER_QUICK:
 			if (g_value_get_boolean(value) != resample->never_quick)
 			{
+				g_mutex_lock(&resample->lock);
 				resample->never_quick = g_value_get_boolean(value);
+				g_mutex_unlock(&resample->lock);
 				mask |= RS_FILTER_CHANGED_PIXELDATA;
 			}
 			break;
@@ -224,7 +218,6 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
 
-	g_rec_mutex_unlock(&resampler_mutex);
 	if (mask)
 		rs_filter_changed(RS_FILTER(object), mask);
 }
@@ -245,7 +238,7 @@ recalculate_dimensions(RSResample *resample)
 	gint new_width, new_height;
 	gint previous_width = 0;
 	gint previous_height = 0;
-	g_rec_mutex_lock(&resampler_mutex);
+	gfloat scale;
 
 	if (RS_FILTER(resample)->previous)
 		rs_filter_get_size_simple(RS_FILTER(resample)->previous, RS_FILTER_REQUEST_QUICK, &previous_width, &previous_height);
@@ -255,7 +248,7 @@ recalculate_dimensions(RSResample *resample)
 		new_width = previous_width;
 		new_height = previous_height;
 		rs_constrain_to_bounding_box(resample->target_width, resample->target_height, &new_width, &new_height);
-		resample->scale = ((((gfloat) new_width)/ previous_width) + (((gfloat) new_height)/ previous_height))/2.0;
+		scale = ((((gfloat) new_width)/ previous_width) + (((gfloat) new_height)/ previous_height))/2.0;
 	}
 	else
 	{
@@ -264,27 +257,30 @@ recalculate_dimensions(RSResample *resample)
 		if (RS_FILTER(resample)->previous)
 		{
 			if (previous_width > 0 && previous_height > 0)
-				resample->scale = MIN((gfloat)new_width / previous_width, (gfloat)new_height / previous_height);
+				scale = MIN((gfloat)new_width / previous_width, (gfloat)new_height / previous_height);
 			else
-				resample->scale = 1.0f;
+				scale = 1.0f;
 		}
 		else
 		{
-			resample->scale = 1.0f;
+			scale = 1.0f;
 		}
 	}
 
+	if (new_width < 0 || new_height < 0)
+		scale = 1.0f;
+
+	/* Only publish the result, a render in progress keeps the size it started with */
+	g_mutex_lock(&resample->lock);
 	if ((new_width != resample->new_width) || (new_height != resample->new_height))
 	{
 		resample->new_width = new_width;
 		resample->new_height = new_height;
 		mask |= RS_FILTER_CHANGED_DIMENSION;
 	}
+	resample->scale = scale;
+	g_mutex_unlock(&resample->lock);
 
-	if (new_width < 0 || new_height < 0)
-		resample->scale = 1.0f;
-
-	g_rec_mutex_unlock(&resampler_mutex);
 	return mask;
 }
 
@@ -314,18 +310,16 @@ start_thread_resampler(gpointer _thread_info)
 	if (!t->input)
 	{
 		g_debug("Resampler: input is NULL");
-		g_thread_exit(NULL);
 		return NULL;
 	}
 
 	if (!t->output)
 	{
 		g_debug("Resampler: output is NULL");
-		g_thread_exit(NULL);
 		return NULL;
 	}
 
-	if (t->input->h != t->output->h)
+	if (t->vertical)
 	{
 		gboolean sse2_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE2);
 		gboolean sse4_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE4_1);
@@ -343,23 +337,186 @@ start_thread_resampler(gpointer _thread_info)
 		else
 			ResizeV(t);
 	} 
-	else if (t->input->w != t->output->w)
+	else
 	{
+		gboolean sse4_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE4_1);
+		gboolean avx2_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_AVX2);
 		if (t->use_fast)
 			ResizeH_fast(t);
 		else if (t->use_compatible)
 			ResizeH_compatible(t);
+		else if (avx2_available)
+			ResizeH_AVX2(t);
+		else if (sse4_available)
+			ResizeH_SSE4(t);
 		else
 			ResizeH(t);
 	}
-	/* Unchanged in both directions, have thread 0 copy all the image */
-	else if (t->dest_offset_other == 0)
-		bit_blt((char*)GET_PIXEL(t->output,0,0), t->output->rowstride * 2, 
-			(const char*)GET_PIXEL(t->input,0,0), t->input->rowstride * 2, t->input->rowstride * 2, t->input->h);
 
-	g_thread_exit(NULL);
+	return NULL;
+}
+
+/* Finds the source pixels needed to write start to end in the direction of a resampler */
+static void
+source_range(guint old_size, guint new_size, gint start, gint end, gboolean use_fast, gint *source_start, gint *source_end)
+{
+	ResampleWeights *w = NULL;
+
+	if (old_size == new_size)
+	{
+		*source_start = start;
+		*source_end = end;
+		return;
+	}
+
+	if (!use_fast)
+		w = resample_weights_get(old_size, new_size);
+
+	if (w)
+	{
+		/* Offsets never decrease, each output pixel reads fir_filter_size pixels */
+		*source_start = w->offsets[start];
+		*source_end = MIN(w->offsets[end-1] + w->fir_filter_size, old_size);
+		resample_weights_unref(w);
+	}
+	else
+	{
+		/* Same stepping as ResizeH_fast() and ResizeV_fast() */
+		gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
+		gint delta = (gint)(pos_step * 65536.0);
+		*source_start = (start * delta) >> 16;
+		*source_end = MIN((((end - 1) * delta) >> 16) + 1, old_size);
+	}
+}
+
+static void
+benchmark_fill(RS_IMAGE16 *image, GRand *rng)
+{
+	gint x, y, c;
+
+	for(y = 0; y < image->h; y++)
+		for(x = 0; x < image->w; x++)
+		{
+			gushort *pixel = GET_PIXEL(image, x, y);
+			for(c = 0; c < 3; c++)
+				pixel[c] = g_rand_int_range(rng, 0, 65536);
+		}
+}
+
+/* Time every resampler supported by this CPU at the scales used by the
+ * preview and for export, this is done once, when performance debugging
+ * is enabled. Each resampler runs on one thread on a band of a 50 megapixel
+ * image, and the time for the whole image is extrapolated from that.
+ * Resamplers not compiled in fall back to plain C */
+static void
+benchmark_resamplers(void)
+{
+	static gsize done = 0;
+	static const struct {
+		const gchar *name;
+		gint old_width, old_height;
+		gint new_width, new_height;
+	} scales[] = {
+		{ "preview 50MP to 2MP", 8660, 5774, 1732, 1155 },
+		{ "export 50MP to 75%", 8660, 5774, 6495, 4330 },
+		{ "export 50MP to 50%", 8660, 5774, 4330, 2887 },
+		{ "export 50MP to 33%", 8660, 5774, 2887, 1925 },
+	};
+	static const struct {
+		const gchar *name;
+		guint cpu_flags;
+		gboolean vertical;
+		void (*resampler)(ResampleInfo *info);
+	} resamplers[] = {
+		{ "C", 0, TRUE, ResizeV },
+		{ "SSE2", RS_CPU_FLAG_SSE2, TRUE, ResizeV_SSE2 },
+		{ "SSE4.1", RS_CPU_FLAG_SSE4_1, TRUE, ResizeV_SSE4 },
+		{ "AVX", RS_CPU_FLAG_AVX, TRUE, ResizeV_AVX },
+		{ "nearest", 0, TRUE, ResizeV_fast },
+		{ "C", 0, FALSE, ResizeH },
+		{ "SSE4.1", RS_CPU_FLAG_SSE4_1, FALSE, ResizeH_SSE4 },
+		{ "AVX2", RS_CPU_FLAG_AVX2, FALSE, ResizeH_AVX2 },
+		{ "nearest", 0, FALSE, ResizeH_fast },
+	};
+	/* Columns done by the vertical resamplers, rows by the horizontal ones */
+	const gint band = 512;
+	GRand *rng;
+	gint s, r;
+
+	if (!g_once_init_enter(&done))
+		return;
+
+	rng = g_rand_new_with_seed(42);
+	for(s = 0; s < G_N_ELEMENTS(scales); s++)
+	{
+		const gint old_width = scales[s].old_width;
+		const gint old_height = scales[s].old_height;
+		const gint new_width = scales[s].new_width;
+		const gint new_height = scales[s].new_height;
+		RS_IMAGE16 *v_input = rs_image16_new(band, old_height, 3, 4);
+		RS_IMAGE16 *v_output = rs_image16_new(band, new_height, 3, 4);
+		RS_IMAGE16 *h_input = rs_image16_new(old_width, band, 3, 4);
+		RS_IMAGE16 *h_output = rs_image16_new(new_width, band, 3, 4);
+
+		benchmark_fill(v_input, rng);
+		benchmark_fill(h_input, rng);
+
+		/* Filters are cached in real use, don't time building them */
+		ResampleWeights *v_weights = resample_weights_get(old_height, new_height);
+		ResampleWeights *h_weights = resample_weights_get(old_width, new_width);
+
+		for(r = 0; r < G_N_ELEMENTS(resamplers); r++)
+		{
+			ResampleInfo info;
+			gdouble frame_scale;
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+			if ((rs_detect_cpu_features() & resamplers[r].cpu_flags) != resamplers[r].cpu_flags)
+				continue;
+
+			memset(&info, 0, sizeof(ResampleInfo));
+			info.dest_offset_other = 0;
+			info.dest_end_other = band;
+			if (resamplers[r].vertical)
+			{
+				info.input = v_input;
+				info.output = v_output;
+				info.old_size = old_height;
+				info.new_size = new_height;
+				info.dest_end = new_height;
+				/* The vertical pass covers all input columns.. */
+				frame_scale = (gdouble) old_width / band;
+			}
+			else
+			{
+				info.input = h_input;
+				info.output = h_output;
+				info.old_size = old_width;
+				info.new_size = new_width;
+				info.dest_end = new_width;
+				/* ..and the horizontal pass all output rows */
+				frame_scale = (gdouble) new_height / band;
+			}
+
+			gint64 start = g_get_monotonic_time();
+			resamplers[r].resampler(&info);
+			gint64 elapsed = MAX(1, g_get_monotonic_time() - start);
+
+			RS_DEBUG(PERFORMANCE, "Resample: %s, %s %s at %.1f Mpix/s, %.0f ms per image on one thread",
+				scales[s].name, resamplers[r].vertical ? "vertical" : "horizontal", resamplers[r].name,
+				(gdouble) info.output->w * info.output->h / elapsed, elapsed * frame_scale / 1000.0);
+		}
+
+		if (v_weights)
+			resample_weights_unref(v_weights);
+		if (h_weights)
+			resample_weights_unref(h_weights);
+		g_object_unref(v_input);
+		g_object_unref(v_output);
+		g_object_unref(h_input);
+		g_object_unref(h_output);
+	}
+	g_rand_free(rng);
+	g_once_init_leave(&done, 1);
 }
 
 static RSFilterResponse *
@@ -367,143 +524,228 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 {
 	gboolean use_fast = FALSE;
 	RSResample *resample = RS_RESAMPLE(filter);
+	RSFilterRequest *new_request;
 	RSFilterResponse *previous_response;
 	RSFilterResponse *response;
 	RS_IMAGE16 *afterVertical;
 	RS_IMAGE16 *input;
+	RS_IMAGE16 *source_image;
 	RS_IMAGE16 *output = NULL;
+	GdkRectangle *roi;
+	GdkRectangle dest;
+	GdkRectangle source;
+	GdkRectangle subframe;
+	gint source_end;
+	gint input_x, input_y;
 	gint input_width;
 	gint input_height;
+	gint new_width, new_height;
+	gboolean never_quick;
+
+	if (rs_debug_flags & RS_DEBUG_PERFORMANCE)
+		benchmark_resamplers();
+
+	/* Take a copy of the size, other instances and property changes must
+	 * not wait for us while we resample */
+	g_mutex_lock(&resample->lock);
+	new_width = resample->new_width;
+	new_height = resample->new_height;
+	never_quick = resample->never_quick;
+	g_mutex_unlock(&resample->lock);
 
 	rs_filter_get_size_simple(filter->previous, request, &input_width, &input_height);
 
 	/* Return the input, if the new size is uninitialized */
-	if ((resample->new_width == -1) || (resample->new_height == -1))
-		return rs_filter_get_image(filter->previous, request);
+	if ((new_width == -1) || (new_height == -1))
+		return rs_filter_get_image_roi(filter->previous, request);
 
 	/* Simply return the input, if we don't scale */
-	if ((input_width == resample->new_width) && (input_height == resample->new_height))
-		return rs_filter_get_image(filter->previous, request);	
-	
-	/* Remove ROI, it doesn't make sense across resampler */
-	if (rs_filter_request_get_roi(request))
+	if ((input_width == new_width) && (input_height == new_height))
+		return rs_filter_get_image_roi(filter->previous, request);
+
+	if (!never_quick && rs_filter_request_get_quick(request))
+		use_fast = TRUE;
+
+	/* Only resample the requested part of the output */
+	dest.x = 0;
+	dest.y = 0;
+	dest.width = new_width;
+	dest.height = new_height;
+	if ((roi = rs_filter_request_get_roi(request)))
 	{
-		RSFilterRequest *new_request = rs_filter_request_clone(request);
-		rs_filter_request_set_roi(new_request, NULL);
-		previous_response = rs_filter_get_image(filter->previous, new_request);
-		g_object_unref(new_request);
+		dest.x = CLAMP(roi->x, 0, new_width - 1);
+		dest.y = CLAMP(roi->y, 0, new_height - 1);
+		dest.width = CLAMP(roi->width, 1, new_width - dest.x);
+		dest.height = CLAMP(roi->height, 1, new_height - dest.y);
 	}
+
+	/* Find the part of the input it is resampled from. The vertical
+	 * resampler needs the first column to be 16 byte aligned */
+	source_range(input_width, new_width, dest.x, dest.x + dest.width, use_fast, &source.x, &source_end);
+	source.x &= ~3;
+	source.width = source_end - source.x;
+	source_range(input_height, new_height, dest.y, dest.y + dest.height, use_fast, &source.y, &source_end);
+	source.height = source_end - source.y;
+
+	new_request = rs_filter_request_clone(request);
+	if ((source.width < input_width) || (source.height < input_height))
+		rs_filter_request_set_roi(new_request, &source);
 	else
-		previous_response = rs_filter_get_image(filter->previous, request);
+		rs_filter_request_set_roi(new_request, NULL);
+	previous_response = rs_filter_get_image_roi(filter->previous, new_request);
+	g_object_unref(new_request);
 
 	input = rs_filter_response_get_image(previous_response);
 
 	if (!RS_IS_IMAGE16(input))
 		return previous_response;
 
-	g_rec_mutex_lock(&resampler_mutex);
-	input_width = input->w;
-	input_height = input->h;	
+	/* Resample all of it, if we didn't get the size we expected */
+	if (!rs_filter_response_get_origin(previous_response, &input_x, &input_y)
+		&& ((input->w != input_width) || (input->h != input_height)))
+	{
+		input_width = input->w;
+		input_height = input->h;
+		dest.x = dest.y = source.x = source.y = 0;
+		dest.width = new_width;
+		dest.height = new_height;
+		source.width = input_width;
+		source.height = input_height;
+		roi = NULL;
+	}
+
+	if ((source.x < input_x) || (source.y < input_y)
+		|| (source.x + source.width > input_x + input->w) || (source.y + source.height > input_y + input->h))
+	{
+		g_warning("Resample: Got %dx%d at %d,%d, which does not cover %dx%d at %d,%d",
+			input->w, input->h, input_x, input_y, source.width, source.height, source.x, source.y);
+		g_object_unref(input);
+		return previous_response;
+	}
+
+	/* Only the source area is read. Keep its first column at an even
+	 * position in input, so the subframe needn't move it for alignment */
+	subframe.x = (source.x - input_x) & ~1;
+	subframe.y = source.y - input_y;
+	subframe.width = source.x + source.width - input_x - subframe.x;
+	subframe.height = source.height;
+	source_image = rs_image16_new_subframe(input, &subframe);
+	source.x = input_x + subframe.x;
+	source.width = source_image->w;
 
 	response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 	previous_response = NULL;
 
-	/* Use compatible (and slow) version if input isn't 3 channels and pixelsize 4 */
-	gboolean use_compatible = ( ! ( input->pixelsize == 4 && input->channels == 3));
-
-	if (!resample->never_quick && rs_filter_request_get_quick(request))
-	{
-		use_fast = TRUE;
+	if (use_fast)
 		rs_filter_response_set_quick(response);
-	}
+
+	/* Use compatible (and slow) version if input isn't 3 channels and pixelsize 4 */
+	gboolean use_compatible = ( ! ( source_image->pixelsize == 4 && source_image->channels == 3));
 
 	if (input_width < 32 || input_height < 32)
 		use_compatible = TRUE;
 
-	guint threads = rs_get_number_of_processor_cores();
-
-	ResampleInfo* h_resample = g_new(ResampleInfo,  threads);
-	ResampleInfo* v_resample = g_new(ResampleInfo,  threads);
-
-	/* Create intermediate and output images*/
-	afterVertical = rs_image16_new(input_width, resample->new_height, input->channels, input->pixelsize);
-
-	// Only even count
-	guint output_x_per_thread = ((input_width + threads - 1 ) / threads );
-	while (((output_x_per_thread * input->pixelsize) & 15) != 0)
-		output_x_per_thread++;
-	guint output_x_offset = 0;
-
+	guint threads = rs_thread_pool_get_num_threads();
 	guint i;
-	for (i = 0; i < threads; i++)
-	{
-		/* Set info for Vertical resampler */
-		ResampleInfo *v = &v_resample[i];
-		v->input = input;
-		v->output  = afterVertical;
-		v->old_size = input_height;
-		v->new_size = resample->new_height;
-		v->dest_offset_other = output_x_offset;
-		v->dest_end_other  = MIN(output_x_offset + output_x_per_thread, input_width);
-		v->use_compatible = use_compatible;
-		v->use_fast = use_fast;
 
-		/* Start it up */
-		v->threadid = g_thread_new("RSResample worker (vertical)", start_thread_resampler, v);
+	if (input_height != new_height)
+	{
+		ResampleInfo* v_resample = g_new(ResampleInfo,  threads);
 
-		/* Update offset */
-		output_x_offset = v->dest_end_other;
-	}
+		/* Create intermediate image, the source columns of the output rows */
+		afterVertical = rs_image16_new(source.width, dest.height, source_image->channels, source_image->pixelsize);
 
-	/* Wait for vertical threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(v_resample[i].threadid);
+		// Only even count
+		guint output_x_per_thread = ((source.width + threads - 1 ) / threads );
+		while (((output_x_per_thread * source_image->pixelsize) & 15) != 0)
+			output_x_per_thread++;
+		guint output_x_offset = 0;
 
-	/* input no longer needed */
-	g_object_unref(input);
-	input = NULL;
+		for (i = 0; i < threads; i++)
+		{
+			/* Set info for Vertical resampler */
+			ResampleInfo *v = &v_resample[i];
+			v->input = source_image;
+			v->output  = afterVertical;
+			v->old_size = input_height;
+			v->new_size = new_height;
+			v->dest_offset = dest.y;
+			v->dest_end = dest.y + dest.height;
+			v->dest_offset_other = output_x_offset;
+			v->dest_end_other  = MIN(output_x_offset + output_x_per_thread, source.width);
+			v->vertical = TRUE;
+			v->input_offset = source.y;
+			v->output_offset = dest.y;
+			v->use_compatible = use_compatible;
+			v->use_fast = use_fast;
+
+			/* Update offset */
+			output_x_offset = v->dest_end_other;
+		}
 
-	/* create output */
-	output = rs_image16_new(resample->new_width,  resample->new_height, afterVertical->channels, afterVertical->pixelsize);
+		/* Run vertical resampler and wait for it to finish */
+		rs_thread_pool_run(start_thread_resampler, v_resample, sizeof(ResampleInfo), threads);
+		g_free(v_resample);
+	}
+	else
+		afterVertical = g_object_ref(source_image);
 
-	guint input_y_offset = 0;
-	guint input_y_per_thread = (resample->new_height+threads-1) / threads;
+	g_object_unref(source_image);
 
-	for (i = 0; i < threads; i++)
+	if (input_width != new_width)
 	{
-		/* Set info for Horizontal resampler */
-		ResampleInfo *h = &h_resample[i];
-		h->input = afterVertical;
-		h->output  = output;
-		h->old_size = input_width;
-		h->new_size = resample->new_width;
-		h->dest_offset_other = input_y_offset;
-		h->dest_end_other  = MIN(input_y_offset+input_y_per_thread, resample->new_height);
-		h->use_compatible = use_compatible;
-		h->use_fast = use_fast;
+		ResampleInfo* h_resample = g_new(ResampleInfo,  threads);
 
-		/* Start it up */
-		h->threadid = g_thread_new("RSResample worker (horizontal)", start_thread_resampler, h);
+		/* create output */
+		output = rs_image16_new(dest.width, dest.height, afterVertical->channels, afterVertical->pixelsize);
 
-		/* Update offset */
-		input_y_offset = h->dest_end_other;
+		guint input_y_offset = 0;
+		guint input_y_per_thread = (dest.height+threads-1) / threads;
 
-	}
+		for (i = 0; i < threads; i++)
+		{
+			/* Set info for Horizontal resampler */
+			ResampleInfo *h = &h_resample[i];
+			h->input = afterVertical;
+			h->output  = output;
+			h->old_size = input_width;
+			h->new_size = new_width;
+			h->dest_offset = dest.x;
+			h->dest_end = dest.x + dest.width;
+			h->dest_offset_other = input_y_offset;
+			h->dest_end_other  = MIN(input_y_offset+input_y_per_thread, dest.height);
+			h->vertical = FALSE;
+			h->input_offset = source.x;
+			h->output_offset = dest.x;
+			h->use_compatible = use_compatible;
+			h->use_fast = use_fast;
+
+			/* Update offset */
+			input_y_offset = h->dest_end_other;
+		}
 
-	/* Wait for horizontal threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(h_resample[i].threadid);
+		/* Run horizontal resampler and wait for it to finish */
+		rs_thread_pool_run(start_thread_resampler, h_resample, sizeof(ResampleInfo), threads);
+		g_free(h_resample);
+	}
+	else
+	{
+		/* Unscaled columns, cut out the ones asked for */
+		output = rs_image16_new(dest.width, dest.height, afterVertical->channels, afterVertical->pixelsize);
+		bit_blt((char*)GET_PIXEL(output, 0, 0), output->rowstride * 2,
+			(const char*)GET_PIXEL(afterVertical, dest.x - source.x, 0), afterVertical->rowstride * 2,
+			output->w * output->pixelsize * 2, output->h);
+	}
 
-	/* Clean up */
-	g_free(h_resample);
-	g_free(v_resample);
+	/* Clean up, input goes last as subframes share its pixels */
 	g_object_unref(afterVertical);
+	g_object_unref(input);
 
 	rs_filter_response_set_image(response, output);
+	rs_filter_response_set_roi(response, roi ? &dest : NULL);
 	rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "half-size", FALSE);
 	g_object_unref(output);
-	g_rec_mutex_unlock(&resampler_mutex);
 	return response;
 }
 
@@ -512,19 +754,61 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSResample *resample = RS_RESAMPLE(filter);
 	RSFilterResponse *previous_response = rs_filter_get_size(filter->previous, request);
+	gint new_width, new_height;
+
+	g_mutex_lock(&resample->lock);
+	new_width = resample->new_width;
+	new_height = resample->new_height;
+	g_mutex_unlock(&resample->lock);
 
-	if ((resample->new_width == -1) || (resample->new_height == -1))
+	if ((new_width == -1) || (new_height == -1))
 		return previous_response;
 
 	RSFilterResponse *response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	rs_filter_response_set_width(response, resample->new_width);
-	rs_filter_response_set_height(response, resample->new_height);
+	rs_filter_response_set_width(response, new_width);
+	rs_filter_response_set_height(response, new_height);
 
 	return response;
 }
 
+/* Input pixels read around a tile: the filter taps, and up to three columns
+ * for aligning the first one */
+static gint
+get_tile_border(RSFilter *filter)
+{
+	RSResample *resample = RS_RESAMPLE(filter);
+	ResampleWeights *w;
+	gint previous_width, previous_height;
+	gint new_width, new_height;
+	gint taps = 1;
+
+	g_mutex_lock(&resample->lock);
+	new_width = resample->new_width;
+	new_height = resample->new_height;
+	g_mutex_unlock(&resample->lock);
+
+	if ((new_width == -1) || (new_height == -1))
+		return 0;
+
+	if (!rs_filter_get_size_simple(filter->previous, RS_FILTER_REQUEST_QUICK, &previous_width, &previous_height))
+		return 0;
+
+	if ((w = resample_weights_get(previous_width, new_width)))
+	{
+		taps = MAX(taps, w->fir_filter_size);
+		resample_weights_unref(w);
+	}
+	if ((w = resample_weights_get(previous_height, new_height)))
+	{
+		taps = MAX(taps, w->fir_filter_size);
+		resample_weights_unref(w);
+	}
+
+	return taps + 3;
+}
+
 static guint
 lanczos_taps(void)
 {
@@ -555,31 +839,34 @@ lanczos_weight(gfloat value)
 		return 0.0f;
 }
 
-const static gint FPScale = 16384; /* fixed point scaler */
-const static gint FPScaleShift = 14; /* fixed point scaler */
-
-static void
-ResizeH(ResampleInfo *info)
-{
-	const RS_IMAGE16 *input = info->input;
-	const RS_IMAGE16 *output = info->output;
-	const guint old_size = info->old_size;
-	const guint new_size = info->new_size;
-
-	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
-	gfloat filter_step = MIN(1.0 / pos_step, 1.0);
-	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
-	gint fir_filter_size = (gint) (ceil(filter_support*2));
+/*
+ * Filter weights only depend on the old and new size, so they're computed
+ * once and shared by all threads and later renders. A few filters are kept,
+ * enough for both passes of the views in use at the same time.
+ */
 
-	if (old_size <= fir_filter_size)
-		return ResizeH_fast(info);
+#define WEIGHTS_CACHE_SIZE 8
 
-	gint *weights = g_new(gint, new_size * fir_filter_size);
-	gint *offsets = g_new(gint, new_size);
+static GMutex weights_lock;
+static GQueue weights_cache = G_QUEUE_INIT; /* Most recently used first */
 
+static ResampleWeights *
+weights_new(guint old_size, guint new_size, gint fir_filter_size, gfloat filter_step, gfloat filter_support)
+{
+	ResampleWeights *w = g_new(ResampleWeights, 1);
+	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
 	gfloat pos = 0.0f;
 	gint i,j,k;
 
+	w->old_size = old_size;
+	w->new_size = new_size;
+	w->fir_filter_size = fir_filter_size;
+	w->weights = g_new(gint, new_size * fir_filter_size);
+	w->offsets = g_new(gint, new_size);
+	w->fir_pairs = (fir_filter_size + 1) / 2;
+	w->weight_pairs = g_new(guint32, new_size * w->fir_pairs);
+	w->refcount = 1;
+
 	for (i=0; i<new_size; ++i)
 	{
 		gint end_pos = (gint) (pos + filter_support);
@@ -592,7 +879,7 @@ ResizeH(ResampleInfo *info)
 		if (start_pos < 0)
 			start_pos = 0;
 
-		offsets[i] = start_pos * 4;
+		w->offsets[i] = start_pos;
 
 		/* the following code ensures that the coefficients add to exactly FPScale */
 		gfloat total = 0.0;
@@ -613,46 +900,122 @@ ResizeH(ResampleInfo *info)
 		for (k=0; k<fir_filter_size; ++k)
 		{
 			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
-			weights[i*fir_filter_size+k] = (gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5);
+			w->weights[i*fir_filter_size+k] = (gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5);
 			total2 = total3;
 		}
+
+		/* Weights never exceed FPScale, so they fit in 16 bits */
+		for (k=0; k<w->fir_pairs; ++k)
+		{
+			gint lo = w->weights[i*fir_filter_size+k*2];
+			gint hi = (k*2+1 < fir_filter_size) ? w->weights[i*fir_filter_size+k*2+1] : 0;
+			w->weight_pairs[i*w->fir_pairs+k] = ((guint32) lo & 0xffff) | ((guint32) hi << 16);
+		}
 		pos += pos_step;
 	}
 
+	return w;
+}
+
+ResampleWeights *
+resample_weights_get(guint old_size, guint new_size)
+{
+	ResampleWeights *w;
+	GList *node;
+
+	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
+	gfloat filter_step = MIN(1.0 / pos_step, 1.0);
+	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
+	gint fir_filter_size = (gint) (ceil(filter_support*2));
+
+	if (old_size <= fir_filter_size)
+		return NULL;
+
+	g_mutex_lock(&weights_lock);
+	for (node = weights_cache.head; node; node = node->next)
+	{
+		w = node->data;
+		if (w->old_size == old_size && w->new_size == new_size)
+		{
+			g_queue_unlink(&weights_cache, node);
+			g_queue_push_head_link(&weights_cache, node);
+			g_atomic_int_inc(&w->refcount);
+			g_mutex_unlock(&weights_lock);
+			return w;
+		}
+	}
+
+	/* Built with the lock held, other threads of this render need it too */
+	w = weights_new(old_size, new_size, fir_filter_size, filter_step, filter_support);
+	g_atomic_int_inc(&w->refcount);
+	g_queue_push_head(&weights_cache, w);
+
+	if (g_queue_get_length(&weights_cache) > WEIGHTS_CACHE_SIZE)
+		resample_weights_unref(g_queue_pop_tail(&weights_cache));
+	g_mutex_unlock(&weights_lock);
+
+	return w;
+}
+
+void
+resample_weights_unref(ResampleWeights *w)
+{
+	if (g_atomic_int_dec_and_test(&w->refcount))
+	{
+		g_free(w->weights);
+		g_free(w->offsets);
+		g_free(w->weight_pairs);
+		g_free(w);
+	}
+}
+
+void
+ResizeH(ResampleInfo *info)
+{
+	const RS_IMAGE16 *input = info->input;
+	const RS_IMAGE16 *output = info->output;
+	const guint new_size = info->new_size;
+
 	g_return_if_fail(input->pixelsize == 4);
 	g_return_if_fail(input->channels == 3);
 
+	ResampleWeights *w = resample_weights_get(info->old_size, new_size);
+
+	if (!w)
+		return ResizeH_fast(info);
+
+	const gint fir_filter_size = w->fir_filter_size;
+	const gint *offsets = w->offsets;
+
 	guint y,x;
 	for (y = info->dest_offset_other; y < info->dest_end_other ; y++)
 	{
 		gushort *in_line = GET_PIXEL(input, 0, y);
 		gushort *out = GET_PIXEL(output, 0, y);
-		gint *wg = weights;
+		gint *wg = w->weights + info->dest_offset * fir_filter_size;
 
-		for (x = 0; x < new_size; x++)
+		for (x = info->dest_offset; x < info->dest_end; x++)
 		{
 			guint i;
-			gushort *in = &in_line[offsets[x]];
+			gushort *in = &in_line[(offsets[x] - info->input_offset) * 4];
 			gint acc1 = 0;
 			gint acc2 = 0;
 			gint acc3 = 0;
 
 			for (i = 0; i <fir_filter_size; i++)
 			{
-				gint w = *wg++;
-				acc1 += in[i*4]*w;
-				acc2 += in[i*4+1]*w;
-				acc3 += in[i*4+2]*w;
+				gint weight = *wg++;
+				acc1 += in[i*4]*weight;
+				acc2 += in[i*4+1]*weight;
+				acc3 += in[i*4+2]*weight;
 			}
-			out[x*4] = clampbits((acc1 + (FPScale/2))>>FPScaleShift, 16);
-			out[x*4+1] = clampbits((acc2 + (FPScale/2))>>FPScaleShift, 16);
-			out[x*4+2] = clampbits((acc3 + (FPScale/2))>>FPScaleShift, 16);
+			out[(x - info->output_offset)*4] = clampbits((acc1 + (FPScale/2))>>FPScaleShift, 16);
+			out[(x - info->output_offset)*4+1] = clampbits((acc2 + (FPScale/2))>>FPScaleShift, 16);
+			out[(x - info->output_offset)*4+2] = clampbits((acc3 + (FPScale/2))>>FPScaleShift, 16);
 		}
 	}
 
-	g_free(weights);
-	g_free(offsets);
-
+	resample_weights_unref(w);
 }
 
 void
@@ -660,74 +1023,28 @@ ResizeV(ResampleInfo *info)
 {
 	const RS_IMAGE16 *input = info->input;
 	const RS_IMAGE16 *output = info->output;
-	const guint old_size = info->old_size;
 	const guint new_size = info->new_size;
 	const guint start_x = info->dest_offset_other;
 	const guint end_x = info->dest_end_other;
 
-	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
-	gfloat filter_step = MIN(1.0 / pos_step, 1.0);
-	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
-	gint fir_filter_size = (gint) (ceil(filter_support*2));
-
-	if (old_size <= fir_filter_size)
-		return ResizeV_fast(info);
-
-	gint *weights = g_new(gint, new_size * fir_filter_size);
-	gint *offsets = g_new(gint, new_size);
-
-	gfloat pos = 0.0;
-
-	gint i,j,k;
-
-	for (i=0; i<new_size; ++i)
-	{
-		gint end_pos = (gint) (pos + filter_support);
-		if (end_pos > old_size-1)
-			end_pos = old_size-1;
-
-		gint start_pos = end_pos - fir_filter_size + 1;
-
-		if (start_pos < 0)
-			start_pos = 0;
-
-		offsets[i] = start_pos;
-
-		/* The following code ensures that the coefficients add to exactly FPScale */
-		gfloat total = 0.0;
-
-		/* Ensure that we have a valid position */
-		gfloat ok_pos = MAX(0.0,MIN(old_size-1,pos));
-
-		for (j=0; j<fir_filter_size; ++j)
-		{
-			/* Accumulate all coefficients */
-			total += lanczos_weight((start_pos+j - ok_pos) * filter_step);
-		}
-
-		g_assert(total > 0.0f);
+	g_return_if_fail(input->pixelsize == 4);
+	g_return_if_fail(input->channels == 3);
 
-		gfloat total2 = 0.0;
+	ResampleWeights *w = resample_weights_get(info->old_size, new_size);
 
-		for (k=0; k<fir_filter_size; ++k)
-		{
-			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
-			weights[i*fir_filter_size+k] = (gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5);
-			total2 = total3;
-		}
-		pos += pos_step;
-	}
+	if (!w)
+		return ResizeV_fast(info);
 
-	g_return_if_fail(input->pixelsize == 4);
-	g_return_if_fail(input->channels == 3);
+	const gint fir_filter_size = w->fir_filter_size;
+	const gint *offsets = w->offsets;
 
-	guint y,x;
-    gint *wg = weights;
+	guint y,x,i;
+	gint *wg = w->weights + info->dest_offset * fir_filter_size;
 
-	for (y = 0; y < new_size ; y++)
+	for (y = info->dest_offset; y < info->dest_end ; y++)
 	{
-		gushort *in = GET_PIXEL(input, start_x, offsets[y]);
-		gushort *out = GET_PIXEL(output, 0, y);
+		gushort *in = GET_PIXEL(input, start_x, offsets[y] - info->input_offset);
+		gushort *out = GET_PIXEL(output, 0, y - info->output_offset);
 		for (x = start_x; x < end_x; x++)
 		{
 			gint acc1 = 0;
@@ -747,9 +1064,7 @@ ResizeV(ResampleInfo *info)
 		wg+=fir_filter_size;
 	}
 
-	g_free(weights);
-	g_free(offsets);
-
+	resample_weights_unref(w);
 }
 
 static void
@@ -757,77 +1072,30 @@ ResizeH_compatible(ResampleInfo *info)
 {
 	const RS_IMAGE16 *input = info->input;
 	const RS_IMAGE16 *output = info->output;
-	const guint old_size = info->old_size;
 	const guint new_size = info->new_size;
 
 	gint pixelsize = input->pixelsize;
 	gint ch = input->channels;
 
-	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
-	gfloat filter_step = MIN(1.0 / pos_step, 1.0);
-	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
-	gint fir_filter_size = (gint) (ceil(filter_support*2));
+	ResampleWeights *w = resample_weights_get(info->old_size, new_size);
 
-	if (old_size <= fir_filter_size)
+	if (!w)
 		return ResizeH_fast(info);
 
-	gint *weights = g_new(gint, new_size * fir_filter_size);
-	gint *offsets = g_new(gint, new_size);
-
-	gfloat pos = 0.0;
-	gint i,j,k;
-
-	for (i=0; i<new_size; ++i)
-	{
-		gint end_pos = (gint) (pos + filter_support);
-
-		if (end_pos > old_size-1)
-			end_pos = old_size-1;
-
-		gint start_pos = end_pos - fir_filter_size + 1;
-
-		if (start_pos < 0)
-			start_pos = 0;
-
-		offsets[i] = start_pos * pixelsize;
-
-		/* the following code ensures that the coefficients add to exactly FPScale */
-		gfloat total = 0.0;
-
-		/* Ensure that we have a valid position */
-		gfloat ok_pos = MAX(0.0,MIN(old_size-1,pos));
-
-		for (j=0; j<fir_filter_size; ++j)
-		{
-			/* Accumulate all coefficients */
-			total += lanczos_weight((start_pos+j - ok_pos) * filter_step);
-		}
-
-		g_assert(total > 0.0f);
-
-		gfloat total2 = 0.0;
-
-		for (k=0; k<fir_filter_size; ++k)
-		{
-			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
-			weights[i*fir_filter_size+k] = (gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5);
-			total2 = total3;
-		}
-		pos += pos_step;
-	}
-
+	const gint fir_filter_size = w->fir_filter_size;
+	const gint *offsets = w->offsets;
 
 	guint y,x,c;
 	for (y = info->dest_offset_other; y < info->dest_end_other ; y++)
 	{
-		gint *wg = weights;
+		gint *wg = w->weights + info->dest_offset * fir_filter_size;
 		gushort *in_line = GET_PIXEL(input, 0, y);
 		gushort *out = GET_PIXEL(output, 0, y);
 
-		for (x = 0; x < new_size; x++)
+		for (x = info->dest_offset; x < info->dest_end; x++)
 		{
 			guint i;
-			gushort *in = &in_line[offsets[x]];
+			gushort *in = &in_line[(offsets[x] - info->input_offset) * pixelsize];
 			for (c = 0 ; c < ch; c++)
 			{
 				gint acc = 0;
@@ -836,15 +1104,13 @@ ResizeH_compatible(ResampleInfo *info)
 				{
 					acc += in[i*pixelsize+c]*wg[i];
 				}
-				out[x*pixelsize+c] = clampbits((acc + (FPScale/2))>>FPScaleShift, 16);
+				out[(x - info->output_offset)*pixelsize+c] = clampbits((acc + (FPScale/2))>>FPScaleShift, 16);
 			}
 			wg += fir_filter_size;
 		}
 	}
 
-	g_free(weights);
-	g_free(offsets);
-
+	resample_weights_unref(w);
 }
 
 static void
@@ -852,7 +1118,6 @@ ResizeV_compatible(ResampleInfo *info)
 {
 	const RS_IMAGE16 *input = info->input;
 	const RS_IMAGE16 *output = info->output;
-	const guint old_size = info->old_size;
 	const guint new_size = info->new_size;
 	const guint start_x = info->dest_offset_other;
 	const guint end_x = info->dest_end_other;
@@ -860,68 +1125,23 @@ ResizeV_compatible(ResampleInfo *info)
 	gint pixelsize = input->pixelsize;
 	gint ch = input->channels;
 
-	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
-	gfloat filter_step = MIN(1.0 / pos_step, 1.0);
-	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
-	gint fir_filter_size = (gint) (ceil(filter_support*2));
+	ResampleWeights *w = resample_weights_get(info->old_size, new_size);
 
-	if (old_size <= fir_filter_size)
+	if (!w)
 		return ResizeV_fast(info);
 
-	gint *weights = g_new(gint, new_size * fir_filter_size);
-	gint *offsets = g_new(gint, new_size);
+	const gint fir_filter_size = w->fir_filter_size;
+	const gint *offsets = w->offsets;
 
-	gfloat pos = 0.0;
-
-	gint i,j,k;
+	guint y,x,c,i;
+	gint *wg = w->weights + info->dest_offset * fir_filter_size;
 
-	for (i=0; i<new_size; ++i)
+	for (y = info->dest_offset; y < info->dest_end ; y++)
 	{
-		gint end_pos = (gint) (pos + filter_support);
-		if (end_pos > old_size-1)
-			end_pos = old_size-1;
-
-		gint start_pos = end_pos - fir_filter_size + 1;
-
-		if (start_pos < 0)
-			start_pos = 0;
-
-		offsets[i] = start_pos;
-
-		/* The following code ensures that the coefficients add to exactly FPScale */
-		gfloat total = 0.0;
-
-		/* Ensure that we have a valid position */
-		gfloat ok_pos = MAX(0.0,MIN(old_size-1,pos));
-
-		for (j=0; j<fir_filter_size; ++j)
-		{
-			/* Accumulate all coefficients */
-			total += lanczos_weight((start_pos+j - ok_pos) * filter_step);
-		}
-
-		g_assert(total > 0.0f);
-
-		gfloat total2 = 0.0;
-
-		for (k=0; k<fir_filter_size; ++k)
-		{
-			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
-			weights[i*fir_filter_size+k] = (gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5);
-			total2 = total3;
-		}
-		pos += pos_step;
-	}
-
-	guint y,x,c;
-	gint *wg = weights;
-
-	for (y = 0; y < new_size ; y++)
-	{
-		gushort *out = GET_PIXEL(output, 0, y);
+		gushort *out = GET_PIXEL(output, 0, y - info->output_offset);
 		for (x = start_x; x < end_x; x++)
 		{
-			gushort *in = GET_PIXEL(input, x, offsets[y]);
+			gushort *in = GET_PIXEL(input, x, offsets[y] - info->input_offset);
 			for (c = 0; c < ch; c++)
 			{
 				gint acc = 0;
@@ -936,8 +1156,7 @@ ResizeV_compatible(ResampleInfo *info)
 		wg+=fir_filter_size;
 	}
 
-	g_free(weights);
-	g_free(offsets);
+	resample_weights_unref(w);
 }
 
 void
@@ -955,15 +1174,15 @@ ResizeV_fast(ResampleInfo *info)
 
 	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
 
-	gint pos = 0;
 	gint delta = (gint)(pos_step * 65536.0);
+	gint pos = info->dest_offset * delta;
 
 	guint y,x,c;
 
-	for (y = 0; y < new_size ; y++)
+	for (y = info->dest_offset; y < info->dest_end ; y++)
 	{
-		gushort *in = GET_PIXEL(input, start_x, pos>>16);
-		gushort *out = GET_PIXEL(output, start_x, y);
+		gushort *in = GET_PIXEL(input, start_x, (pos>>16) - info->input_offset);
+		gushort *out = GET_PIXEL(output, start_x, y - info->output_offset);
 		int out_pos = 0;
 		for (x = start_x; x < end_x; x++)
 		{
@@ -980,7 +1199,7 @@ ResizeV_fast(ResampleInfo *info)
 
 
 
-static void
+void
 ResizeH_fast(ResampleInfo *info)
 {
 	const RS_IMAGE16 *input = info->input;
@@ -1001,12 +1220,12 @@ ResizeH_fast(ResampleInfo *info)
 	{
 		gushort *in_line = GET_PIXEL(input, 0, y);
 		gushort *out = GET_PIXEL(output, 0, y);
-		pos = 0;
-		int out_pos = 0;
+		pos = info->dest_offset * delta;
+		int out_pos = (info->dest_offset - info->output_offset) * pixelsize;
 
-		for (x = 0; x < new_size; x++)
+		for (x = info->dest_offset; x < info->dest_end; x++)
 		{
-			gushort* start_pos = &in_line[(pos>>16)*pixelsize];
+			gushort* start_pos = &in_line[((pos>>16) - info->input_offset)*pixelsize];
 			for (c = 0 ; c < ch; c++)
 			{
 				out[out_pos+c] = start_pos[c];
@@ -0,0 +1,81 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <rawstudio.h>
+
+typedef struct {
+	RS_IMAGE16 *input;			/* Input Image to Resampler */
+	RS_IMAGE16 *output;			/* Output Image from Resampler */
+	guint old_size;				/* Old dimension in the direction of the resampler*/
+	guint new_size;				/* New size in the direction of the resampler */
+	guint dest_offset;			/* Where in the direction of the resampler should we begin writing? */
+	guint dest_end;				/* Where in the direction of the resampler should we stop writing? */
+	guint dest_offset_other;	/* Where in the unchanged direction should we begin writing? */
+	guint dest_end_other;		/* Where in the unchanged direction should we stop writing? */
+	gboolean vertical;			/* Resample rows, otherwise columns */
+	gint input_offset;			/* Position of the first row/column of input in the direction of the resampler */
+	gint output_offset;			/* Position of the first row/column of output in the direction of the resampler */
+	guint (*resample_support)(void);
+	gfloat (*resample_func)(gfloat);
+	gboolean use_compatible;	/* Use compatible resampler if pixelsize != 4 */
+	gboolean use_fast;		/* Use nearest neighbour resampler, also compatible*/
+} ResampleInfo;
+
+/* Lanczos filter for scaling old_size to new_size. Weights are fixed point,
+ * the weights for each output pixel add up to exactly FPScale */
+typedef struct {
+	guint old_size;
+	guint new_size;
+	gint fir_filter_size;		/* Number of weights per output pixel */
+	gint *weights;				/* fir_filter_size weights for each output pixel */
+	gint *offsets;				/* First input pixel for each output pixel */
+	gint fir_pairs;				/* (fir_filter_size+1)/2 */
+	guint32 *weight_pairs;		/* Two 16 bit weights, low is first, for pmaddwd. Padded with 0 */
+	gint refcount;
+} ResampleWeights;
+
+#define FPScale (16384) /* fixed point scaler */
+#define FPScaleShift (14) /* fixed point scaler */
+
+static inline guint clampbits(gint x, guint n) { guint32 _y_temp; if( (_y_temp=x>>n) ) x = ~_y_temp >> (32-n); return x;}
+
+/**
+ * Get the filter for a scale, filters are cached and shared between threads
+ * @param old_size The input size
+ * @param new_size The output size
+ * @return The filter, must be released with resample_weights_unref(), or
+ *         NULL if the input is too small for filtering
+ */
+extern ResampleWeights *resample_weights_get(guint old_size, guint new_size);
+extern void resample_weights_unref(ResampleWeights *weights);
+
+extern void ResizeH(ResampleInfo *info);
+extern void ResizeV(ResampleInfo *info);
+extern void ResizeV_SSE2(ResampleInfo *info);
+extern void ResizeV_SSE4(ResampleInfo *info);
+extern void ResizeV_AVX(ResampleInfo *info);
+extern void ResizeV_fast(ResampleInfo *info);
+extern void ResizeH_SSE4(ResampleInfo *info);
+extern void ResizeH_AVX2(ResampleInfo *info);
+extern void ResizeH_fast(ResampleInfo *info);
+
+#endif /* RESAMPLE_H */
@@ -33,14 +33,9 @@ typedef struct _RSRotateClass RSRotateClass;
 struct _RSRotate {
 	RSFilter parent;
 
-	RS_MATRIX3 affine;
-	gboolean dirty;
+	GMutex lock; /* Protects angle and orientation */
 	gfloat angle;
 	gint orientation;
-	gint new_width;
-	gint new_height;
-	gint translate_x;
-	gint translate_y;
 };
 
 struct _RSRotateClass {
@@ -60,23 +55,22 @@ typedef struct {
 	RS_IMAGE16 *output;			/* Output Image*/
 	gint start_y;
 	gint end_y;
-	GThread *threadid;
 	gboolean use_straight;
-	RSRotate* rotate;
+	const RS_MATRIX3 *affine;
+	gint orientation;
 	gboolean use_fast;		/* Use nearest neighbour resampler */
 } ThreadInfo;
 
 
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
-static void previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static void turn_right_angle(RS_IMAGE16 *in, RS_IMAGE16 *out, gint start_y, gint end_y, const int direction);
 static RSFilterResponse *get_size(RSFilter *filter, const RSFilterRequest *request);
 static void inline bilinear(RS_IMAGE16 *in, gushort *out, gint x, gint y);
 static void inline nearest(RS_IMAGE16 *in, gushort *out, gint x, gint y);
-static void recalculate(RSRotate *rotate, const RSFilterRequest *request);
-static void recalculate_dims(RSRotate *rotate, gint previous_width, gint previous_height);
+static void finalize(GObject *object);
+static void recalculate_dims(gfloat angle, gint orientation, gint previous_width, gint previous_height, RS_MATRIX3 *affine, gint *new_width, gint *new_height);
 gpointer start_rotate_thread(gpointer _thread_info);
 
 static RSFilterClass *rs_rotate_parent_class = NULL;
@@ -97,6 +91,7 @@ rs_rotate_class_init(RSRotateClass *klass)
 
 	object_class->get_property = get_property;
 	object_class->set_property = set_property;
+	object_class->finalize = finalize;
 
 	g_object_class_install_property(object_class,
 		PROP_ANGLE, g_param_spec_float(
@@ -110,7 +105,6 @@ rs_rotate_class_init(RSRotateClass *klass)
 	);
 
 	filter_class->name = "Bilinear rotate filter";
-	filter_class->previous_changed = previous_changed;
 	filter_class->get_image = get_image;
 	filter_class->get_size = get_size;
 }
@@ -118,16 +112,27 @@ rs_rotate_class_init(RSRotateClass *klass)
 static void
 rs_rotate_init(RSRotate *rotate)
 {
+	g_mutex_init(&rotate->lock);
 	rotate->angle = 0.0;
-	rotate->dirty = TRUE;
 	ORIENTATION_RESET(rotate->orientation);
 }
 
+static void
+finalize(GObject *object)
+{
+	RSRotate *rotate = RS_ROTATE(object);
+
+	g_mutex_clear(&rotate->lock);
+
+	G_OBJECT_CLASS(rs_rotate_parent_class)->finalize(object);
+}
+
 static void
 get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
 {
 	RSRotate *rotate = RS_ROTATE(object);
 
+	g_mutex_lock(&rotate->lock);
 	switch (property_id)
 	{
 		case PROP_ANGLE:
@@ -139,15 +144,18 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
+	g_mutex_unlock(&rotate->lock);
 }
 
 static void
 set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
 {
 	RSRotate *rotate = RS_ROTATE(object);
+	gboolean changed = FALSE;
 
 	float new_angle = 0.0f;
 
+	g_mutex_lock(&rotate->lock);
 	switch (property_id)
 	{
 		case PROP_ANGLE:
@@ -162,8 +170,7 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 
 				/* We only support positive */
 
-				rotate->dirty = TRUE;
-				rs_filter_changed(RS_FILTER(object), RS_FILTER_CHANGED_DIMENSION);
+				changed = TRUE;
 			}
 			break;
 		case PROP_ORIENTATION:
@@ -171,24 +178,16 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			{
 				rotate->orientation = g_value_get_uint(value);
 
-				rotate->dirty = TRUE;
-				rs_filter_changed(RS_FILTER(object), RS_FILTER_CHANGED_DIMENSION);
+				changed = TRUE;
 			}
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
-}
+	g_mutex_unlock(&rotate->lock);
 
-static void
-previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask)
-{
-	RSRotate *rotate = RS_ROTATE(filter);
-
-	if (mask & RS_FILTER_CHANGED_DIMENSION)
-		rotate->dirty = TRUE;
-
-	rs_filter_changed(filter, mask);
+	if (changed)
+		rs_filter_changed(RS_FILTER(object), RS_FILTER_CHANGED_DIMENSION);
 }
 
 static RSFilterResponse *
@@ -202,8 +201,19 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	gboolean use_fast = FALSE;
 	GdkRectangle *old_roi;
 	GdkRectangle *roi;
+	RS_MATRIX3 affine;
+	gfloat angle;
+	gint orientation;
+	gint new_width, new_height;
+
+	/* Render everything from the same settings, even if they are changed
+	 * while we wait for the previous filter */
+	g_mutex_lock(&rotate->lock);
+	angle = rotate->angle;
+	orientation = rotate->orientation;
+	g_mutex_unlock(&rotate->lock);
 
-	if ((ABS(rotate->angle) < 0.001) && (rotate->orientation==0))
+	if ((ABS(angle) < 0.001) && (orientation==0))
 		return rs_filter_get_image(filter->previous, request);
 	
 	/* FIXME: Handle ROI across rotation */
@@ -212,17 +222,16 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		/* Calculate rotated ROI */
 		old_roi = rs_filter_request_get_roi(request);
 		RSFilterRequest *new_request = rs_filter_request_clone(request);
-		recalculate(rotate, request);
+		gint prev_w;
+		gint prev_h;
+		rs_filter_get_size_simple(filter->previous, request, &prev_w, &prev_h);
+		recalculate_dims(angle, orientation, prev_w, prev_h, &affine, &new_width, &new_height);
 		
 		gdouble minx, miny;
 		gdouble maxx, maxy;
-		matrix3_affine_get_minmax(&rotate->affine, &minx, &miny, &maxx, &maxy, old_roi->x-1.0, old_roi->y-1.0, (gdouble) ( old_roi->x+old_roi->width+1), (gdouble) ( old_roi->y + old_roi->height+1));
-		matrix3_affine_translate(&rotate->affine, -minx, -miny);
+		matrix3_affine_get_minmax(&affine, &minx, &miny, &maxx, &maxy, old_roi->x-1.0, old_roi->y-1.0, (gdouble) ( old_roi->x+old_roi->width+1), (gdouble) ( old_roi->y + old_roi->height+1));
 
 		/* Create new ROI */
-		gint prev_w;
-		gint prev_h;
-		rs_filter_get_size_simple(filter->previous, request, &prev_w, &prev_h);
 		roi = g_new(GdkRectangle, 1);
 		roi->x = MAX(0, (gint)minx);
 		roi->y = MAX(0, (gint)miny);
@@ -253,16 +262,16 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	gboolean straight = FALSE;
 
-	if ((rotate->angle < 0.001) && (rotate->orientation < 4)) 
+	if ((angle < 0.001) && (orientation < 4)) 
 	{
-		if (rotate->orientation == 2)
+		if (orientation == 2)
 			output = rs_image16_new(input->w, input->h, 3, input->pixelsize);
 		else 
 			output = rs_image16_new(input->h, input->w, 3, input->pixelsize);
 		straight = TRUE;
 	} else {
-		recalculate_dims(rotate, input->w, input->h);
-		output = rs_image16_new(rotate->new_width, rotate->new_height, 3, 4);
+		recalculate_dims(angle, orientation, input->w, input->h, &affine, &new_width, &new_height);
+		output = rs_image16_new(new_width, new_height, 3, 4);
 	}
 
 	if (rs_filter_request_get_quick(request))
@@ -273,7 +282,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	/* Prepare threads */
 	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
+	const guint threads = rs_thread_pool_get_num_threads();
 	ThreadInfo *t = g_new(ThreadInfo, threads);
 
 	threaded_h = output->h;
@@ -290,15 +299,12 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		y_offset += y_per_thread;
 		y_offset = MIN(threaded_h, y_offset);
 		t[i].end_y = y_offset;
-		t[i].rotate = rotate;
+		t[i].affine = &affine;
+		t[i].orientation = orientation;
 		t[i].use_fast = use_fast;
-
-		t[i].threadid = g_thread_new("RSRotate worker", start_rotate_thread, &t[i]);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	rs_thread_pool_run(start_rotate_thread, t, sizeof(ThreadInfo), threads);
 
 	g_free(t);
 	g_object_unref(input);
@@ -316,11 +322,10 @@ start_rotate_thread(gpointer _thread_info)
 
 	RS_IMAGE16 *input = t->input;
 	RS_IMAGE16 *output = t->output;
-	RSRotate *rotate = t->rotate;
+	const RS_MATRIX3 *affine = t->affine;
 
 	if (t->use_straight) {
-		turn_right_angle(input, output, t->start_y, t->end_y, rotate->orientation);
-		g_thread_exit(NULL);
+		turn_right_angle(input, output, t->start_y, t->end_y, t->orientation);
 		return NULL;
 	}
 
@@ -328,12 +333,12 @@ start_rotate_thread(gpointer _thread_info)
 	gint row, col;
 	gint destoffset;
 
-	gint crapx = (gint) (rotate->affine.coeff[0][0]*65536.0);
-	gint crapy = (gint) (rotate->affine.coeff[0][1]*65536.0);
+	gint crapx = (gint) (affine->coeff[0][0]*65536.0);
+	gint crapy = (gint) (affine->coeff[0][1]*65536.0);
 	for(row=t->start_y;row<t->end_y;row++)
 	{
-		gint foox = (gint) ((((gdouble)row) * rotate->affine.coeff[1][0] + rotate->affine.coeff[2][0])*65536.0);
-		gint fooy = (gint) ((((gdouble)row) * rotate->affine.coeff[1][1] + rotate->affine.coeff[2][1])*65536.0);
+		gint foox = (gint) ((((gdouble)row) * affine->coeff[1][0] + affine->coeff[2][0])*65536.0);
+		gint fooy = (gint) ((((gdouble)row) * affine->coeff[1][1] + affine->coeff[2][1])*65536.0);
 		destoffset = row * output->rowstride;
 		for(col=0;col<output->w;col++,destoffset += output->pixelsize)
 		{
@@ -346,9 +351,7 @@ start_rotate_thread(gpointer _thread_info)
 		}
 	}
 
-	g_thread_exit(NULL);
-
-	return NULL; /* Make the compiler shut up - we'll never return */
+	return NULL;
 }
 
 
@@ -357,17 +360,26 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSRotate *rotate = RS_ROTATE(filter);
 	RSFilterResponse *previous_response = rs_filter_get_size(filter->previous, request);
+	RS_MATRIX3 affine;
+	gfloat angle;
+	gint orientation;
+	gint new_width, new_height;
 
 	if (!previous_response)
 		return NULL;
 
-	recalculate(rotate, request);
+	g_mutex_lock(&rotate->lock);
+	angle = rotate->angle;
+	orientation = rotate->orientation;
+	g_mutex_unlock(&rotate->lock);
+
+	recalculate_dims(angle, orientation, rs_filter_response_get_width(previous_response), rs_filter_response_get_height(previous_response), &affine, &new_width, &new_height);
 
 	RSFilterResponse *response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	rs_filter_response_set_width(response, rotate->new_width);
-	rs_filter_response_set_height(response, rotate->new_height);
+	rs_filter_response_set_width(response, new_width);
+	rs_filter_response_set_height(response, new_height);
 
 	return response;
 }
@@ -456,55 +468,41 @@ bilinear(RS_IMAGE16 *in, gushort *out, gint x, gint y)
 }
 
 static void
-recalculate_dims(RSRotate *rotate, gint previous_width, gint previous_height)
+recalculate_dims(gfloat angle, gint orientation, gint previous_width, gint previous_height, RS_MATRIX3 *affine, gint *new_width, gint *new_height)
 {
 	/* Bail out, if parent returns negative dimensions */
 	if ((previous_width < 0) || (previous_height < 0))
 	{
-		rotate->new_width = -1;
-		rotate->new_height = -1;
+		matrix3_identity(affine);
+		*new_width = -1;
+		*new_height = -1;
 		return;
 	}
 	gdouble minx, miny;
 	gdouble maxx, maxy;
 
 	/* Start clean */
-	matrix3_identity(&rotate->affine);
+	matrix3_identity(affine);
 
 	/* Rotate + orientation-angle */
-	matrix3_affine_rotate(&rotate->affine, rotate->angle+(rotate->orientation&3)*90.0);
+	matrix3_affine_rotate(affine, angle+(orientation&3)*90.0);
 
 	/* Flip if needed */
-	if (rotate->orientation&4)
-		matrix3_affine_scale(&rotate->affine, 1.0, -1.0);
+	if (orientation&4)
+		matrix3_affine_scale(affine, 1.0, -1.0);
 
 	/* Translate into positive x,y */
-	matrix3_affine_get_minmax(&rotate->affine, &minx, &miny, &maxx, &maxy, 0.0, 0.0, (gdouble) (previous_width-1), (gdouble) (previous_height-1));
+	matrix3_affine_get_minmax(affine, &minx, &miny, &maxx, &maxy, 0.0, 0.0, (gdouble) (previous_width-1), (gdouble) (previous_height-1));
 	minx -= 0.5; /* This SHOULD be the correct rounding :) */
 	miny -= 0.5;
-	matrix3_affine_translate(&rotate->affine, -minx, -miny);
+	matrix3_affine_translate(affine, -minx, -miny);
 
 	/* Get width and height used for calculating scale */
-	rotate->new_width = (gint) (maxx - minx + 1.0);
-	rotate->new_height = (gint) (maxy - miny + 1.0);
+	*new_width = (gint) (maxx - minx + 1.0);
+	*new_height = (gint) (maxy - miny + 1.0);
 
 	/* We use the inverse matrix for our transform */
-	matrix3_affine_invert(&rotate->affine);
-
-	rotate->dirty = FALSE;
-}
-
-static void
-recalculate(RSRotate *rotate, const RSFilterRequest *request)
-{
-	RSFilter *previous = RS_FILTER(rotate)->previous;
-	RSFilterResponse *response = rs_filter_get_size(previous, request);
-	if (!response || !RS_IS_FILTER_RESPONSE(response))
-		return;
-	gint previous_width = rs_filter_response_get_width(response);
-	gint previous_height = rs_filter_response_get_height(response);
-	g_object_unref(response);
-	recalculate_dims(rotate, previous_width, previous_height);
+	matrix3_affine_invert(affine);
 }
 
 static void turn_right_angle(RS_IMAGE16 *in, RS_IMAGE16 *out, gint start_y, gint end_y, const int direction)
@@ -57,6 +57,7 @@
 #include "lensfun.h"
 #include "rs-profile-factory-model.h"
 #include "rs-profile-camera.h"
+#include "rs-preload.h"
 
 static void photo_profile_changed(RS_PHOTO *photo, gpointer profile, RS_BLOB *rs);
 
@@ -274,6 +275,9 @@ test(void)
 	GIOStatus status = G_IO_STATUS_NORMAL;
 	GIOChannel *io = g_io_channel_new_file("testimages", "r", NULL);
 	gint sum, good = 0, bad = 0;
+	gint thumbnails = 0;
+	gdouble metadata_time = 0.0;
+	GTimer *timer = g_timer_new();
 
 	struct lfDatabase *lensdb = lf_db_new ();
 	lf_db_load (lensdb);
@@ -324,7 +328,9 @@ test(void)
 			}
 
 			RSMetadata *metadata = rs_metadata_new();
+			g_timer_start(timer);
 			rs_metadata_load_from_file(metadata, filename);
+			metadata_time += g_timer_elapsed(timer, NULL);
 
 			load_meta_ok = TRUE;
 
@@ -350,6 +356,7 @@ test(void)
 			if (pixbuf)
 			{
 				thumbnail_ok = TRUE;
+				thumbnails++;
 				g_object_unref(pixbuf);
 			}
 
@@ -431,6 +438,10 @@ test(void)
 		filename = next_filename;
 	}
 	printf("Passed: %d Failed: %d (%d%%)\n", good, bad, (good*100)/(good+bad));
+	/* Metadata loading is dominated by thumbnail decoding */
+	if (metadata_time > 0.0)
+		printf("Metadata and thumbnails: %d thumbnails in %.2fs, %.1f thumbnails/s\n", thumbnails, metadata_time, thumbnails/metadata_time);
+	g_timer_destroy(timer);
 	g_io_channel_shutdown(io, TRUE, NULL);
 	exit(0);
 }
@@ -561,6 +572,10 @@ main(int argc, char **argv)
 	gboolean do_test = FALSE;
 	gboolean print_version = FALSE;
 	gchar *debug = NULL;
+	gint threads = 0;
+	gint pool_limit = 0;
+	gint preload_limit = 0;
+	RSImagePoolStats pool_stats;
     gchar *client_mode_dest = NULL;
 
 	GError *error = NULL;
@@ -568,6 +583,7 @@ main(int argc, char **argv)
 	const GOptionEntry option_entries[] = {
         { "output", 'o', 0, G_OPTION_ARG_STRING, &client_mode_dest, "Run in client mode", "target filename"},
 		{ "debug", 'd', 0, G_OPTION_ARG_STRING, &debug, "Debug flags to use", "flags" },
+		{ "threads", 'j', 0, G_OPTION_ARG_INT, &threads, "Number of worker threads to use for processing", "count" },
 		{ "do-tests", 't', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &do_test, "Do internal tests", NULL },
 		{ "version", 'V', 0, G_OPTION_ARG_NONE, &print_version, "Output version information and exit", NULL },
 		{ NULL }
@@ -639,6 +655,18 @@ main(int argc, char **argv)
 
 	rs_filetype_init();
 
+	/* Command line overrides the configured number of worker threads */
+	if (threads > 0 || rs_conf_get_integer(CONF_WORKER_THREADS, &threads))
+		rs_thread_pool_set_num_threads(threads);
+
+	/* Memory kept for reuse by images, in megabytes */
+	if (rs_conf_get_integer(CONF_IMAGE_POOL_LIMIT, &pool_limit))
+		rs_image16_pool_set_limit(((gsize) MAX(0, pool_limit)) * 1024 * 1024);
+
+	/* Memory used for photos decoded ahead of time, in megabytes */
+	if (rs_conf_get_integer(CONF_PRELOAD_LIMIT, &preload_limit))
+		rs_preload_set_limit(((gsize) MAX(0, preload_limit)) * 1024 * 1024);
+
 	rs_plugin_manager_load_all_plugins();
 
 #ifdef WITH_GCONF
@@ -659,6 +687,11 @@ main(int argc, char **argv)
 	else
 		gui_init(argc, argv, rs);
 
+	rs_io_print_lock_stats();
+	rs_image16_pool_get_stats(&pool_stats);
+	RS_DEBUG(PERFORMANCE, "Image pool: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " allocations reused, %" G_GUINT64_FORMAT " buffers evicted, peak %" G_GSIZE_FORMAT " MB idle",
+		pool_stats.reused, pool_stats.allocations, pool_stats.evicted, pool_stats.idle_peak/(1024*1024));
+
 	/* This is so fucking evil, but Rawstudio will deadlock in some GTK atexit() function from time to time :-/ */
 	_exit(0);
 }
@@ -27,12 +27,16 @@
 #include "filename.h"
 #include "conf_interface.h"
 #include "gettext.h"
+#ifndef RAWSTUDIO_CLI
 #include "gtk-helper.h"
+#endif
 #include "rs-metadata.h"
 
+#ifndef RAWSTUDIO_CLI
 static void filename_entry_changed_writeback(GtkEntry *entry, gpointer user_data);
 static void filename_entry_changed_writeconf(GtkEntry *entry, gpointer user_data);
 static void filename_add_clicked(GtkButton *button, gpointer user_data);
+#endif
 
 gchar *
 filename_parse(const gchar *in, const gchar *filename, const gint snapshot, gboolean load_metadata)
@@ -326,6 +330,7 @@ filename_parse(const gchar *in, const gchar *filename, const gint snapshot, gboo
 	return output;
 }
 
+#ifndef RAWSTUDIO_CLI
 static void
 filename_entry_changed_writeback(GtkEntry *entry, gpointer user_data)
 {
@@ -455,3 +460,4 @@ rs_filename_chooser_button_new(gchar **filename, const gchar *conf_key)
 
 	return(hbox);
 }
+#endif /* RAWSTUDIO_CLI */
@@ -43,6 +43,7 @@
 #include "rs-toolbox.h"
 #include "rs-library.h"
 #include "rs-tag-gui.h"
+#include "rs-preload.h"
 
 static GtkStatusbar *statusbar;
 static gboolean fullscreen;
@@ -210,7 +211,9 @@ open_photo(RS_BLOB *rs, const gchar *filename)
 
 	gui_set_busy(TRUE);
 	rs_preview_widget_set_photo(RS_PREVIEW_WIDGET(rs->preview), NULL);
-	photo = rs_photo_load_from_file(filename);
+	photo = rs_preload_get_photo(filename);
+	if (!photo)
+		photo = rs_photo_load_from_file(filename);
 
 	if (photo)
 	{
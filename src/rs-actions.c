@@ -43,6 +43,7 @@
 #include "rs-toolbox.h"
 #include "rs-tethered-shooting.h"
 #include "rs-enfuse.h"
+#include "rs-preload.h"
 
 static GtkActionGroup *core_action_group = NULL;
 static GMutex rs_actions_spinlock;
@@ -396,6 +397,7 @@ ACTION(quit)
 	rs_conf_set_integer(CONF_LAST_PRIORITY_PAGE, rs_store_get_current_page(rs->store));
 	rs_io_idle_cancel_class(METADATA_CLASS);
 	rs_io_idle_cancel_class(PRELOAD_CLASS);
+	rs_preload_cancel();
 	rs_io_idle_cancel_class(RESTORE_TAGS_CLASS);
 	
 	RS_PROGRESS *progress;
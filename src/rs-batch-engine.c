@@ -0,0 +1,708 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include <glib/gstdio.h>
+#include "rs-batch-engine.h"
+#include "rs-cache.h"
+#include "rs-photo.h"
+
+/*
+ * Every job passes three stages, each served by its own threads:
+ *
+ *  load:    Decode the photo and load metadata and settings.
+ *  develop: Render the photo at full size in to the cache of a filter chain.
+ *  encode:  Let the output resample, convert and save the cached image.
+ *
+ * A filter chain is taken from a pool of "concurrency" chains when a job is
+ * developed and returned when it's encoded. This limits the number of photos
+ * being developed and encoded at once, while decoding can run ahead until the
+ * loaded queue is full or the memory limit is reached.
+ */
+
+#define DEFAULT_MEMORY_LIMIT 2048 /* Megabytes */
+
+struct _RSBatchChain {
+	RSFilter *input;
+	RSFilter *demosaic;
+	RSFilter *fujirotate;
+	RSFilter *lensfun;
+	RSFilter *rotate;
+	RSFilter *crop;
+	RSFilter *transform_input;
+	RSFilter *dcp;
+	RSFilter *cache;
+	RSFilter *resample;
+	RSFilter *denoise;
+	RSFilter *transform_display;
+	RSFilter *end;
+	RSFilter *tile_cache;
+	RSOutput *output;
+};
+
+struct _RSBatchEngine {
+	GMutex lock;
+	GCond cond;
+
+	GQueue input;             /* Jobs waiting to be loaded */
+	GQueue loaded;            /* Jobs waiting to be developed */
+	GQueue developed;         /* Jobs waiting to be encoded */
+	GQueue chains;            /* Idle filter chains */
+	GAsyncQueue *finished;
+
+	GThread **threads;
+	guint num_threads;
+
+	RSOutput *output;
+	gint concurrency;
+	gint preview_size;
+	gsize memory_limit;
+	gsize memory_used;
+	gsize memory_estimate;    /* Highest memory use seen for a single photo */
+	guint jobs_in_memory;
+	guint pending;            /* Jobs pushed but not finished yet */
+	gboolean cancelled;
+	gboolean shutdown;
+
+	gint64 start;
+	RSBatchEngineStats stats;
+};
+
+/**
+ * Allocate a new RSBatchJob
+ * @param input The photo to load
+ * @param setting_id The snapshot to export
+ * @param output The filename to save to
+ * @return A new RSBatchJob, free with rs_batch_job_free()
+ */
+RSBatchJob *
+rs_batch_job_new(const gchar *input, gint setting_id, const gchar *output)
+{
+	RSBatchJob *job = g_new0(RSBatchJob, 1);
+
+	job->input = g_strdup(input);
+	job->setting_id = setting_id;
+	job->output = g_strdup(output);
+	job->width = 65535;
+	job->height = 65535;
+	job->scale = -1.0;
+	job->status = RS_BATCH_JOB_PENDING;
+
+	return job;
+}
+
+/**
+ * Create an empty output file, if none exists, so the filename will not be
+ * chosen again by filename_parse() for a later job. The file is removed if
+ * the job doesn't finish successfully
+ * @param job A RSBatchJob
+ */
+void
+rs_batch_job_reserve_output(RSBatchJob *job)
+{
+	g_return_if_fail(job != NULL);
+
+	if (!g_file_test(job->output, G_FILE_TEST_EXISTS))
+		job->reserved = g_file_set_contents(job->output, "", 0, NULL);
+}
+
+/**
+ * Free a RSBatchJob
+ * @param job A RSBatchJob
+ */
+void
+rs_batch_job_free(RSBatchJob *job)
+{
+	g_return_if_fail(job != NULL);
+
+	g_free(job->input);
+	g_free(job->output);
+	if (job->preview)
+		g_object_unref(job->preview);
+	if (job->photo)
+		g_object_unref(job->photo);
+	g_free(job);
+}
+
+/* Make a copy of an output with all properties set equally */
+static RSOutput *
+output_clone(RSOutput *template)
+{
+	RSOutput *output = g_object_new(G_OBJECT_TYPE(template), NULL);
+	GParamSpec **specs;
+	guint num_specs, i;
+
+	specs = g_object_class_list_properties(G_OBJECT_GET_CLASS(template), &num_specs);
+	for(i = 0; i < num_specs; i++)
+	{
+		GValue value = {0};
+
+		if ((specs[i]->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE)
+			continue;
+		if (specs[i]->flags & G_PARAM_CONSTRUCT_ONLY)
+			continue;
+
+		g_value_init(&value, specs[i]->value_type);
+		g_object_get_property(G_OBJECT(template), specs[i]->name, &value);
+		g_object_set_property(G_OBJECT(output), specs[i]->name, &value);
+		g_value_unset(&value);
+	}
+	g_free(specs);
+
+	return output;
+}
+
+static RSBatchChain *
+chain_new(RSBatchEngine *engine)
+{
+	RSBatchChain *chain = g_new0(RSBatchChain, 1);
+
+	chain->input = rs_filter_new("RSInputImage16", NULL);
+	chain->demosaic = rs_filter_new("RSDemosaic", chain->input);
+	chain->fujirotate = rs_filter_new("RSFujiRotate", chain->demosaic);
+	chain->lensfun = rs_filter_new("RSLensfun", chain->fujirotate);
+	chain->rotate = rs_filter_new("RSRotate", chain->lensfun);
+	chain->crop = rs_filter_new("RSCrop", chain->rotate);
+	chain->transform_input = rs_filter_new("RSColorspaceTransform", chain->crop);
+	chain->dcp = rs_filter_new("RSDcp", chain->transform_input);
+	chain->cache = rs_filter_new("RSCache", chain->dcp);
+	chain->resample = rs_filter_new("RSResample", chain->cache);
+	chain->denoise = rs_filter_new("RSDenoise", chain->resample);
+	chain->transform_display = rs_filter_new("RSColorspaceTransform", chain->denoise);
+	chain->end = chain->transform_display;
+	/* Outputs render the image in strips, filters that cannot render
+	 * strips on their own will render the whole image once for all */
+	chain->tile_cache = rs_filter_insert_tile_cache(chain->end);
+
+	chain->output = output_clone(engine->output);
+
+	return chain;
+}
+
+static void
+chain_free(RSBatchChain *chain)
+{
+	g_object_unref(chain->input);
+	g_object_unref(chain->demosaic);
+	g_object_unref(chain->fujirotate);
+	g_object_unref(chain->lensfun);
+	g_object_unref(chain->rotate);
+	g_object_unref(chain->crop);
+	g_object_unref(chain->transform_input);
+	g_object_unref(chain->dcp);
+	g_object_unref(chain->cache);
+	g_object_unref(chain->resample);
+	g_object_unref(chain->denoise);
+	g_object_unref(chain->transform_display);
+	if (chain->tile_cache)
+		g_object_unref(chain->tile_cache);
+	g_object_unref(chain->output);
+	g_free(chain);
+}
+
+/* The colorspace the output will request, or NULL */
+static RSColorSpace *
+chain_get_colorspace(RSBatchChain *chain)
+{
+	RSColorSpace *colorspace = NULL;
+
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(chain->output), "colorspace"))
+		g_object_get(chain->output, "colorspace", &colorspace, NULL);
+
+	return colorspace;
+}
+
+/* Estimate the memory needed to develop a loaded photo */
+static gsize
+photo_memory(RS_PHOTO *photo)
+{
+	RS_IMAGE16 *image = rs_filter_response_get_image(photo->input_response);
+	gsize memory = 0;
+
+	if (image)
+	{
+		/* The raw data itself, and room for three full size four channel
+		 * images: demosaic output, the cached rotated image and the cached
+		 * developed image */
+		memory = (gsize) image->rowstride * image->h * sizeof(gushort);
+		memory += (gsize) image->w * image->h * 4 * sizeof(gushort) * 3;
+		g_object_unref(image);
+	}
+
+	return memory;
+}
+
+/* Must be called with lock held */
+static void
+finish(RSBatchEngine *engine, RSBatchJob *job, RSBatchJobStatus status)
+{
+	job->status = status;
+
+	if (job->in_memory)
+	{
+		engine->memory_used -= job->memory;
+		engine->jobs_in_memory--;
+		job->in_memory = FALSE;
+		job->memory = 0;
+	}
+
+	if (job->photo)
+	{
+		g_object_unref(job->photo);
+		job->photo = NULL;
+	}
+
+	if (job->chain)
+	{
+		/* Let go of the image data while idle */
+		g_object_set(job->chain->input, "image", NULL, NULL);
+		g_queue_push_tail(&engine->chains, job->chain);
+		job->chain = NULL;
+	}
+
+	/* Don't leave an empty file behind */
+	if (job->reserved && status != RS_BATCH_JOB_DONE)
+		g_unlink(job->output);
+
+	if (status == RS_BATCH_JOB_DONE)
+		engine->stats.done++;
+	else
+		engine->stats.failed++;
+	engine->stats.load_time += job->load_time;
+	engine->stats.develop_time += job->develop_time;
+	engine->stats.encode_time += job->encode_time;
+
+	engine->pending--;
+	g_async_queue_push(engine->finished, job);
+	g_cond_broadcast(&engine->cond);
+}
+
+static gpointer
+load_thread(gpointer data)
+{
+	RSBatchEngine *engine = data;
+	RSBatchJob *job;
+	RS_PHOTO *photo;
+	gint64 start;
+	gsize memory;
+
+	g_mutex_lock(&engine->lock);
+	while (!engine->shutdown)
+	{
+		/* Wait until there's room for another photo. We always allow one
+		 * photo, to make sure we make progress */
+		if (g_queue_is_empty(&engine->input)
+			|| g_queue_get_length(&engine->loaded) >= (guint) engine->concurrency
+			|| (engine->jobs_in_memory > 0 && engine->memory_used + engine->memory_estimate > engine->memory_limit))
+		{
+			g_cond_wait(&engine->cond, &engine->lock);
+			continue;
+		}
+
+		job = g_queue_pop_head(&engine->input);
+		job->in_memory = TRUE;
+		job->memory = engine->memory_estimate;
+		engine->memory_used += job->memory;
+		engine->jobs_in_memory++;
+		g_mutex_unlock(&engine->lock);
+
+		start = g_get_monotonic_time();
+		photo = rs_photo_load_from_file(job->input);
+		if (photo)
+		{
+			rs_metadata_load_from_file(photo->metadata, job->input);
+			rs_cache_load(photo);
+		}
+		job->load_time = g_get_monotonic_time() - start;
+		memory = photo ? photo_memory(photo) : 0;
+
+		g_mutex_lock(&engine->lock);
+		job->photo = photo;
+		engine->memory_used = engine->memory_used - job->memory + memory;
+		job->memory = memory;
+		engine->memory_estimate = MAX(engine->memory_estimate, memory);
+		engine->stats.memory_peak = MAX(engine->stats.memory_peak, engine->memory_used);
+
+		if (!photo)
+			finish(engine, job, RS_BATCH_JOB_LOAD_FAILED);
+		else if (engine->cancelled)
+			finish(engine, job, RS_BATCH_JOB_CANCELLED);
+		else
+		{
+			g_queue_push_tail(&engine->loaded, job);
+			g_cond_broadcast(&engine->cond);
+		}
+	}
+	g_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+static gpointer
+develop_thread(gpointer data)
+{
+	RSBatchEngine *engine = data;
+	RSBatchJob *job;
+	RSBatchChain *chain;
+	RSFilterRequest *request;
+	RSFilterResponse *response;
+	RSColorSpace *colorspace;
+	gint64 start;
+	gint width, height;
+	GList *filters;
+
+	g_mutex_lock(&engine->lock);
+	while (!engine->shutdown)
+	{
+		if (g_queue_is_empty(&engine->loaded) || g_queue_is_empty(&engine->chains))
+		{
+			g_cond_wait(&engine->cond, &engine->lock);
+			continue;
+		}
+
+		job = g_queue_pop_head(&engine->loaded);
+		chain = g_queue_pop_head(&engine->chains);
+		job->chain = chain;
+		g_mutex_unlock(&engine->lock);
+
+		start = g_get_monotonic_time();
+
+		filters = g_list_append(NULL, chain->end);
+		rs_photo_apply_to_filters(job->photo, filters, job->setting_id);
+		g_list_free(filters);
+
+		rs_filter_set_recursive(chain->end,
+			"image", job->photo->input_response,
+			"filename", job->photo->filename,
+			"bounding-box", TRUE,
+			NULL);
+
+		/* Calculate new size */
+		width = job->width;
+		height = job->height;
+		if (job->scale > 0.0)
+		{
+			rs_filter_get_size_simple(chain->crop, RS_FILTER_REQUEST_QUICK, &width, &height);
+			width = (gint) (((gdouble) width) * job->scale);
+			height = (gint) (((gdouble) height) * job->scale);
+		}
+		rs_filter_set_recursive(chain->end,
+			"width", width,
+			"height", height,
+			NULL);
+
+		/* Render the full size image in to the cache, the request must
+		 * match what the output will ask for, to hit the cache later */
+		request = rs_filter_request_new();
+		rs_filter_request_set_quick(request, FALSE);
+		colorspace = chain_get_colorspace(chain);
+		if (colorspace)
+		{
+			rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", colorspace);
+			g_object_unref(colorspace);
+		}
+		response = rs_filter_get_image(chain->cache, request);
+		g_object_unref(response);
+		g_object_unref(request);
+
+		job->develop_time = g_get_monotonic_time() - start;
+
+		g_mutex_lock(&engine->lock);
+		if (engine->cancelled)
+			finish(engine, job, RS_BATCH_JOB_CANCELLED);
+		else
+		{
+			g_queue_push_tail(&engine->developed, job);
+			g_cond_broadcast(&engine->cond);
+		}
+	}
+	g_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+static gpointer
+encode_thread(gpointer data)
+{
+	RSBatchEngine *engine = data;
+	RSBatchJob *job;
+	RSBatchChain *chain;
+	gboolean exported;
+	gint64 start;
+
+	g_mutex_lock(&engine->lock);
+	while (!engine->shutdown)
+	{
+		if (g_queue_is_empty(&engine->developed))
+		{
+			g_cond_wait(&engine->cond, &engine->lock);
+			continue;
+		}
+
+		job = g_queue_pop_head(&engine->developed);
+		chain = job->chain;
+		g_mutex_unlock(&engine->lock);
+
+		start = g_get_monotonic_time();
+
+		if (g_object_class_find_property(G_OBJECT_GET_CLASS(chain->output), "filename"))
+			g_object_set(chain->output, "filename", job->output, NULL);
+		exported = rs_output_execute(chain->output, chain->end);
+
+		/* Use the colorspace of the output, this way we can use the cached image */
+		if (exported && engine->preview_size > 0)
+		{
+			RSFilterRequest *request = rs_filter_request_new();
+			RSColorSpace *colorspace = chain_get_colorspace(chain);
+			RSFilterResponse *response;
+
+			rs_filter_set_recursive(chain->end,
+				"width", engine->preview_size,
+				"height", engine->preview_size,
+				NULL);
+			if (colorspace)
+			{
+				rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", colorspace);
+				g_object_unref(colorspace);
+			}
+			response = rs_filter_get_image8(chain->end, request);
+			job->preview = rs_filter_response_get_image8(response);
+			g_object_unref(response);
+			g_object_unref(request);
+		}
+
+		job->encode_time = g_get_monotonic_time() - start;
+		RS_DEBUG(PERFORMANCE, "%s: load %.03fs, develop %.03fs, encode %.03fs", job->input,
+			job->load_time/1000000.0, job->develop_time/1000000.0, job->encode_time/1000000.0);
+
+		g_mutex_lock(&engine->lock);
+		finish(engine, job, exported ? RS_BATCH_JOB_DONE : RS_BATCH_JOB_EXPORT_FAILED);
+	}
+	g_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+/**
+ * Start a new batch engine. Photos are loaded, developed and encoded by
+ * separate threads, allowing several photos to be in flight at once
+ * @param output An RSOutput, every concurrent export will get a copy of this
+ * @param concurrency The number of photos to develop at once, 0 or less to choose automatically
+ * @param memory_limit Don't load more photos when this many megabytes are estimated to be in use, 0 or less for default
+ * @param preview_size If above 0, a preview of this size will be rendered for each photo
+ * @return A new RSBatchEngine
+ */
+RSBatchEngine *
+rs_batch_engine_new(RSOutput *output, gint concurrency, gint memory_limit, gint preview_size)
+{
+	RSBatchEngine *engine;
+	gint i, loaders;
+
+	g_return_val_if_fail(RS_IS_OUTPUT(output), NULL);
+
+	/* The filters are threaded themselves, we only need enough photos in
+	 * flight to keep the cores busy during the single threaded parts */
+	if (concurrency < 1)
+		concurrency = CLAMP(rs_get_number_of_processor_cores()/2, 2, 8);
+	if (memory_limit < 1)
+		memory_limit = DEFAULT_MEMORY_LIMIT;
+	loaders = MAX(1, concurrency/2);
+
+	engine = g_new0(RSBatchEngine, 1);
+	g_mutex_init(&engine->lock);
+	g_cond_init(&engine->cond);
+	g_queue_init(&engine->input);
+	g_queue_init(&engine->loaded);
+	g_queue_init(&engine->developed);
+	g_queue_init(&engine->chains);
+	engine->finished = g_async_queue_new();
+	engine->output = g_object_ref(output);
+	engine->concurrency = concurrency;
+	engine->preview_size = preview_size;
+	engine->memory_limit = ((gsize) memory_limit) * 1024 * 1024;
+	engine->start = g_get_monotonic_time();
+
+	for(i = 0; i < concurrency; i++)
+		g_queue_push_tail(&engine->chains, chain_new(engine));
+
+	engine->num_threads = loaders + concurrency * 2;
+	engine->threads = g_new(GThread *, engine->num_threads);
+	for(i = 0; i < loaders; i++)
+		engine->threads[i] = g_thread_new("RSBatchEngine load", load_thread, engine);
+	for(i = 0; i < concurrency; i++)
+	{
+		engine->threads[loaders + i*2] = g_thread_new("RSBatchEngine develop", develop_thread, engine);
+		engine->threads[loaders + i*2 + 1] = g_thread_new("RSBatchEngine encode", encode_thread, engine);
+	}
+
+	RS_DEBUG(PERFORMANCE, "Batch engine started with %d concurrent photos, %d loaders and %d MB memory limit", concurrency, loaders, memory_limit);
+
+	return engine;
+}
+
+/**
+ * Get the number of photos developed at once
+ * @param engine A RSBatchEngine
+ * @return The number of concurrent photos
+ */
+gint
+rs_batch_engine_get_concurrency(RSBatchEngine *engine)
+{
+	g_return_val_if_fail(engine != NULL, 0);
+
+	return engine->concurrency;
+}
+
+/**
+ * Queue a job, the engine takes ownership of the job until it's returned
+ * by rs_batch_engine_pop_finished()
+ * @param engine A RSBatchEngine
+ * @param job A RSBatchJob
+ */
+void
+rs_batch_engine_push(RSBatchEngine *engine, RSBatchJob *job)
+{
+	g_return_if_fail(engine != NULL);
+	g_return_if_fail(job != NULL);
+
+	g_mutex_lock(&engine->lock);
+	engine->pending++;
+	if (engine->cancelled)
+		finish(engine, job, RS_BATCH_JOB_CANCELLED);
+	else
+	{
+		g_queue_push_tail(&engine->input, job);
+		g_cond_broadcast(&engine->cond);
+	}
+	g_mutex_unlock(&engine->lock);
+}
+
+/**
+ * Get a finished job, jobs are not necessarily finished in the order they were queued
+ * @param engine A RSBatchEngine
+ * @param timeout Time to wait in microseconds, or -1 to wait forever
+ * @return A finished RSBatchJob or NULL if none finished within timeout
+ */
+RSBatchJob *
+rs_batch_engine_pop_finished(RSBatchEngine *engine, gint64 timeout)
+{
+	g_return_val_if_fail(engine != NULL, NULL);
+
+	if (timeout < 0)
+		return g_async_queue_pop(engine->finished);
+	else
+		return g_async_queue_timeout_pop(engine->finished, timeout);
+}
+
+/**
+ * Cancel all jobs not yet started, they will be returned with RS_BATCH_JOB_CANCELLED status
+ * @param engine A RSBatchEngine
+ */
+void
+rs_batch_engine_cancel(RSBatchEngine *engine)
+{
+	RSBatchJob *job;
+
+	g_return_if_fail(engine != NULL);
+
+	g_mutex_lock(&engine->lock);
+	engine->cancelled = TRUE;
+	while ((job = g_queue_pop_head(&engine->input)))
+		finish(engine, job, RS_BATCH_JOB_CANCELLED);
+	while ((job = g_queue_pop_head(&engine->loaded)))
+		finish(engine, job, RS_BATCH_JOB_CANCELLED);
+	while ((job = g_queue_pop_head(&engine->developed)))
+		finish(engine, job, RS_BATCH_JOB_CANCELLED);
+	g_mutex_unlock(&engine->lock);
+}
+
+/**
+ * Get statistics from a running engine
+ * @param engine A RSBatchEngine
+ * @param stats A RSBatchEngineStats to fill
+ */
+void
+rs_batch_engine_get_stats(RSBatchEngine *engine, RSBatchEngineStats *stats)
+{
+	g_return_if_fail(engine != NULL);
+	g_return_if_fail(stats != NULL);
+
+	g_mutex_lock(&engine->lock);
+	*stats = engine->stats;
+	stats->elapsed = g_get_monotonic_time() - engine->start;
+	g_mutex_unlock(&engine->lock);
+}
+
+/**
+ * Get the throughput of an engine
+ * @param stats Statistics from rs_batch_engine_get_stats()
+ * @return The number of finished photos per minute
+ */
+gdouble
+rs_batch_engine_stats_get_rate(const RSBatchEngineStats *stats)
+{
+	g_return_val_if_fail(stats != NULL, 0.0);
+
+	if (stats->elapsed <= 0)
+		return 0.0;
+
+	return ((gdouble) stats->done) * 60000000.0 / ((gdouble) stats->elapsed);
+}
+
+/**
+ * Wait for all queued jobs to finish, then stop and free the engine. Jobs
+ * not popped by rs_batch_engine_pop_finished() will be freed
+ * @param engine A RSBatchEngine
+ */
+void
+rs_batch_engine_free(RSBatchEngine *engine)
+{
+	RSBatchEngineStats stats;
+	RSBatchChain *chain;
+	RSBatchJob *job;
+	guint i;
+
+	g_return_if_fail(engine != NULL);
+
+	g_mutex_lock(&engine->lock);
+	while (engine->pending > 0)
+		g_cond_wait(&engine->cond, &engine->lock);
+	engine->shutdown = TRUE;
+	g_cond_broadcast(&engine->cond);
+	g_mutex_unlock(&engine->lock);
+
+	for(i = 0; i < engine->num_threads; i++)
+		g_thread_join(engine->threads[i]);
+	g_free(engine->threads);
+
+	rs_batch_engine_get_stats(engine, &stats);
+	RS_DEBUG(PERFORMANCE, "Batch engine exported %u photos (%u failed) in %.03fs, %.1f images/minute, peak memory %" G_GSIZE_FORMAT " MB",
+		stats.done, stats.failed, stats.elapsed/1000000.0, rs_batch_engine_stats_get_rate(&stats), stats.memory_peak/(1024*1024));
+
+	while ((chain = g_queue_pop_head(&engine->chains)))
+		chain_free(chain);
+	while ((job = g_async_queue_try_pop(engine->finished)))
+		rs_batch_job_free(job);
+	g_async_queue_unref(engine->finished);
+	g_object_unref(engine->output);
+
+	g_mutex_clear(&engine->lock);
+	g_cond_clear(&engine->cond);
+	g_free(engine);
+}
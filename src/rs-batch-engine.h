@@ -0,0 +1,154 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_BATCH_ENGINE_H
+#define RS_BATCH_ENGINE_H
+
+#include "application.h"
+
+typedef struct _RSBatchEngine RSBatchEngine;
+typedef struct _RSBatchChain RSBatchChain;
+
+typedef enum {
+	RS_BATCH_JOB_PENDING = 0,
+	RS_BATCH_JOB_DONE,
+	RS_BATCH_JOB_LOAD_FAILED,
+	RS_BATCH_JOB_EXPORT_FAILED,
+	RS_BATCH_JOB_CANCELLED,
+} RSBatchJobStatus;
+
+typedef struct {
+	gchar *input;             /* Photo to load */
+	gint setting_id;          /* Snapshot to export */
+	gchar *output;            /* Filename to save to */
+	gint width;               /* Bounding box of the output */
+	gint height;
+	gdouble scale;            /* If above 0, scale the cropped photo by this instead */
+	gpointer user_data;
+
+	/* Set by the engine */
+	RSBatchJobStatus status;
+	GdkPixbuf *preview;       /* Small version of the output, if requested */
+	gint64 load_time;         /* Time spent in each stage in microseconds */
+	gint64 develop_time;
+	gint64 encode_time;
+
+	/* Private */
+	RS_PHOTO *photo;
+	RSBatchChain *chain;
+	gboolean reserved;
+	gboolean in_memory;
+	gsize memory;
+} RSBatchJob;
+
+typedef struct {
+	guint done;               /* Jobs finished successfully */
+	guint failed;             /* Jobs failed or cancelled */
+	gint64 elapsed;           /* Time since the engine was started (us) */
+	gint64 load_time;         /* Total time spent in each stage (us) */
+	gint64 develop_time;
+	gint64 encode_time;
+	gsize memory_peak;        /* Highest estimated memory use in bytes */
+} RSBatchEngineStats;
+
+/**
+ * Allocate a new RSBatchJob
+ * @param input The photo to load
+ * @param setting_id The snapshot to export
+ * @param output The filename to save to
+ * @return A new RSBatchJob, free with rs_batch_job_free()
+ */
+extern RSBatchJob *rs_batch_job_new(const gchar *input, gint setting_id, const gchar *output);
+
+/**
+ * Create an empty output file, if none exists, so the filename will not be
+ * chosen again by filename_parse() for a later job. The file is removed if
+ * the job doesn't finish successfully
+ * @param job A RSBatchJob
+ */
+extern void rs_batch_job_reserve_output(RSBatchJob *job);
+
+/**
+ * Free a RSBatchJob
+ * @param job A RSBatchJob
+ */
+extern void rs_batch_job_free(RSBatchJob *job);
+
+/**
+ * Start a new batch engine. Photos are loaded, developed and encoded by
+ * separate threads, allowing several photos to be in flight at once
+ * @param output An RSOutput, every concurrent export will get a copy of this
+ * @param concurrency The number of photos to develop at once, 0 or less to choose automatically
+ * @param memory_limit Don't load more photos when this many megabytes are estimated to be in use, 0 or less for default
+ * @param preview_size If above 0, a preview of this size will be rendered for each photo
+ * @return A new RSBatchEngine
+ */
+extern RSBatchEngine *rs_batch_engine_new(RSOutput *output, gint concurrency, gint memory_limit, gint preview_size);
+
+/**
+ * Get the number of photos developed at once
+ * @param engine A RSBatchEngine
+ * @return The number of concurrent photos
+ */
+extern gint rs_batch_engine_get_concurrency(RSBatchEngine *engine);
+
+/**
+ * Queue a job, the engine takes ownership of the job until it's returned
+ * by rs_batch_engine_pop_finished()
+ * @param engine A RSBatchEngine
+ * @param job A RSBatchJob
+ */
+extern void rs_batch_engine_push(RSBatchEngine *engine, RSBatchJob *job);
+
+/**
+ * Get a finished job, jobs are not necessarily finished in the order they were queued
+ * @param engine A RSBatchEngine
+ * @param timeout Time to wait in microseconds, or -1 to wait forever
+ * @return A finished RSBatchJob or NULL if none finished within timeout
+ */
+extern RSBatchJob *rs_batch_engine_pop_finished(RSBatchEngine *engine, gint64 timeout);
+
+/**
+ * Cancel all jobs not yet started, they will be returned with RS_BATCH_JOB_CANCELLED status
+ * @param engine A RSBatchEngine
+ */
+extern void rs_batch_engine_cancel(RSBatchEngine *engine);
+
+/**
+ * Get statistics from a running engine
+ * @param engine A RSBatchEngine
+ * @param stats A RSBatchEngineStats to fill
+ */
+extern void rs_batch_engine_get_stats(RSBatchEngine *engine, RSBatchEngineStats *stats);
+
+/**
+ * Get the throughput of an engine
+ * @param stats Statistics from rs_batch_engine_get_stats()
+ * @return The number of finished photos per minute
+ */
+extern gdouble rs_batch_engine_stats_get_rate(const RSBatchEngineStats *stats);
+
+/**
+ * Wait for all queued jobs to finish, then stop and free the engine. Jobs
+ * not popped by rs_batch_engine_pop_finished() will be freed
+ * @param engine A RSBatchEngine
+ */
+extern void rs_batch_engine_free(RSBatchEngine *engine);
+
+#endif /* RS_BATCH_ENGINE_H */
@@ -35,6 +35,7 @@
 #include "rs-photo.h"
 #include "rs-actions.h"
 #include "rs-store.h"
+#include "rs-batch-engine.h"
 
 extern GtkWindow *rawstudio_window;
 
@@ -371,47 +372,99 @@ cancel_clicked(GtkButton *button, gpointer user_data)
 	return;
 }
 
+typedef struct {
+	gchar *filename;
+	gint setting_id;
+	GtkTreeRowReference *row;
+} BATCH_ENTRY;
+
+/* Build a job for the batch engine, returns NULL on error */
+static RSBatchJob *
+batch_job_new(RS_QUEUE *queue, BATCH_ENTRY *entry)
+{
+	RSBatchJob *job;
+	GString *filename;
+	gchar *parsed_filename, *parsed_dir;
+
+	/* Build new filename */
+	if (NULL == g_strrstr(queue->filename, "%p"))
+	{
+		filename = g_string_new(queue->directory);
+		g_string_append(filename, G_DIR_SEPARATOR_S);
+		g_string_append(filename, queue->filename);
+	} 
+	else
+		filename = g_string_new(queue->filename);
+
+	g_string_append(filename, ".");
+	g_string_append(filename, rs_output_get_extension(queue->output));
+	parsed_filename = filename_parse(filename->str, entry->filename, entry->setting_id, TRUE);
+	g_string_free(filename, TRUE);
+
+	/* Create directory, if it doesn't exist */
+	parsed_dir = g_path_get_dirname(parsed_filename);
+	if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
+		if (g_mkdir_with_parents(parsed_dir, 0x1ff))
+		{
+			g_free(parsed_dir);
+			g_free(parsed_filename);
+			return NULL;
+		}
+	g_free(parsed_dir);
+
+	job = rs_batch_job_new(entry->filename, entry->setting_id, parsed_filename);
+	rs_batch_job_reserve_output(job);
+	g_free(parsed_filename);
+
+	/* Calculate new size */
+	switch (queue->size_lock)
+	{
+		case LOCK_SCALE:
+			job->scale = queue->scale/100.0;
+			break;
+		case LOCK_WIDTH:
+			job->width = queue->width;
+			break;
+		case LOCK_HEIGHT:
+			job->height = queue->height;
+			break;
+		case LOCK_BOUNDING_BOX:
+			job->width = queue->width;
+			job->height = queue->height;
+			break;
+	}
+	job->user_data = entry->row;
+
+	return job;
+}
+
 void
 rs_batch_process(RS_QUEUE *queue)
 {
-	RS_PHOTO *photo = NULL;
 	GtkTreeIter iter;
-	gchar *filename_in;
-	gint setting_id;
+	GtkTreePath *path;
 	GtkWidget *preview = gtk_image_new();
-	GdkPixbuf *pixbuf = NULL;
-	gint width = -1, height = -1;
-	gdouble scale = -1.0;
-	gchar *parsed_filename, *basename, *parsed_dir;
-	GString *filename;
+	gchar *basename;
 	GString *status = g_string_new(NULL);
 	GtkWidget *window;
 	GtkWidget *label = gtk_label_new(NULL);
 	GtkWidget *vbox = gtk_vbox_new(FALSE, 4);
 	GtkWidget *cancel;
 	gboolean abort_render = FALSE;
-	GTimeVal start_time;
-	GTimeVal now_time = {0,0};
-	gint time, eta;
+	gboolean cancelled = FALSE;
+	gboolean failed = FALSE;
+	gboolean exported = TRUE;
+	gint eta;
 	GtkWidget *eta_label = gtk_label_new(NULL);
 	gchar *eta_text, *title_text;
 	gint h = 0, m = 0, s = 0;
-	gint done = 0, left = 0;
-	RSFilter *finput = rs_filter_new("RSInputImage16", NULL);
-	RSFilter *fdemosaic = rs_filter_new("RSDemosaic", finput);
-	RSFilter *ffujirotate = rs_filter_new("RSFujiRotate", fdemosaic);
-	RSFilter *flensfun = rs_filter_new("RSLensfun", ffujirotate);
-	RSFilter *frotate = rs_filter_new("RSRotate", flensfun);
-	RSFilter *fcrop = rs_filter_new("RSCrop", frotate);
-	RSFilter *ftransform_input = rs_filter_new("RSColorspaceTransform", fcrop);
-	RSFilter *fdcp= rs_filter_new("RSDcp", ftransform_input);
-	RSFilter *fcache = rs_filter_new("RSCache", fdcp);
-	RSFilter *fresample= rs_filter_new("RSResample", fcache);
-	RSFilter *fdenoise= rs_filter_new("RSDenoise", fresample);
-	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fdenoise);
-	RSFilter *fend = ftransform_display;
-	RSFilterResponse *filter_response;
-	RSColorSpace *display_color_space;
+	gint done = 0, in_flight = 0;
+	gint concurrency = 0, memory_limit = 0;
+	GList *entries, *node;
+	BATCH_ENTRY *entry;
+	RSBatchEngine *engine;
+	RSBatchEngineStats stats;
+	RSBatchJob *job;
 
 	gdk_threads_enter();
 	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -435,200 +488,153 @@ rs_batch_process(RS_QUEUE *queue)
 	gtk_widget_show_all(window);
 	while (gtk_events_pending()) gtk_main_iteration();
 
-	display_color_space = rs_get_display_profile(GTK_WIDGET(window));
 	g_mkdir_with_parents(queue->directory, 00755);
 
-	g_get_current_time(&start_time);
+	rs_conf_get_integer(CONF_BATCH_CONCURRENCY, &concurrency);
+	rs_conf_get_integer(CONF_BATCH_MEMORY_LIMIT, &memory_limit);
+	rs_output_set_from_conf(queue->output, "batch");
+	g_assert(RS_IS_OUTPUT(queue->output));
 
-	while(gtk_tree_model_get_iter_first(queue->list, &iter) && (!abort_render))
+	engine = rs_batch_engine_new(queue->output, concurrency, memory_limit, 250);
+
+	/* Feed the engine with everything in the queue. We loop, to catch
+	 * photos added to the queue while processing */
+	while (!abort_render && !failed && gtk_tree_model_get_iter_first(queue->list, &iter))
 	{
-		left = rs_batch_num_entries(queue);
-		if (done > 0 && now_time.tv_sec > 0)
-		{
-			time = (gint) (now_time.tv_sec-start_time.tv_sec);
-			eta = (time/done)*left;
-			h = (eta/3600);
-			eta %= 3600;
-			m = (eta/60);
-			eta %= 60;
-			s = eta;
-
-			eta_text = g_strdup_printf(_("Time left: %dh %dm %ds"), h, m, s);
-			title_text = g_strdup_printf(_("Processing Image %d/%d"), done+1, done+left);
-		}
-		else
-		{
-			eta_text = g_strdup(_("Time left: ..."));
-			title_text = g_strdup_printf(_("Processing Image 1/%d."), left);
-		}
+		entries = NULL;
+		do {
+			entry = g_new(BATCH_ENTRY, 1);
+			gtk_tree_model_get(queue->list, &iter,
+				RS_QUEUE_ELEMENT_FILENAME, &entry->filename,
+				RS_QUEUE_ELEMENT_SETTING_ID, &entry->setting_id,
+				-1);
+			path = gtk_tree_model_get_path(queue->list, &iter);
+			entry->row = gtk_tree_row_reference_new(queue->list, path);
+			gtk_tree_path_free(path);
+			entries = g_list_append(entries, entry);
+		} while (gtk_tree_model_iter_next(queue->list, &iter));
 
-		gtk_window_set_title(GTK_WINDOW(window), title_text);
-		gtk_label_set_text(GTK_LABEL(eta_label), eta_text);
-		g_free(eta_text);
-		g_free(title_text);
-		done++;
-
-		gtk_tree_model_get(queue->list, &iter,
-			RS_QUEUE_ELEMENT_FILENAME, &filename_in,
-			RS_QUEUE_ELEMENT_SETTING_ID, &setting_id,
-			-1);
-		basename = g_path_get_basename(filename_in);
-		g_string_printf(status, _("Loading %s ..."), basename);
+		g_string_printf(status, _("Processing %d photos ..."), g_list_length(entries));
 		gtk_label_set_text(GTK_LABEL(label), status->str);
-		while (gtk_events_pending()) gtk_main_iteration();
-		g_free(basename);
-
 		gdk_threads_leave();
-		photo = rs_photo_load_from_file(filename_in);
-		if (photo)
-		{
-			rs_metadata_load_from_file(photo->metadata, filename_in);
-			rs_cache_load(photo);
 
-			/* Build new filename */
-			if (NULL == g_strrstr(queue->filename, "%p"))
+		for(node = entries; node; node = g_list_next(node))
+		{
+			entry = node->data;
+			if (!failed && (job = batch_job_new(queue, entry)))
 			{
-				filename = g_string_new(queue->directory);
-				g_string_append(filename, G_DIR_SEPARATOR_S);
-				g_string_append(filename, queue->filename);
-			} 
+				rs_batch_engine_push(engine, job);
+				in_flight++;
+			}
 			else
-				filename = g_string_new(queue->filename);
-			
-			g_string_append(filename, ".");
-			g_string_append(filename, rs_output_get_extension(queue->output));
-			parsed_filename = filename_parse(filename->str, filename_in, setting_id, TRUE);
-			
-			/* Create directory, if it doesn't exist */
-			parsed_dir = g_path_get_dirname(parsed_filename);
-			if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
-				if (g_mkdir_with_parents(parsed_dir, 0x1ff))
+			{
+				if (!failed)
 				{
 					gdk_threads_enter();
 					gui_status_notify(_("Could not create output directory."));
-					break;
+					gdk_threads_leave();
 				}
+				failed = TRUE;
+				gtk_tree_row_reference_free(entry->row);
+			}
+			g_free(entry->filename);
+			g_free(entry);
+		}
+		g_list_free(entries);
 
-			GList *filters = g_list_append(NULL, fend);
-			rs_photo_apply_to_filters(photo, filters, setting_id);
-			g_list_free(filters);
-
-			rs_filter_set_recursive(fend,
-				"image", photo->input_response,
-				"filename", photo->filename,
-				"bounding-box", TRUE,
-				"width", 250,
-				"height", 250,
-				NULL);
-
-			/* Render preview image */
-			RSFilterRequest *request = rs_filter_request_new();
-			rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
-			/* FIXME: Should be set to output colorspace, not forced to sRGB */
-
-			rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", display_color_space);	
-			filter_response = rs_filter_get_image8(fend, request);
-			pixbuf = rs_filter_response_get_image8(filter_response);
-			gdk_threads_enter();
-			if (pixbuf)
+		gdk_threads_enter();
+		while (in_flight > 0)
+		{
+			rs_batch_engine_get_stats(engine, &stats);
+			if (done > 0)
 			{
-				gtk_image_set_from_pixbuf(GTK_IMAGE(preview), pixbuf);
-				g_object_unref(pixbuf);
+				eta = (gint) (stats.elapsed/1000000/done*in_flight);
+				h = (eta/3600);
+				eta %= 3600;
+				m = (eta/60);
+				eta %= 60;
+				s = eta;
+
+				eta_text = g_strdup_printf(_("Time left: %dh %dm %ds (%.1f images/minute)"), h, m, s, rs_batch_engine_stats_get_rate(&stats));
+				title_text = g_strdup_printf(_("Processing Image %d/%d"), done+1, done+in_flight);
 			}
-			g_object_unref(request);
-			g_object_unref(filter_response);
-
-			if (left > 1)
+			else
 			{
-				GtkTreeIter iter2 = iter;
-				if (gtk_tree_model_iter_next (queue->list, &iter2))
-				{
-					gtk_tree_model_get(queue->list, &iter2, RS_QUEUE_ELEMENT_FILENAME, &filename_in, -1);
-					rs_io_idle_prefetch_file(filename_in, 0xC01A);
-				}
+				eta_text = g_strdup(_("Time left: ..."));
+				title_text = g_strdup_printf(_("Processing Image 1/%d."), in_flight);
 			}
-			/* Build text for small preview-window */
-			basename = g_path_get_basename(parsed_filename);
-			g_string_printf(status, _("Saving %s ..."), basename);
-			gtk_label_set_text(GTK_LABEL(label), status->str);
-			while (gtk_events_pending())
-				gtk_main_iteration();
-			g_free(basename);
-			gdk_threads_leave();
+			gtk_window_set_title(GTK_WINDOW(window), title_text);
+			gtk_label_set_text(GTK_LABEL(eta_label), eta_text);
+			g_free(eta_text);
+			g_free(title_text);
 
-			width = 65535;
-			height = 65535;
-			/* Calculate new size */
-			switch (queue->size_lock)
+			while (gtk_events_pending()) gtk_main_iteration();
+			if (abort_render && !cancelled)
 			{
-				case LOCK_SCALE:
-					scale = queue->scale/100.0;
-					rs_filter_get_size_simple(fcrop, RS_FILTER_REQUEST_QUICK, &width, &height);
-					width = (gint) (((gdouble) width) * scale);
-					height = (gint) (((gdouble) height) * scale);
-					break;
-				case LOCK_WIDTH:
-					width = queue->width;
-					break;
-				case LOCK_HEIGHT:
-					height = queue->height;
-					break;
-				case LOCK_BOUNDING_BOX:
-					width = queue->width;
-					height = queue->height;
-					break;
+				rs_batch_engine_cancel(engine);
+				cancelled = TRUE;
 			}
-			rs_filter_set_recursive(fend,
-				"width", width,
-				"height", height,
-				NULL);
-
-			/* Save the image */
-			if (g_object_class_find_property(G_OBJECT_GET_CLASS(queue->output), "filename"))
-				g_object_set(queue->output, "filename", parsed_filename, NULL);
 
-			rs_output_set_from_conf(queue->output, "batch");
+			gdk_threads_leave();
+			job = rs_batch_engine_pop_finished(engine, 100000);
+			gdk_threads_enter();
 
-			g_assert(RS_IS_OUTPUT(queue->output));
-			g_assert(RS_IS_FILTER(fend));
+			if (!job)
+				continue;
+			in_flight--;
 
-			gboolean exported = rs_output_execute(queue->output, fend);
-			gdk_threads_enter();
-			if (exported)
-				rs_store_set_flags(NULL, photo->filename, NULL, NULL, &exported, NULL);
-			else
+			path = gtk_tree_row_reference_get_path(job->user_data);
+			switch (job->status)
 			{
-				gui_status_notify(_("Could not export photo."));
-				break;
+				case RS_BATCH_JOB_DONE:
+					done++;
+					rs_store_set_flags(NULL, job->input, NULL, NULL, &exported, NULL);
+					if (job->preview)
+						gtk_image_set_from_pixbuf(GTK_IMAGE(preview), job->preview);
+
+					/* Build text for small preview-window */
+					basename = g_path_get_basename(job->output);
+					g_string_printf(status, _("Saved %s"), basename);
+					gtk_label_set_text(GTK_LABEL(label), status->str);
+					g_free(basename);
+					/* Fall through, the photo is done either way */
+				case RS_BATCH_JOB_LOAD_FAILED:
+					if (path && gtk_tree_model_get_iter(queue->list, &iter, path))
+					{
+						gtk_list_store_remove(GTK_LIST_STORE(queue->list), &iter);
+						batch_queue_save(queue);
+					}
+					break;
+				case RS_BATCH_JOB_EXPORT_FAILED:
+					if (!failed)
+						gui_status_notify(_("Could not export photo."));
+					failed = TRUE;
+					rs_batch_engine_cancel(engine);
+					break;
+				default:
+					break;
 			}
-
-			g_free(parsed_filename);
-			g_string_free(filename, TRUE);
-			g_object_unref(photo);
-			photo = NULL;
+			if (path)
+				gtk_tree_path_free(path);
+			gtk_tree_row_reference_free(job->user_data);
+			rs_batch_job_free(job);
 		}
-		gtk_list_store_remove(GTK_LIST_STORE(queue->list), &iter);
-		batch_queue_save(queue);
+	}
 
-		g_get_current_time(&now_time);
+	rs_batch_engine_get_stats(engine, &stats);
+	if (stats.done > 0)
+	{
+		g_string_printf(status, _("Exported %u photos, %.1f images/minute"), stats.done, rs_batch_engine_stats_get_rate(&stats));
+		gui_status_notify(status->str);
 	}
+	g_string_free(status, TRUE);
+
 	gtk_widget_destroy(window);
 
 	batch_queue_update_sensivity(queue);
 	gdk_threads_leave();
 
-	g_object_unref(finput);
-	g_object_unref(fdemosaic);
-	g_object_unref(ffujirotate);
-	g_object_unref(flensfun);
-	g_object_unref(frotate);
-	g_object_unref(fcrop);
-	g_object_unref(fcache);
-	g_object_unref(fresample);
-	g_object_unref(fdcp);
-	g_object_unref(fdenoise);
-	g_object_unref(ftransform_input);
-	g_object_unref(ftransform_display);
+	rs_batch_engine_free(engine);
 }
 
 static void
@@ -25,7 +25,9 @@
 #include "rs-cache.h"
 #include "rs-photo.h"
 #include "gettext.h"
+#ifndef RAWSTUDIO_CLI
 #include "gtk-interface.h"
+#endif
 
 /* This will be written to XML files for making backward compatibility easier to implement */
 #define CACHEVERSION 5
@@ -55,7 +57,11 @@ rs_cache_get_name(const gchar *src)
 static void
 notity_save_failed()
 {
+#ifdef RAWSTUDIO_CLI
+	g_warning("Failed to save image settings! Check you have sufficient rights, and free space on your device.");
+#else
 	gui_status_error(_("WARNING: Failed to save image settings! Check you have sufficient rights, and free space on your device."));
+#endif
 }
 
 void
@@ -23,7 +23,9 @@
 #include <libxml/xmlwriter.h>
 #include "rs-camera-db.h"
 #include "rs-photo.h"
+#ifndef RAWSTUDIO_CLI
 #include "rs-toolbox.h"
+#endif
 #include "rs-cache.h"
 
 /* FIXME: Make this thread safe! */
@@ -412,6 +414,7 @@ save_db(RSCameraDb *camera_db)
 	return;
 }
 
+#ifndef RAWSTUDIO_CLI
 static void
 icon_func(GtkTreeViewColumn *tree_column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
 {
@@ -477,3 +480,4 @@ rs_camera_db_editor_new(RSCameraDb *camera_db)
 
 	return dialog;
 }
+#endif /* RAWSTUDIO_CLI */
@@ -0,0 +1,296 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <config.h>
+#include "application.h"
+#include "conf_interface.h"
+#include "filename.h"
+#include "rs-batch-engine.h"
+
+/*
+ * rawstudio-cli exports photos without ever touching the display. It uses the
+ * same filter chain and outputs as the batch queue, and can be used from
+ * scripts or build servers with no X server available. Only the batch engine
+ * and the sources it needs are built into it, GTK is never initialized.
+ */
+
+/* Find an output by extension ("jpg") or identifier ("RSJpegfile") */
+static RSOutput *
+output_from_format(const gchar *format)
+{
+	RSOutput *output = NULL;
+	GType *types;
+	guint num_types, i;
+
+	if (g_type_from_name(format) && g_type_is_a(g_type_from_name(format), RS_TYPE_OUTPUT))
+		return rs_output_new(format);
+
+	types = g_type_children(RS_TYPE_OUTPUT, &num_types);
+	for(i = 0; i < num_types && !output; i++)
+	{
+		RSOutput *candidate = rs_output_new(g_type_name(types[i]));
+		const gchar *extension = rs_output_get_extension(candidate);
+
+		if (extension && g_ascii_strcasecmp(extension, format) == 0)
+			output = candidate;
+		else
+			g_object_unref(candidate);
+	}
+	g_free(types);
+
+	/* "jpeg" and "tiff" for convenience */
+	if (!output && g_ascii_strcasecmp(format, "jpeg") == 0)
+		output = output_from_format("jpg");
+	if (!output && g_ascii_strcasecmp(format, "tiff") == 0)
+		output = output_from_format("tif");
+
+	return output;
+}
+
+/* Set a property of an output from a "name=value" string */
+static gboolean
+output_set_option(RSOutput *output, const gchar *option)
+{
+	gchar **pair = g_strsplit(option, "=", 2);
+	GParamSpec *spec = NULL;
+	gboolean ret = TRUE;
+
+	if (pair[0] && pair[1])
+		spec = g_object_class_find_property(G_OBJECT_GET_CLASS(output), pair[0]);
+
+	if (!spec || !(spec->flags & G_PARAM_WRITABLE))
+		ret = FALSE;
+	else if (spec->value_type == G_TYPE_INT)
+		g_object_set(output, pair[0], atoi(pair[1]), NULL);
+	else if (spec->value_type == G_TYPE_UINT)
+		g_object_set(output, pair[0], (guint) atoi(pair[1]), NULL);
+	else if (spec->value_type == G_TYPE_DOUBLE)
+		g_object_set(output, pair[0], g_ascii_strtod(pair[1], NULL), NULL);
+	else if (spec->value_type == G_TYPE_FLOAT)
+		g_object_set(output, pair[0], (gfloat) g_ascii_strtod(pair[1], NULL), NULL);
+	else if (spec->value_type == G_TYPE_BOOLEAN)
+		g_object_set(output, pair[0], (g_ascii_strcasecmp(pair[1], "true") == 0 || atoi(pair[1]) != 0), NULL);
+	else if (spec->value_type == G_TYPE_STRING)
+		g_object_set(output, pair[0], pair[1], NULL);
+	else if (g_type_is_a(spec->value_type, RS_TYPE_COLOR_SPACE))
+	{
+		RSColorSpace *colorspace = rs_color_space_new_singleton(pair[1]);
+		if (colorspace)
+			g_object_set(output, pair[0], colorspace, NULL);
+		else
+			ret = FALSE;
+	}
+	else
+		ret = FALSE;
+
+	g_strfreev(pair);
+
+	return ret;
+}
+
+static const gchar *
+status_text(RSBatchJobStatus status)
+{
+	switch (status)
+	{
+		case RS_BATCH_JOB_DONE:
+			return "ok";
+		case RS_BATCH_JOB_LOAD_FAILED:
+			return "load failed";
+		case RS_BATCH_JOB_EXPORT_FAILED:
+			return "export failed";
+		case RS_BATCH_JOB_CANCELLED:
+			return "cancelled";
+		default:
+			return "unknown";
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	gchar *format = "jpg";
+	gchar *directory = ".";
+	gchar *template = NULL;
+	gchar *snapshot = "A";
+	gchar **options = NULL;
+	gchar **inputs = NULL;
+	gchar *debug = NULL;
+	gint width = 0, height = 0;
+	gdouble scale = 0.0;
+	gint concurrency = 0, memory_limit = 0, threads = 0, pool_limit = 0;
+	gboolean use_conf = FALSE;
+	gboolean quiet = FALSE;
+	gint setting_id, i, num_inputs, num_jobs = 0, failed = 0;
+	GError *error = NULL;
+	GOptionContext *option_context;
+	RSOutput *output;
+	RSBatchEngine *engine;
+	RSBatchEngineStats stats;
+	RSImagePoolStats pool_stats;
+	RSBatchJob *job;
+
+	const GOptionEntry option_entries[] = {
+		{ "format", 'f', 0, G_OPTION_ARG_STRING, &format, "Output format, an extension like jpg, png or tif (default: jpg)", "format" },
+		{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &directory, "Directory to save to (default: .)", "directory" },
+		{ "filename", 'n', 0, G_OPTION_ARG_STRING, &template, "Filename template as used by the batch queue, without extension", "template" },
+		{ "snapshot", 's', 0, G_OPTION_ARG_STRING, &snapshot, "Snapshot to export, A, B or C (default: A)", "snapshot" },
+		{ "width", 'W', 0, G_OPTION_ARG_INT, &width, "Maximum width of output", "pixels" },
+		{ "height", 'H', 0, G_OPTION_ARG_INT, &height, "Maximum height of output", "pixels" },
+		{ "scale", 'S', 0, G_OPTION_ARG_DOUBLE, &scale, "Scale output by this percentage", "percent" },
+		{ "set", 'O', 0, G_OPTION_ARG_STRING_ARRAY, &options, "Set an output option, like quality=90", "name=value" },
+		{ "use-conf", 0, 0, G_OPTION_ARG_NONE, &use_conf, "Start from the output options saved by the batch queue", NULL },
+		{ "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "Number of photos to process at once", "count" },
+		{ "memory-limit", 'm', 0, G_OPTION_ARG_INT, &memory_limit, "Approximate memory limit in megabytes", "megabytes" },
+		{ "threads", 'j', 0, G_OPTION_ARG_INT, &threads, "Number of worker threads to use for processing", "count" },
+		{ "debug", 'd', 0, G_OPTION_ARG_STRING, &debug, "Debug flags to use", "flags" },
+		{ "quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet, "Only print errors", NULL },
+		{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs, NULL, "FILE..." },
+		{ NULL }
+	};
+
+	option_context = g_option_context_new("FILE... - export photos without a display");
+	g_option_context_add_main_entries(option_context, option_entries, NULL);
+	if (!g_option_context_parse(option_context, &argc, &argv, &error))
+	{
+		g_printerr("option parsing failed: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(option_context);
+
+	if (!inputs || !inputs[0])
+	{
+		g_printerr("No input files given, see --help\n");
+		return 1;
+	}
+
+	setting_id = g_ascii_toupper(snapshot[0]) - 'A';
+	if (setting_id < 0 || setting_id > 2)
+	{
+		g_printerr("Unknown snapshot: %s\n", snapshot);
+		return 1;
+	}
+
+	if (debug)
+		rs_debug_setup(debug);
+
+#if ! GLIB_CHECK_VERSION(2,36,0)
+	/* Make sure the GType system is initialized */
+	g_type_init();
+#endif
+
+	/* Everything Rawstudio needs to load and develop photos, but no GTK */
+	rs_filetype_init();
+	if (threads > 0 || rs_conf_get_integer(CONF_WORKER_THREADS, &threads))
+		rs_thread_pool_set_num_threads(threads);
+	if (rs_conf_get_integer(CONF_IMAGE_POOL_LIMIT, &pool_limit))
+		rs_image16_pool_set_limit(((gsize) MAX(0, pool_limit)) * 1024 * 1024);
+	rs_plugin_manager_load_all_plugins();
+	rs_lens_fix_init();
+
+	output = output_from_format(format);
+	if (!output)
+	{
+		g_printerr("Unknown output format: %s\n", format);
+		return 1;
+	}
+	if (use_conf)
+		rs_output_set_from_conf(output, "batch");
+	for(i = 0; options && options[i]; i++)
+		if (!output_set_option(output, options[i]))
+		{
+			g_printerr("Cannot set output option: %s\n", options[i]);
+			return 1;
+		}
+
+	if (!template)
+		template = rs_conf_get_string(CONF_BATCH_FILENAME);
+	if (!template)
+		template = DEFAULT_CONF_BATCH_FILENAME;
+	g_mkdir_with_parents(directory, 00755);
+
+	engine = rs_batch_engine_new(output, concurrency, memory_limit, 0);
+
+	for(num_inputs = 0; inputs[num_inputs]; num_inputs++)
+	{
+		gchar *name = g_strconcat(template, ".", rs_output_get_extension(output), NULL);
+		gchar *path = g_build_filename(directory, name, NULL);
+		gchar *parsed = filename_parse(path, inputs[num_inputs], setting_id, TRUE);
+
+		if (!parsed)
+		{
+			failed++;
+			g_printerr("%s: cannot make an output filename from %s\n", inputs[num_inputs], path);
+		}
+		else
+		{
+			job = rs_batch_job_new(inputs[num_inputs], setting_id, parsed);
+			rs_batch_job_reserve_output(job);
+			if (scale > 0.0)
+				job->scale = scale/100.0;
+			if (width > 0)
+				job->width = width;
+			if (height > 0)
+				job->height = height;
+			rs_batch_engine_push(engine, job);
+			num_jobs++;
+		}
+
+		g_free(parsed);
+		g_free(path);
+		g_free(name);
+	}
+
+	for(i = 0; i < num_jobs; i++)
+	{
+		job = rs_batch_engine_pop_finished(engine, -1);
+		if (job->status != RS_BATCH_JOB_DONE)
+		{
+			failed++;
+			g_printerr("%s: %s\n", job->input, status_text(job->status));
+		}
+		else if (!quiet)
+			g_print("%s -> %s (load %.03fs, develop %.03fs, encode %.03fs)\n", job->input, job->output,
+				job->load_time/1000000.0, job->develop_time/1000000.0, job->encode_time/1000000.0);
+		rs_batch_job_free(job);
+	}
+
+	rs_batch_engine_get_stats(engine, &stats);
+	if (!quiet)
+	{
+		g_print("Exported %u of %d photos in %.03fs, %.1f images/minute, %d concurrent\n",
+			stats.done, num_inputs, stats.elapsed/1000000.0, rs_batch_engine_stats_get_rate(&stats),
+			rs_batch_engine_get_concurrency(engine));
+		g_print("Total stage time: load %.03fs, develop %.03fs, encode %.03fs, peak memory %" G_GSIZE_FORMAT " MB\n",
+			stats.load_time/1000000.0, stats.develop_time/1000000.0, stats.encode_time/1000000.0,
+			stats.memory_peak/(1024*1024));
+		rs_image16_pool_get_stats(&pool_stats);
+		g_print("Image buffers: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " reused, %" G_GUINT64_FORMAT " evicted\n",
+			pool_stats.reused, pool_stats.allocations, pool_stats.evicted);
+	}
+
+	rs_batch_engine_free(engine);
+	g_object_unref(output);
+	rs_io_print_lock_stats();
+
+	return (failed > 0) ? 2 : 0;
+}
@@ -251,14 +251,16 @@ redraw(RSLoupe *loupe)
 	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", loupe->display_color_space);
 
 	gdk_threads_leave();
-	RSFilterResponse *response = rs_filter_get_image8(loupe->filter, request);
+	RSFilterResponse *response = rs_filter_get_image8_roi(loupe->filter, request);
 	gdk_threads_enter();
 	GdkPixbuf *buffer = rs_filter_response_get_image8(response);
+	gint x, y;
+	rs_filter_response_get_origin(response, &x, &y);
 	g_object_unref(response);
 
 	g_object_unref(request);
 
-	gdk_cairo_set_source_pixbuf(cr, buffer, -roi.x, -roi.y);
+	gdk_cairo_set_source_pixbuf(cr, buffer, x - roi.x, y - roi.y);
 	cairo_paint(cr);
 
 	/* Draw border */
@@ -0,0 +1,339 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include <glib/gstdio.h>
+#include "config.h"
+#include "rs-preload.h"
+#include "rs-cache.h"
+#include "rs-photo.h"
+
+/*
+ * Photos next to the one being viewed are loaded completely - raw data,
+ * metadata and settings - by the io-system, and kept here until they're
+ * opened. Loaded photos are kept in least recently used order, and the
+ * oldest are dropped when they use more than the memory limit.
+ *
+ * A preloaded photo is only handed out if neither the photo nor its
+ * settings cache has changed on disk since it was loaded. Modification
+ * times are compared with nanosecond precision along with the size, a
+ * file rewritten within the same second is still noticed.
+ */
+
+#define DEFAULT_LIMIT (256*1024*1024)
+
+typedef struct {
+	gint64 mtime;             /* In nanoseconds */
+	gint64 size;              /* -1 if the file doesn't exist */
+} FileStamp;
+
+typedef struct {
+	gchar *filename;
+	RS_PHOTO *photo;          /* NULL while loading */
+	gsize memory;
+	FileStamp photo_stamp;    /* As they were before loading */
+	FileStamp cache_stamp;
+} PreloadEntry;
+
+static GMutex lock;
+static GCond loaded_cond;
+static GHashTable *entries = NULL; /* filename -> PreloadEntry */
+static GQueue lru = G_QUEUE_INIT;  /* Loaded entries, most recently used first */
+static gsize memory_used = 0;
+static gsize memory_limit = DEFAULT_LIMIT;
+
+typedef struct {
+	RSIoJob parent;
+	gchar *filename;
+} RSIoJobPreload;
+
+typedef RSIoJobClass RSIoJobPreloadClass;
+
+G_DEFINE_TYPE(RSIoJobPreload, rs_io_job_preload, RS_TYPE_IO_JOB)
+
+static void
+get_stamp(const gchar *filename, FileStamp *stamp)
+{
+	struct stat st;
+
+	stamp->mtime = 0;
+	stamp->size = -1;
+
+	if (filename && g_stat(filename, &st) == 0)
+	{
+		stamp->mtime = (gint64) st.st_mtime * G_GINT64_CONSTANT(1000000000);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+		stamp->mtime += st.st_mtim.tv_nsec;
+#endif
+		stamp->size = st.st_size;
+	}
+}
+
+static void
+get_cache_stamp(const gchar *filename, FileStamp *stamp)
+{
+	gchar *cache_filename = rs_cache_get_name(filename);
+
+	get_stamp(cache_filename, stamp);
+	g_free(cache_filename);
+}
+
+static gboolean
+stamp_unchanged(const FileStamp *before, const FileStamp *now)
+{
+	return (before->mtime == now->mtime) && (before->size == now->size);
+}
+
+static gsize
+photo_memory(RS_PHOTO *photo)
+{
+	RS_IMAGE16 *image = rs_filter_response_get_image(photo->input_response);
+	gsize memory = 0;
+
+	if (image)
+	{
+		memory = (gsize) image->rowstride * image->h * sizeof(gushort);
+		g_object_unref(image);
+	}
+
+	return memory;
+}
+
+static void
+entry_free(PreloadEntry *entry)
+{
+	if (entry->photo)
+		g_object_unref(entry->photo);
+	g_free(entry->filename);
+	g_free(entry);
+}
+
+/* Must be called with lock held, entry must be loaded */
+static void
+entry_remove(PreloadEntry *entry)
+{
+	g_queue_remove(&lru, entry);
+	memory_used -= entry->memory;
+	g_hash_table_remove(entries, entry->filename);
+}
+
+/* Must be called with lock held. Keeps at least one photo, whatever its size */
+static void
+evict(void)
+{
+	while (memory_used > memory_limit && g_queue_get_length(&lru) > 1)
+	{
+		PreloadEntry *entry = g_queue_peek_tail(&lru);
+		RS_DEBUG(PERFORMANCE, "Preload: dropping %s", entry->filename);
+		entry_remove(entry);
+		entry_free(entry);
+	}
+}
+
+static void
+execute(RSIoJob *job)
+{
+	RSIoJobPreload *preload = (RSIoJobPreload *) job;
+	PreloadEntry *entry;
+	RS_PHOTO *photo;
+	gint64 start;
+
+	g_mutex_lock(&lock);
+	entry = g_hash_table_lookup(entries, preload->filename);
+	if (entry)
+	{
+		/* Already here or on the way, just mark it as used */
+		if (entry->photo)
+		{
+			g_queue_remove(&lru, entry);
+			g_queue_push_head(&lru, entry);
+		}
+		g_mutex_unlock(&lock);
+		return;
+	}
+
+	entry = g_new0(PreloadEntry, 1);
+	entry->filename = g_strdup(preload->filename);
+	g_hash_table_insert(entries, entry->filename, entry);
+	g_mutex_unlock(&lock);
+
+	get_stamp(preload->filename, &entry->photo_stamp);
+	get_cache_stamp(preload->filename, &entry->cache_stamp);
+
+	start = g_get_monotonic_time();
+	photo = rs_photo_load_from_file(preload->filename);
+
+	g_mutex_lock(&lock);
+	if (g_hash_table_lookup(entries, preload->filename) != entry)
+	{
+		/* Cleared while we were loading */
+		if (photo)
+			g_object_unref(photo);
+		entry_free(entry);
+	}
+	else if (!photo)
+	{
+		g_hash_table_remove(entries, entry->filename);
+		entry_free(entry);
+	}
+	else
+	{
+		RS_DEBUG(PERFORMANCE, "Preload: %s loaded in %.03fs", preload->filename, (g_get_monotonic_time() - start) / 1000000.0);
+		entry->photo = photo;
+		entry->memory = photo_memory(photo);
+		memory_used += entry->memory;
+		g_queue_push_head(&lru, entry);
+		evict();
+	}
+	g_cond_broadcast(&loaded_cond);
+	g_mutex_unlock(&lock);
+}
+
+static void
+rs_io_job_preload_finalize(GObject *object)
+{
+	RSIoJobPreload *preload = (RSIoJobPreload *) object;
+
+	g_free(preload->filename);
+
+	G_OBJECT_CLASS(rs_io_job_preload_parent_class)->finalize(object);
+}
+
+static void
+rs_io_job_preload_class_init(RSIoJobPreloadClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->finalize = rs_io_job_preload_finalize;
+	klass->execute = execute;
+}
+
+static void
+rs_io_job_preload_init(RSIoJobPreload *preload)
+{
+}
+
+static void
+init(void)
+{
+	if (!entries)
+		entries = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+void
+rs_preload_set_limit(gsize limit)
+{
+	g_mutex_lock(&lock);
+	memory_limit = limit;
+	init();
+	evict();
+	g_mutex_unlock(&lock);
+}
+
+void
+rs_preload_photo(const gchar *filename, gint priority)
+{
+	RSIoJobPreload *preload;
+	gboolean known;
+
+	g_return_if_fail(filename != NULL);
+
+	if (memory_limit == 0)
+		return;
+
+	g_mutex_lock(&lock);
+	init();
+	known = (g_hash_table_lookup(entries, filename) != NULL);
+	g_mutex_unlock(&lock);
+
+	if (known)
+		return;
+
+	preload = g_object_new(rs_io_job_preload_get_type(), NULL);
+	preload->filename = g_strdup(filename);
+	rs_io_idle_add_job(RS_IO_JOB(preload), DECODE_AHEAD_CLASS, priority, NULL);
+}
+
+void
+rs_preload_cancel(void)
+{
+	rs_io_idle_cancel_class(DECODE_AHEAD_CLASS);
+}
+
+RS_PHOTO *
+rs_preload_get_photo(const gchar *filename)
+{
+	PreloadEntry *entry;
+	RS_PHOTO *photo = NULL;
+	FileStamp photo_stamp, cache_stamp;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	g_mutex_lock(&lock);
+	init();
+
+	/* If it's being loaded, it will be here sooner than if we start over */
+	while ((entry = g_hash_table_lookup(entries, filename)) && !entry->photo)
+		g_cond_wait(&loaded_cond, &lock);
+
+	if (entry)
+	{
+		entry_remove(entry);
+
+		get_stamp(filename, &photo_stamp);
+		get_cache_stamp(filename, &cache_stamp);
+		if (stamp_unchanged(&entry->photo_stamp, &photo_stamp)
+			&& stamp_unchanged(&entry->cache_stamp, &cache_stamp))
+		{
+			photo = entry->photo;
+			entry->photo = NULL;
+		}
+		entry_free(entry);
+	}
+	g_mutex_unlock(&lock);
+
+	return photo;
+}
+
+void
+rs_preload_clear(void)
+{
+	PreloadEntry *entry;
+	GHashTableIter iter;
+
+	rs_preload_cancel();
+
+	g_mutex_lock(&lock);
+	init();
+
+	while ((entry = g_queue_pop_head(&lru)))
+	{
+		memory_used -= entry->memory;
+		g_hash_table_remove(entries, entry->filename);
+		entry_free(entry);
+	}
+
+	/* Photos still loading are freed by their job, when it finds itself gone */
+	g_hash_table_iter_init(&iter, entries);
+	while (g_hash_table_iter_next(&iter, NULL, NULL))
+		g_hash_table_iter_remove(&iter);
+
+	g_cond_broadcast(&loaded_cond);
+	g_mutex_unlock(&lock);
+}
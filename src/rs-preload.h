@@ -0,0 +1,59 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_PRELOAD_H
+#define RS_PRELOAD_H
+
+#include "application.h"
+
+/* Class used for decode-ahead jobs in the io-system */
+#define DECODE_AHEAD_CLASS (6379121)
+
+/**
+ * Set how much memory decoded photos may use
+ * @param limit The limit in bytes
+ */
+extern void rs_preload_set_limit(gsize limit);
+
+/**
+ * Queue a photo for loading in the background
+ * @param filename The full path to the photo
+ * @param priority The io-system priority, lower values are loaded first
+ */
+extern void rs_preload_photo(const gchar *filename, gint priority);
+
+/**
+ * Cancel all queued loads, photos being loaded will still be kept
+ */
+extern void rs_preload_cancel(void);
+
+/**
+ * Get a photo loaded in the background. If the photo is being loaded, this
+ * will wait for it to finish
+ * @param filename The full path to the photo
+ * @return A RS_PHOTO as returned by rs_photo_load_from_file() or NULL if the photo is not preloaded
+ */
+extern RS_PHOTO *rs_preload_get_photo(const gchar *filename);
+
+/**
+ * Drop all preloaded photos
+ */
+extern void rs_preload_clear(void);
+
+#endif /* RS_PRELOAD_H */
@@ -96,6 +96,21 @@ typedef enum {
 	SPLIT_VERTICAL,
 } VIEW_SPLIT;
 
+typedef struct {
+	RSPreviewWidget *preview;
+	gint view;
+	guint serial;
+	gint generation;
+	RSFilter *filter;
+	RSFilterRequest *request;
+	GdkRectangle roi;
+	gint width;             /* Size of the whole image */
+	gint height;
+	gboolean quick;
+	GCancellable *cancellable;
+	RSFilterResponse *response;
+} RENDER_JOB;
+
 const static gint PADDING = 3;
 const static gint SPLITTER_WIDTH = 4;
 #define MAX_VIEWS 2 /* maximum 32! */
@@ -212,6 +227,27 @@ struct _RSPreviewWidget
 	RSColorSpace *exposure_color_space;
 	GdkDisplay *display;
 	guint status_num;
+
+	/* Background rendering, render_pending, render_running and render_quit
+	 * are protected by render_lock, everything else is only touched from
+	 * the main loop */
+	GThread *render_thread;
+	GMutex render_lock;
+	GCond render_cond;
+	RENDER_JOB *render_pending[MAX_VIEWS];
+	RENDER_JOB *render_running;
+	gboolean render_quit;
+	gint render_generation;
+	gint render_discard_before; /* Results from older generations are never shown */
+	guint render_serial;
+	RENDER_JOB render_requested[MAX_VIEWS]; /* Last job submitted for view, serial 0 if none in flight */
+	GdkPixbuf *display_buffer[MAX_VIEWS];
+	GdkRectangle display_area[MAX_VIEWS]; /* Where display_buffer is placed in the whole image */
+	GdkRectangle display_roi[MAX_VIEWS];
+	gint display_width[MAX_VIEWS];
+	gint display_height[MAX_VIEWS];
+	gint display_generation[MAX_VIEWS];
+	gboolean display_quick[MAX_VIEWS];
 };
 
 /* Define the boiler plate stuff using the predefined macro */
@@ -251,13 +287,49 @@ static CROP_NEAR crop_near(RS_RECT *roi, gint x, gint y);
 static gboolean make_cbdata(RSPreviewWidget *preview, const gint view, RS_PREVIEW_CALLBACK_DATA *cbdata, gint screen_x, gint screen_y, gint real_x, gint real_y);
 static void canvas_draw(RSPreviewWidget *preview, GdkRectangle *rect, gboolean now);
 static void canvas_draw_handler(GtkWidget *widget, cairo_t *cr, RSPreviewWidget *preview);
+static void get_view_placement(RSPreviewWidget *preview, const gint view, const gint width, const gint height, GdkRectangle *placement);
+static void render_invalidate(RSPreviewWidget *preview);
+static void render_cancel(RSPreviewWidget *preview, gboolean wait);
+static void render_job_free(RENDER_JOB *job);
+static void render_submit(RSPreviewWidget *preview, const gint view, GdkRectangle *roi, gint width, gint height, gboolean quick);
 static void photo_spatial_changed(RS_PHOTO *photo, RSPreviewWidget *preview);
+
+/**
+ * Stops the render thread, it must be gone before we are
+ */
+static void
+rs_preview_widget_dispose(GObject *object)
+{
+	RSPreviewWidget *preview = RS_PREVIEW_WIDGET(object);
+
+	if (preview->render_thread)
+	{
+		render_cancel(preview, FALSE);
+
+		g_mutex_lock(&preview->render_lock);
+		preview->render_quit = TRUE;
+		g_cond_broadcast(&preview->render_cond);
+		g_mutex_unlock(&preview->render_lock);
+
+		g_thread_join(preview->render_thread);
+		preview->render_thread = NULL;
+	}
+	else
+		preview->render_quit = TRUE;
+
+	G_OBJECT_CLASS(rs_preview_widget_parent_class)->dispose(object);
+}
+
 /**
  * Class initializer
  */
 static void
 rs_preview_widget_class_init(RSPreviewWidgetClass *klass)
 {
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->dispose = rs_preview_widget_dispose;
+
 	signals[WB_PICKED] = g_signal_new ("wb-picked",
 		G_TYPE_FROM_CLASS (klass),
 		G_SIGNAL_RUN_FIRST | G_SIGNAL_ACTION,
@@ -338,6 +410,14 @@ rs_preview_widget_init(RSPreviewWidget *preview)
 	preview->exposure_mask = FALSE;
 	preview->crop_near = CROP_NEAR_NOTHING;
 	preview->keep_quick_enabled = FALSE;
+	preview->render_thread = NULL;
+	g_mutex_init(&preview->render_lock);
+	g_cond_init(&preview->render_cond);
+	preview->render_running = NULL;
+	preview->render_quit = FALSE;
+	preview->render_generation = 1;
+	preview->render_discard_before = 0;
+	preview->render_serial = 0;
 
 	gchar* name;
 	preview->display_color_space = NULL;
@@ -404,6 +484,11 @@ rs_preview_widget_init(RSPreviewWidget *preview)
 #endif
 		preview->snapshot[i] = i;
 		preview->last_roi[i] = NULL;
+		preview->render_pending[i] = NULL;
+		preview->render_requested[i].serial = 0;
+		preview->display_buffer[i] = NULL;
+		preview->display_generation[i] = 0;
+		preview->display_quick[i] = FALSE;
 	}
 #if MAX_VIEWS != 2
 #error Fix lines below
@@ -709,6 +794,8 @@ rs_preview_widget_set_photo(RSPreviewWidget *preview, RS_PHOTO *photo)
 	g_assert(RS_IS_PREVIEW_WIDGET(preview));
 
 	preview->photo = photo;
+	render_invalidate(preview);
+	render_cancel(preview, FALSE);
 	if (preview->state & CROP)
 		crop_end(preview, FALSE);
 	if (preview->state & STRAIGHTEN)
@@ -797,6 +884,9 @@ rs_preview_widget_set_filter(RSPreviewWidget *preview, RSFilter *filter, RSFilte
 	g_assert(RS_IS_PREVIEW_WIDGET(preview));
 	g_assert(RS_IS_FILTER(filter));
 
+	/* The render thread must not walk the chain while we relink it */
+	render_cancel(preview, TRUE);
+
 	preview->filter_input = filter;
 	rs_filter_set_recursive(RS_FILTER(preview->filter_input), "demosaic-allow-downscale",  preview->zoom_to_fit, NULL);
 	rs_filter_set_previous(preview->filter_lensfun[0], preview->filter_input);
@@ -1279,8 +1369,13 @@ rs_preview_widget_quick_start(RSPreviewWidget *preview, gboolean keep_quick)
 void
 rs_preview_widget_quick_end(RSPreviewWidget *preview) 
 {
+	gint i;
+
 	preview->keep_quick_enabled = FALSE;
 
+	for(i=0;i<MAX_VIEWS;i++)
+		rs_filter_request_set_quick(preview->request[i], FALSE);
+
 	canvas_draw(preview, NULL, FALSE);
 	GUI_CATCHUP_DISPLAY(preview->display);
 }
@@ -2125,6 +2220,8 @@ filter_changed(RSFilter *filter, RSFilterChangedMask mask, RSPreviewWidget *prev
 	{
 		if (filter == preview->filter_end[view])
 		{
+			render_invalidate(preview);
+
 			if ((view==0) && (mask & RS_FILTER_CHANGED_DIMENSION))
 			{
 				gint width, height;
@@ -2410,6 +2507,287 @@ make_cbdata(RSPreviewWidget *preview, const gint view, RS_PREVIEW_CALLBACK_DATA
 	return TRUE;
 }
 
+static inline gboolean
+rectangle_contains(const GdkRectangle *outer, const GdkRectangle *inner)
+{
+	return (inner->x >= outer->x && inner->y >= outer->y
+		&& inner->x + inner->width <= outer->x + outer->width
+		&& inner->y + inner->height <= outer->y + outer->height);
+}
+
+/* Where on the canvas the image for a view is placed */
+static void
+get_view_placement(RSPreviewWidget *preview, const gint view, const gint width, const gint height, GdkRectangle *placement)
+{
+	GdkRectangle rect;
+
+	if (preview->zoom_to_fit)
+	{
+		if (!get_placement(preview, view, placement))
+			placement->x = placement->y = placement->width = placement->height = 0;
+		return;
+	}
+
+	gtk_widget_get_allocation(GTK_WIDGET(preview->canvas), &rect);
+
+	if (width > rect.width)
+		placement->x = -gtk_adjustment_get_value(preview->hadjustment);
+	else
+		placement->x = ((rect.width)-width)/2;
+
+	if (height > rect.height)
+		placement->y = -gtk_adjustment_get_value(preview->vadjustment);
+	else
+		placement->y = ((rect.height)-height)/2;
+
+	placement->width = width;
+	placement->height = height;
+}
+
+/*
+ * Rendering of the preview is done in a separate thread, the draw handler
+ * only blits the last finished image and submits a new job for a view if
+ * the image is outdated. Every view has at most one pending job, a newer job
+ * replaces the pending one. Finished jobs are handed back to the main loop
+ * where the result is shown even if the filters has changed in the meantime,
+ * it's still the newest we have and the draw handler will ask for another.
+ * A job is cancelled through its request when its result would be useless.
+ */
+
+static void
+render_job_free(RENDER_JOB *job)
+{
+	if (job->response)
+		g_object_unref(job->response);
+	g_object_unref(job->cancellable);
+	g_object_unref(job->request);
+	g_object_unref(job->filter);
+	g_object_unref(job->preview);
+	g_slice_free(RENDER_JOB, job);
+}
+
+/* Mark all rendered images as outdated, must be called when filters change */
+static void
+render_invalidate(RSPreviewWidget *preview)
+{
+	g_atomic_int_inc(&preview->render_generation);
+}
+
+/* Drop all pending jobs and cancel the running one, if wait is TRUE this
+ * will not return until the render thread is idle */
+static void
+render_cancel(RSPreviewWidget *preview, gboolean wait)
+{
+	gint view;
+
+	preview->render_discard_before = preview->render_generation;
+
+	g_mutex_lock(&preview->render_lock);
+	for(view=0;view<MAX_VIEWS;view++)
+	{
+		if (preview->render_pending[view])
+			render_job_free(preview->render_pending[view]);
+		preview->render_pending[view] = NULL;
+		preview->render_requested[view].serial = 0;
+	}
+
+	if (preview->render_running)
+		g_cancellable_cancel(preview->render_running->cancellable);
+
+	while (wait && preview->render_running)
+		g_cond_wait(&preview->render_cond, &preview->render_lock);
+	g_mutex_unlock(&preview->render_lock);
+}
+
+static gboolean
+render_done(gpointer data)
+{
+	RENDER_JOB *job = data;
+	RSPreviewWidget *preview = job->preview;
+	const gint view = job->view;
+	GdkPixbuf *buffer = NULL;
+	GdkRectangle area;
+	gboolean current;
+
+	/* We're being disposed, nobody is interested anymore */
+	if (preview->render_quit)
+	{
+		render_job_free(job);
+		return FALSE;
+	}
+
+	if (preview->render_requested[view].serial == job->serial)
+		preview->render_requested[view].serial = 0;
+
+	/* Jobs for a view finish in the order they were submitted, so a result
+	 * rendered from outdated settings is still newer than what we show */
+	current = (job->generation == g_atomic_int_get(&preview->render_generation));
+	if (job->response && job->generation >= preview->render_discard_before && !g_cancellable_is_cancelled(job->cancellable))
+		buffer = rs_filter_response_get_image8(job->response);
+
+	if (!buffer)
+	{
+		render_job_free(job);
+		return FALSE;
+	}
+
+	if (preview->display_buffer[view])
+		g_object_unref(preview->display_buffer[view]);
+	preview->display_buffer[view] = buffer;
+
+	/* The buffer may only cover the ROI */
+	rs_filter_response_get_origin(job->response, &area.x, &area.y);
+	area.width = gdk_pixbuf_get_width(buffer);
+	area.height = gdk_pixbuf_get_height(buffer);
+	preview->display_area[view] = area;
+	gdk_rectangle_intersect(&job->roi, &area, &preview->display_roi[view]);
+	preview->display_width[view] = job->width;
+	preview->display_height[view] = job->height;
+	preview->display_generation[view] = job->generation;
+	preview->display_quick[view] = job->quick;
+
+	/* Only the newest result can tell what to do next */
+	if (current && job->quick)
+	{
+		/* Follow up with the full quality version */
+		if (!preview->keep_quick_enabled && !(preview->photo && preview->photo->signal && *preview->photo->signal == MAIN_SIGNAL_CANCEL_LOAD))
+			rs_filter_request_set_quick(preview->request[view], FALSE);
+	}
+	else if (current && preview->photo && NULL==preview->photo->crop && NULL==preview->photo->proposed_crop)
+	{
+		preview->photo->proposed_crop = g_new(RS_RECT,1);
+		if (ABS(preview->photo->angle) < 0.001 &&
+			rs_filter_param_get_integer(RS_FILTER_PARAM(job->response), "proposed-crop-x1", &preview->photo->proposed_crop->x1) &&
+				rs_filter_param_get_integer(RS_FILTER_PARAM(job->response), "proposed-crop-y1", &preview->photo->proposed_crop->y1) &&
+					rs_filter_param_get_integer(RS_FILTER_PARAM(job->response), "proposed-crop-x2", &preview->photo->proposed_crop->x2) &&
+						rs_filter_param_get_integer(RS_FILTER_PARAM(job->response), "proposed-crop-y2", &preview->photo->proposed_crop->y2))
+		{
+			if (preview->photo->orientation)
+				rs_photo_rotate_rect_inverse(preview->photo, preview->photo->proposed_crop);
+		}
+		else 
+		{
+			g_free(preview->photo->proposed_crop);
+			preview->photo->proposed_crop = NULL;
+		}
+	}
+
+	/* Blit the new image */
+	if (view < preview->views)
+	{
+		GdkRectangle placement;
+		GdkRectangle dirty = job->roi;
+
+		get_view_placement(preview, view, job->width, job->height, &placement);
+		dirty.x += placement.x;
+		dirty.y += placement.y;
+		canvas_draw(preview, &dirty, FALSE);
+	}
+
+	render_job_free(job);
+	return FALSE;
+}
+
+static gpointer
+render_thread_func(gpointer data)
+{
+	RSPreviewWidget *preview = data;
+	RENDER_JOB *job;
+	gint view;
+
+	g_mutex_lock(&preview->render_lock);
+	while (!preview->render_quit)
+	{
+		job = NULL;
+		for(view=0;view<MAX_VIEWS && !job;view++)
+		{
+			job = preview->render_pending[view];
+			preview->render_pending[view] = NULL;
+		}
+
+		if (!job)
+		{
+			g_cond_wait(&preview->render_cond, &preview->render_lock);
+			continue;
+		}
+		preview->render_running = job;
+		g_mutex_unlock(&preview->render_lock);
+
+		/* Even if outdated, this is the newest job we have. The filters will
+		 * bail out early if the job is cancelled */
+		job->response = rs_filter_get_image8_roi(job->filter, job->request);
+
+		g_mutex_lock(&preview->render_lock);
+		preview->render_running = NULL;
+		g_cond_broadcast(&preview->render_cond);
+
+		/* Jobs are always freed in the main loop, we may hold the last
+		 * reference to the preview */
+		gdk_threads_add_idle(render_done, job);
+	}
+	g_mutex_unlock(&preview->render_lock);
+
+	return NULL;
+}
+
+/* Ask the render thread to render roi of a view */
+static void
+render_submit(RSPreviewWidget *preview, const gint view, GdkRectangle *roi, gint width, gint height, gboolean quick)
+{
+	RENDER_JOB *requested = &preview->render_requested[view];
+	RENDER_JOB *job;
+	RENDER_JOB *running;
+	GdkRectangle overlap;
+
+	if (preview->render_quit)
+		return;
+
+	/* Is this already on its way? */
+	if (requested->serial
+		&& requested->generation == preview->render_generation
+		&& requested->quick == quick
+		&& rectangle_contains(&requested->roi, roi))
+		return;
+
+	job = g_slice_new0(RENDER_JOB);
+	job->preview = g_object_ref(preview);
+	job->view = view;
+	if (++preview->render_serial == 0)
+		preview->render_serial++;
+	job->serial = preview->render_serial;
+	job->generation = preview->render_generation;
+	job->filter = g_object_ref(preview->filter_end[view]);
+	job->roi = *roi;
+	job->width = width;
+	job->height = height;
+	job->quick = quick;
+	job->cancellable = g_cancellable_new();
+
+	/* Clone, now so it cannot change while filters are being called */
+	job->request = rs_filter_request_clone(preview->request[view]);
+	rs_filter_request_set_quick(job->request, quick);
+	rs_filter_request_set_roi(job->request, preview->zoom_to_fit ? NULL : roi);
+	rs_filter_request_set_cancellable(job->request, job->cancellable);
+
+	*requested = *job;
+
+	g_mutex_lock(&preview->render_lock);
+	if (preview->render_pending[view])
+		render_job_free(preview->render_pending[view]);
+	preview->render_pending[view] = job;
+
+	/* Stop the running job for this view if its result could never be shown */
+	running = preview->render_running;
+	if (running && running->view == view
+		&& (running->width != width || running->height != height || !gdk_rectangle_intersect(&running->roi, roi, &overlap)))
+		g_cancellable_cancel(running->cancellable);
+
+	if (!preview->render_thread)
+		preview->render_thread = g_thread_new("RSPreviewWidget render", render_thread_func, preview);
+	g_cond_signal(&preview->render_cond);
+	g_mutex_unlock(&preview->render_lock);
+}
+
 static void
 canvas_draw(RSPreviewWidget *preview, GdkRectangle *rect, gboolean now)
 {
@@ -2449,6 +2827,8 @@ canvas_draw_handler(GtkWidget *widget, cairo_t *cr, RSPreviewWidget *preview)
 	GdkRectangle rect;
 
 	gtk_widget_get_allocation(GTK_WIDGET(preview->canvas), &rect);
+	rect.x = 0;
+	rect.y = 0;
 
 	cairo_set_antialias(cr, CAIRO_ANTIALIAS_GRAY);
 	if (!gdk_cairo_get_clip_rectangle(cr, &dirty_area))
@@ -2466,97 +2846,59 @@ canvas_draw_handler(GtkWidget *widget, cairo_t *cr, RSPreviewWidget *preview)
 	for(i=0;i<preview->views;i++)
 	{
 		rs_filter_get_size_simple(preview->filter_end[i], preview->request[i], &width, &height);
+		get_view_placement(preview, i, width, height, &placement);
 
-		if (preview->zoom_to_fit)
-			get_placement(preview, i, &placement);
-		else
+		/* Blit the photo itself, the actual rendering is done by the render thread */
+		if (preview->photo && gdk_rectangle_intersect(&dirty_area, &placement, &area))
 		{
-			if (width > rect.width)
-				placement.x = -gtk_adjustment_get_value(preview->hadjustment);
-			else
-				placement.x = ((rect.width)-width)/2;
+			GdkPixbuf *buffer = preview->display_buffer[i];
+			gboolean quick = rs_filter_request_get_quick(preview->request[i]);
+			gboolean current = FALSE;
+			GdkRectangle roi;
+			GdkRectangle valid;
 
-			if (height > rect.height)
-				placement.y = -gtk_adjustment_get_value(preview->vadjustment);
+			/* Find the visible part of the image */
+			if (preview->zoom_to_fit)
+			{
+				roi.x = 0;
+				roi.y = 0;
+				roi.width = width;
+				roi.height = height;
+			}
 			else
-				placement.y = ((rect.height)-height)/2;
-
-			placement.width = width;
-			placement.height = height;
-		}
-
-		/* Render the photo itself */
-		if (preview->photo && gdk_rectangle_intersect(&dirty_area, &placement, &area))
-		{
-			GdkRectangle roi = area;
-			roi.x -= placement.x;
-			roi.y -= placement.y;
+			{
+				if (!gdk_rectangle_intersect(&rect, &placement, &roi))
+					roi = area;
+				roi.x -= placement.x;
+				roi.y -= placement.y;
+			}
 
 			if (!preview->last_roi[i])
 				preview->last_roi[i] = g_new(GdkRectangle, 1);
 			*preview->last_roi[i] = roi;
 
-			if (preview->zoom_to_fit)
-				rs_filter_request_set_roi(preview->request[i], NULL);
-			else
-				rs_filter_request_set_roi(preview->request[i], &roi);
-
-			/* Clone, now so it cannot change while filters are being called */
-			RSFilterRequest *new_request = rs_filter_request_clone(preview->request[i]);  
-
-			RSFilterResponse *response = rs_filter_get_image8(preview->filter_end[i], new_request);
-			GdkPixbuf *buffer = rs_filter_response_get_image8(response);
-
-			if (buffer)
+			/* Show what we have, even if it's outdated, as long as it fits */
+			if (buffer && preview->display_width[i] == width && preview->display_height[i] == height)
 			{
-				if (area.x-placement.x >= 0 && area.x-placement.x + area.width <= gdk_pixbuf_get_width(buffer)
-					&& area.y-placement.y >= 0 && area.y-placement.y + area.height <= gdk_pixbuf_get_height(buffer))
+				valid = preview->display_roi[i];
+				valid.x += placement.x;
+				valid.y += placement.y;
+				if (gdk_rectangle_intersect(&area, &valid, &valid))
 				{
-					gdk_cairo_set_source_pixbuf(cr, buffer, placement.x, placement.y);
-					cairo_rectangle(cr, area.x, area.y, area.width, area.height);
+					gdk_cairo_set_source_pixbuf(cr, buffer, placement.x + preview->display_area[i].x, placement.y + preview->display_area[i].y);
+					gdk_cairo_rectangle(cr, &valid);
 					cairo_fill(cr);
 				}
 
-				g_object_unref(buffer);
+				current = (preview->display_generation[i] == preview->render_generation)
+					&& rectangle_contains(&preview->display_roi[i], &roi);
 			}
 
-			if(preview->views > 1 && rs_filter_request_get_quick(new_request) && !preview->keep_quick_enabled)
-			{
-				rs_filter_request_set_quick(preview->request[i], FALSE);
-				canvas_draw(preview, &area, FALSE);
-			}
-			else if(rs_filter_request_get_quick(new_request) && !preview->keep_quick_enabled)
-			{
-				/* Catch up, so we can get new signals */
-				g_object_unref(new_request);
-				g_object_unref(response);
-				if (!(preview->photo && preview->photo->signal && *preview->photo->signal == MAIN_SIGNAL_CANCEL_LOAD))
-				{
-					rs_filter_request_set_quick(preview->request[i], FALSE);
-					canvas_draw(preview, &area, FALSE);
-				}
-				return;
-			}
-			else if (preview->photo && NULL==preview->photo->crop && NULL==preview->photo->proposed_crop)
-			{
-				preview->photo->proposed_crop = g_new(RS_RECT,1);
-				if (ABS(preview->photo->angle) < 0.001 &&
-					rs_filter_param_get_integer(RS_FILTER_PARAM(response), "proposed-crop-x1", &preview->photo->proposed_crop->x1) &&
-						rs_filter_param_get_integer(RS_FILTER_PARAM(response), "proposed-crop-y1", &preview->photo->proposed_crop->y1) &&
-							rs_filter_param_get_integer(RS_FILTER_PARAM(response), "proposed-crop-x2", &preview->photo->proposed_crop->x2) &&
-								rs_filter_param_get_integer(RS_FILTER_PARAM(response), "proposed-crop-y2", &preview->photo->proposed_crop->y2))
-				{
-					if (preview->photo->orientation)
-						rs_photo_rotate_rect_inverse(preview->photo, preview->photo->proposed_crop);
-				}
-				else 
-				{
-					g_free(preview->photo->proposed_crop);
-					preview->photo->proposed_crop = NULL;
-				}
-			}
-			g_object_unref(new_request);
-			g_object_unref(response);
+			/* Render a quick version first if we have nothing usable */
+			if (!current)
+				render_submit(preview, i, &roi, width, height, TRUE);
+			else if (preview->display_quick[i] && !quick)
+				render_submit(preview, i, &roi, width, height, FALSE);
 		}
 
 		if (preview->state & DRAW_ROI)
@@ -60,6 +60,8 @@ rs_save_dialog_dispose (GObject *object)
 		g_object_unref(dialog->fdcp);
 		g_object_unref(dialog->fdenoise);
 		g_object_unref(dialog->ftransform_display);
+		if (dialog->ftile_cache)
+			g_object_unref(dialog->ftile_cache);
 
 		if (dialog->photo)
 			g_object_unref(dialog->photo);
@@ -169,6 +171,9 @@ rs_save_dialog_init (RSSaveDialog *dialog)
 	dialog->fdenoise= rs_filter_new("RSDenoise", dialog->fresample);
 	dialog->ftransform_display = rs_filter_new("RSColorspaceTransform", dialog->fdenoise);
 	dialog->fend = dialog->ftransform_display;
+	/* Outputs render the image in strips, filters that cannot render
+	 * strips on their own will render the whole image once for all */
+	dialog->ftile_cache = rs_filter_insert_tile_cache(dialog->fend);
 
 	/* FIXME: Set correct ICC-profiles */
 //	g_object_set(dialog->filter_input, "icc-profile", profile, NULL);
@@ -66,6 +66,7 @@ typedef struct {
 	RSFilter *fdenoise;
 	RSFilter *ftransform_display;
 	RSFilter *fend;
+	RSFilter *ftile_cache;
 
 	RS_PHOTO *photo;
 	gint snapshot;
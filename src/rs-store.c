@@ -36,6 +36,7 @@
 #include "rs-cache.h"
 #include "rs-pixbuf.h"
 #include "rs-photo.h"
+#include "rs-preload.h"
 #include "rs-actions.h"
 
 /* How many different icon views do we have (tabs) */
@@ -423,17 +424,31 @@ preload_iter(GtkTreeModel *model, GtkTreeIter *iter)
 	rs_io_idle_prefetch_file(filename, PRELOAD_CLASS);
 }
 
+/* Load a photo completely, ready to be opened */
+static void
+decode_iter(GtkTreeModel *model, GtkTreeIter *iter, gint priority)
+{
+	gchar *filename;
+	gtk_tree_model_get(model, iter, FULLNAME_COLUMN, &filename, -1);
+
+	rs_preload_photo(filename, priority);
+	g_free(filename);
+}
+
 static void
 predict_preload(RSStore *store, gboolean initial)
 {
 	GList *selected = NULL;
 	gint n, near = 5;
+	/* Photos to decode completely in each direction, most people browse forward */
+	const gint decode_next = 2, decode_prev = 1;
 	GtkTreeIter iter;
 	GtkIconView *iconview = GTK_ICON_VIEW(store->current_iconview);
 	GtkTreePath *path, *next, *prev;
 	GtkTreeModel *model = gtk_icon_view_get_model (iconview);
 
 	rs_io_idle_cancel_class(PRELOAD_CLASS);
+	rs_preload_cancel();
 
 	/* Get a list of selected icons */
 	selected = gtk_icon_view_get_selected_items(iconview);
@@ -450,11 +465,19 @@ predict_preload(RSStore *store, gboolean initial)
 			/* Travel forward */
 			gtk_tree_path_next(next);
 			if (gtk_tree_model_get_iter(gtk_icon_view_get_model (iconview), &iter, next))
+			{
+				if (n < decode_next)
+					decode_iter(model, &iter, 15 + n);
 				preload_iter(model, &iter);
+			}
 			/* Travel backward */
 			if (gtk_tree_path_prev(prev))
 				if (gtk_tree_model_get_iter(gtk_icon_view_get_model (iconview), &iter, prev))
+				{
+					if (n < decode_prev)
+						decode_iter(model, &iter, 15 + n);
 					preload_iter(model, &iter);
+				}
 		}
 		gtk_tree_path_free(next);
 		gtk_tree_path_free(prev);
@@ -463,7 +486,10 @@ predict_preload(RSStore *store, gboolean initial)
 	{
 		path = gtk_tree_path_new_first();
 		if (gtk_tree_model_get_iter(gtk_icon_view_get_model (iconview), &iter, path))
+		{
+			decode_iter(model, &iter, 15);
 			preload_iter(model, &iter);
+		}
 
 		/* Next */
 		for(n=0;n<near;n++)
@@ -1415,6 +1441,9 @@ rs_store_load_directory(RSStore *store, const gchar *path)
 	sortable = GTK_TREE_SORTABLE(store->store);
 	gtk_tree_sortable_set_sort_column_id(sortable, GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
 
+	/* Photos decoded ahead in the previous directory will not be opened now */
+	rs_preload_clear();
+
 	g_atomic_int_set(&store->jobs_to_do, 0);
 	gtk_label_set_markup(GTK_LABEL(store->label[0]), _("* <small>(-)</small>"));
 	gtk_label_set_markup(GTK_LABEL(store->label[1]), _("1 <small>(-)</small>"));
@@ -1425,8 +1454,8 @@ rs_store_load_directory(RSStore *store, const gchar *path)
 	g_signal_handler_block(store->store, store->counthandler);
 	store->counter_blocked = TRUE;
 
-	/* While we're loading, we keep the IO lock to ourself. We need to read very basic meta and directory data */
-	rs_io_lock();
+	/* While we're loading, we keep the IO lock of the device to ourself. We need to read very basic meta and directory data */
+	rs_io_lock_file(path);
 	items = load_directory(store, path, library, load_8bit, load_recursive);
 	rs_io_unlock();
 